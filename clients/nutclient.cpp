@@ -32,7 +32,10 @@
 #else
 #  include <sys/types.h>
 #  include <sys/socket.h>
+#  include <sys/uio.h> /* struct iovec */
+#  include <limits.h> /* IOV_MAX */
 #  include <netinet/in.h>
+#  include <netinet/tcp.h> /* TCP_NODELAY */
 #  include <arpa/inet.h>
 #  include <unistd.h> /* close */
 #  include <netdb.h> /* gethostbyname */
@@ -45,6 +48,12 @@
    typedef struct sockaddr SOCKADDR;
    typedef struct in_addr IN_ADDR;
 #endif /* WIN32 */
+#ifndef IOV_MAX
+#  define IOV_MAX 16
+#endif
+#ifndef MSG_NOSIGNAL
+#  define MSG_NOSIGNAL 0
+#endif
 /* End of Windows/Linux Socket compatibility layer: */
 
 
@@ -98,20 +107,27 @@ public:
 	~Socket();
 
 	void connect(const std::string& host, int port);
+	void attach(SOCKET sock);
 	void disconnect();
 	bool isConnected()const;
 
 	void setTimeout(long timeout);
 	bool hasTimeout()const{return _tv.tv_sec>=0;}
 
+	int getFd()const{return _sock;}
+	bool hasData();
+	bool isClosedByPeer();
+
 	size_t read(void* buf, size_t sz);
 	size_t write(const void* buf, size_t sz);
 
 	std::string read();
 	void write(const std::string& str);
-
+	void write(const std::vector<std::string>& lines);
 
 private:
+	void writeLines(const std::string* lines, size_t count);
+
 	SOCKET _sock;
 	struct timeval	_tv;
 	std::string _buffer; /* Received buffer, string because data should be text only. */
@@ -133,6 +149,7 @@ Socket::~Socket()
 void Socket::setTimeout(long timeout)
 {
 	_tv.tv_sec = timeout;
+	_tv.tv_usec = 0;
 }
 
 void Socket::connect(const std::string& host, int port)
@@ -142,7 +159,9 @@ void Socket::connect(const std::string& host, int port)
 	char			sport[NI_MAXSERV];
 	int			v;
 	fd_set 			wfds;
+	struct timeval		tv;
 	int			error;
+	int			one = 1;
 	socklen_t		error_size;
 	long			fd_flags;
 
@@ -202,7 +221,8 @@ void Socket::connect(const std::string& host, int port)
 			if(errno == EINPROGRESS) {
 				FD_ZERO(&wfds);
 				FD_SET(sock_fd, &wfds);
-				select(sock_fd+1,NULL,&wfds,NULL, hasTimeout()?&_tv:NULL);
+				tv = _tv; /* select() may modify it */
+				select(sock_fd+1,NULL,&wfds,NULL, hasTimeout()?&tv:NULL);
 				if (FD_ISSET(sock_fd, &wfds)) {
 					error_size = sizeof(error);
 					getsockopt(sock_fd,SOL_SOCKET,SO_ERROR,
@@ -248,6 +268,14 @@ void Socket::connect(const std::string& host, int port)
 			fcntl(sock_fd, F_SETFL, fd_flags);
 		}
 
+		/* Queries are small and latency bound: no Nagle delay.
+		 * Let the system detect dead peers of idle connections too. */
+		setsockopt(sock_fd, IPPROTO_TCP, TCP_NODELAY, (const char*)&one, sizeof(one));
+		setsockopt(sock_fd, SOL_SOCKET, SO_KEEPALIVE, (const char*)&one, sizeof(one));
+#ifdef SO_NOSIGPIPE
+		setsockopt(sock_fd, SOL_SOCKET, SO_NOSIGPIPE, (const char*)&one, sizeof(one));
+#endif
+
 		_sock = sock_fd;
 //		ups->upserror = 0;
 //		ups->syserrno = 0;
@@ -289,6 +317,12 @@ void Socket::connect(const std::string& host, int port)
 #endif // OLD
 }
 
+void Socket::attach(SOCKET sock)
+{
+	disconnect();
+	_sock = sock;
+}
+
 void Socket::disconnect()
 {
 	if(_sock != INVALID_SOCKET)
@@ -304,6 +338,44 @@ bool Socket::isConnected()const
 	return _sock!=INVALID_SOCKET;
 }
 
+bool Socket::hasData()
+{
+	if(_buffer.find('\n')!=std::string::npos)
+	{
+		return true;
+	}
+	if(!isConnected())
+	{
+		return false;
+	}
+
+	fd_set fds;
+	struct timeval tv = {0, 0};
+	FD_ZERO(&fds);
+	FD_SET(_sock, &fds);
+	return select(_sock+1, &fds, NULL, NULL, &tv) > 0;
+}
+
+bool Socket::isClosedByPeer()
+{
+	if(!isConnected())
+	{
+		return true;
+	}
+
+	fd_set fds;
+	struct timeval tv = {0, 0};
+	FD_ZERO(&fds);
+	FD_SET(_sock, &fds);
+	if(select(_sock+1, &fds, NULL, NULL, &tv) < 1)
+	{
+		return false;
+	}
+	/* Readable: either pending data, or end of stream / error */
+	char c;
+	return ::recv(_sock, &c, 1, MSG_PEEK) <= 0;
+}
+
 size_t Socket::read(void* buf, size_t sz)
 {
 	if(!isConnected())
@@ -316,7 +388,8 @@ size_t Socket::read(void* buf, size_t sz)
 		fd_set fds;
 		FD_ZERO(&fds);
 		FD_SET(_sock, &fds);
-		int ret = select(_sock+1, &fds, NULL, NULL, &_tv);
+		struct timeval tv = _tv; /* select() may modify it */
+		int ret = select(_sock+1, &fds, NULL, NULL, &tv);
 		if (ret < 1) {
 			throw nut::TimeoutException();
 		}
@@ -343,7 +416,8 @@ size_t Socket::write(const void* buf, size_t sz)
 		fd_set fds;
 		FD_ZERO(&fds);
 		FD_SET(_sock, &fds);
-		int ret = select(_sock+1, NULL, &fds, NULL, &_tv);
+		struct timeval tv = _tv; /* select() may modify it */
+		int ret = select(_sock+1, NULL, &fds, NULL, &tv);
 		if (ret < 1) {
 			throw nut::TimeoutException();
 		}
@@ -371,7 +445,7 @@ std::string Socket::read()
 			size_t idx = _buffer.find('\n');
 			if(idx!=std::string::npos)
 			{
-				res += _buffer.substr(0, idx);
+				res.append(_buffer, 0, idx);
 				_buffer.erase(0, idx+1);
 				return res;
 			}
@@ -391,10 +465,107 @@ std::string Socket::read()
 
 void Socket::write(const std::string& str)
 {
-//	write(str.c_str(), str.size());
-//	write("\n", 1);
-	std::string buff = str + "\n";
-	write(buff.c_str(), buff.size());
+	writeLines(&str, 1);
+}
+
+void Socket::write(const std::vector<std::string>& lines)
+{
+	if(!lines.empty())
+	{
+		writeLines(&lines[0], lines.size());
+	}
+}
+
+void Socket::writeLines(const std::string* lines, size_t count)
+{
+#ifdef WIN32
+	std::string buff;
+	for(size_t n=0; n<count; ++n)
+	{
+		buff += lines[n];
+		buff += '\n';
+	}
+	for(size_t done=0; done<buff.size(); )
+	{
+		done += write(buff.c_str() + done, buff.size() - done);
+	}
+#else /* WIN32 */
+	/* Send all lines with as few system calls as possible:
+	 * one iovec for each line and one for its terminating newline. */
+	static char eol[] = "\n";
+	/* Usual queries are sent without allocating */
+	struct iovec small[8];
+	std::vector<struct iovec> big;
+	struct iovec* iov = small;
+	size_t iovcnt = count * 2;
+	if(iovcnt > sizeof(small) / sizeof(small[0]))
+	{
+		big.resize(iovcnt);
+		iov = &big[0];
+	}
+	for(size_t n=0; n<count; ++n)
+	{
+		iov[2*n].iov_base = (void*)lines[n].data();
+		iov[2*n].iov_len = lines[n].size();
+		iov[2*n+1].iov_base = eol;
+		iov[2*n+1].iov_len = 1;
+	}
+
+	size_t first = 0;
+	while(first < iovcnt)
+	{
+		if(!isConnected())
+		{
+			throw nut::NotConnectedException();
+		}
+
+		if(_tv.tv_sec>=0)
+		{
+			fd_set fds;
+			FD_ZERO(&fds);
+			FD_SET(_sock, &fds);
+			struct timeval tv = _tv; /* select() may modify it */
+			int ret = select(_sock+1, NULL, &fds, NULL, &tv);
+			if (ret < 1) {
+				throw nut::TimeoutException();
+			}
+		}
+
+		size_t chunk = iovcnt - first;
+		if(chunk > (size_t)IOV_MAX)
+		{
+			chunk = IOV_MAX;
+		}
+
+		/* sendmsg() rather than writev(): a connection closed by the
+		 * server must raise an error, not a SIGPIPE */
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov[first];
+		msg.msg_iovlen = chunk;
+		ssize_t res = ::sendmsg(_sock, &msg, MSG_NOSIGNAL);
+		if(res==-1)
+		{
+			if(errno==EINTR)
+				continue;
+			disconnect();
+			throw nut::IOException("Error while writing on socket");
+		}
+
+		/* Skip what has been written, handling partial writes */
+		size_t sz = (size_t)res;
+		while(first < iovcnt && sz >= iov[first].iov_len)
+		{
+			sz -= iov[first].iov_len;
+			++first;
+		}
+		if(sz > 0)
+		{
+			iov[first].iov_base = (char*)iov[first].iov_base + sz;
+			iov[first].iov_len -= sz;
+		}
+	}
+#endif /* WIN32 */
 }
 
 }/* namespace internal */
@@ -437,7 +608,7 @@ std::set<Device> Client::getDevices()
 	std::set<std::string> devs = getDeviceNames();
 	for(std::set<std::string>::iterator it=devs.begin(); it!=devs.end(); ++it)
 	{
-	  res.insert(Device(this, *it));
+	  res.insert(res.end(), Device(this, *it));
 	}
 
 	return res;
@@ -505,14 +676,24 @@ TcpClient::TcpClient():
 Client(),
 _host("localhost"),
 _port(3493),
-_socket(new internal::Socket)
+_timeout(-1),
+_socket(new internal::Socket),
+_autoReconnect(true),
+_connectRequested(false),
+_keepAliveInterval(30000),
+_watchPollInterval(2000)
 {
 	// Do not connect now
 }
 
 TcpClient::TcpClient(const std::string& host, int port):
 Client(),
-_socket(new internal::Socket)
+_timeout(-1),
+_socket(new internal::Socket),
+_autoReconnect(true),
+_connectRequested(false),
+_keepAliveInterval(30000),
+_watchPollInterval(2000)
 {
 	connect(host, port);
 }
@@ -531,7 +712,20 @@ void TcpClient::connect(const std::string& host, int port)
 
 void TcpClient::connect()
 {
+	_socket->disconnect();
+	resetSession();
 	_socket->connect(_host, _port);
+	_connectRequested = true;
+	_lastSent = std::chrono::steady_clock::now();
+}
+
+void TcpClient::attach(int fd)
+{
+	_socket->attach(fd);
+	resetSession();
+	// Nothing to reconnect to
+	_connectRequested = false;
+	_lastSent = std::chrono::steady_clock::now();
 }
 
 std::string TcpClient::getHost()const
@@ -552,11 +746,13 @@ bool TcpClient::isConnected()const
 void TcpClient::disconnect()
 {
 	_socket->disconnect();
+	_connectRequested = false;
 }
 
 void TcpClient::setTimeout(long timeout)
 {
 	_timeout = timeout;
+	_socket->setTimeout(timeout);
 }
 
 long TcpClient::getTimeout()const
@@ -566,14 +762,18 @@ long TcpClient::getTimeout()const
 
 void TcpClient::authenticate(const std::string& user, const std::string& passwd)
 {
-	detectError(sendQuery("USERNAME " + user));
-	detectError(sendQuery("PASSWORD " + passwd));
+	_request.assign("USERNAME ").append(user);
+	detectError(sendQuery(_request));
+	_user = user;
+	_request.assign("PASSWORD ").append(passwd);
+	detectError(sendQuery(_request));
+	_password = passwd;
 }
 
 void TcpClient::logout()
 {
 	detectError(sendQuery("LOGOUT"));
-	_socket->disconnect();
+	disconnect();
 }
 
 Device TcpClient::getDevice(const std::string& name)
@@ -600,9 +800,9 @@ std::set<std::string> TcpClient::getDeviceNames()
 	for(std::vector<std::vector<std::string> >::iterator it=devs.begin();
 		it!=devs.end(); ++it)
 	{
-		std::string id = (*it)[0];
+		std::string& id = (*it)[0];
 		if(!id.empty())
-			res.insert(id);
+			res.insert(res.end(), std::move(id));
 	}
 
 	return res;
@@ -620,7 +820,7 @@ std::set<std::string> TcpClient::getDeviceVariableNames(const std::string& dev)
 	std::vector<std::vector<std::string> > res = list("VAR", dev);
 	for(size_t n=0; n<res.size(); ++n)
 	{
-		set.insert(res[n][0]);
+		set.insert(set.end(), std::move(res[n][0]));
 	}
 
 	return set;
@@ -633,7 +833,7 @@ std::set<std::string> TcpClient::getDeviceRWVariableNames(const std::string& dev
 	std::vector<std::vector<std::string> > res = list("RW", dev);
 	for(size_t n=0; n<res.size(); ++n)
 	{
-		set.insert(res[n][0]);
+		set.insert(set.end(), std::move(res[n][0]));
 	}
 
 	return set;
@@ -641,60 +841,59 @@ std::set<std::string> TcpClient::getDeviceRWVariableNames(const std::string& dev
 
 std::string TcpClient::getDeviceVariableDescription(const std::string& dev, const std::string& name)
 {
-	return get("DESC", dev + " " + name)[0];
+	_request.assign("GET DESC ").append(dev).append(1, ' ').append(name);
+	return sendGet()[0];
 }
 
 std::vector<std::string> TcpClient::getDeviceVariableValue(const std::string& dev, const std::string& name)
 {
-	return get("VAR", dev + " " + name);
+	_request.assign("GET VAR ").append(dev).append(1, ' ').append(name);
+	return sendGet();
 }
 
-std::map<std::string,std::vector<std::string> > TcpClient::getDeviceVariableValues(const std::string& dev)
+/* Index LIST VAR items by variable name, moving strings instead of copying them */
+static std::map<std::string,std::vector<std::string> > listToValues(std::vector<std::vector<std::string> >& res)
 {
-
-	std::map<std::string,std::vector<std::string> >  map;
-	
-	std::vector<std::vector<std::string> > res = list("VAR", dev);
+	std::map<std::string,std::vector<std::string> > map;
 	for(size_t n=0; n<res.size(); ++n)
 	{
 		std::vector<std::string>& vals = res[n];
-		std::string var = vals[0];
+		std::string var = std::move(vals[0]);
 		vals.erase(vals.begin());
-		map[var] = vals;
+		// upsd lists variables sorted by name: hint insertion at the end
+		map.insert(map.end(), std::make_pair(std::move(var), std::move(vals)));
 	}
-
 	return map;
 }
 
+std::map<std::string,std::vector<std::string> > TcpClient::getDeviceVariableValues(const std::string& dev)
+{
+	std::vector<std::vector<std::string> > res = list("VAR", dev);
+	return listToValues(res);
+}
+
 std::map<std::string,std::map<std::string,std::vector<std::string> > > TcpClient::getDevicesVariableValues(const std::set<std::string>& devs)
 {
 	std::map<std::string,std::map<std::string,std::vector<std::string> > > map;
 
-	std::vector<std::string> queries;
+	Batch batch(*this);
 	for (std::set<std::string>::const_iterator it=devs.cbegin(); it!=devs.cend(); ++it)
 	{
-		queries.push_back("LIST VAR " + *it);
+		batch.getDeviceVariableValues(*it);
 	}
-	sendAsyncQueries(queries);
+	batch.execute();
 
-	for (std::set<std::string>::const_iterator it=devs.cbegin(); it!=devs.cend(); ++it)
+	size_t id = 0;
+	for (std::set<std::string>::const_iterator it=devs.cbegin(); it!=devs.cend(); ++it, ++id)
 	{
 		try
 		{
-			std::map<std::string,std::vector<std::string> > map2;
-			std::vector<std::vector<std::string> > res = parseList("VAR " + *it);
-			for (std::vector<std::vector<std::string> >::iterator it2=res.begin(); it2!=res.end(); ++it2)
-			{
-				std::vector<std::string>& vals = *it2;
-				std::string var = vals[0];
-				vals.erase(vals.begin()),
-				map2[var] = vals;
-			}
-			map[*it] = map2;
+			std::vector<std::vector<std::string> > res = batch.getListResult(id);
+			map.insert(map.end(), std::make_pair(*it, listToValues(res)));
 		}
 		catch (NutException&)
 		{
-			// We sent a bunch of queries, we need to process them all to clear up the backlog.
+			// Device-specific failure, other devices are still valid.
 		}
 	}
 
@@ -709,18 +908,20 @@ std::map<std::string,std::map<std::string,std::vector<std::string> > > TcpClient
 
 TrackingID TcpClient::setDeviceVariable(const std::string& dev, const std::string& name, const std::string& value)
 {
-	std::string query = "SET VAR " + dev + " " + name + " " + escape(value);
-	return sendTrackingQuery(query);
+	_request.assign("SET VAR ").append(dev).append(1, ' ').append(name).append(1, ' ');
+	appendEscaped(_request, value);
+	return sendTrackingQuery(_request);
 }
 
 TrackingID TcpClient::setDeviceVariable(const std::string& dev, const std::string& name, const std::vector<std::string>& values)
 {
-	std::string query = "SET VAR " + dev + " " + name;
+	_request.assign("SET VAR ").append(dev).append(1, ' ').append(name);
 	for(size_t n=0; n<values.size(); ++n)
 	{
-		query += " " + escape(values[n]);
+		_request.append(1, ' ');
+		appendEscaped(_request, values[n]);
 	}
-	return sendTrackingQuery(query);
+	return sendTrackingQuery(_request);
 }
 
 std::set<std::string> TcpClient::getDeviceCommandNames(const std::string& dev)
@@ -730,7 +931,7 @@ std::set<std::string> TcpClient::getDeviceCommandNames(const std::string& dev)
 	std::vector<std::vector<std::string> > res = list("CMD", dev);
 	for(size_t n=0; n<res.size(); ++n)
 	{
-		cmds.insert(res[n][0]);
+		cmds.insert(cmds.end(), std::move(res[n][0]));
 	}
 
 	return cmds;
@@ -738,27 +939,33 @@ std::set<std::string> TcpClient::getDeviceCommandNames(const std::string& dev)
 
 std::string TcpClient::getDeviceCommandDescription(const std::string& dev, const std::string& name)
 {
-	return get("CMDDESC", dev + " " + name)[0];
+	_request.assign("GET CMDDESC ").append(dev).append(1, ' ').append(name);
+	return sendGet()[0];
 }
 
 TrackingID TcpClient::executeDeviceCommand(const std::string& dev, const std::string& name, const std::string& param)
 {
-	return sendTrackingQuery("INSTCMD " + dev + " " + name + " " + param);
+	_request.assign("INSTCMD ").append(dev).append(1, ' ').append(name).append(1, ' ').append(param);
+	return sendTrackingQuery(_request);
 }
 
 void TcpClient::deviceLogin(const std::string& dev)
 {
-	detectError(sendQuery("LOGIN " + dev));
+	_request.assign("LOGIN ").append(dev);
+	detectError(sendQuery(_request));
+	_loginDevice = dev;
 }
 
 void TcpClient::deviceMaster(const std::string& dev)
 {
-	detectError(sendQuery("MASTER " + dev));
+	_request.assign("MASTER ").append(dev);
+	detectError(sendQuery(_request));
 }
 
 void TcpClient::deviceForcedShutdown(const std::string& dev)
 {
-	detectError(sendQuery("FSD " + dev));
+	_request.assign("FSD ").append(dev);
+	detectError(sendQuery(_request));
 }
 
 int TcpClient::deviceGetNumLogins(const std::string& dev)
@@ -774,7 +981,8 @@ TrackingResult TcpClient::getTrackingResult(const TrackingID& id)
 		return TrackingResult::SUCCESS;
 	}
 
-	std::string result = sendQuery("GET TRACKING " + id);
+	_request.assign("GET TRACKING ").append(id);
+	std::string result = sendQuery(_request);
 
 	if (result == "PENDING")
 	{
@@ -822,224 +1030,721 @@ void TcpClient::setFeature(const Feature& feature, bool status)
 	detectError(result);
 }
 
-std::vector<std::string> TcpClient::get
-	(const std::string& subcmd, const std::string& params)
+void TcpClient::setAutoReconnect(bool enable)
 {
-	std::string req = subcmd;
-	if(!params.empty())
+	_autoReconnect = enable;
+}
+
+bool TcpClient::isAutoReconnect()const
+{
+	return _autoReconnect;
+}
+
+void TcpClient::setKeepAliveInterval(long interval)
+{
+	_keepAliveInterval = interval;
+}
+
+long TcpClient::getKeepAliveInterval()const
+{
+	return _keepAliveInterval;
+}
+
+void TcpClient::checkConnection()
+{
+	if(!_autoReconnect || !_connectRequested)
 	{
-		req += " " + params;
+		return;
 	}
-	std::string res = sendQuery("GET " + req);
-	detectError(res);
-	if(res.substr(0, req.size()) != req)
+	if(_socket->isConnected())
 	{
-		throw NutException("Invalid response");
+		// upsd drops idle clients: before using a connection which has
+		// been idle for a while, check that it was not closed meanwhile.
+		if(std::chrono::steady_clock::now() - _lastSent < std::chrono::seconds(1)
+			|| !_socket->isClosedByPeer())
+		{
+			return;
+		}
 	}
-	
-	return explode(res, req.size());
+	reconnect();
 }
 
-std::vector<std::vector<std::string> > TcpClient::list
-	(const std::string& subcmd, const std::string& params)
+void TcpClient::reconnect()
 {
-	std::string req = subcmd;
-	if(!params.empty())
+	_socket->disconnect();
+	_socket->connect(_host, _port);
+	_lastSent = std::chrono::steady_clock::now();
+
+	// Restore the session. If it fails, the next query will try again.
+	try
+	{
+		restoreSession();
+	}
+	catch(NutException&)
 	{
-		req += " " + params;
+		_socket->disconnect();
+		throw;
 	}
-	std::vector<std::string> query;
-	query.push_back("LIST " + req);
-	sendAsyncQueries(query);
-	return parseList(req);
 }
 
-std::vector<std::vector<std::string> > TcpClient::parseList
-	(const std::string& req)
+void TcpClient::restoreSession()
 {
-	std::string res = _socket->read();
-	detectError(res);
-	if(res != ("BEGIN LIST " + req))
+	// Not in _request: it holds the query waiting for the connection
+	std::string req;
+
+	if(!_user.empty())
 	{
-		throw NutException("Invalid response");
+		req.assign("USERNAME ").append(_user);
+		detectError(sendQuery(req));
+	}
+	if(!_password.empty())
+	{
+		req.assign("PASSWORD ").append(_password);
+		detectError(sendQuery(req));
+	}
+	if(!_loginDevice.empty())
+	{
+		req.assign("LOGIN ").append(_loginDevice);
+		detectError(sendQuery(req));
 	}
 
-	std::vector<std::vector<std::string> > arr;
-	while(true)
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	for(std::map<std::string,Watch>::iterator it=_watches.begin(); it!=_watches.end(); ++it)
 	{
-		res = _socket->read();
-		detectError(res);
-		if(res == ("END LIST " + req))
+		Watch& watch = it->second;
+		req.assign("WATCH ").append(it->first);
+		for(size_t n=0; n<watch.prefixes.size(); ++n)
 		{
-			return arr;
+			req.append(1, ' ').append(watch.prefixes[n]);
 		}
-		if(res.substr(0, req.size()) == req)
+		std::string res = sendQuery(req);
+		if(res == "ERR UNKNOWN-COMMAND")
 		{
-			arr.push_back(explode(res, req.size()));
+			watch.pushed = false;
 		}
 		else
 		{
-			throw NutException("Invalid response");
+			detectError(res);
+			watch.pushed = true;
 		}
+		// Report the changes missed meanwhile from processWatches()
+		watch.resync = true;
+		watch.nextPoll = now;
 	}
 }
 
-std::string TcpClient::sendQuery(const std::string& req)
+void TcpClient::resetSession()
 {
-	_socket->write(req);
-	return _socket->read();
+	_user.clear();
+	_password.clear();
+	_loginDevice.clear();
+	_watches.clear();
+	_notifications.clear();
 }
 
-void TcpClient::sendAsyncQueries(const std::vector<std::string>& req)
+static bool watchMatch(const std::vector<std::string>& prefixes, const std::string& name)
 {
-	for (std::vector<std::string>::const_iterator it = req.cbegin(); it != req.cend(); it++)
+	if(prefixes.empty())
 	{
-		_socket->write(*it);
+		return true;
 	}
-}
-
-void TcpClient::detectError(const std::string& req)
-{
-	if(req.substr(0,3)=="ERR")
+	for(std::vector<std::string>::const_iterator it=prefixes.begin(); it!=prefixes.end(); ++it)
 	{
-		throw NutException(req.substr(4));
+		if(name.compare(0, it->size(), *it) == 0)
+		{
+			return true;
+		}
 	}
+	return false;
 }
 
-std::vector<std::string> TcpClient::explode(const std::string& str, size_t begin)
+void TcpClient::watch(const std::string& dev, const std::vector<std::string>& prefixes, WatchCallback callback)
 {
-	std::vector<std::string> res;
-	std::string temp;
+	Watch watch;
+	watch.prefixes = prefixes;
+	watch.callback = callback;
+	watch.resync = false;
 
-	enum STATE {
-		INIT,
-		SIMPLE_STRING,
-		QUOTED_STRING,
-		SIMPLE_ESCAPE,
-		QUOTED_ESCAPE
-	} state = INIT;
+	std::string query = "WATCH " + dev;
+	for(size_t n=0; n<prefixes.size(); ++n)
+	{
+		query += " " + prefixes[n];
+	}
+	std::string res = sendQuery(query);
+	if(res == "ERR UNKNOWN-COMMAND")
+	{
+		// Older server: fall back to polling
+		watch.pushed = false;
+	}
+	else
+	{
+		detectError(res);
+		watch.pushed = true;
+	}
 
-	for(size_t idx=begin; idx<str.size(); ++idx)
+	// Initial state of the variables. Notifications received up to now
+	// were sent before the list, so are already taken into account.
+	std::vector<std::vector<std::string> > vars = list("VAR", dev);
+	dropNotifications(dev);
+	for(size_t n=0; n<vars.size(); ++n)
 	{
-		char c = str[idx];
-		switch(state)
+		std::vector<std::string>& vals = vars[n];
+		std::string name = vals[0];
+		if(watchMatch(prefixes, name))
 		{
-		case INIT:
-			if(c==' ' /* || c=='\t' */)
-			{ /* Do nothing */ }
-			else if(c=='"')
-			{
-				state = QUOTED_STRING;
-			}
-			else if(c=='\\')
-			{
-				state = SIMPLE_ESCAPE;
-			}
-			/* What about bad characters ? */
-			else
-			{
-				temp += c;
-				state = SIMPLE_STRING;
-			}
-			break;
-		case SIMPLE_STRING:
-			if(c==' ' /* || c=='\t' */)
-			{
-				/* if(!temp.empty()) : Must not occur */
-					res.push_back(temp);
-				temp.clear();
-				state = INIT;
-			}
-			else if(c=='\\')
-			{
-				state = SIMPLE_ESCAPE;
-			}
-			else if(c=='"')
-			{
-				/* if(!temp.empty()) : Must not occur */
-					res.push_back(temp);
-				temp.clear();
-				state = QUOTED_STRING;
-			}
-			/* What about bad characters ? */
-			else
-			{
-				temp += c;
-			}		
-			break;
-		case QUOTED_STRING:
-			if(c=='\\')
-			{
-				state = QUOTED_ESCAPE;
-			}
-			else if(c=='"')
-			{
-				res.push_back(temp);
-				temp.clear();
-				state = INIT;
-			}
-			/* What about bad characters ? */
-			else
-			{
-				temp += c;
-			}
-			break;
-		case SIMPLE_ESCAPE:
-			if(c=='\\' || c=='"' || c==' ' /* || c=='\t'*/)
-			{
-				temp += c;
-			}
-			else
-			{
-				temp += '\\' + c; // Really do this ?
-			}
-			state = SIMPLE_STRING;
-			break;
-		case QUOTED_ESCAPE:
-			if(c=='\\' || c=='"')
-			{
-				temp += c;
-			}
-			else
-			{
-				temp += '\\' + c; // Really do this ?
-			}
-			state = QUOTED_STRING;
-			break;
+			vals.erase(vals.begin());
+			watch.values[name] = vals;
 		}
 	}
+	watch.nextPoll = std::chrono::steady_clock::now() + std::chrono::milliseconds(_watchPollInterval);
+	_watches[dev] = watch;
 
-	if(!temp.empty())
+	for(std::map<std::string,std::vector<std::string> >::const_iterator it=watch.values.begin();
+		it!=watch.values.end(); ++it)
 	{
-		res.push_back(temp);
+		callback(dev, it->first, it->second);
 	}
-
-	return res;
 }
 
-std::string TcpClient::escape(const std::string& str)
+void TcpClient::unwatch(const std::string& dev)
 {
-	std::string res = "\"";
-	
-	for(size_t n=0; n<str.size(); n++)
+	std::map<std::string,Watch>::iterator it = _watches.find(dev);
+	if(it == _watches.end())
 	{
-		char c = str[n];
-		if(c=='"')
-			res += "\\\"";
-		else if(c=='\\')
-			res += "\\\\";
-		else
-			res += c;
+		return;
 	}
+	bool pushed = it->second.pushed;
+	_watches.erase(it);
+	dropNotifications(dev);
 
-	res += '"';
-	return res; 
+	if(pushed && isConnected())
+	{
+		detectError(sendQuery("UNWATCH " + dev));
+	}
 }
 
-TrackingID TcpClient::sendTrackingQuery(const std::string& req)
+bool TcpClient::isWatchPushed(const std::string& dev)const
 {
-	std::string reply = sendQuery(req);
-	detectError(reply);
+	std::map<std::string,Watch>::const_iterator it = _watches.find(dev);
+	return it != _watches.end() && it->second.pushed;
+}
+
+void TcpClient::setWatchPollInterval(long interval)
+{
+	_watchPollInterval = interval;
+}
+
+long TcpClient::getWatchPollInterval()const
+{
+	return _watchPollInterval;
+}
+
+long TcpClient::getWatchTimeout()const
+{
+	if(!_notifications.empty())
+	{
+		return 0;
+	}
+
+	long timeout = -1;
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	if(_autoReconnect && _connectRequested && !_socket->isConnected())
+	{
+		// Connection lost: retry later
+		return _watchPollInterval;
+	}
+	if(_keepAliveInterval > 0 && _socket->isConnected())
+	{
+		std::chrono::steady_clock::time_point keepAlive = _lastSent + std::chrono::milliseconds(_keepAliveInterval);
+		timeout = 0;
+		if(keepAlive > now)
+		{
+			timeout = std::chrono::duration_cast<std::chrono::milliseconds>(keepAlive - now).count();
+		}
+	}
+	for(std::map<std::string,Watch>::const_iterator it=_watches.begin(); it!=_watches.end(); ++it)
+	{
+		if(it->second.pushed && !it->second.resync)
+		{
+			continue;
+		}
+		long delay = 0;
+		if(it->second.nextPoll > now)
+		{
+			delay = std::chrono::duration_cast<std::chrono::milliseconds>(it->second.nextPoll - now).count();
+		}
+		if(timeout < 0 || delay < timeout)
+		{
+			timeout = delay;
+		}
+	}
+	return timeout;
+}
+
+void TcpClient::processWatches()
+{
+	checkConnection();
+
+	try
+	{
+		// Fetch notifications already received, without blocking
+		while(_socket->hasData())
+		{
+			std::string res = _socket->read();
+			if(res.compare(0, 7, "NOTIFY ") == 0)
+			{
+				_notifications.push_back(res);
+			}
+			/* else: stray response, nothing is waiting for it */
+		}
+
+		// Keep the connection alive: upsd drops silent clients
+		if(_keepAliveInterval > 0 && _socket->isConnected()
+			&& std::chrono::steady_clock::now() - _lastSent >= std::chrono::milliseconds(_keepAliveInterval))
+		{
+			sendQuery("VER");
+		}
+	}
+	catch(IOException&)
+	{
+		if(!_autoReconnect || !_connectRequested)
+		{
+			throw;
+		}
+		// Watches are resynchronized below
+		reconnect();
+	}
+
+	while(!_notifications.empty())
+	{
+		std::string notification = _notifications.front();
+		_notifications.pop_front();
+		dispatchNotification(notification);
+	}
+
+	// Poll devices whose changes are not pushed.
+	// Callbacks may (un)watch devices, so don't keep iterators on _watches.
+	std::vector<std::string> devs;
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	for(std::map<std::string,Watch>::const_iterator it=_watches.begin(); it!=_watches.end(); ++it)
+	{
+		if((!it->second.pushed || it->second.resync) && it->second.nextPoll <= now)
+		{
+			devs.push_back(it->first);
+		}
+	}
+	for(size_t n=0; n<devs.size(); ++n)
+	{
+		pollWatch(devs[n]);
+	}
+}
+
+int TcpClient::getFd()const
+{
+	return _socket->getFd();
+}
+
+void TcpClient::dispatchNotification(const std::string& notification)
+{
+	// NOTIFY VAR <dev> <var> <value>
+	// NOTIFY DELVAR <dev> <var>
+	std::vector<std::string> args = explode(notification);
+	if(args.size() < 4)
+	{
+		return;
+	}
+
+	std::map<std::string,Watch>::iterator it = _watches.find(args[2]);
+	if(it == _watches.end() || !watchMatch(it->second.prefixes, args[3]))
+	{
+		return;
+	}
+	Watch& watch = it->second;
+	const std::string& name = args[3];
+	std::vector<std::string> values;
+
+	if(args[1] == "VAR")
+	{
+		values.assign(args.begin() + 4, args.end());
+		std::map<std::string,std::vector<std::string> >::iterator var = watch.values.find(name);
+		if(var != watch.values.end() && var->second == values)
+		{
+			return;
+		}
+		watch.values[name] = values;
+	}
+	else if(args[1] == "DELVAR")
+	{
+		if(watch.values.erase(name) == 0)
+		{
+			return;
+		}
+	}
+	else
+	{
+		return;
+	}
+
+	// Copy the callback, it may unwatch the device
+	WatchCallback callback = watch.callback;
+	callback(args[2], name, values);
+}
+
+void TcpClient::dropNotifications(const std::string& dev)
+{
+	std::deque<std::string>::iterator it = _notifications.begin();
+	while(it != _notifications.end())
+	{
+		std::vector<std::string> args = explode(*it);
+		if(args.size() >= 3 && args[2] == dev)
+		{
+			it = _notifications.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+}
+
+void TcpClient::pollWatch(const std::string& dev)
+{
+	std::map<std::string,std::vector<std::string> > values;
+	std::vector<std::vector<std::string> > vars = list("VAR", dev);
+
+	std::map<std::string,Watch>::iterator it = _watches.find(dev);
+	if(it == _watches.end())
+	{
+		return;
+	}
+	Watch& watch = it->second;
+
+	for(size_t n=0; n<vars.size(); ++n)
+	{
+		std::vector<std::string>& vals = vars[n];
+		std::string name = vals[0];
+		if(watchMatch(watch.prefixes, name))
+		{
+			vals.erase(vals.begin());
+			values[name] = vals;
+		}
+	}
+
+	// Compute changes: new or changed values, then removed variables
+	std::vector<std::pair<std::string,std::vector<std::string> > > changes;
+	for(std::map<std::string,std::vector<std::string> >::const_iterator var=values.begin(); var!=values.end(); ++var)
+	{
+		std::map<std::string,std::vector<std::string> >::const_iterator old = watch.values.find(var->first);
+		if(old == watch.values.end() || old->second != var->second)
+		{
+			changes.push_back(*var);
+		}
+	}
+	for(std::map<std::string,std::vector<std::string> >::const_iterator old=watch.values.begin(); old!=watch.values.end(); ++old)
+	{
+		if(values.find(old->first) == values.end())
+		{
+			changes.push_back(std::make_pair(old->first, std::vector<std::string>()));
+		}
+	}
+
+	watch.values.swap(values);
+	watch.nextPoll = std::chrono::steady_clock::now() + std::chrono::milliseconds(_watchPollInterval);
+	if(watch.resync)
+	{
+		// Pushed notifications received up to now are part of the list
+		watch.resync = false;
+		if(watch.pushed)
+		{
+			dropNotifications(dev);
+		}
+	}
+
+	WatchCallback callback = watch.callback;
+	for(size_t n=0; n<changes.size(); ++n)
+	{
+		callback(dev, changes[n].first, changes[n].second);
+	}
+}
+
+std::vector<std::string> TcpClient::get
+	(const std::string& subcmd, const std::string& params)
+{
+	_request.assign("GET ").append(subcmd);
+	if(!params.empty())
+	{
+		_request.append(1, ' ').append(params);
+	}
+	return sendGet();
+}
+
+std::vector<std::string> TcpClient::sendGet()
+{
+	// The reply repeats the request, without "GET "
+	const size_t begin = 4;
+	const size_t len = _request.size() - begin;
+
+	std::string res = sendQuery(_request);
+	detectError(res);
+	if(res.compare(0, len, _request, begin, len) != 0)
+	{
+		throw NutException("Invalid response");
+	}
+
+	return explode(res, len);
+}
+
+std::vector<std::vector<std::string> > TcpClient::list
+	(const std::string& subcmd, const std::string& params)
+{
+	_request.assign("LIST ").append(subcmd);
+	if(!params.empty())
+	{
+		_request.append(1, ' ').append(params);
+	}
+	checkConnection();
+	_socket->write(_request);
+	_lastSent = std::chrono::steady_clock::now();
+	// Items repeat the request, without "LIST "
+	return parseList(_request, 5);
+}
+
+std::vector<std::vector<std::string> > TcpClient::parseList
+	(const std::string& req)
+{
+	return parseList(req, 0);
+}
+
+/* Test if <line> is <marker> followed by <req> from <begin>, without building it */
+static bool isListMarker(const std::string& line, const char* marker, const std::string& req, size_t begin)
+{
+	const size_t len = strlen(marker);
+	return line.size() == len + req.size() - begin
+		&& line.compare(0, len, marker) == 0
+		&& line.compare(len, std::string::npos, req, begin, std::string::npos) == 0;
+}
+
+std::vector<std::vector<std::string> > TcpClient::parseList
+	(const std::string& req, size_t begin)
+{
+	const size_t len = req.size() - begin;
+
+	std::string res = readResponse();
+	detectError(res);
+	if(!isListMarker(res, "BEGIN LIST ", req, begin))
+	{
+		throw NutException("Invalid response");
+	}
+
+	std::vector<std::vector<std::string> > arr;
+	bool valid = true;
+	while(true)
+	{
+		res = readResponse();
+		if(isListMarker(res, "END LIST ", req, begin))
+		{
+			break;
+		}
+		if(valid && res.compare(0, len, req, begin, len) == 0)
+		{
+			arr.push_back(explode(res, len));
+		}
+		else
+		{
+			// Keep on reading up to the end of the list to stay in sync
+			// with the server, in case other replies are pending.
+			valid = false;
+		}
+	}
+
+	if(!valid)
+	{
+		throw NutException("Invalid response");
+	}
+	return arr;
+}
+
+std::string TcpClient::sendQuery(const std::string& req)
+{
+	checkConnection();
+	_socket->write(req);
+	_lastSent = std::chrono::steady_clock::now();
+	return readResponse();
+}
+
+std::string TcpClient::readResponse()
+{
+	while(true)
+	{
+		std::string res = _socket->read();
+		if(res.compare(0, 7, "NOTIFY ") == 0)
+		{
+			// Change notification, to be dispatched by processWatches()
+			_notifications.push_back(res);
+			continue;
+		}
+		return res;
+	}
+}
+
+void TcpClient::sendAsyncQueries(const std::vector<std::string>& req)
+{
+	checkConnection();
+	_socket->write(req);
+	_lastSent = std::chrono::steady_clock::now();
+}
+
+void TcpClient::detectError(const std::string& req)
+{
+	if(req.substr(0,3)=="ERR")
+	{
+		/* A bare "ERR" must not make substr() throw out_of_range */
+		throw NutException(req.size() > 4 ? req.substr(4) : std::string());
+	}
+}
+
+std::vector<std::string> TcpClient::explode(const std::string& str, size_t begin)
+{
+	std::vector<std::string> res;
+	std::string temp;
+
+	enum STATE {
+		INIT,
+		SIMPLE_STRING,
+		QUOTED_STRING,
+		SIMPLE_ESCAPE,
+		QUOTED_ESCAPE
+	} state = INIT;
+
+	for(size_t idx=begin; idx<str.size(); ++idx)
+	{
+		char c = str[idx];
+		switch(state)
+		{
+		case INIT:
+			if(c==' ' /* || c=='\t' */)
+			{ /* Do nothing */ }
+			else if(c=='"')
+			{
+				state = QUOTED_STRING;
+			}
+			else if(c=='\\')
+			{
+				state = SIMPLE_ESCAPE;
+			}
+			/* What about bad characters ? */
+			else
+			{
+				temp += c;
+				state = SIMPLE_STRING;
+			}
+			break;
+		case SIMPLE_STRING:
+			if(c==' ' /* || c=='\t' */)
+			{
+				/* if(!temp.empty()) : Must not occur */
+					res.push_back(std::move(temp));
+				temp.clear();
+				state = INIT;
+			}
+			else if(c=='\\')
+			{
+				state = SIMPLE_ESCAPE;
+			}
+			else if(c=='"')
+			{
+				/* if(!temp.empty()) : Must not occur */
+					res.push_back(std::move(temp));
+				temp.clear();
+				state = QUOTED_STRING;
+			}
+			/* What about bad characters ? */
+			else
+			{
+				temp += c;
+			}		
+			break;
+		case QUOTED_STRING:
+			if(c=='\\')
+			{
+				state = QUOTED_ESCAPE;
+			}
+			else if(c=='"')
+			{
+				res.push_back(std::move(temp));
+				temp.clear();
+				state = INIT;
+			}
+			/* What about bad characters ? */
+			else
+			{
+				temp += c;
+			}
+			break;
+		case SIMPLE_ESCAPE:
+			if(c=='\\' || c=='"' || c==' ' /* || c=='\t'*/)
+			{
+				temp += c;
+			}
+			else
+			{
+				temp += '\\'; // Really do this ?
+				temp += c;
+			}
+			state = SIMPLE_STRING;
+			break;
+		case QUOTED_ESCAPE:
+			if(c=='\\' || c=='"')
+			{
+				temp += c;
+			}
+			else
+			{
+				temp += '\\'; // Really do this ?
+				temp += c;
+			}
+			state = QUOTED_STRING;
+			break;
+		}
+	}
+
+	if(!temp.empty())
+	{
+		res.push_back(std::move(temp));
+	}
+
+	return res;
+}
+
+std::string TcpClient::escape(const std::string& str)
+{
+	std::string res;
+	res.reserve(str.size() + 2);
+	appendEscaped(res, str);
+	return res;
+}
+
+void TcpClient::appendEscaped(std::string& buf, const std::string& str)
+{
+	buf += '"';
+	for(size_t n=0; n<str.size(); n++)
+	{
+		char c = str[n];
+		if(c=='"' || c=='\\')
+			buf += '\\';
+		buf += c;
+	}
+	buf += '"';
+}
+
+TrackingID TcpClient::sendTrackingQuery(const std::string& req)
+{
+	return parseTracking(sendQuery(req));
+}
+
+TrackingID TcpClient::parseTracking(const std::string& reply)
+{
+	detectError(reply);
 	std::vector<std::string> res = explode(reply);
 
 	if (res.size() == 1 && res[0] == "OK")
@@ -1056,6 +1761,224 @@ TrackingID TcpClient::sendTrackingQuery(const std::string& req)
 	}
 }
 
+/*
+ *
+ * Batch implementation
+ *
+ */
+
+Batch::Batch(TcpClient& client):
+_client(client),
+_executed(0)
+{
+}
+
+Batch::~Batch()
+{
+}
+
+size_t Batch::push(OperationType type, std::string req, std::string query)
+{
+	_ops.push_back(Operation());
+	Operation& op = _ops.back();
+	op.type = type;
+	op.req = std::move(req);
+	op.query = std::move(query);
+	op.done = false;
+	return _ops.size() - 1;
+}
+
+size_t Batch::get(const std::string& subcmd, const std::string& params)
+{
+	std::string req = subcmd;
+	if(!params.empty())
+	{
+		req.append(1, ' ').append(params);
+	}
+	std::string query = "GET " + req;
+	return push(OP_GET, std::move(req), std::move(query));
+}
+
+size_t Batch::list(const std::string& subcmd, const std::string& params)
+{
+	std::string req = subcmd;
+	if(!params.empty())
+	{
+		req.append(1, ' ').append(params);
+	}
+	std::string query = "LIST " + req;
+	return push(OP_LIST, std::move(req), std::move(query));
+}
+
+size_t Batch::getDeviceVariableValue(const std::string& dev, const std::string& name)
+{
+	return get("VAR", dev + " " + name);
+}
+
+size_t Batch::getDeviceVariableValues(const std::string& dev)
+{
+	return list("VAR", dev);
+}
+
+size_t Batch::setDeviceVariable(const std::string& dev, const std::string& name, const std::string& value)
+{
+	std::string query = "SET VAR ";
+	query.append(dev).append(1, ' ').append(name).append(1, ' ');
+	TcpClient::appendEscaped(query, value);
+	return push(OP_TRACKING, std::string(), std::move(query));
+}
+
+size_t Batch::setDeviceVariable(const std::string& dev, const std::string& name, const std::vector<std::string>& values)
+{
+	std::string query = "SET VAR ";
+	query.append(dev).append(1, ' ').append(name);
+	for(size_t n=0; n<values.size(); ++n)
+	{
+		query.append(1, ' ');
+		TcpClient::appendEscaped(query, values[n]);
+	}
+	return push(OP_TRACKING, std::string(), std::move(query));
+}
+
+size_t Batch::executeDeviceCommand(const std::string& dev, const std::string& name, const std::string& param)
+{
+	std::string query = "INSTCMD ";
+	query.append(dev).append(1, ' ').append(name).append(1, ' ').append(param);
+	return push(OP_TRACKING, std::string(), std::move(query));
+}
+
+size_t Batch::size()const
+{
+	return _ops.size();
+}
+
+bool Batch::empty()const
+{
+	return _ops.empty();
+}
+
+void Batch::clear()
+{
+	_ops.clear();
+	_executed = 0;
+}
+
+void Batch::execute()
+{
+	if(_executed >= _ops.size())
+	{
+		return;
+	}
+
+	std::vector<std::string> queries;
+	for(size_t n=_executed; n<_ops.size(); ++n)
+	{
+		queries.push_back(_ops[n].query);
+	}
+	try
+	{
+		_client.sendAsyncQueries(queries);
+	}
+	catch(NutException&)
+	{
+		// Some of them may have been sent already:
+		// they must not be sent again, as a SET or an INSTCMD would be.
+		std::exception_ptr error = std::current_exception();
+		for(size_t n=_executed; n<_ops.size(); ++n)
+		{
+			_ops[n].error = error;
+			_ops[n].done = true;
+		}
+		_executed = _ops.size();
+		throw;
+	}
+
+	for(size_t n=_executed; n<_ops.size(); ++n)
+	{
+		Operation& op = _ops[n];
+		try
+		{
+			switch(op.type)
+			{
+			case OP_GET:
+			{
+				std::string res = _client.readResponse();
+				TcpClient::detectError(res);
+				if(res.substr(0, op.req.size()) != op.req)
+				{
+					throw NutException("Invalid response");
+				}
+				op.result.push_back(TcpClient::explode(res, op.req.size()));
+				break;
+			}
+			case OP_LIST:
+				op.result = _client.parseList(op.req);
+				break;
+			case OP_TRACKING:
+				op.tracking = TcpClient::parseTracking(_client.readResponse());
+				break;
+			}
+		}
+		catch(IOException&)
+		{
+			// Connection is lost or out of sync:
+			// no reply can be read for this one nor for the following ones.
+			std::exception_ptr error = std::current_exception();
+			for(; n<_ops.size(); ++n)
+			{
+				_ops[n].error = error;
+				_ops[n].done = true;
+			}
+			_executed = _ops.size();
+			throw;
+		}
+		catch(NutException&)
+		{
+			op.error = std::current_exception();
+		}
+		op.done = true;
+	}
+	_executed = _ops.size();
+}
+
+const Batch::Operation& Batch::result(size_t id, OperationType type)const
+{
+	if(id >= _ops.size() || _ops[id].type != type)
+	{
+		throw NutException("Invalid batch operation");
+	}
+	const Operation& op = _ops[id];
+	if(!op.done)
+	{
+		throw NutException("Batch not executed");
+	}
+	if(op.error)
+	{
+		std::rethrow_exception(op.error);
+	}
+	return op;
+}
+
+bool Batch::isOk(size_t id)const
+{
+	return id < _ops.size() && _ops[id].done && !_ops[id].error;
+}
+
+std::vector<std::string> Batch::getResult(size_t id)const
+{
+	return result(id, OP_GET).result[0];
+}
+
+std::vector<std::vector<std::string> > Batch::getListResult(size_t id)const
+{
+	return result(id, OP_LIST).result;
+}
+
+TrackingID Batch::getTrackingID(size_t id)const
+{
+	return result(id, OP_TRACKING).tracking;
+}
+
 /*
  *
  * Device implementation
@@ -1068,12 +1991,38 @@ _name(name)
 {
 }
 
+Device::Device(Client* client, std::string&& name):
+_client(client),
+_name(std::move(name))
+{
+}
+
 Device::Device(const Device& dev):
 _client(dev._client),
 _name(dev._name)
 {
 }
 
+Device::Device(Device&& dev):
+_client(dev._client),
+_name(std::move(dev._name))
+{
+}
+
+Device& Device::operator=(const Device& dev)
+{
+	_client = dev._client;
+	_name = dev._name;
+	return *this;
+}
+
+Device& Device::operator=(Device&& dev)
+{
+	_client = dev._client;
+	_name = std::move(dev._name);
+	return *this;
+}
+
 Device::~Device()
 {
 }
@@ -1115,49 +2064,49 @@ bool Device::operator==(const Device& dev)const
 
 bool Device::operator<(const Device& dev)const
 {
-  return getName()<dev.getName();
+  return _name<dev._name;
 }
 
 std::string Device::getDescription()
 {
 	if (!isOk()) throw NutException("Invalid device");
-	return getClient()->getDeviceDescription(getName());
+	return _client->getDeviceDescription(_name);
 }
 
 std::vector<std::string> Device::getVariableValue(const std::string& name)
 {
 	if (!isOk()) throw NutException("Invalid device");
-	return getClient()->getDeviceVariableValue(getName(), name);
+	return _client->getDeviceVariableValue(_name, name);
 }
 
 std::map<std::string,std::vector<std::string> > Device::getVariableValues()
 {
 	if (!isOk()) throw NutException("Invalid device");
-	return getClient()->getDeviceVariableValues(getName());
+	return _client->getDeviceVariableValues(_name);
 }
 
 std::set<std::string> Device::getVariableNames()
 {
 	if (!isOk()) throw NutException("Invalid device");
-	return getClient()->getDeviceVariableNames(getName());
+	return _client->getDeviceVariableNames(_name);
 }
 
 std::set<std::string> Device::getRWVariableNames()
 {
 	if (!isOk()) throw NutException("Invalid device");
-	return getClient()->getDeviceRWVariableNames(getName());
+	return _client->getDeviceRWVariableNames(_name);
 }
 
 void Device::setVariable(const std::string& name, const std::string& value)
 {
 	if (!isOk()) throw NutException("Invalid device");
-	getClient()->setDeviceVariable(getName(), name, value);
+	_client->setDeviceVariable(_name, name, value);
 }
 
 void Device::setVariable(const std::string& name, const std::vector<std::string>& values)
 {
 	if (!isOk()) throw NutException("Invalid device");
-	getClient()->setDeviceVariable(getName(), name, values);
+	_client->setDeviceVariable(_name, name, values);
 }
 
 
@@ -1165,7 +2114,7 @@ void Device::setVariable(const std::string& name, const std::vector<std::string>
 Variable Device::getVariable(const std::string& name)
 {
   if (!isOk()) throw NutException("Invalid device");
-  if(getClient()->hasDeviceVariable(getName(), name))
+  if(_client->hasDeviceVariable(_name, name))
   	return Variable(this, name);
   else
     return Variable(NULL, "");
@@ -1176,10 +2125,10 @@ std::set<Variable> Device::getVariables()
 	std::set<Variable> set;
 	if (!isOk()) throw NutException("Invalid device");
 
-  std::set<std::string> names = getClient()->getDeviceVariableNames(getName());
+  std::set<std::string> names = _client->getDeviceVariableNames(_name);
   for(std::set<std::string>::iterator it=names.begin(); it!=names.end(); ++it)
   {
-		set.insert(Variable(this, *it));
+		set.insert(set.end(), Variable(this, *it));
   }
 
 	return set;
@@ -1190,10 +2139,10 @@ std::set<Variable> Device::getRWVariables()
 	std::set<Variable> set;
 	if (!isOk()) throw NutException("Invalid device");
 
-  std::set<std::string> names = getClient()->getDeviceRWVariableNames(getName());
+  std::set<std::string> names = _client->getDeviceRWVariableNames(_name);
   for(std::set<std::string>::iterator it=names.begin(); it!=names.end(); ++it)
   {
-		set.insert(Variable(this, *it));
+		set.insert(set.end(), Variable(this, *it));
   }
 
 	return set;
@@ -1202,7 +2151,7 @@ std::set<Variable> Device::getRWVariables()
 std::set<std::string> Device::getCommandNames()
 {
 	if (!isOk()) throw NutException("Invalid device");
-	return getClient()->getDeviceCommandNames(getName());
+	return _client->getDeviceCommandNames(_name);
 }
 
 std::set<Command> Device::getCommands()
@@ -1212,7 +2161,7 @@ std::set<Command> Device::getCommands()
 	std::set<std::string> res = getCommandNames();
 	for(std::set<std::string>::iterator it=res.begin(); it!=res.end(); ++it)
 	{
-		cmds.insert(Command(this, *it));
+		cmds.insert(cmds.end(), Command(this, *it));
 	}
 
 	return cmds;
@@ -1221,7 +2170,7 @@ std::set<Command> Device::getCommands()
 Command Device::getCommand(const std::string& name)
 {
   if (!isOk()) throw NutException("Invalid device");
-  if(getClient()->hasDeviceCommand(getName(), name))
+  if(_client->hasDeviceCommand(_name, name))
   	return Command(this, name);
   else
     return Command(NULL, "");
@@ -1230,19 +2179,19 @@ Command Device::getCommand(const std::string& name)
 TrackingID Device::executeCommand(const std::string& name, const std::string& param)
 {
   if (!isOk()) throw NutException("Invalid device");
-  return getClient()->executeDeviceCommand(getName(), name, param);
+  return _client->executeDeviceCommand(_name, name, param);
 }
 
 void Device::login()
 {
   if (!isOk()) throw NutException("Invalid device");
-  getClient()->deviceLogin(getName());
+  _client->deviceLogin(_name);
 }
 
 void Device::master()
 {
   if (!isOk()) throw NutException("Invalid device");
-  getClient()->deviceMaster(getName());
+  _client->deviceMaster(_name);
 }
 
 void Device::forcedShutdown()
@@ -1252,7 +2201,7 @@ void Device::forcedShutdown()
 int Device::getNumLogins()
 {
   if (!isOk()) throw NutException("Invalid device");
-  return getClient()->deviceGetNumLogins(getName());
+  return _client->deviceGetNumLogins(_name);
 }
 
 /*
@@ -1267,12 +2216,38 @@ _name(name)
 {
 }
 
+Variable::Variable(Device* dev, std::string&& name):
+_device(dev),
+_name(std::move(name))
+{
+}
+
 Variable::Variable(const Variable& var):
 _device(var._device),
 _name(var._name)
 {
 }
 
+Variable::Variable(Variable&& var):
+_device(var._device),
+_name(std::move(var._name))
+{
+}
+
+Variable& Variable::operator=(const Variable& var)
+{
+	_device = var._device;
+	_name = var._name;
+	return *this;
+}
+
+Variable& Variable::operator=(Variable&& var)
+{
+	_device = var._device;
+	_name = std::move(var._name);
+	return *this;
+}
+
 Variable::~Variable()
 {
 }
@@ -1315,27 +2290,27 @@ bool Variable::operator==(const Variable& var)const
 
 bool Variable::operator<(const Variable& var)const
 {
-	return getName()<var.getName();
+	return _name<var._name;
 }
 
 std::vector<std::string> Variable::getValue()
 {
-  return getDevice()->getClient()->getDeviceVariableValue(getDevice()->getName(), getName());
+  return _device->_client->getDeviceVariableValue(_device->_name, _name);
 }
 
 std::string Variable::getDescription()
 {
-  return getDevice()->getClient()->getDeviceVariableDescription(getDevice()->getName(), getName());
+  return _device->_client->getDeviceVariableDescription(_device->_name, _name);
 }
 
 void Variable::setValue(const std::string& value)
 {
-	getDevice()->setVariable(getName(), value);
+	_device->setVariable(_name, value);
 }
 
 void Variable::setValues(const std::vector<std::string>& values)
 {
-	getDevice()->setVariable(getName(), values);
+	_device->setVariable(_name, values);
 }
 
 
@@ -1351,12 +2326,38 @@ _name(name)
 {
 }
 
+Command::Command(Device* dev, std::string&& name):
+_device(dev),
+_name(std::move(name))
+{
+}
+
 Command::Command(const Command& cmd):
 _device(cmd._device),
 _name(cmd._name)
 {
 }
 
+Command::Command(Command&& cmd):
+_device(cmd._device),
+_name(std::move(cmd._name))
+{
+}
+
+Command& Command::operator=(const Command& cmd)
+{
+	_device = cmd._device;
+	_name = cmd._name;
+	return *this;
+}
+
+Command& Command::operator=(Command&& cmd)
+{
+	_device = cmd._device;
+	_name = std::move(cmd._name);
+	return *this;
+}
+
 Command::~Command()
 {
 }
@@ -1399,17 +2400,17 @@ bool Command::operator==(const Command& cmd)const
 
 bool Command::operator<(const Command& cmd)const
 {
-	return getName()<cmd.getName();
+	return _name<cmd._name;
 }
 
 std::string Command::getDescription()
 {
-	return getDevice()->getClient()->getDeviceCommandDescription(getDevice()->getName(), getName());
+	return _device->_client->getDeviceCommandDescription(_device->_name, _name);
 }
 
 void Command::execute(const std::string& param)
 {
-	getDevice()->executeCommand(getName(), param);
+	_device->executeCommand(_name, param);
 }
 
 } /* namespace nut */
@@ -1546,6 +2547,30 @@ void nutclient_tcp_set_timeout(NUTCLIENT_TCP_t client, long timeout)
 	}
 }
 
+void nutclient_tcp_set_auto_reconnect(NUTCLIENT_TCP_t client, int enable)
+{
+	if(client)
+	{
+		nut::TcpClient* cl = dynamic_cast<nut::TcpClient*>((nut::Client*)client);
+		if(cl)
+		{
+			cl->setAutoReconnect(enable != 0);
+		}
+	}
+}
+
+void nutclient_tcp_set_keepalive_interval(NUTCLIENT_TCP_t client, long interval)
+{
+	if(client)
+	{
+		nut::TcpClient* cl = dynamic_cast<nut::TcpClient*>((nut::Client*)client);
+		if(cl)
+		{
+			cl->setKeepAliveInterval(interval);
+		}
+	}
+}
+
 long nutclient_tcp_get_timeout(NUTCLIENT_TCP_t client)
 {
 	if(client)
@@ -1560,6 +2585,104 @@ long nutclient_tcp_get_timeout(NUTCLIENT_TCP_t client)
 }
 
 
+int nutclient_tcp_watch(NUTCLIENT_TCP_t client, const char* dev, const strarr prefixes,
+	nutclient_watch_callback_t callback, void* userdata)
+{
+	if(client)
+	{
+		nut::TcpClient* cl = dynamic_cast<nut::TcpClient*>((nut::Client*)client);
+		if(cl)
+		{
+			try
+			{
+				std::vector<std::string> prefs;
+				if(prefixes)
+				{
+					for(strarr pstr = (strarr)prefixes; *pstr; ++pstr)
+					{
+						prefs.push_back(std::string(*pstr));
+					}
+				}
+
+				cl->watch(dev, prefs, [client, callback, userdata](const std::string& d,
+					const std::string& name, const std::vector<std::string>& values)
+				{
+					strarr arr = values.empty() ? NULL : stringvector_to_strarr(values);
+					callback(client, d.c_str(), name.c_str(), arr, userdata);
+					if(arr)
+					{
+						strarr_free(arr);
+					}
+				});
+				return 0;
+			}
+			catch(...){}
+		}
+	}
+	return -1;
+}
+
+void nutclient_tcp_unwatch(NUTCLIENT_TCP_t client, const char* dev)
+{
+	if(client)
+	{
+		nut::TcpClient* cl = dynamic_cast<nut::TcpClient*>((nut::Client*)client);
+		if(cl)
+		{
+			try
+			{
+				cl->unwatch(dev);
+			}
+			catch(...){}
+		}
+	}
+}
+
+int nutclient_tcp_get_fd(NUTCLIENT_TCP_t client)
+{
+	if(client)
+	{
+		nut::TcpClient* cl = dynamic_cast<nut::TcpClient*>((nut::Client*)client);
+		if(cl)
+		{
+			return cl->getFd();
+		}
+	}
+	return -1;
+}
+
+long nutclient_tcp_get_watch_timeout(NUTCLIENT_TCP_t client)
+{
+	if(client)
+	{
+		nut::TcpClient* cl = dynamic_cast<nut::TcpClient*>((nut::Client*)client);
+		if(cl)
+		{
+			return cl->getWatchTimeout();
+		}
+	}
+	return -1;
+}
+
+int nutclient_tcp_process_watches(NUTCLIENT_TCP_t client)
+{
+	if(client)
+	{
+		nut::TcpClient* cl = dynamic_cast<nut::TcpClient*>((nut::Client*)client);
+		if(cl)
+		{
+			try
+			{
+				cl->processWatches();
+				return 0;
+			}
+			catch(...){}
+		}
+	}
+	return -1;
+}
+
+
 void nutclient_authenticate(NUTCLIENT_t client, const char* login, const char* passwd)
 {
 	if(client)
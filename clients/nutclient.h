@@ -27,7 +27,10 @@
 #include <vector>
 #include <map>
 #include <set>
+#include <deque>
 #include <exception>
+#include <functional>
+#include <chrono>
 
 namespace nut
 {
@@ -40,6 +43,7 @@ class Socket;
 
 class Client;
 class TcpClient;
+class Batch;
 class Device;
 class Variable;
 class Command;
@@ -130,6 +134,15 @@ typedef enum
 
 typedef std::string Feature;
 
+/**
+ * Callback notified of the changes of the variables of a watched device.
+ * \param dev Device name.
+ * \param name Variable name.
+ * \param values New variable values, empty if the variable disappeared.
+ */
+typedef std::function<void(const std::string& dev, const std::string& name,
+	const std::vector<std::string>& values)> WatchCallback;
+
 /**
  * A nut client is the starting point to dialog to NUTD.
  * It can connect to an NUTD then retrieve its device list.
@@ -335,6 +348,7 @@ protected:
  */
 class TcpClient : public Client
 {
+	friend class Batch;
 public:
 	/**
 	 * Construct a nut TcpClient object.
@@ -360,6 +374,8 @@ public:
 	/**
 	 * Connect to the server.
 	 * Host name and ports must have already set (usefull for reconnection).
+	 * An existing connection is closed first. Its session (authentication,
+	 * device login, watches) is not restored.
 	 */
 	void connect();
 
@@ -370,6 +386,7 @@ public:
 	bool isConnected()const;
 	/**
 	 * Force the deconnection.
+	 * The connection will not be reestablished automatically.
 	 */
 	void disconnect();
 
@@ -426,8 +443,113 @@ public:
 	virtual bool isFeatureEnabled(const Feature& feature);
 	virtual void setFeature(const Feature& feature, bool status);
 
+	/**
+	 * Connection maintenance.
+	 * \{
+	 */
+	/**
+	 * Enable or disable automatic reconnection (enabled by default).
+	 * When the connection is lost (server restarted, idle client dropped
+	 * by the server...), the next query reconnects to the server and
+	 * restores the session: authentication, device login and watches.
+	 * A query already waiting for its reply when the connection is lost
+	 * still fails. A connection closed by disconnect() or logout() is not
+	 * restored.
+	 * \param enable true to reconnect automatically.
+	 */
+	void setAutoReconnect(bool enable);
+	/**
+	 * Test if automatic reconnection is enabled.
+	 */
+	bool isAutoReconnect()const;
+	/**
+	 * Set the interval of keepalive queries, sent by processWatches() when
+	 * the connection is idle. upsd drops clients silent for 60 seconds.
+	 * \param interval Interval in milliseconds, 0 to disable (default: 30000).
+	 */
+	void setKeepAliveInterval(long interval);
+	/**
+	 * Retrieve the interval of keepalive queries.
+	 * \return Interval in milliseconds, 0 if disabled.
+	 */
+	long getKeepAliveInterval()const;
+	/** \} */
+
+	/**
+	 * Variable change notifications.
+	 * \{
+	 */
+	/**
+	 * Watch the changes of the variables of a device.
+	 * Changes are pushed by the server (WATCH command) when it supports it,
+	 * otherwise the variables are periodically listed and compared with
+	 * their previous values. In both cases, the callback is only called
+	 * for new, changed or removed variables, from processWatches().
+	 * The callback is first called for all matching variables, with their
+	 * current values.
+	 * Watching again a device replaces the previous watch.
+	 * \param dev Device name.
+	 * \param prefixes Prefixes of the variable names to watch (like
+	 * "ups.status" or "battery."), empty to watch all variables.
+	 * \param callback Function called for each variable change.
+	 */
+	void watch(const std::string& dev, const std::vector<std::string>& prefixes, WatchCallback callback);
+	/**
+	 * Stop watching the changes of the variables of a device.
+	 * \param dev Device name.
+	 */
+	void unwatch(const std::string& dev);
+	/**
+	 * Test if the changes of a watched device are pushed by the server.
+	 * \param dev Device name.
+	 * \return false if the device is polled, or not watched.
+	 */
+	bool isWatchPushed(const std::string& dev)const;
+	/**
+	 * Set the interval between two polls of devices whose changes are not
+	 * pushed by the server.
+	 * \param interval Interval in milliseconds.
+	 */
+	void setWatchPollInterval(long interval);
+	/**
+	 * Retrieve the interval between two polls of watched devices.
+	 * \return Interval in milliseconds.
+	 */
+	long getWatchPollInterval()const;
+	/**
+	 * Retrieve the delay before processWatches() must be called again,
+	 * if no data is received on the connection before.
+	 * \return Delay in milliseconds, negative if there is no deadline.
+	 */
+	long getWatchTimeout()const;
+	/**
+	 * Dispatch received change notifications and poll watched devices if
+	 * needed, calling their callbacks. Also keep the connection alive, and
+	 * restore it if it was lost (see setAutoReconnect()).
+	 * This should be called when the descriptor returned by getFd() is
+	 * readable, or when getWatchTimeout() is elapsed.
+	 */
+	void processWatches();
+	/**
+	 * Retrieve the system descriptor of the connection, to be polled for
+	 * change notifications.
+	 * It changes when the connection is restored: retrieve it again after
+	 * each call to processWatches().
+	 * \return Socket descriptor, negative if not connected.
+	 */
+	int getFd()const;
+	/** \} */
+
 protected:
+	/**
+	 * Use an already connected socket instead of connecting to a server.
+	 * The client takes ownership of the descriptor.
+	 * \param fd Socket descriptor (typically one end of a socketpair(2)).
+	 */
+	void attach(int fd);
+
 	std::string sendQuery(const std::string& req);
+	std::string readResponse();
 	void sendAsyncQueries(const std::vector<std::string>& req);
 	static void detectError(const std::string& req);
 	TrackingID sendTrackingQuery(const std::string& req);
@@ -440,12 +562,191 @@ protected:
 
 	static std::vector<std::string> explode(const std::string& str, size_t begin=0);
 	static std::string escape(const std::string& str);
+	static TrackingID parseTracking(const std::string& reply);
 
 private:
+	/* Restore a lost connection before using it, if enabled */
+	void checkConnection();
+	void reconnect();
+	void restoreSession();
+	/* Forget the session state restored by reconnect() */
+	void resetSession();
+
+	/* Send the GET request built in _request and parse its reply */
+	std::vector<std::string> sendGet();
+	/* Parse a list whose items are prefixed by req, from begin */
+	std::vector<std::vector<std::string> > parseList(const std::string& req, size_t begin);
+	static void appendEscaped(std::string& buf, const std::string& str);
+
 	std::string _host;
 	int _port;
 	long _timeout;
 	internal::Socket* _socket;
+	std::string _request; /* Reused for building requests, to spare allocations */
+
+	/* Session state, restored after a connection loss */
+	bool _autoReconnect;
+	bool _connectRequested; /* Not closed by disconnect() or logout() */
+	std::string _user;
+	std::string _password;
+	std::string _loginDevice;
+
+	long _keepAliveInterval;
+	std::chrono::steady_clock::time_point _lastSent;
+
+	struct Watch
+	{
+		std::vector<std::string> prefixes;
+		WatchCallback callback;
+		bool pushed;
+		bool resync; /* Changes may have been missed while disconnected */
+		std::chrono::steady_clock::time_point nextPoll;
+		std::map<std::string,std::vector<std::string> > values;
+	};
+
+	void dispatchNotification(const std::string& notification);
+	void dropNotifications(const std::string& dev);
+	void pollWatch(const std::string& dev);
+
+	std::map<std::string,Watch> _watches;
+	std::deque<std::string> _notifications; /* Received while waiting for responses */
+	long _watchPollInterval;
+};
+
+
+/**
+ * Batch of queries pipelined to a TCP NUTD client.
+ * Operations are queued, then sent all together in one network write by
+ * Batch::execute(). Replies are read back in order and stored per operation:
+ * an error on one operation (ERR reply, unexpected data) does not affect
+ * the others.
+ * Each queuing method returns the index of the operation, to be used to
+ * retrieve its result once the batch has been executed.
+ */
+class Batch
+{
+public:
+	/**
+	 * Construct an empty batch for the specified client.
+	 * \param client Connected TCP client.
+	 */
+	Batch(TcpClient& client);
+	~Batch();
+
+	/**
+	 * Queue a GET query.
+	 * \param subcmd GET sub-command (VAR, DESC, UPSDESC...).
+	 * \param params Sub-command parameters.
+	 * \return Operation index.
+	 */
+	size_t get(const std::string& subcmd, const std::string& params = "");
+	/**
+	 * Queue a LIST query.
+	 * \param subcmd LIST sub-command (VAR, RW, CMD...).
+	 * \param params Sub-command parameters.
+	 * \return Operation index.
+	 */
+	size_t list(const std::string& subcmd, const std::string& params = "");
+
+	/**
+	 * Queue the retrieval of the values of a variable.
+	 * \see Client::getDeviceVariableValue
+	 */
+	size_t getDeviceVariableValue(const std::string& dev, const std::string& name);
+	/**
+	 * Queue the retrieval of the values of all variables of a device.
+	 * \see Client::getDeviceVariableValues
+	 */
+	size_t getDeviceVariableValues(const std::string& dev);
+	/**
+	 * Queue the setting of a variable.
+	 * \see Client::setDeviceVariable
+	 */
+	size_t setDeviceVariable(const std::string& dev, const std::string& name, const std::string& value);
+	/**
+	 * Queue the setting of (multiple) values of a variable.
+	 * \see Client::setDeviceVariable
+	 */
+	size_t setDeviceVariable(const std::string& dev, const std::string& name, const std::vector<std::string>& values);
+	/**
+	 * Queue the execution of a command.
+	 * \see Client::executeDeviceCommand
+	 */
+	size_t executeDeviceCommand(const std::string& dev, const std::string& name, const std::string& param="");
+
+	/**
+	 * Retrieve the number of queued operations.
+	 */
+	size_t size()const;
+	/**
+	 * Test if no operation is queued.
+	 */
+	bool empty()const;
+	/**
+	 * Remove all operations and their results.
+	 */
+	void clear();
+
+	/**
+	 * Send all queued operations and read their replies.
+	 * Operations already executed are not sent again.
+	 * If the connection fails, the error is recorded for every operation
+	 * still waiting for its reply, then thrown.
+	 */
+	void execute();
+
+	/**
+	 * Test if an operation has been executed successfully.
+	 * \param id Operation index.
+	 */
+	bool isOk(size_t id)const;
+	/**
+	 * Retrieve the values returned by a GET operation.
+	 * Throws the exception recorded for the operation if it failed.
+	 * \param id Operation index.
+	 * \return Values of the reply, without the request prefix.
+	 */
+	std::vector<std::string> getResult(size_t id)const;
+	/**
+	 * Retrieve the items returned by a LIST operation.
+	 * Throws the exception recorded for the operation if it failed.
+	 * \param id Operation index.
+	 * \return List items, without the request prefix.
+	 */
+	std::vector<std::vector<std::string> > getListResult(size_t id)const;
+	/**
+	 * Retrieve the tracking ID returned by a SET or INSTCMD operation.
+	 * Throws the exception recorded for the operation if it failed.
+	 * \param id Operation index.
+	 * \return Tracking ID, empty if tracking is disabled.
+	 */
+	TrackingID getTrackingID(size_t id)const;
+
+private:
+	typedef enum
+	{
+		OP_GET,
+		OP_LIST,
+		OP_TRACKING
+	} OperationType;
+
+	struct Operation
+	{
+		OperationType type;
+		std::string req;
+		std::string query;
+		bool done;
+		std::vector<std::vector<std::string> > result;
+		TrackingID tracking;
+		std::exception_ptr error;
+	};
+
+	size_t push(OperationType type, std::string req, std::string query);
+	const Operation& result(size_t id, OperationType type)const;
+
+	TcpClient& _client;
+	std::vector<Operation> _ops;
+	size_t _executed;
 };
 
 
@@ -457,9 +758,14 @@ class Device
 {
 	friend class Client;
 	friend class TcpClient;
+	friend class Variable;
+	friend class Command;
 public:
 	~Device();
 	Device(const Device& dev);
+	Device(Device&& dev);
+	Device& operator=(const Device& dev);
+	Device& operator=(Device&& dev);
 
 	/**
 	 * Retrieve the name of the device.
@@ -591,6 +897,7 @@ public:
 
 protected:
 	Device(Client* client, const std::string& name);
+	Device(Client* client, std::string&& name);
 
 private:
 	Client* _client;
@@ -609,6 +916,9 @@ public:
 	~Variable();
 
 	Variable(const Variable& var);
+	Variable(Variable&& var);
+	Variable& operator=(const Variable& var);
+	Variable& operator=(Variable&& var);
 
 	/**
 	 * Retrieve variable name.
@@ -670,6 +980,7 @@ public:
 
 protected:
 	Variable(Device* dev, const std::string& name);
+	Variable(Device* dev, std::string&& name);
 
 private:
 	Device* _device;
@@ -688,6 +999,9 @@ public:
 	~Command();
 
 	Command(const Command& cmd);
+	Command(Command&& cmd);
+	Command& operator=(const Command& cmd);
+	Command& operator=(Command&& cmd);
 
 	/**
 	 * Retrieve command name.
@@ -741,6 +1055,7 @@ public:
 
 protected:
 	Command(Device* dev, const std::string& name);
+	Command(Device* dev, std::string&& name);
 
 private:
 	Device* _device;
@@ -999,6 +1314,69 @@ void nutclient_tcp_set_timeout(NUTCLIENT_TCP_t client, long timeout);
  * \return Timeout value in seconds.
  */
 long nutclient_tcp_get_timeout(NUTCLIENT_TCP_t client);
+/**
+ * Enable or disable the automatic reconnection of a lost connection,
+ * restoring authentication, device login and watches.
+ * \param client Nut TCP client handle.
+ * \param enable 1 to enable (default), 0 to disable.
+ */
+void nutclient_tcp_set_auto_reconnect(NUTCLIENT_TCP_t client, int enable);
+/**
+ * Set the interval of keepalive queries sent on an idle connection by
+ * nutclient_tcp_process_watches().
+ * \param client Nut TCP client handle.
+ * \param interval Interval in milliseconds, 0 to disable (default: 30000).
+ */
+void nutclient_tcp_set_keepalive_interval(NUTCLIENT_TCP_t client, long interval);
+
+/**
+ * Callback notified of the changes of the variables of a watched device.
+ * \param client Nut TCP client handle.
+ * \param dev Device name.
+ * \param var Variable name.
+ * \param values New variable values, NULL if the variable disappeared.
+ * Only valid during the call.
+ * \param userdata User data given to nutclient_tcp_watch().
+ */
+typedef void (*nutclient_watch_callback_t)(NUTCLIENT_TCP_t client, const char* dev,
+	const char* var, const strarr values, void* userdata);
+/**
+ * Watch the changes of the variables of a device.
+ * The callback is called from nutclient_tcp_process_watches().
+ * \param client Nut TCP client handle.
+ * \param dev Device name.
+ * \param prefixes Prefixes of the variable names to watch, NULL for all.
+ * \param callback Function called for each variable change.
+ * \param userdata User data passed to the callback.
+ * \return 0 if the device is watched.
+ */
+int nutclient_tcp_watch(NUTCLIENT_TCP_t client, const char* dev, const strarr prefixes,
+	nutclient_watch_callback_t callback, void* userdata);
+/**
+ * Stop watching the changes of the variables of a device.
+ * \param client Nut TCP client handle.
+ * \param dev Device name.
+ */
+void nutclient_tcp_unwatch(NUTCLIENT_TCP_t client, const char* dev);
+/**
+ * Retrieve the descriptor of the TCP connection, to be polled for changes.
+ * \param client Nut TCP client handle.
+ * \return Socket descriptor, -1 if not connected.
+ */
+int nutclient_tcp_get_fd(NUTCLIENT_TCP_t client);
+/**
+ * Retrieve the delay before nutclient_tcp_process_watches() must be called,
+ * if the descriptor does not become readable before.
+ * \param client Nut TCP client handle.
+ * \return Delay in milliseconds, negative if there is no deadline.
+ */
+long nutclient_tcp_get_watch_timeout(NUTCLIENT_TCP_t client);
+/**
+ * Dispatch the changes of the watched devices to their callbacks.
+ * \param client Nut TCP client handle.
+ * \return 0 if correctly processed, -1 if the connection failed.
+ */
+int nutclient_tcp_process_watches(NUTCLIENT_TCP_t client);
 
 /** \} */
 
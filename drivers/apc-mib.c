@@ -296,7 +296,24 @@ static snmp_info_t apcc_mib[] = {
 	{ NULL, 0, 0, NULL, NULL, 0, NULL }
 };
 
-mib2nut_info_t	apc = { "apcc", APCC_MIB_VERSION, APCC_OID_POWER_STATUS, ".1.3.6.1.4.1.318.1.1.1.1.1.1.0", apcc_mib };
+/* PowerNet-MIB traps (SNMPv1: enterprise apc, and the specific trap) */
+static traps_info_t apcc_traps[] = {
+	/* upsOverload */
+	{ ".1.3.6.1.4.1.318.0.2", "ups.load" },
+	/* upsOnBattery */
+	{ ".1.3.6.1.4.1.318.0.5", "battery." },
+	{ ".1.3.6.1.4.1.318.0.5", "input." },
+	/* lowBattery */
+	{ ".1.3.6.1.4.1.318.0.7", "battery." },
+	/* powerRestored */
+	{ ".1.3.6.1.4.1.318.0.9", "input." },
+	/* returnFromLowBattery */
+	{ ".1.3.6.1.4.1.318.0.11", "battery." },
+	/* end of structure. */
+	{ NULL, NULL }
+} ;
+
+mib2nut_info_t	apc = { "apcc", APCC_MIB_VERSION, APCC_OID_POWER_STATUS, ".1.3.6.1.4.1.318.1.1.1.1.1.1.0", apcc_mib, NULL, NULL, apcc_traps };
 
 /*
 vim:ts=4:sw=4:et:
@@ -22,6 +22,7 @@
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <limits.h>
 #include <sys/stat.h>
 #include <pwd.h>
 #include <sys/types.h>
@@ -32,13 +33,28 @@
 #include "dstate.h"
 #include "state.h"
 #include "parseconf.h"
-
-	static int	sockfd = -1, stale = 1, alarm_active = 0, ignorelb = 0;
-	static char	*sockfn = NULL;
-	static char	status_buf[ST_MAX_VALUE_LEN], alarm_buf[LARGEBUF];
-	static st_tree_t	*dtree_root = NULL;
-	static conn_t	*connhead = NULL;
-	static cmdlist_t *cmdhead = NULL;
+#include "eventloop.h"
+#include "history.h"
+#include "timehead.h"
+
+/* everything that belongs to one device: a driver normally has exactly one
+ * of these, the multi-device host (main.c, -A) one per hosted section */
+struct dstate_ctx_s {
+	int	sockfd, stale, alarm_active, ignorelb;
+	char	*sockfn;
+	char	status_buf[ST_MAX_VALUE_LEN], alarm_buf[LARGEBUF];
+	st_tree_t	*dtree_root;
+	conn_t	*connhead;
+	cmdlist_t	*cmdhead;
+	dstate_ctx_t	*dirty_next;	/* on dirty_head while output is queued */
+	int	dirty;
+	unsigned long	changes;	/* see dstate_changes() */
+	history_t	*history;	/* see dstate_sethistory() */
+};
+
+	static dstate_ctx_t	dstate_default = { -1, 1, 0, 0, NULL, "", "", NULL, NULL, NULL, NULL, 0, 0, NULL };
+	static dstate_ctx_t	*ds = &dstate_default;
+	static dstate_ctx_t	*dirty_head = NULL;
 
 	struct ups_handler	upsh;
 
@@ -109,12 +125,12 @@ static int sock_open(const char *fn)
 	}
 
 	/* keep this around for the unlink() when exiting */
-	sockfn = xstrdup(fn);
+	ds->sockfn = xstrdup(fn);
 
 	ssaddr.sun_family = AF_UNIX;
-	snprintf(ssaddr.sun_path, sizeof(ssaddr.sun_path), "%s", sockfn);
+	snprintf(ssaddr.sun_path, sizeof(ssaddr.sun_path), "%s", ds->sockfn);
 
-	unlink(sockfn);
+	unlink(ds->sockfn);
 
 	/* group gets access so upsd can be a different user but same group */
 	umask(0007);
@@ -122,13 +138,13 @@ static int sock_open(const char *fn)
 	ret = bind(fd, (struct sockaddr *) &ssaddr, sizeof ssaddr);
 
 	if (ret < 0) {
-		sock_fail(sockfn);
+		sock_fail(ds->sockfn);
 	}
 
-	ret = chmod(sockfn, 0660);
+	ret = chmod(ds->sockfn, 0660);
 
 	if (ret < 0) {
-		fatal_with_errno(EXIT_FAILURE, "chmod(%s, 0660) failed", sockfn);
+		fatal_with_errno(EXIT_FAILURE, "chmod(%s, 0660) failed", ds->sockfn);
 	}
 
 	ret = listen(fd, DS_LISTEN_BACKLOG);
@@ -142,14 +158,16 @@ static int sock_open(const char *fn)
 
 static void sock_disconnect(conn_t *conn)
 {
+	ev_delfd(conn->fd);
 	close(conn->fd);
 
 	pconf_finish(&conn->ctx);
+	free(conn->outbuf);
 
 	if (conn->prev) {
 		conn->prev->next = conn->next;
 	} else {
-		connhead = conn->next;
+		ds->connhead = conn->next;
 	}
 
 	if (conn->next) {
@@ -161,6 +179,77 @@ static void sock_disconnect(conn_t *conn)
 	free(conn);
 }
 
+static void sock_write_handler(int fd, void *arg);
+
+/* write as much of the queued output as the socket takes right now,
+ * and have the event loop tell us when there's room for the rest */
+static int conn_flush(conn_t *conn)
+{
+	ssize_t	ret;
+	size_t	done = 0;
+
+	while (done < conn->outlen) {
+		ret = write(conn->fd, conn->outbuf + done, conn->outlen - done);
+
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+				break;
+			}
+
+			upsdebug_with_errno(1, "write %d bytes to socket %d failed",
+				(int)(conn->outlen - done), conn->fd);
+			sock_disconnect(conn);
+			return 0;	/* failed */
+		}
+
+		done += ret;
+	}
+
+	if (done > 0) {
+		memmove(conn->outbuf, conn->outbuf + done, conn->outlen - done);
+		conn->outlen -= done;
+	}
+
+	ev_setwrite(conn->fd, conn->outlen ? sock_write_handler : NULL);
+
+	return 1;	/* OK */
+}
+
+/* queue a line for this connection, it goes out with the next flush */
+static int conn_queue(conn_t *conn, const char *buf, size_t len)
+{
+	if (conn->outlen + len > DS_MAX_OUTBUF) {
+		upsdebugx(1, "output for socket %d not read, disconnecting", conn->fd);
+		sock_disconnect(conn);
+		return 0;	/* failed */
+	}
+
+	if (conn->outlen + len > conn->outsize) {
+		conn->outsize = (conn->outsize > 0) ? conn->outsize * 2 : ST_SOCK_BUF_LEN;
+
+		while (conn->outlen + len > conn->outsize) {
+			conn->outsize *= 2;
+		}
+
+		conn->outbuf = xrealloc(conn->outbuf, conn->outsize);
+	}
+
+	memcpy(conn->outbuf + conn->outlen, buf, len);
+	conn->outlen += len;
+
+	if (!ds->dirty) {
+		ds->dirty = 1;
+		ds->dirty_next = dirty_head;
+		dirty_head = ds;
+	}
+
+	return 1;	/* OK */
+}
+
 static void send_to_all(const char *fmt, ...)
 {
 	int	ret;
@@ -177,17 +266,15 @@ static void send_to_all(const char *fmt, ...)
 		return;
 	}
 
+	if (ret >= (int)sizeof(buf)) {
+		ret = sizeof(buf) - 1;
+	}
+
 	upsdebugx(5, "%s: %.*s", __func__, ret-1, buf);
 
-	for (conn = connhead; conn; conn = cnext) {
+	for (conn = ds->connhead; conn; conn = cnext) {
 		cnext = conn->next;
-
-		ret = write(conn->fd, buf, strlen(buf));
-
-		if (ret != (int)strlen(buf)) {
-			upsdebugx(1, "write %d bytes to socket %d failed", (int)strlen(buf), conn->fd);
-			sock_disconnect(conn);
-		}
+		conn_queue(conn, buf, ret);
 	}
 }
 
@@ -207,19 +294,17 @@ static int send_to_one(conn_t *conn, const char *fmt, ...)
 		return 1;
 	}
 
-	upsdebugx(5, "%s: %.*s", __func__, ret-1, buf);
-
-	ret = write(conn->fd, buf, strlen(buf));
-
-	if (ret != (int)strlen(buf)) {
-		upsdebugx(1, "write %d bytes to socket %d failed", (int)strlen(buf), conn->fd);
-		sock_disconnect(conn);
-		return 0;	/* failed */
+	if (ret >= (int)sizeof(buf)) {
+		ret = sizeof(buf) - 1;
 	}
 
-	return 1;	/* OK */
+	upsdebugx(5, "%s: %.*s", __func__, ret-1, buf);
+
+	return conn_queue(conn, buf, ret);
 }
 
+static void sock_read_handler(int fd, void *arg);
+
 static void sock_connect(int sock)
 {
 	int	fd, ret;
@@ -262,12 +347,14 @@ static void sock_connect(int sock)
 
 	pconf_init(&conn->ctx, NULL);
 
-	if (connhead) {
-		conn->next = connhead;
-		connhead->prev = conn;
+	if (ds->connhead) {
+		conn->next = ds->connhead;
+		ds->connhead->prev = conn;
 	}
 
-	connhead = conn;
+	ds->connhead = conn;
+
+	ev_addfd(fd, sock_read_handler, conn);
 
 	upsdebugx(3, "new connection on fd %d", fd);
 }
@@ -348,7 +435,7 @@ static int cmd_dump_conn(conn_t *conn)
 {
 	cmdlist_t	*cmd;
 
-	for (cmd = cmdhead; cmd; cmd = cmd->next) {
+	for (cmd = ds->cmdhead; cmd; cmd = cmd->next) {
 		if (!send_to_one(conn, "ADDCMD %s\n", cmd->name)) {
 			return 0;
 		}
@@ -363,6 +450,22 @@ static void send_tracking(conn_t *conn, const char *id, int value)
 	send_to_one(conn, "TRACKING %s %i\n", id, value);
 }
 
+/* history_query() callback: <arg> is a send_history_t */
+typedef struct {
+	conn_t	*conn;
+	int	ok;
+} send_history_t;
+
+static int send_history(const char *var, long long t, double val, void *arg)
+{
+	send_history_t	*sh = arg;
+
+	sh->ok = send_to_one(sh->conn, "HISTORY %s %lld.%03d %.15g\n",
+		var, t / 1000, (int)(t % 1000), val);
+
+	return sh->ok;
+}
+
 static int sock_arg(conn_t *conn, int numarg, char **arg)
 {
 	if (numarg < 1) {
@@ -372,11 +475,11 @@ static int sock_arg(conn_t *conn, int numarg, char **arg)
 	if (!strcasecmp(arg[0], "DUMPALL")) {
 
 		/* first thing: the staleness flag */
-		if ((stale == 1) && !send_to_one(conn, "DATASTALE\n")) {
+		if ((ds->stale == 1) && !send_to_one(conn, "DATASTALE\n")) {
 			return 1;
 		}
 
-		if (!st_tree_dump_conn(dtree_root, conn)) {
+		if (!st_tree_dump_conn(ds->dtree_root, conn)) {
 			return 1;
 		}
 
@@ -384,7 +487,7 @@ static int sock_arg(conn_t *conn, int numarg, char **arg)
 			return 1;
 		}
 
-		if ((stale == 0) && !send_to_one(conn, "DATAOK\n")) {
+		if ((ds->stale == 0) && !send_to_one(conn, "DATAOK\n")) {
 			return 1;
 		}
 
@@ -439,6 +542,40 @@ static int sock_arg(conn_t *conn, int numarg, char **arg)
 		return 1;
 	}
 
+	/* HISTORY <var> <since>: upsd waits for an answer, whatever the
+	 * request looks like */
+	if ((numarg >= 2) && !strcasecmp(arg[0], "HISTORY")) {
+		char	*ptr = NULL;
+		double	since = 0;
+		send_history_t	sh = { conn, 1 };
+
+		if (!ds->history) {
+			send_to_one(conn, "HISTORYOFF %s\n", arg[1]);
+			return 1;
+		}
+
+		if (numarg == 3) {
+			since = strtod(arg[2], &ptr);
+		}
+
+		if ((numarg != 3) || (ptr == arg[2]) || (*ptr != '\0') || !(since >= 0) || (since >= LLONG_MAX / 1000)) {
+			upslogx(LOG_NOTICE, "Got HISTORY with an invalid time (%s)",
+				(numarg == 3) ? arg[2] : "none");
+			send_to_one(conn, "HISTORYDONE %s\n", arg[1]);
+			return 1;
+		}
+
+		/* a page at most, the client asks again from the last one */
+		history_query(ds->history, arg[1], (long long)(since * 1000),
+			DS_HISTORY_MAX, send_history, &sh);
+
+		if (sh.ok) {
+			send_to_one(conn, "HISTORYDONE %s\n", arg[1]);
+		}
+
+		return 1;
+	}
+
 	if (numarg < 3) {
 		return 0;
 	}
@@ -527,28 +664,71 @@ static void sock_read(conn_t *conn)
 	}
 }
 
+/* event loop callbacks */
+static void sock_read_handler(int fd, void *arg)
+{
+	sock_read((conn_t *)arg);
+}
+
+static void sock_connect_handler(int fd, void *arg)
+{
+	sock_connect(fd);
+}
+
+static void sock_write_handler(int fd, void *arg)
+{
+	conn_flush((conn_t *)arg);
+}
+
+/* take a context off the list of those with queued output */
+static void dirty_remove(dstate_ctx_t *ctx)
+{
+	dstate_ctx_t	**pp;
+
+	if (!ctx->dirty) {
+		return;
+	}
+
+	for (pp = &dirty_head; *pp; pp = &(*pp)->dirty_next) {
+		if (*pp == ctx) {
+			*pp = ctx->dirty_next;
+			break;
+		}
+	}
+
+	ctx->dirty = 0;
+	ctx->dirty_next = NULL;
+}
+
 static void sock_close(void)
 {
 	conn_t	*conn, *cnext;
 
-	if (sockfd != -1) {
-		close(sockfd);
-		sockfd = -1;
+	if (ds->sockfd != -1) {
+		ev_delfd(ds->sockfd);
+		close(ds->sockfd);
+		ds->sockfd = -1;
 
-		if (sockfn) {
-			unlink(sockfn);
-			free(sockfn);
-			sockfn = NULL;
+		if (ds->sockfn) {
+			unlink(ds->sockfn);
+			free(ds->sockfn);
+			ds->sockfn = NULL;
 		}
 	}
 
-	for (conn = connhead; conn; conn = cnext) {
+	for (conn = ds->connhead; conn; conn = cnext) {
 		cnext = conn->next;
-		sock_disconnect(conn);
+
+		/* last chance for what's still queued, without waiting */
+		if (conn_flush(conn)) {
+			sock_disconnect(conn);
+		}
 	}
 
-	connhead = NULL;
+	ds->connhead = NULL;
 	/* conntail = NULL; */
+
+	dirty_remove(ds);
 }
 
 /* interface */
@@ -566,96 +746,72 @@ void dstate_init(const char *prog, const char *devname)
 		snprintf(sockname, sizeof(sockname), "%s/%s", dflt_statepath(), prog);
 	}
 
-	sockfd = sock_open(sockname);
+	ds->sockfd = sock_open(sockname);
+
+	ev_addfd(ds->sockfd, sock_connect_handler, NULL);
 
-	upsdebugx(2, "dstate_init: sock %s open on fd %d", sockname, sockfd);
+	upsdebugx(2, "dstate_init: sock %s open on fd %d", sockname, ds->sockfd);
 }
 
-/* returns 1 if timeout expired or data is available on UPS fd, 0 otherwise */
-int dstate_poll_fds(struct timeval timeout, int extrafd)
+/* multi-device hosting: allocate, release and select the state context
+ * that all other dstate_* and status_* calls work on */
+dstate_ctx_t *dstate_ctx_new(void)
 {
-	int	ret, maxfd, overrun = 0;
-	fd_set	rfds;
-	struct timeval	now;
-	conn_t	*conn, *cnext;
+	dstate_ctx_t	*ctx;
 
-	FD_ZERO(&rfds);
-	FD_SET(sockfd, &rfds);
+	ctx = xcalloc(1, sizeof(*ctx));
+	ctx->sockfd = -1;
+	ctx->stale = 1;
 
-	maxfd = sockfd;
-
-	if (extrafd != -1) {
-		FD_SET(extrafd, &rfds);
-
-		if (extrafd > maxfd) {
-			maxfd = extrafd;
-		}
-	}
-
-	for (conn = connhead; conn; conn = conn->next) {
-		FD_SET(conn->fd, &rfds);
-
-		if (conn->fd > maxfd) {
-			maxfd = conn->fd;
-		}
-	}
+	return ctx;
+}
 
-	gettimeofday(&now, NULL);
+void dstate_ctx_free(dstate_ctx_t *ctx)
+{
+	dstate_ctx_t	*prev = ds;
 
-	/* number of microseconds should always be positive */
-	if (timeout.tv_usec < now.tv_usec) {
-		timeout.tv_sec -= 1;
-		timeout.tv_usec += 1000000;
+	if (!ctx) {
+		return;
 	}
 
-	if (timeout.tv_sec < now.tv_sec) {
-		timeout.tv_sec = 0;
-		timeout.tv_usec = 0;
-		overrun = 1;	/* no time left */
-	} else {
-		timeout.tv_sec -= now.tv_sec;
-		timeout.tv_usec -= now.tv_usec;
-	}
-	
-	ret = select(maxfd + 1, &rfds, NULL, NULL, &timeout);
+	ds = ctx;
+	dstate_free();
+	ds = (prev == ctx) ? &dstate_default : prev;
 
-	if (ret == 0) {
-		return 1;	/* timer expired */
+	if (ctx != &dstate_default) {
+		free(ctx);
 	}
+}
 
-	if (ret < 0) {
-		switch (errno)
-		{
-		case EINTR:
-		case EAGAIN:
-			/* ignore interruptions from signals */
-			break;
-
-		default:
-			upslog_with_errno(LOG_ERR, "select unix sockets failed");
-		}
+void dstate_ctx_switch(dstate_ctx_t *ctx)
+{
+	ds = ctx ? ctx : &dstate_default;
+}
 
-		return overrun;
-	}
+unsigned long dstate_changes(void)
+{
+	return ds->changes;
+}
 
-	if (FD_ISSET(sockfd, &rfds)) {
-		sock_connect(sockfd);
-	}
+void dstate_flush(void)
+{
+	dstate_ctx_t	*prev = ds;
+	conn_t	*conn, *cnext;
 
-	for (conn = connhead; conn; conn = cnext) {
-		cnext = conn->next;
+	while (dirty_head) {
+		/* sock_disconnect() works on the current context */
+		ds = dirty_head;
+		dirty_head = ds->dirty_next;
+		ds->dirty = 0;
+		ds->dirty_next = NULL;
 
-		if (FD_ISSET(conn->fd, &rfds)) {
-			sock_read(conn);
+		for (conn = ds->connhead; conn; conn = cnext) {
+			cnext = conn->next;
+			conn_flush(conn);
 		}
 	}
 
-	/* tell the caller if that fd woke up */
-	if ((extrafd != -1) && (FD_ISSET(extrafd, &rfds))) {
-		return 1;
-	}
-
-	return overrun;
+	ds = prev;
 }
 
 int dstate_setinfo(const char *var, const char *fmt, ...)
@@ -668,10 +824,11 @@ int dstate_setinfo(const char *var, const char *fmt, ...)
 	vsnprintf(value, sizeof(value), fmt, ap);
 	va_end(ap);
 
-	ret = state_setinfo(&dtree_root, var, value);
+	ret = state_setinfo(&ds->dtree_root, var, value);
 
 	if (ret == 1) {
 		send_to_all("SETINFO %s \"%s\"\n", var, value);
+		ds->changes++;
 	}
 
 	return ret;
@@ -687,7 +844,7 @@ int dstate_addenum(const char *var, const char *fmt, ...)
 	vsnprintf(value, sizeof(value), fmt, ap);
 	va_end(ap);
 
-	ret = state_addenum(dtree_root, var, value);
+	ret = state_addenum(ds->dtree_root, var, value);
 
 	if (ret == 1) {
 		send_to_all("ADDENUM %s \"%s\"\n", var, value);
@@ -700,7 +857,7 @@ int dstate_addrange(const char *var, const int min, const int max)
 {
 	int	ret;
 
-	ret = state_addrange(dtree_root, var, min, max);
+	ret = state_addrange(ds->dtree_root, var, min, max);
 
 	if (ret == 1) {
 		send_to_all("ADDRANGE %s %i %i\n", var, min, max);
@@ -717,7 +874,7 @@ void dstate_setflags(const char *var, int flags)
 	char	flist[SMALLBUF];
 
 	/* find the dtree node for var */
-	sttmp = state_tree_find(dtree_root, var);
+	sttmp = state_tree_find(ds->dtree_root, var);
 
 	if (!sttmp) {
 		upslogx(LOG_ERR, "%s: base variable (%s) does not exist", __func__, var);
@@ -756,7 +913,7 @@ void dstate_setflags(const char *var, int flags)
 
 void dstate_addflags(const char *var, const int addflags)
 {
-	int	flags = state_getflags(dtree_root, var);
+	int	flags = state_getflags(ds->dtree_root, var);
 
 	if (flags == -1) {
 		upslogx(LOG_ERR, "%s: cannot get flags of '%s'", __func__, var);
@@ -774,7 +931,7 @@ void dstate_addflags(const char *var, const int addflags)
 
 void dstate_delflags(const char *var, const int delflags)
 {
-	int	flags = state_getflags(dtree_root, var);
+	int	flags = state_getflags(ds->dtree_root, var);
 
 	if (flags == -1) {
 		upslogx(LOG_ERR, "%s: cannot get flags of '%s'", __func__, var);
@@ -795,7 +952,7 @@ void dstate_setaux(const char *var, int aux)
 	st_tree_t	*sttmp;
 
 	/* find the dtree node for var */
-	sttmp = state_tree_find(dtree_root, var);
+	sttmp = state_tree_find(ds->dtree_root, var);
 
 	if (!sttmp) {
 		upslogx(LOG_ERR, "dstate_setaux: base variable (%s) does not exist", var);
@@ -814,14 +971,14 @@ void dstate_setaux(const char *var, int aux)
 
 const char *dstate_getinfo(const char *var)
 {
-	return state_getinfo(dtree_root, var);
+	return state_getinfo(ds->dtree_root, var);
 }
 
 void dstate_addcmd(const char *cmdname)
 {
 	int	ret;
 
-	ret = state_addcmd(&cmdhead, cmdname);
+	ret = state_addcmd(&ds->cmdhead, cmdname);
 
 	/* update listeners */
 	if (ret == 1) {
@@ -833,11 +990,12 @@ int dstate_delinfo(const char *var)
 {
 	int	ret;
 
-	ret = state_delinfo(&dtree_root, var);
+	ret = state_delinfo(&ds->dtree_root, var);
 
 	/* update listeners */
 	if (ret == 1) {
 		send_to_all("DELINFO %s\n", var);
+		ds->changes++;
 	}
 
 	return ret;
@@ -847,7 +1005,7 @@ int dstate_delenum(const char *var, const char *val)
 {
 	int	ret;
 
-	ret = state_delenum(dtree_root, var, val);
+	ret = state_delenum(ds->dtree_root, var, val);
 
 	/* update listeners */
 	if (ret == 1) {
@@ -861,7 +1019,7 @@ int dstate_delrange(const char *var, const int min, const int max)
 {
 	int	ret;
 
-	ret = state_delrange(dtree_root, var, min, max);
+	ret = state_delrange(ds->dtree_root, var, min, max);
 
 	/* update listeners */
 	if (ret == 1) {
@@ -875,7 +1033,7 @@ int dstate_delcmd(const char *cmd)
 {
 	int	ret;
 
-	ret = state_delcmd(&cmdhead, cmd);
+	ret = state_delcmd(&ds->cmdhead, cmd);
 
 	/* update listeners */
 	if (ret == 1) {
@@ -885,46 +1043,92 @@ int dstate_delcmd(const char *cmd)
 	return ret;
 }
 
+/* keep a history of the numeric values, in <bytes> of memory (0: none) */
+void dstate_sethistory(size_t bytes)
+{
+	history_free(ds->history);
+	ds->history = (bytes > 0) ? history_new(bytes) : NULL;
+}
+
+static void sample_tree(const st_tree_t *node, long long now)
+{
+	char	*ptr;
+	double	val;
+
+	if (!node) {
+		return;
+	}
+
+	sample_tree(node->left, now);
+
+	/* the driver's own settings are no measurements */
+	if (!(node->flags & ST_FLAG_STRING) && strncmp(node->var, "driver.", 7)) {
+		val = strtod(node->raw, &ptr);
+
+		if ((ptr != node->raw) && (*ptr == '\0')) {
+			history_add(ds->history, node->var, now, val);
+		}
+	}
+
+	sample_tree(node->right, now);
+}
+
+/* record the current numeric values in the history */
+void dstate_sample(void)
+{
+	struct timeval	now;
+
+	if (!ds->history) {
+		return;
+	}
+
+	gettimeofday(&now, NULL);
+	sample_tree(ds->dtree_root, (long long)now.tv_sec * 1000 + now.tv_usec / 1000);
+}
+
 void dstate_free(void)
 {
-	state_infofree(dtree_root);
-	dtree_root = NULL;
+	state_infofree(ds->dtree_root);
+	ds->dtree_root = NULL;
 	
-	state_cmdfree(cmdhead);
-	cmdhead = NULL;
+	state_cmdfree(ds->cmdhead);
+	ds->cmdhead = NULL;
+
+	history_free(ds->history);
+	ds->history = NULL;
 
 	sock_close();
 }
 
 const st_tree_t *dstate_getroot(void)
 {
-	return dtree_root;
+	return ds->dtree_root;
 }
 
 const cmdlist_t *dstate_getcmdlist(void)
 {
-	return cmdhead;
+	return ds->cmdhead;
 }
 
 void dstate_dataok(void)
 {
-	if (stale == 1) {
-		stale = 0;
+	if (ds->stale == 1) {
+		ds->stale = 0;
 		send_to_all("DATAOK\n");
 	}
 }
 
 void dstate_datastale(void)
 {
-	if (stale == 0) {
-		stale = 1;
+	if (ds->stale == 0) {
+		ds->stale = 1;
 		send_to_all("DATASTALE\n");
 	}
 }
 
 int dstate_is_stale(void)
 {
-	return stale;
+	return ds->stale;
 }
 
 /* ups.status management functions - reducing duplication in the drivers */
@@ -933,39 +1137,39 @@ int dstate_is_stale(void)
 void status_init(void)
 {
 	if (dstate_getinfo("driver.flag.ignorelb")) {
-		ignorelb = 1;
+		ds->ignorelb = 1;
 	}
 
-	memset(status_buf, 0, sizeof(status_buf));
+	memset(ds->status_buf, 0, sizeof(ds->status_buf));
 }
 
 /* add a status element */
 void status_set(const char *buf)
 {
-	if (ignorelb && !strcasecmp(buf, "LB")) {
+	if (ds->ignorelb && !strcasecmp(buf, "LB")) {
 		upsdebugx(2, "%s: ignoring LB flag from device", __func__);
 		return;
 	}
 
 	/* separate with a space if multiple elements are present */
-	if (strlen(status_buf) > 0) {
-		snprintfcat(status_buf, sizeof(status_buf), " %s", buf);
+	if (strlen(ds->status_buf) > 0) {
+		snprintfcat(ds->status_buf, sizeof(ds->status_buf), " %s", buf);
 	} else {
-		snprintfcat(status_buf, sizeof(status_buf), "%s", buf);
+		snprintfcat(ds->status_buf, sizeof(ds->status_buf), "%s", buf);
 	}
 }
 
 /* write the status_buf into the externally visible dstate storage */
 void status_commit(void)
 {
-	while (ignorelb) {
+	while (ds->ignorelb) {
 		const char	*val, *low;
 
 		val = dstate_getinfo("battery.charge");
 		low = dstate_getinfo("battery.charge.low");
 
 		if (val && low && (strtol(val, NULL, 10) < strtol(low, NULL, 10))) {
-			snprintfcat(status_buf, sizeof(status_buf), " LB");
+			snprintfcat(ds->status_buf, sizeof(ds->status_buf), " LB");
 			upsdebugx(2, "%s: appending LB flag [charge '%s' below '%s']", __func__, val, low);
 			break;
 		}
@@ -974,7 +1178,7 @@ void status_commit(void)
 		low = dstate_getinfo("battery.runtime.low");
 
 		if (val && low && (strtol(val, NULL, 10) < strtol(low, NULL, 10))) {
-			snprintfcat(status_buf, sizeof(status_buf), " LB");
+			snprintfcat(ds->status_buf, sizeof(ds->status_buf), " LB");
 			upsdebugx(2, "%s: appending LB flag [runtime '%s' below '%s']", __func__, val, low);
 			break;
 		}
@@ -983,10 +1187,10 @@ void status_commit(void)
 		break;
 	}
 
-	if (alarm_active) {
-		dstate_setinfo("ups.status", "ALARM %s", status_buf);
+	if (ds->alarm_active) {
+		dstate_setinfo("ups.status", "ALARM %s", ds->status_buf);
 	} else {
-		dstate_setinfo("ups.status", "%s", status_buf);
+		dstate_setinfo("ups.status", "%s", ds->status_buf);
 	}
 }
 
@@ -995,36 +1199,36 @@ void status_commit(void)
 void alarm_init(void)
 {
 	/* reinit global counter */
-	alarm_active = 0;
+	ds->alarm_active = 0;
 
 	device_alarm_init();
 }
 
 void alarm_set(const char *buf)
 {
-	if (strlen(alarm_buf) > 0) {
-		snprintfcat(alarm_buf, sizeof(alarm_buf), " %s", buf);
+	if (strlen(ds->alarm_buf) > 0) {
+		snprintfcat(ds->alarm_buf, sizeof(ds->alarm_buf), " %s", buf);
 	} else {
-		snprintfcat(alarm_buf, sizeof(alarm_buf), "%s", buf);
+		snprintfcat(ds->alarm_buf, sizeof(ds->alarm_buf), "%s", buf);
 	}
 }
 
 /* write the status_buf into the info array */
 void alarm_commit(void)
 {
-	if (strlen(alarm_buf) > 0) {
-		dstate_setinfo("ups.alarm", "%s", alarm_buf);
-		alarm_active = 1;
+	if (strlen(ds->alarm_buf) > 0) {
+		dstate_setinfo("ups.alarm", "%s", ds->alarm_buf);
+		ds->alarm_active = 1;
 	} else {
 		dstate_delinfo("ups.alarm");
-		alarm_active = 0;
+		ds->alarm_active = 0;
 	}
 }
 
 void device_alarm_init(void)
 {
 	/* only clear the buffer, don't touch the alarms counter */
-	memset(alarm_buf, 0, sizeof(alarm_buf));
+	memset(ds->alarm_buf, 0, sizeof(ds->alarm_buf));
 }
 
 /* same as above, but writes to "device.X.ups.alarm" or "ups.alarm" */
@@ -1043,9 +1247,9 @@ void device_alarm_commit(const int device_number)
 	 * increase the counter when alarms are present on a subdevice, but
 	 * don't decrease the count. Otherwise, we may not get the ALARM flag
 	 * in ups.status, while there are some alarms present on device.X */
-	if (strlen(alarm_buf) > 0) {
-		dstate_setinfo(info_name, "%s", alarm_buf);
-		alarm_active++;
+	if (strlen(ds->alarm_buf) > 0) {
+		dstate_setinfo(info_name, "%s", ds->alarm_buf);
+		ds->alarm_active++;
 	} else {
 		dstate_delinfo(info_name);
 	}
@@ -31,6 +31,8 @@
 
 #define DS_LISTEN_BACKLOG 16
 #define DS_MAX_READ 256		/* don't read forever from upsd */
+#define DS_MAX_OUTBUF 1048576	/* drop upsd if it stops reading */
+#define DS_HISTORY_MAX 4096	/* samples sent for one HISTORY request */
 
 #ifndef MAX_STRING_SIZE
 #define MAX_STRING_SIZE	128
@@ -40,6 +42,8 @@
 typedef struct conn_s {
 	int     fd;
 	PCONF_CTX_t	ctx;
+	char	*outbuf;	/* queued until dstate_flush() */
+	size_t	outlen, outsize;
 	struct conn_s	*prev;
 	struct conn_s	*next;
 } conn_t;
@@ -50,8 +54,15 @@ typedef struct conn_s {
 	 * Defaults to nonblocking, for backward compatibility */
 	extern	int	do_synchronous;
 
+/* opaque per-device state, see dstate_ctx_*() */
+typedef struct dstate_ctx_s	dstate_ctx_t;
+
 void dstate_init(const char *prog, const char *devname);
-int dstate_poll_fds(struct timeval timeout, int extrafd);
+
+/* multi-device hosting (driver -A) */
+dstate_ctx_t *dstate_ctx_new(void);
+void dstate_ctx_free(dstate_ctx_t *ctx);
+void dstate_ctx_switch(dstate_ctx_t *ctx);
 int dstate_setinfo(const char *var, const char *fmt, ...)
 	__attribute__ ((__format__ (__printf__, 2, 3)));
 int dstate_addenum(const char *var, const char *fmt, ...)
@@ -68,6 +79,16 @@ int dstate_delenum(const char *var, const char *val);
 int dstate_delrange(const char *var, const int min, const int max);
 int dstate_delcmd(const char *cmd);
 void dstate_free(void);
+
+/* write out the updates queued since the last call (for all devices) */
+void dstate_flush(void);
+
+/* a count of the values set or deleted so far, to see whether reading
+ * something from the device changed anything */
+unsigned long dstate_changes(void);
+
+void dstate_sethistory(size_t bytes);
+void dstate_sample(void);
 const st_tree_t *dstate_getroot(void);
 const cmdlist_t *dstate_getcmdlist(void);
 
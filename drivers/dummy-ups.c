@@ -153,7 +153,9 @@ void upsdrv_updateinfo(void)
 {
 	upsdebugx(1, "upsdrv_updateinfo...");
 
-	sleep(1);
+	/* don't hold up the other devices when hosted (-A) */
+	if (!host_mode)
+		sleep(1);
 
 	switch (mode)
 	{
@@ -216,6 +218,14 @@ void upsdrv_help(void)
 
 void upsdrv_makevartable(void)
 {
+	/* per-device state, for serving several devices from one process (-A) */
+	host_register_state(&mode, sizeof(mode));
+	host_register_state(&ctx, sizeof(ctx));
+	host_register_state(&next_update, sizeof(next_update));
+	host_register_state(&client_upsname, sizeof(client_upsname));
+	host_register_state(&hostname, sizeof(hostname));
+	host_register_state(&ups, sizeof(ups));
+	host_register_state(&port, sizeof(port));
 }
 
 void upsdrv_initups(void)
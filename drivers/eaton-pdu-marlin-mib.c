@@ -866,5 +866,11 @@ static snmp_info_t eaton_marlin_mib[] = {
 	{ NULL, 0, 0, NULL, NULL, 0, NULL }
 };
 
+/* EATON-EPDU-MIB notifications: the status only, whichever it is */
+static traps_info_t eaton_marlin_traps[] = {
+	{ ".1.3.6.1.4.1.534.6.6.7.0", NULL },
+	/* end of structure. */
+	{ NULL, NULL }
+} ;
 
-mib2nut_info_t	eaton_marlin = { "eaton_epdu", EATON_MARLIN_MIB_VERSION, NULL, EATON_MARLIN_OID_MODEL_NAME, eaton_marlin_mib, EATON_MARLIN_SYSOID };
+mib2nut_info_t	eaton_marlin = { "eaton_epdu", EATON_MARLIN_MIB_VERSION, NULL, EATON_MARLIN_OID_MODEL_NAME, eaton_marlin_mib, EATON_MARLIN_SYSOID, NULL, eaton_marlin_traps };
@@ -0,0 +1,615 @@
+/* eventloop.c - Network UPS Tools driver core event loop
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <limits.h>
+#include <poll.h>
+
+#include "common.h"
+#include "timehead.h"
+#include "eventloop.h"
+
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_SYS_TIMERFD_H)
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#define EV_USE_EPOLL	1
+#define EV_MAX_EVENTS	64
+#endif
+
+typedef struct ev_fd_s {
+	int	fd;
+	ev_fd_handler_t	handler;
+	ev_fd_handler_t	whandler;	/* set while waiting to write */
+	void	*arg;
+	void	*owner;
+	int	dead;		/* removed while its events were pending */
+	struct ev_fd_s	*next;
+} ev_fd_t;
+
+typedef struct ev_timer_s {
+	int	id;
+	long	interval;
+	long long	expires;
+	ev_timer_handler_t	handler;
+	void	*arg;
+	void	*owner;
+	struct ev_timer_s	*next;
+} ev_timer_t;
+
+	static ev_fd_t	*fdhead = NULL;
+	static ev_timer_t	*timerhead = NULL;
+	static int	timer_lastid = 0, dispatching = 0, fds_changed = 1;
+	static void	*cur_owner = NULL;
+	static void	(*activate_owner)(void *owner) = NULL;
+
+#ifdef EV_USE_EPOLL
+	/* the timerfd is armed for the earliest timer and watched by epoll,
+	 * so that epoll_wait() itself never needs a timeout */
+	static int	epfd = -1, tfd = -1, ev_setup_done = 0;
+	static long long	tfd_armed = -1;
+#endif
+
+	/* poll() fallback, rebuilt when the registered fds change */
+	static struct pollfd	*pfds = NULL;
+	static ev_fd_t	**pregs = NULL;
+	static int	npfds = 0, maxpfds = 0;
+
+long long ev_now(void)
+{
+	struct timeval	tv;
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+	struct timespec	ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0) {
+		return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+	}
+#endif
+	gettimeofday(&tv, NULL);
+
+	return (long long)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+#ifdef EV_USE_EPOLL
+static uint32_t ev_events(const ev_fd_t *reg)
+{
+	return reg->whandler ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+}
+
+/* create the epoll and timer fds once; if that fails, poll() is used */
+static void ev_setup(void)
+{
+	struct epoll_event	ev;
+	ev_fd_t	*reg;
+
+	if (ev_setup_done) {
+		return;
+	}
+
+	ev_setup_done = 1;
+
+	epfd = epoll_create(EV_MAX_EVENTS);
+
+	if (epfd < 0) {
+		upslog_with_errno(LOG_WARNING, "epoll_create failed, using poll()");
+		return;
+	}
+
+	tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;	/* marks the timer */
+
+	if ((tfd < 0) || (epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev) < 0)) {
+		upslog_with_errno(LOG_WARNING, "timerfd setup failed, using poll()");
+
+		if (tfd >= 0) {
+			close(tfd);
+		}
+
+		close(epfd);
+		tfd = epfd = -1;
+		return;
+	}
+
+	/* pick up what was registered before */
+	for (reg = fdhead; reg; reg = reg->next) {
+		ev.events = ev_events(reg);
+		ev.data.ptr = reg;
+		epoll_ctl(epfd, EPOLL_CTL_ADD, reg->fd, &ev);
+	}
+}
+
+/* arm the timerfd for the absolute monotonic time <when> (-1: disarm) */
+static void ev_arm(long long when)
+{
+	struct itimerspec	its;
+
+	if (when == tfd_armed) {
+		return;
+	}
+
+	memset(&its, 0, sizeof(its));
+
+	if (when >= 0) {
+		/* 0 would disarm it, and our clock values are never that low */
+		its.it_value.tv_sec = when / 1000;
+		its.it_value.tv_nsec = (when % 1000) * 1000000;
+
+		if ((its.it_value.tv_sec == 0) && (its.it_value.tv_nsec == 0)) {
+			its.it_value.tv_nsec = 1;
+		}
+	}
+
+	if (timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+		upslog_with_errno(LOG_ERR, "timerfd_settime failed");
+		return;
+	}
+
+	tfd_armed = when;
+}
+#endif	/* EV_USE_EPOLL */
+
+void ev_set_owner(void *owner)
+{
+	cur_owner = owner;
+}
+
+void *ev_get_owner(void)
+{
+	return cur_owner;
+}
+
+void ev_set_activate(void (*activate)(void *owner))
+{
+	activate_owner = activate;
+}
+
+static void ev_activate(void *owner)
+{
+	if (activate_owner) {
+		activate_owner(owner);
+	}
+}
+
+static ev_fd_t *ev_findfd(int fd)
+{
+	ev_fd_t	*reg;
+
+	for (reg = fdhead; reg; reg = reg->next) {
+		if ((reg->fd == fd) && !reg->dead) {
+			return reg;
+		}
+	}
+
+	return NULL;
+}
+
+void ev_addfd(int fd, ev_fd_handler_t handler, void *arg)
+{
+	ev_fd_t	*reg;
+
+	if (fd < 0) {
+		return;
+	}
+
+	reg = ev_findfd(fd);
+
+	if (reg) {
+		reg->handler = handler;
+		reg->arg = arg;
+		reg->owner = cur_owner;
+	} else {
+		reg = xcalloc(1, sizeof(*reg));
+		reg->fd = fd;
+		reg->handler = handler;
+		reg->arg = arg;
+		reg->owner = cur_owner;
+		reg->next = fdhead;
+		fdhead = reg;
+
+		fds_changed = 1;
+	}
+
+#ifdef EV_USE_EPOLL
+	/* also when it was known: the fd may have been closed and reopened
+	 * under the same number, which drops it from the epoll set */
+	if (epfd >= 0) {
+		struct epoll_event	ev;
+
+		memset(&ev, 0, sizeof(ev));
+		ev.events = ev_events(reg);
+		ev.data.ptr = reg;
+
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+			if (errno != EEXIST) {
+				upslog_with_errno(LOG_ERR, "epoll_ctl add fd %d failed", fd);
+			}
+		}
+	}
+#endif
+}
+
+
+void ev_setwrite(int fd, ev_fd_handler_t handler)
+{
+	ev_fd_t	*reg = ev_findfd(fd);
+
+	if (!reg || (reg->whandler == handler)) {
+		return;
+	}
+
+	reg->whandler = handler;
+	fds_changed = 1;
+
+#ifdef EV_USE_EPOLL
+	if (epfd >= 0) {
+		struct epoll_event	ev;
+
+		memset(&ev, 0, sizeof(ev));
+		ev.events = ev_events(reg);
+		ev.data.ptr = reg;
+
+		if (epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev) < 0) {
+			upslog_with_errno(LOG_ERR, "epoll_ctl modify fd %d failed", fd);
+		}
+	}
+#endif
+}
+
+/* drop the registrations that were removed while dispatching */
+static void ev_purge(void)
+{
+	ev_fd_t	*reg, **prev = &fdhead;
+
+	while ((reg = *prev) != NULL) {
+		if (reg->dead) {
+			*prev = reg->next;
+			free(reg);
+		} else {
+			prev = &reg->next;
+		}
+	}
+}
+
+void ev_delfd(int fd)
+{
+	ev_fd_t	*reg = ev_findfd(fd);
+
+	if (!reg) {
+		return;
+	}
+
+#ifdef EV_USE_EPOLL
+	if (epfd >= 0) {
+		struct epoll_event	ev;	/* for kernels before 2.6.9 */
+
+		epoll_ctl(epfd, EPOLL_CTL_DEL, fd, &ev);
+	}
+#endif
+
+	/* pending events may still point to it */
+	reg->dead = 1;
+	fds_changed = 1;
+
+	if (!dispatching) {
+		ev_purge();
+	}
+}
+
+int ev_addtimer(long interval, long first, ev_timer_handler_t handler, void *arg)
+{
+	ev_timer_t	*timer;
+
+	timer = xcalloc(1, sizeof(*timer));
+	timer->id = ++timer_lastid;
+	timer->interval = interval;
+	timer->expires = ev_now() + first;
+	timer->handler = handler;
+	timer->arg = arg;
+	timer->owner = cur_owner;
+	timer->next = timerhead;
+	timerhead = timer;
+
+	return timer->id;
+}
+
+static ev_timer_t *ev_findtimer(int id)
+{
+	ev_timer_t	*timer;
+
+	for (timer = timerhead; timer; timer = timer->next) {
+		if (timer->id == id) {
+			return timer;
+		}
+	}
+
+	return NULL;
+}
+
+void ev_settimer(int id, long interval, long delay)
+{
+	ev_timer_t	*timer = ev_findtimer(id);
+
+	if (!timer) {
+		return;
+	}
+
+	timer->interval = interval;
+	timer->expires = ev_now() + delay;
+}
+
+void ev_deltimer(int id)
+{
+	ev_timer_t	*timer, **prev = &timerhead;
+
+	while ((timer = *prev) != NULL) {
+		if (timer->id == id) {
+			*prev = timer->next;
+			free(timer);
+			return;
+		}
+
+		prev = &timer->next;
+	}
+}
+
+/* the timer that expires first, if any */
+static ev_timer_t *ev_nexttimer(void)
+{
+	ev_timer_t	*timer, *next = NULL;
+
+	for (timer = timerhead; timer; timer = timer->next) {
+		if (!next || (timer->expires < next->expires)) {
+			next = timer;
+		}
+	}
+
+	return next;
+}
+
+/* run the expired timers, one at a time since handlers may change the list */
+static int ev_run_timers(void)
+{
+	int	ran = 0;
+	long long	now = ev_now();
+	ev_timer_t	*timer;
+
+	while (((timer = ev_nexttimer()) != NULL) && (timer->expires <= now)) {
+		ev_timer_handler_t	handler = timer->handler;
+		void	*arg = timer->arg;
+
+		ev_activate(timer->owner);
+
+		if (timer->interval > 0) {
+			/* skip the ticks that were missed, rather than catching up */
+			timer->expires += timer->interval;
+
+			if (timer->expires <= now) {
+				timer->expires = now + timer->interval;
+			}
+		} else {
+			ev_deltimer(timer->id);
+		}
+
+		handler(arg);
+		ran++;
+	}
+
+	return ran;
+}
+
+static void ev_callfd(ev_fd_t *reg, int writable, int readable)
+{
+	if (reg->dead) {
+		return;
+	}
+
+	ev_activate(reg->owner);
+
+	if (writable && reg->whandler) {
+		reg->whandler(reg->fd, reg->arg);
+	}
+
+	/* the write handler may have dropped it */
+	if (readable && !reg->dead) {
+		reg->handler(reg->fd, reg->arg);
+	}
+}
+
+/* poll() fallback */
+static int ev_wait_poll(long long deadline)
+{
+	int	i, ret, timeout = -1, ran = 0;
+	ev_fd_t	*reg;
+
+	if (fds_changed) {
+		npfds = 0;
+
+		for (reg = fdhead; reg; reg = reg->next) {
+			if (reg->dead) {
+				continue;
+			}
+
+			if (npfds == maxpfds) {
+				maxpfds = maxpfds ? 2 * maxpfds : 16;
+				pfds = xrealloc(pfds, maxpfds * sizeof(*pfds));
+				pregs = xrealloc(pregs, maxpfds * sizeof(*pregs));
+			}
+
+			pfds[npfds].fd = reg->fd;
+			pfds[npfds].events = reg->whandler ? (POLLIN | POLLOUT) : POLLIN;
+			pregs[npfds] = reg;
+			npfds++;
+		}
+
+		fds_changed = 0;
+	}
+
+	if (deadline >= 0) {
+		long long	left = deadline - ev_now();
+
+		timeout = (left < 0) ? 0 : (left > INT_MAX) ? INT_MAX : (int)left;
+	}
+
+	ret = poll(pfds, npfds, timeout);
+
+	if (ret < 0) {
+		if ((errno != EINTR) && (errno != EAGAIN)) {
+			upslog_with_errno(LOG_ERR, "poll failed");
+		}
+
+		return 0;
+	}
+
+	for (i = 0; (i < npfds) && (ret > 0); i++) {
+		if (!pfds[i].revents) {
+			continue;
+		}
+
+		ret--;
+		ev_callfd(pregs[i], pfds[i].revents & POLLOUT,
+			pfds[i].revents & ~POLLOUT);
+		ran++;
+	}
+
+	return ran;
+}
+
+#ifdef EV_USE_EPOLL
+static int ev_wait_epoll(long long deadline)
+{
+	struct epoll_event	events[EV_MAX_EVENTS];
+	int	i, ret, ran = 0;
+
+	/* 0: don't wait */
+	if (deadline != 0) {
+		ev_arm(deadline);
+	}
+
+	ret = epoll_wait(epfd, events, EV_MAX_EVENTS, (deadline != 0) ? -1 : 0);
+
+	if (ret < 0) {
+		if ((errno != EINTR) && (errno != EAGAIN)) {
+			upslog_with_errno(LOG_ERR, "epoll_wait failed");
+		}
+
+		return 0;
+	}
+
+	for (i = 0; i < ret; i++) {
+		ev_fd_t	*reg = events[i].data.ptr;
+
+		if (!reg) {
+			uint64_t	expirations;
+
+			/* just clear it, the timers are checked below */
+			if (read(tfd, &expirations, sizeof(expirations)) < 0) {
+				upsdebug_with_errno(3, "read timerfd");
+			}
+
+			tfd_armed = -1;
+			continue;
+		}
+
+		ev_callfd(reg, events[i].events & EPOLLOUT,
+			events[i].events & ~EPOLLOUT);
+		ran++;
+	}
+
+	return ran;
+}
+#endif	/* EV_USE_EPOLL */
+
+int ev_dispatch(long long deadline)
+{
+	int	ran, timers;
+	ev_timer_t	*timer;
+
+	dispatching = 1;
+	ran = timers = ev_run_timers();
+
+	timer = ev_nexttimer();
+
+	if (timer && ((deadline < 0) || (timer->expires < deadline))) {
+		deadline = timer->expires;
+	}
+
+	/* whatever is already due doesn't need to wait for anything, but the
+	 * fds are looked at anyway, lest a timer that overruns starve them */
+	if (timers > 0) {
+		deadline = 0;
+	}
+
+#ifdef EV_USE_EPOLL
+	ev_setup();
+
+	if (epfd >= 0) {
+		ran += ev_wait_epoll(deadline);
+	} else
+#endif
+		ran += ev_wait_poll(deadline);
+
+	if (timers == 0) {
+		ran += ev_run_timers();
+	}
+
+	dispatching = 0;
+	ev_purge();
+
+	return ran;
+}
+
+void ev_free(void)
+{
+	ev_fd_t	*reg, *rnext;
+	ev_timer_t	*timer, *tnext;
+
+	for (reg = fdhead; reg; reg = rnext) {
+		rnext = reg->next;
+		free(reg);
+	}
+
+	fdhead = NULL;
+
+	for (timer = timerhead; timer; timer = tnext) {
+		tnext = timer->next;
+		free(timer);
+	}
+
+	timerhead = NULL;
+
+	free(pfds);
+	free(pregs);
+	pfds = NULL;
+	pregs = NULL;
+	npfds = maxpfds = 0;
+	fds_changed = 1;
+
+#ifdef EV_USE_EPOLL
+	if (tfd >= 0) {
+		close(tfd);
+	}
+
+	if (epfd >= 0) {
+		close(epfd);
+	}
+
+	tfd = epfd = -1;
+	tfd_armed = -1;
+	ev_setup_done = 0;
+#endif
+}
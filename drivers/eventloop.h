@@ -0,0 +1,64 @@
+/* eventloop.h - Network UPS Tools driver core event loop
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef EVENTLOOP_H_SEEN
+#define EVENTLOOP_H_SEEN 1
+
+/* The driver core waits in ev_dispatch() for data on the registered file
+ * descriptors and for the periodic timers to expire.  main.c runs
+ * upsdrv_updateinfo() from one such timer; drivers may add their own fds
+ * and timers, e.g. a quick status poll every second next to a full update
+ * every 30 seconds.  All times are in milliseconds, on a monotonic clock. */
+
+typedef void (*ev_fd_handler_t)(int fd, void *arg);
+typedef void (*ev_timer_handler_t)(void *arg);
+
+/* current time on the monotonic clock */
+long long ev_now(void);
+
+/* call <handler> whenever <fd> is readable; registering the same fd again
+ * replaces its handler */
+void ev_addfd(int fd, ev_fd_handler_t handler, void *arg);
+void ev_delfd(int fd);
+
+/* also call <handler> whenever the (registered) <fd> can be written to,
+ * until this is called again with NULL */
+void ev_setwrite(int fd, ev_fd_handler_t handler);
+
+/* call <handler> in <first> ms, then every <interval> ms (0: only once);
+ * returns the timer id */
+int ev_addtimer(long interval, long first, ev_timer_handler_t handler, void *arg);
+
+/* change the interval of a timer, and run it next in <delay> ms */
+void ev_settimer(int id, long interval, long delay);
+void ev_deltimer(int id);
+
+/* wait for and handle events, until at least one was handled or the
+ * <deadline> (as returned by ev_now(), -1 for none) has passed, or a
+ * signal arrived; returns the number of handlers that were called */
+int ev_dispatch(long long deadline);
+
+/* multi-device hosting (driver -A): fds and timers are tagged with the
+ * owner that was current when they were added, and <activate> is called
+ * with that owner before any of its handlers runs */
+void ev_set_owner(void *owner);
+void *ev_get_owner(void);
+void ev_set_activate(void (*activate)(void *owner));
+
+void ev_free(void);
+
+#endif	/* EVENTLOOP_H_SEEN */
@@ -422,28 +422,80 @@ HIDData_t *FindObject_with_ID(HIDDesc_t *pDesc, uint8_t ReportID, uint8_t Offset
 	return NULL;
 }
 
+/*
+ * PrepareData
+ * Precompute where GetValue() and SetValue() find the data of pData in a
+ * report, and how GetValue() brings it into LogMin..LogMax.
+ * -------------------------------------------------------------------------- */
+static void PrepareData(HIDData_t *pData)
+{
+	int	size = (pData->Size < 32) ? pData->Size : 32;
+	long	range;
+	int	b;
+
+	pData->Byte = 1 + (pData->Offset >> 3);	/* First byte of report is report ID */
+	pData->Shift = pData->Offset & 7;
+	pData->Bytes = (pData->Shift + size + 7) >> 3;
+	pData->Mask = (size < 32) ? (1UL << size) - 1 : 0xffffffffUL;
+
+	if (!pData->Shift && ((size == 8) || (size == 16) || (size == 32))) {
+		pData->Aligned = size;
+	} else {
+		pData->Aligned = 0;
+	}
+
+	/* see GetValue() for what this is about */
+	range = pData->LogMax - pData->LogMin + 1;
+	if (range <= 0) {
+		pData->LogBits = -1;
+		return;
+	}
+
+	b = hibit(range-1);
+
+	pData->LogBits = b;
+	pData->LogMask = (long)((b < 32) ? (1UL << b) - 1 : 0xffffffffUL);
+	pData->LogSign = b ? (long)(1UL << (b - 1)) : 0;
+}
+
 /*
  * GetValue
  * Extract data from a report stored in Buf.
- * Use Value, Offset, Size and LogMax of pData.
+ * Use Value, Offset, Size and LogMax of pData, as prepared by PrepareData().
  * Return response in Value.
  * -------------------------------------------------------------------------- */
 void GetValue(const unsigned char *Buf, HIDData_t *pData, long *pValue)
 {
-	int	Weight, Bit;
-	long	value = 0, rawvalue;
-	long	range, mask, signbit, b, m;
+	const unsigned char	*p = Buf + pData->Byte;
+	unsigned long	rawvalue;
+	uint64_t	word = 0;
+	long	value, m;
+	int	i;
 
-	Bit = pData->Offset + 8;	/* First byte of report is report ID */
-	
-	for (Weight = 0; Weight < pData->Size; Weight++, Bit++) {
-		int	State = Buf[Bit >> 3] & (1 << (Bit & 7));
-		
-		if(State) {
-			value += (1 << Weight);
+	/* the common sizes come in whole bytes, the rest is shifted out of
+	 * the (at most 5) bytes it spans */
+	switch (pData->Aligned)
+	{
+	case 8:
+		rawvalue = p[0];
+		break;
+	case 16:
+		rawvalue = p[0] | ((unsigned long)p[1] << 8);
+		break;
+	case 32:
+		rawvalue = p[0] | ((unsigned long)p[1] << 8)
+			| ((unsigned long)p[2] << 16) | ((unsigned long)p[3] << 24);
+		break;
+	default:
+		for (i = pData->Bytes - 1; i >= 0; i--) {
+			word = (word << 8) | p[i];
 		}
+		rawvalue = (unsigned long)(word >> pData->Shift) & pData->Mask;
+		break;
 	}
 
+	value = (long)rawvalue;
+
 	/* translate Value into a signed/unsigned value in the range
 	LogMin..LogMax, as appropriate. See HID spec, p.38: "If both the
 	Logical Minimum and Logical Maximum extents are defined as
@@ -466,25 +518,19 @@ void GetValue(const unsigned char *Buf, HIDData_t *pData, long *pValue)
 	"throwing away higher-order bits" exacly means, so we try to do
 	something sensible. -PS */
 
-	rawvalue = value; /* remember this for later */
-
-	/* figure out how many bits are significant */
-	range = pData->LogMax - pData->LogMin + 1;
-	if (range <= 0) {
+	/* the number of significant bits comes from PrepareData() */
+	if (pData->LogBits < 0) {
 		/* makes no sense, give up */
 		*pValue = value;
 		return;
 	}
-	b = hibit(range-1);
 
 	/* throw away insignificant bits; the result is >= 0 */
-	mask = (1 << b) - 1;
-	signbit = 1 << (b - 1);
-	value = value & mask;
+	value = value & pData->LogMask;
 
 	/* sign-extend it, if appropriate */
-	if (pData->LogMin < 0 && (value & signbit) != 0) {
-		value |= ~mask;
+	if (pData->LogMin < 0 && (value & pData->LogSign) != 0) {
+		value |= ~pData->LogMask;
 	}
 
 	/* if the resulting value is in the desired range, stop */
@@ -494,7 +540,7 @@ void GetValue(const unsigned char *Buf, HIDData_t *pData, long *pValue)
 	}
 
 	/* else, try to reach interval by adjusting high-order bits */
-	m = (value - pData->LogMin) & mask;
+	m = (value - pData->LogMin) & pData->LogMask;
 	value = pData->LogMin + m;
 	if (value <= pData->LogMax) {
 		*pValue = value;
@@ -503,11 +549,9 @@ void GetValue(const unsigned char *Buf, HIDData_t *pData, long *pValue)
 
 	/* if everything else failed, sign-extend the original raw value,
 	and simply round it to the closest point in the interval. */
-	value = rawvalue;
-	mask = (1 << pData->Size) - 1;
-	signbit = 1 << (pData->Size - 1);
-	if (pData->LogMin < 0 && (value & signbit) != 0) {
-		value |= ~mask;
+	value = (long)rawvalue;
+	if (pData->LogMin < 0 && (rawvalue & (pData->Mask ^ (pData->Mask >> 1))) != 0) {
+		value |= ~(long)pData->Mask;
 	}
 	if (value < pData->LogMin) {
 		value = pData->LogMin;
@@ -521,23 +565,40 @@ void GetValue(const unsigned char *Buf, HIDData_t *pData, long *pValue)
 
 /*
  * SetValue
- * Set a data in a report stored in Buf. Use Value, Offset and Size of pData.
+ * Set a data in a report stored in Buf. Use Value, Offset and Size of pData,
+ * as prepared by PrepareData().
  * Return response in Buf.
  * -------------------------------------------------------------------------- */
 void SetValue(const HIDData_t *pData, unsigned char *Buf, long Value)
 {
-	int	Weight, Bit;
-	
-	Bit = pData->Offset + 8;	/* First byte of report is report ID */
-
-	for (Weight = 0; Weight < pData->Size; Weight++, Bit++) {
-		int	State = Value & (1 << Weight);
+	unsigned char	*p = Buf + pData->Byte;
+	unsigned long	rawvalue = (unsigned long)Value & pData->Mask;
+	uint64_t	word = 0;
+	int	i;
 
-		if (State) {
-			Buf[Bit >> 3] |= (1 << (Bit & 7));
-		} else {
-			Buf[Bit >> 3] &= ~(1 << (Bit & 7));
+	switch (pData->Aligned)
+	{
+	case 32:
+		p[3] = (rawvalue >> 24) & 0xff;
+		p[2] = (rawvalue >> 16) & 0xff;
+		/* fallthrough */
+	case 16:
+		p[1] = (rawvalue >> 8) & 0xff;
+		/* fallthrough */
+	case 8:
+		p[0] = rawvalue & 0xff;
+		break;
+	default:
+		/* keep the bits around it */
+		for (i = pData->Bytes - 1; i >= 0; i--) {
+			word = (word << 8) | p[i];
 		}
+		word &= ~((uint64_t)pData->Mask << pData->Shift);
+		word |= (uint64_t)rawvalue << pData->Shift;
+		for (i = 0; i < pData->Bytes; i++, word >>= 8) {
+			p[i] = word & 0xff;
+		}
+		break;
 	}
 }
 
@@ -549,7 +610,7 @@ void SetValue(const HIDData_t *pData, unsigned char *Buf, long Value)
    returned by this function must be freed with Free_ReportDesc(). */
 HIDDesc_t *Parse_ReportDesc(const unsigned char *ReportDesc, const int n)
 {
-	int		ret;
+	int		ret, i;
 	HIDDesc_t	*pDesc;
 	HIDParser_t	*parser;
 
@@ -595,6 +656,11 @@ HIDDesc_t *Parse_ReportDesc(const unsigned char *ReportDesc, const int n)
 		}
 	}
 
+	/* now that the items are complete, work out how to get at their data */
+	for (i = 0; i < pDesc->nitems; i++) {
+		PrepareData(&pDesc->item[i]);
+	}
+
 	/* Sanity check: are there remaining HID objects that can't
 	 * be processed? */
 	if ((pDesc->nitems == MAX_REPORT) && (parser->Pos < parser->ReportDescSize))
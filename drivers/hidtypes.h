@@ -132,6 +132,16 @@ typedef struct {
 	long		PhyMax;				/* Physical Max			*/
 	int8_t		have_PhyMin;			/* Physical Min defined?		*/
 	int8_t		have_PhyMax;			/* Physical Max defined?		*/
+
+	/* Precomputed by Parse_ReportDesc() for GetValue() and SetValue() */
+	uint8_t		Byte;				/* First byte of data (after the ID)	*/
+	uint8_t		Shift;				/* First bit of data in that byte	*/
+	uint8_t		Bytes;				/* Bytes spanned (1 to 5)		*/
+	uint8_t		Aligned;			/* 8, 16 or 32 if whole bytes, else 0	*/
+	unsigned long	Mask;				/* Size bits (32 at most)		*/
+	int8_t		LogBits;			/* Bits of LogMin..LogMax, -1: invalid	*/
+	long		LogMask;			/* The LogBits low bits			*/
+	long		LogSign;			/* Sign bit within LogBits (or 0)	*/
 } HIDData_t;
 
 /*
@@ -0,0 +1,398 @@
+/* history.c - Network UPS Tools driver-side history of numeric values
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "common.h"
+#include "history.h"
+
+#define HIST_CHUNK	240	/* bytes of encoded samples per chunk */
+#define HIST_HASH	256	/* buckets for the variable names */
+
+/* the most a sample can take: 4 + 64 bits of timestamp, 2 + 5 + 6 + 64
+ * bits of value */
+#define HIST_MAXBITS	145
+
+typedef struct hist_series_s	hist_series_t;
+
+typedef struct hist_chunk_s {
+	hist_series_t	*owner;		/* NULL while unused */
+	struct hist_chunk_s	*next;	/* next newer chunk of the owner */
+	long long	t0;		/* the first sample, as is */
+	double	v0;
+	unsigned int	bits;		/* of data[] used by the others */
+	unsigned char	data[HIST_CHUNK];
+} hist_chunk_t;
+
+/* the samples of one variable */
+struct hist_series_s {
+	char	*var;
+	hist_chunk_t	*head, *tail;	/* oldest and newest chunk */
+
+	/* the last sample, that the next one is encoded against */
+	long long	last_t, last_delta;
+	unsigned long long	last_v;
+	int	lead, trail;		/* bits around the last value XOR (lead -1: none) */
+
+	hist_series_t	*next;		/* in the hash bucket */
+};
+
+struct history_s {
+	hist_chunk_t	*pool;		/* used round robin */
+	size_t	nchunks, nextchunk;
+	hist_series_t	*bucket[HIST_HASH];
+};
+
+/* decoding state, the same as the encoding part of hist_series_t */
+typedef struct {
+	const hist_chunk_t	*chunk;
+	unsigned int	pos;
+	long long	t, delta;
+	unsigned long long	v;
+	int	lead, trail;
+} hist_reader_t;
+
+static unsigned long long dbl_bits(double val)
+{
+	unsigned long long	bits = 0;
+
+	memcpy(&bits, &val, sizeof(val));
+	return bits;
+}
+
+static double bits_dbl(unsigned long long bits)
+{
+	double	val;
+
+	memcpy(&val, &bits, sizeof(val));
+	return val;
+}
+
+static int clz64(unsigned long long x)
+{
+	int	n = 0;
+
+	while (!(x & (1ULL << 63))) {
+		x <<= 1;
+		n++;
+	}
+
+	return n;
+}
+
+static int ctz64(unsigned long long x)
+{
+	int	n = 0;
+
+	while (!(x & 1)) {
+		x >>= 1;
+		n++;
+	}
+
+	return n;
+}
+
+static void put_bits(hist_chunk_t *chunk, unsigned long long val, int n)
+{
+	while (n-- > 0) {
+		if ((val >> n) & 1) {
+			chunk->data[chunk->bits / 8] |= 0x80 >> (chunk->bits % 8);
+		}
+
+		chunk->bits++;
+	}
+}
+
+static unsigned long long get_bits(hist_reader_t *r, int n)
+{
+	unsigned long long	val = 0;
+
+	while (n-- > 0) {
+		val = (val << 1) | ((r->chunk->data[r->pos / 8] >> (7 - r->pos % 8)) & 1);
+		r->pos++;
+	}
+
+	return val;
+}
+
+/* timestamps: the difference between this delta and the previous one,
+ * which is 0 for a regular poll */
+static void put_time(hist_series_t *s, hist_chunk_t *chunk, long long t)
+{
+	long long	delta = t - s->last_t;
+	long long	dod = delta - s->last_delta;
+
+	if (dod == 0) {
+		put_bits(chunk, 0, 1);
+	} else if ((dod >= -63) && (dod <= 64)) {
+		put_bits(chunk, 2, 2);
+		put_bits(chunk, dod + 63, 7);
+	} else if ((dod >= -255) && (dod <= 256)) {
+		put_bits(chunk, 6, 3);
+		put_bits(chunk, dod + 255, 9);
+	} else if ((dod >= -2047) && (dod <= 2048)) {
+		put_bits(chunk, 14, 4);
+		put_bits(chunk, dod + 2047, 12);
+	} else {
+		put_bits(chunk, 15, 4);
+		put_bits(chunk, (unsigned long long)dod, 64);
+	}
+
+	s->last_t = t;
+	s->last_delta = delta;
+}
+
+static void get_time(hist_reader_t *r)
+{
+	long long	dod;
+
+	if (!get_bits(r, 1)) {
+		dod = 0;
+	} else if (!get_bits(r, 1)) {
+		dod = (long long)get_bits(r, 7) - 63;
+	} else if (!get_bits(r, 1)) {
+		dod = (long long)get_bits(r, 9) - 255;
+	} else if (!get_bits(r, 1)) {
+		dod = (long long)get_bits(r, 12) - 2047;
+	} else {
+		dod = (long long)get_bits(r, 64);
+	}
+
+	r->delta += dod;
+	r->t += r->delta;
+}
+
+/* values: the bits that changed, within the window of the previous
+ * change if they fit */
+static void put_value(hist_series_t *s, hist_chunk_t *chunk, double val)
+{
+	unsigned long long	v = dbl_bits(val), x = v ^ s->last_v;
+	int	lead, trail;
+
+	s->last_v = v;
+
+	if (!x) {
+		put_bits(chunk, 0, 1);
+		return;
+	}
+
+	lead = clz64(x);
+	trail = ctz64(x);
+
+	if (lead > 31) {
+		lead = 31;
+	}
+
+	if ((s->lead >= 0) && (lead >= s->lead) && (trail >= s->trail)) {
+		put_bits(chunk, 2, 2);
+		put_bits(chunk, x >> s->trail, 64 - s->lead - s->trail);
+		return;
+	}
+
+	put_bits(chunk, 3, 2);
+	put_bits(chunk, lead, 5);
+	put_bits(chunk, 64 - lead - trail - 1, 6);
+	put_bits(chunk, x >> trail, 64 - lead - trail);
+
+	s->lead = lead;
+	s->trail = trail;
+}
+
+static void get_value(hist_reader_t *r)
+{
+	if (!get_bits(r, 1)) {
+		return;
+	}
+
+	if (get_bits(r, 1)) {
+		r->lead = (int)get_bits(r, 5);
+		r->trail = 64 - r->lead - ((int)get_bits(r, 6) + 1);
+	}
+
+	r->v ^= get_bits(r, 64 - r->lead - r->trail) << r->trail;
+}
+
+static unsigned int hist_hash(const char *var)
+{
+	unsigned int	h = 5381;
+
+	while (*var) {
+		h = h * 33 + (unsigned char)*var++;
+	}
+
+	return h % HIST_HASH;
+}
+
+static hist_series_t *hist_series(const history_t *hist, const char *var)
+{
+	hist_series_t	*s;
+
+	for (s = hist->bucket[hist_hash(var)]; s; s = s->next) {
+		if (!strcmp(s->var, var)) {
+			return s;
+		}
+	}
+
+	return NULL;
+}
+
+/* take the next chunk of the pool for <s>, dropping what it held */
+static hist_chunk_t *hist_chunk_new(history_t *hist, hist_series_t *s)
+{
+	hist_chunk_t	*chunk = &hist->pool[hist->nextchunk];
+
+	hist->nextchunk = (hist->nextchunk + 1) % hist->nchunks;
+
+	/* the pool goes round in order, so this is the oldest of its owner */
+	if (chunk->owner) {
+		chunk->owner->head = chunk->next;
+
+		if (chunk->owner->tail == chunk) {
+			chunk->owner->tail = NULL;
+		}
+	}
+
+	memset(chunk, 0, sizeof(*chunk));
+	chunk->owner = s;
+
+	if (s->tail) {
+		s->tail->next = chunk;
+	} else {
+		s->head = chunk;
+	}
+
+	s->tail = chunk;
+
+	return chunk;
+}
+
+history_t *history_new(size_t bytes)
+{
+	history_t	*hist;
+
+	hist = xcalloc(1, sizeof(*hist));
+	hist->nchunks = bytes / sizeof(hist_chunk_t);
+
+	if (hist->nchunks < 1) {
+		hist->nchunks = 1;
+	}
+
+	hist->pool = xcalloc(hist->nchunks, sizeof(hist_chunk_t));
+
+	return hist;
+}
+
+void history_free(history_t *hist)
+{
+	hist_series_t	*s, *snext;
+	int	i;
+
+	if (!hist) {
+		return;
+	}
+
+	for (i = 0; i < HIST_HASH; i++) {
+		for (s = hist->bucket[i]; s; s = snext) {
+			snext = s->next;
+			free(s->var);
+			free(s);
+		}
+	}
+
+	free(hist->pool);
+	free(hist);
+}
+
+void history_add(history_t *hist, const char *var, long long t, double val)
+{
+	hist_series_t	*s;
+	hist_chunk_t	*chunk;
+
+	s = hist_series(hist, var);
+
+	if (!s) {
+		unsigned int	h = hist_hash(var);
+
+		s = xcalloc(1, sizeof(*s));
+		s->var = xstrdup(var);
+		s->next = hist->bucket[h];
+		hist->bucket[h] = s;
+	}
+
+	chunk = s->tail;
+
+	if (chunk && (chunk->bits + HIST_MAXBITS <= HIST_CHUNK * 8)) {
+		put_time(s, chunk, t);
+		put_value(s, chunk, val);
+		return;
+	}
+
+	/* start a new chunk, with this sample as is */
+	chunk = hist_chunk_new(hist, s);
+	chunk->t0 = t;
+	chunk->v0 = val;
+
+	s->last_t = t;
+	s->last_delta = 0;
+	s->last_v = dbl_bits(val);
+	s->lead = -1;
+	s->trail = 0;
+}
+
+int history_query(const history_t *hist, const char *var, long long since,
+	int max, history_cb_t cb, void *arg)
+{
+	const hist_series_t	*s;
+	const hist_chunk_t	*chunk;
+	hist_reader_t	r;
+	int	count = 0;
+
+	if (!hist || !(s = hist_series(hist, var))) {
+		return 0;
+	}
+
+	for (chunk = s->head; chunk && (count < max); chunk = chunk->next) {
+
+		/* all of it is older than that */
+		if (chunk->next && (chunk->next->t0 <= since)) {
+			continue;
+		}
+
+		memset(&r, 0, sizeof(r));
+		r.chunk = chunk;
+		r.t = chunk->t0;
+		r.v = dbl_bits(chunk->v0);
+		r.lead = -1;
+
+		while (count < max) {
+			if (r.t > since) {
+				if (!cb(var, r.t, bits_dbl(r.v), arg)) {
+					return count;
+				}
+
+				count++;
+			}
+
+			if (r.pos >= chunk->bits) {
+				break;
+			}
+
+			get_time(&r);
+			get_value(&r);
+		}
+	}
+
+	return count;
+}
@@ -0,0 +1,48 @@
+/* history.h - Network UPS Tools driver-side history of numeric values
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef HISTORY_H_SEEN
+#define HISTORY_H_SEEN 1
+
+#include <stddef.h>
+
+/* The samples of each variable are compressed into small chunks, the way
+ * time series databases do it: a timestamp costs the difference between
+ * its delta and the previous one, a value the bits in which it differs
+ * from the previous one.  A regular poll of a value that doesn't change
+ * takes two bits per sample.  All chunks come from one pool of a fixed
+ * size, and when that is full, the oldest chunk is reused. */
+
+typedef struct history_s	history_t;
+
+/* called for each sample, <t> in ms since the epoch; returning 0 stops
+ * the query */
+typedef int (*history_cb_t)(const char *var, long long t, double val, void *arg);
+
+/* a history that takes <bytes> of memory at most (plus the names) */
+history_t *history_new(size_t bytes);
+void history_free(history_t *hist);
+
+/* record a value of <var>, taken at <t> */
+void history_add(history_t *hist, const char *var, long long t, double val);
+
+/* call <cb> for the samples of <var> taken after <since>, oldest first,
+ * <max> of them at most; returns how many */
+int history_query(const history_t *hist, const char *var, long long since,
+	int max, history_cb_t cb, void *arg);
+
+#endif	/* HISTORY_H_SEEN */
@@ -285,12 +285,26 @@ static snmp_info_t ietf_mib[] = {
 	{ NULL, 0, 0, NULL, NULL, 0, NULL }
 };
 
+/* RFC 1628 upsTraps; the status and alarms are always read again */
+static traps_info_t ietf_traps[] = {
+	/* upsTrapOnBattery */
+	{ ".1.3.6.1.2.1.33.2.1", "battery." },
+	{ ".1.3.6.1.2.1.33.2.1", "input." },
+	/* upsTrapTestCompleted */
+	{ ".1.3.6.1.2.1.33.2.2", "ups.test." },
+	/* upsTrapAlarmEntryAdded, upsTrapAlarmEntryRemoved */
+	{ ".1.3.6.1.2.1.33.2.3", NULL },
+	{ ".1.3.6.1.2.1.33.2.4", NULL },
+	/* end of structure. */
+	{ NULL, NULL }
+} ;
+
 /* FIXME: Rename the structure here (or even relocate to new file)
  * and in snmp-ups.c when the real TrippLite mappings get defined. */
 /* FIXME: Duplicate the line below to fix an issue with the code generator (nut-snmpinfo.py -> line is discarding) */
 /*mib2nut_info_t	tripplite_ietf = { "tripplite", IETF_MIB_VERSION, NULL, NULL, ietf_mib, TRIPPLITE_SYSOID };*/
-mib2nut_info_t	tripplite_ietf = { "tripplite", IETF_MIB_VERSION, NULL, NULL, ietf_mib, TRIPPLITE_SYSOID };
+mib2nut_info_t	tripplite_ietf = { "tripplite", IETF_MIB_VERSION, NULL, NULL, ietf_mib, TRIPPLITE_SYSOID, NULL, ietf_traps };
 
 /* FIXME: Duplicate the line below to fix an issue with the code generator (nut-snmpinfo.py -> line is discarding) */
 /*mib2nut_info_t	ietf = { "ietf", IETF_MIB_VERSION, IETF_OID_UPS_MIB "4.1.0", IETF_OID_UPS_MIB "1.1.0", ietf_mib, IETF_SYSOID };*/
-mib2nut_info_t	ietf = { "ietf", IETF_MIB_VERSION, IETF_OID_UPS_MIB "4.1.0", IETF_OID_UPS_MIB "1.1.0", ietf_mib, IETF_SYSOID };
+mib2nut_info_t	ietf = { "ietf", IETF_MIB_VERSION, IETF_OID_UPS_MIB "4.1.0", IETF_OID_UPS_MIB "1.1.0", ietf_mib, IETF_SYSOID, NULL, ietf_traps };
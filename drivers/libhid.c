@@ -36,6 +36,7 @@
 #include "libhid.h"
 #include "hidparser.h"
 #include "common.h" /* for xmalloc, upsdebugx prototypes */
+#include "eventloop.h" /* for ev_now() */
 
 /* Communication layers and drivers (USB and MGE SHUT) */
 #ifdef SHUT_MODE
@@ -141,7 +142,7 @@ reportbuf_t *new_report_buffer(HIDDesc_t *pDesc)
 
 /* refresh the report with the given id in the report buffer rbuf.  If
    the report is not yet in the buffer, or if it is older than "age"
-   seconds, then the report is freshly read from the USB
+   milliseconds, then the report is freshly read from the USB
    device. Otherwise, it is unchanged.
    Return 0 on success, -1 on error with errno set. */
 /* because buggy firmwares from APC return wrong report size, we either
@@ -152,7 +153,7 @@ static int refresh_report_buffer(reportbuf_t *rbuf, hid_dev_handle_t udev, HIDDa
 	int	id = pData->ReportID;
 	int	r;
 
-	if (interrupt_only || rbuf->ts[id] + age > time(NULL)) {
+	if (interrupt_only || rbuf->ts[id] + age > ev_now()) {
 		/* buffered report is still good; nothing to do */
 		upsdebug_hex(3, "Report[buf]", rbuf->data[id], rbuf->len[id]);
 		return 0;
@@ -160,6 +161,7 @@ static int refresh_report_buffer(reportbuf_t *rbuf, hid_dev_handle_t udev, HIDDa
 
 	r = comm_driver->get_report(udev, id, rbuf->data[id],
 		max_report_size ? (int)sizeof(rbuf->data[id]):rbuf->len[id]);
+	rbuf->transfers++;
 
 	if (r <= 0) {
 		return -1;
@@ -173,7 +175,7 @@ static int refresh_report_buffer(reportbuf_t *rbuf, hid_dev_handle_t udev, HIDDa
 	}
 
 	/* have (valid) report */
-	time(&rbuf->ts[id]);
+	rbuf->ts[id] = ev_now();
 
 	return 0;
 }
@@ -239,7 +241,7 @@ static int file_report_buffer(reportbuf_t *rbuf, unsigned char *buf, int buflen)
 	}
 
 	/* have (valid) report */
-	time(&rbuf->ts[id]);
+	rbuf->ts[id] = ev_now();
 
 	return 0;
 }
@@ -402,6 +404,24 @@ int HIDGetDataValue(hid_dev_handle_t udev, HIDData_t *hiddata, double *Value, in
 	return 1;
 }
 
+/* Read the report holding the given HIDData, unless the buffered one
+ * is recent enough. return 1 if OK, 0 on fail, -errno otherwise (ie
+ * disconnect).
+ */
+int HIDGetReport(hid_dev_handle_t udev, HIDData_t *hiddata, int age)
+{
+	if (hiddata == NULL) {
+		return 0;
+	}
+
+	if (refresh_report_buffer(reportbuf, udev, hiddata, age) < 0) {
+		upsdebug_with_errno(1, "Can't retrieve Report %02x", hiddata->ReportID);
+		return -errno;
+	}
+
+	return 1;
+}
+
 /* Return the physical value associated with the given path.
  * return 1 if OK, 0 on fail, -errno otherwise (ie disconnect).
  */
@@ -483,7 +503,7 @@ bool_t HIDSetItemValue(hid_dev_handle_t udev, const char *hidpath, double Value,
 /* On success, return item count >0. When no notifications are available,
  * return 'error' or 'no event' code.
  */
-int HIDGetEvents(hid_dev_handle_t udev, HIDData_t **event, int eventsize)
+int HIDGetEvents(hid_dev_handle_t udev, HIDData_t **event, int eventsize, int timeout)
 {
 	unsigned char	buf[SMALLBUF];
 	int		itemCount = 0;
@@ -491,7 +511,7 @@ int HIDGetEvents(hid_dev_handle_t udev, HIDData_t **event, int eventsize)
 	HIDData_t	*pData;
 
 	/* needs libusb-0.1.8 to work => use ifdef and autoconf */
-	buflen = comm_driver->get_interrupt(udev, buf, interrupt_size ? interrupt_size:sizeof(buf), 250);
+	buflen = comm_driver->get_interrupt(udev, buf, interrupt_size ? interrupt_size:sizeof(buf), timeout);
 	if (buflen <= 0) {
 		return buflen;	/* propagate "error" or "no event" code */
 	}
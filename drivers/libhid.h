@@ -60,7 +60,7 @@ typedef int bool_t;
 #define MODE_OPEN	0	/* open a HID device for the first time */
 #define MODE_REOPEN	1	/* reopen a HID device that was opened before */
 
-#define MAX_TS		2	/* validity period of a gotten report (2 sec) */
+#define MAX_TS		2000	/* validity period of a gotten report (2 sec, in ms) */
 
 /* ---------------------------------------------------------------------- */
 
@@ -82,9 +82,10 @@ extern HIDDesc_t	*pDesc;	/* parsed Report Descriptor */
 /* report buffer structure: holds data about most recent report for
    each given report id */
 typedef struct reportbuf_s {
-       time_t	ts[256];			/* timestamp when report was retrieved */
+       long long	ts[256];		/* when report was retrieved (ev_now(), ms) */
        int	len[256];			/* size of report data */
        unsigned char	*data[256];		/* report data (allocated) */
+       unsigned long	transfers;		/* reports read from the device */
 } reportbuf_t;
 
 extern reportbuf_t	*reportbuf;	/* buffer for most recent reports */
@@ -121,9 +122,18 @@ char *HIDGetDataItem(const HIDData_t *hiddata, usage_tables_t *utab);
 
 /*
  * HIDGetDataValue
+ * the report holding <hiddata> is read from the device if the buffered one
+ * is older than <age> ms
  * -------------------------------------------------------------------------- */
 int HIDGetDataValue(hid_dev_handle_t udev, HIDData_t *hiddata, double *Value, int age);
 
+/*
+ * HIDGetReport
+ * only brings the report holding <hiddata> up to date, the same way; the
+ * values in it can then be taken with HIDGetDataValue()
+ * -------------------------------------------------------------------------- */
+int HIDGetReport(hid_dev_handle_t udev, HIDData_t *hiddata, int age);
+
 /*
  * HIDSetDataValue
  * -------------------------------------------------------------------------- */
@@ -136,8 +146,10 @@ char *HIDGetIndexString(hid_dev_handle_t udev, int Index, char *buf, size_t bufl
 
 /*
  * HIDGetEvents
+ * waits up to <timeout> ms for a report on the interrupt pipe, or as long
+ * as the device may need to send one if <timeout> is negative
  * -------------------------------------------------------------------------- */
-int HIDGetEvents(hid_dev_handle_t udev, HIDData_t **event, int eventlen);
+int HIDGetEvents(hid_dev_handle_t udev, HIDData_t **event, int eventlen, int timeout);
 
 /*
  * Support functions
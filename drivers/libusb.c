@@ -47,6 +47,9 @@ upsdrv_info_t comm_upsdrv_info = {
 
 #define MAX_REPORT_SIZE         0x1800
 
+/* the bInterval of the interrupt IN endpoint (ms), 0 if unknown */
+static int interrupt_interval = 0;
+
 static void libusb_close(usb_dev_handle *udev);
 
 /*! Add USB-related driver variables with addvar().
@@ -290,6 +293,20 @@ static int libusb_open(usb_dev_handle **udevp, USBDevice_t *curDevice, USBDevice
 
 			nut_usb_set_altinterface(udev);
 
+			interrupt_interval = 0;
+
+			if (dev->config && dev->config[0].interface) {
+				struct usb_interface_descriptor *alt = &dev->config[0].interface[0].altsetting[0];
+
+				for (i = 0; i < alt->bNumEndpoints; i++) {
+					if (alt->endpoint[i].bEndpointAddress == 0x81) {
+						interrupt_interval = alt->endpoint[i].bInterval;
+					}
+				}
+
+				upsdebugx(2, "Interrupt endpoint interval: %d ms", interrupt_interval);
+			}
+
 			if (!callback) {
 				return 1;
 			}
@@ -530,6 +547,18 @@ static int libusb_get_interrupt(usb_dev_handle *udev, unsigned char *buf, int bu
 		return -1;
 	}
 
+	/* no timeout given: wait about twice as long as the device may take
+	 * to get polled for a report, which is what it needs to send one */
+	if (timeout < 0) {
+		timeout = (interrupt_interval > 0) ? 2 * interrupt_interval : USB_INTERRUPT_WAIT;
+
+		if (timeout < 10) {
+			timeout = 10;
+		} else if (timeout > USB_INTERRUPT_WAIT) {
+			timeout = USB_INTERRUPT_WAIT;
+		}
+	}
+
 	/* FIXME: hardcoded interrupt EP => need to get EP descr for IF descr */
 	ret = usb_interrupt_read(udev, 0x81, (char *)buf, bufsize, timeout);
 
@@ -20,6 +20,8 @@
    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 */
 
+#include <limits.h>
+
 #include "main.h"
 #include "dstate.h"
 
@@ -28,7 +30,8 @@
 	char		*device_path = NULL;
 	const char	*progname = NULL, *upsname = NULL, *device_name = NULL;
 
-	/* may be set by the driver to wake up while in dstate_poll_fds */
+	/* may be set by the driver to get upsdrv_updateinfo() called as soon
+	 * as there is data on it (for more, see ev_addfd()) */
 	int	extrafd = -1;
 
 	/* for ser_open */
@@ -53,6 +56,64 @@
 	static char	*pidfn = NULL;
 	int	dump_data = 0; /* Store the update_count requested */
 
+	/* set when serving all 'hosted' ups.conf sections of this driver (-A) */
+	int	host_mode = 0;
+
+	/* the timer that runs upsdrv_updateinfo(), and what it was set up for */
+	static int	update_timer = 0, update_extrafd = -1;
+	static long	update_interval = 0;
+	static int	update_count = 0;
+
+	/* adaptive polling, see main.h; intervals in ms */
+#define POLL_OB_DEFAULT		1000
+#define POLL_LB_DEFAULT		500
+#define POLL_MAX_DEFAULT	120000
+	int	poll_state = POLL_ONLINE;
+	static long	poll_ob_ms = POLL_OB_DEFAULT, poll_lb_ms = POLL_LB_DEFAULT,
+		poll_max_ms = POLL_MAX_DEFAULT;
+
+	/* bytes for the history of the values, 0: none (see dstate_sample()) */
+	static size_t	history_size = 0;
+
+/* a block of per-device globals, swapped in and out by the host */
+typedef struct host_state_s {
+	void	*addr;
+	size_t	len;
+	struct host_state_s	*next;
+} host_state_t;
+
+/* a ups.conf setting kept for a section until its device is set up */
+typedef struct host_arg_s {
+	char	*var;
+	char	*val;
+	struct host_arg_s	*next;
+} host_arg_t;
+
+/* one device served by the host */
+typedef struct host_dev_s {
+	char	*upsname;
+	char	*driver;
+	int	hosted;
+	host_arg_t	*args;
+	unsigned char	*state;		/* saved copy of the registered globals */
+	dstate_ctx_t	*dstate;
+	char	*pidfn;
+	int	inited;			/* upsdrv_initups() has succeeded */
+	long	retry_delay;		/* ms before trying it again otherwise */
+	struct host_dev_s	*next;
+} host_dev_t;
+
+	static host_state_t	*host_state_h = NULL;
+	static size_t	host_state_len = 0;
+	static host_dev_t	*host_devs = NULL, *host_cur = NULL;
+	static vartab_t	*host_vartab = NULL;	/* template for every device */
+	static int	host_failed = 0;	/* see host_init_failed() */
+
+	/* a device that fails to start is tried again after this, then after
+	 * twice as long each time, up to HOST_RETRY_MAX (ms) */
+#define HOST_RETRY_MIN		30000
+#define HOST_RETRY_MAX		960000
+
 /* print the driver banner */
 void upsdrv_banner (void)
 {
@@ -91,7 +152,7 @@ static void help_msg(void)
 {
 	vartab_t	*tmp;
 
-	printf("\nusage: %s (-a <id>|-s <id>) [OPTIONS]\n", progname);
+	printf("\nusage: %s (-a <id>|-s <id>|-A) [OPTIONS]\n", progname);
 
 	printf("  -a <id>        - autoconfig using ups.conf section <id>\n");
 	printf("                 - note: -x after -a overrides ups.conf settings\n\n");
@@ -104,6 +165,9 @@ static void help_msg(void)
 	printf("                   the OS - e.g. to query networked devices), you can specify\n");
 	printf("                   '-d 1' argument and `export NUT_STATEPATH=/tmp` beforehand\n\n");
 
+	printf("  -A             - serve all ups.conf sections of this driver that are\n");
+	printf("                   flagged 'hosted' from this single process\n\n");
+
 	printf("  -V             - print version, then exit\n");
 	printf("  -L             - print parseable list of driver variables\n");
 	printf("  -D             - raise debugging level\n");
@@ -279,6 +343,10 @@ static int main_arg(char *var, char *val)
 		return 1;	/* handled */
 	}
 
+	/* only for upsdrvctl and -A - ignored here */
+	if (!strcmp(var, "hosted"))
+		return 1;	/* handled */
+
 	/* any other flags are for the driver code */
 	if (!val)
 		return 0;
@@ -308,7 +376,8 @@ static int main_arg(char *var, char *val)
 	}
 
 	/* only for upsdrvctl - ignored here */
-	if (!strcmp(var, "sdorder"))
+	if (!strcmp(var, "sdorder") || !strcmp(var, "maxstartdelay")
+		|| !strcmp(var, "maxretry") || !strcmp(var, "retrydelay"))
 		return 1;	/* handled */
 
 	/* only for upsd (at the moment) - ignored here */
@@ -318,6 +387,52 @@ static int main_arg(char *var, char *val)
 	return 0;	/* unhandled, pass it through to the driver */
 }
 
+/* "0.5" (seconds) -> 500 (ms) */
+static long poll_ms(const char *var, const char *val)
+{
+	char	*end;
+	double	sec = strtod(val, &end);
+
+	if ((end == val) || *end || (sec < 0) || (sec > LONG_MAX / 1000)) {
+		fatalx(EXIT_FAILURE, "Invalid %s: %s", var, val);
+	}
+
+	return (long)(sec * 1000);
+}
+
+/* the pollinterval_* and history settings, global or per section */
+static int poll_args(const char *var, const char *val)
+{
+	if (!strcmp(var, "pollinterval_ob")) {
+		poll_ob_ms = poll_ms(var, val);
+		return 1;
+	}
+
+	if (!strcmp(var, "pollinterval_lb")) {
+		poll_lb_ms = poll_ms(var, val);
+		return 1;
+	}
+
+	if (!strcmp(var, "pollinterval_max")) {
+		poll_max_ms = poll_ms(var, val);
+		return 1;
+	}
+
+	if (!strcmp(var, "history")) {
+		char	*end;
+		long	kb = strtol(val, &end, 10);
+
+		if ((end == val) || *end || (kb < 0) || (kb > LONG_MAX / 1024)) {
+			fatalx(EXIT_FAILURE, "Invalid %s: %s", var, val);
+		}
+
+		history_size = (size_t)kb * 1024;
+		return 1;
+	}
+
+	return 0;
+}
+
 static void do_global_args(const char *var, const char *val)
 {
 	if (!strcmp(var, "pollinterval")) {
@@ -325,6 +440,9 @@ static void do_global_args(const char *var, const char *val)
 		return;
 	}
 
+	if (poll_args(var, val))
+		return;
+
 	if (!strcmp(var, "chroot")) {
 		free(chroot_path);
 		chroot_path = xstrdup(val);
@@ -346,22 +464,13 @@ static void do_global_args(const char *var, const char *val)
 	/* unrecognized */
 }
 
-void do_upsconf_args(char *confupsname, char *var, char *val)
+static void host_conf_arg(const char *confupsname, const char *var, const char *val);
+
+/* apply one setting of the ups.conf section for the current device */
+static void upsconf_arg(const char *confupsname, char *var, char *val)
 {
 	char	tmp[SMALLBUF];
 
-	/* handle global declarations */
-	if (!confupsname) {
-		do_global_args(var, val);
-		return;
-	}
-
-	/* no match = not for us */
-	if (strcmp(confupsname, upsname) != 0)
-		return;
-
-	upsname_found = 1;
-
 	if (main_arg(var, val))
 		return;
 
@@ -390,10 +499,36 @@ void do_upsconf_args(char *confupsname, char *var, char *val)
 		return;
 	}
 
+	if (poll_args(var, val))
+		return;
+
 	/* everything else must be for the driver */
 	storeval(var, val);
 }
 
+void do_upsconf_args(char *confupsname, char *var, char *val)
+{
+	/* handle global declarations */
+	if (!confupsname) {
+		do_global_args(var, val);
+		return;
+	}
+
+	/* -A: keep everything, the hosted sections are picked later */
+	if (host_mode) {
+		host_conf_arg(confupsname, var, val);
+		return;
+	}
+
+	/* no match = not for us */
+	if (strcmp(confupsname, upsname) != 0)
+		return;
+
+	upsname_found = 1;
+
+	upsconf_arg(confupsname, var, val);
+}
+
 /* split -x foo=bar into 'foo' and 'bar' */
 static void splitxarg(char *inbuf)
 {
@@ -443,11 +578,9 @@ static void listxarg(void)
 	}
 }
 
-static void vartab_free(void)
+static void vartab_free(vartab_t *tmp)
 {
-	vartab_t	*tmp, *next;
-
-	tmp = vartab_h;
+	vartab_t	*next;
 
 	while (tmp) {
 		next = tmp->next;
@@ -473,7 +606,252 @@ static void exit_cleanup(void)
 	}
 
 	dstate_free();
-	vartab_free();
+	vartab_free(vartab_h);
+	vartab_h = NULL;
+
+	ev_free();
+}
+
+/* if a PID file for this device exists, stop the instance behind it */
+static void kill_duplicate(const char *pidfn)
+{
+	int	i;
+
+	/* Try to prevent that driver is started multiple times. If a PID file */
+	/* already exists, send a TERM signal to the process and try if it goes */
+	/* away. If not, retry a couple of times. */
+	for (i = 0; i < 3; i++) {
+		struct stat	st;
+
+		if (stat(pidfn, &st) != 0) {
+			/* PID file not found */
+			break;
+		}
+
+		if (sendsignalfn(pidfn, SIGTERM) != 0) {
+			/* Can't send signal to PID, assume invalid file */
+			break;
+		}
+
+		upslogx(LOG_WARNING, "Duplicate driver instance detected (PID file %s exists)! Terminating other driver!", pidfn);
+
+		/* Allow driver some time to quit */
+		sleep(5);
+	}
+}
+
+/* publish the top-level data: version numbers, driver name */
+static void publish_driver_version(void)
+{
+	dstate_setinfo("driver.version", "%s", UPS_VERSION);
+	dstate_setinfo("driver.version.internal", "%s", upsdrv_info.version);
+	dstate_setinfo("driver.name", "%s", progname);
+}
+
+static void check_ignorelb(void)
+{
+	int	have_lb_method = 0;
+
+	if (!dstate_getinfo("driver.flag.ignorelb"))
+		return;
+
+	if (dstate_getinfo("battery.charge") && dstate_getinfo("battery.charge.low")) {
+		upslogx(LOG_INFO, "using 'battery.charge' to set battery low state");
+		have_lb_method++;
+	}
+
+	if (dstate_getinfo("battery.runtime") && dstate_getinfo("battery.runtime.low")) {
+		upslogx(LOG_INFO, "using 'battery.runtime' to set battery low state");
+		have_lb_method++;
+	}
+
+	if (!have_lb_method) {
+		fatalx(EXIT_FAILURE,
+			"The 'ignorelb' flag is set, but there is no way to determine the\n"
+			"battery state of charge.\n\n"
+			"Only set this flag if both 'battery.charge' and 'battery.charge.low'\n"
+			"and/or 'battery.runtime' and 'battery.runtime.low' are available.\n");
+	}
+}
+
+/* publish the settings that may have been changed from their defaults */
+static void publish_driver_parameters(void)
+{
+	/* The poll_interval may have been changed from the default */
+	dstate_setinfo("driver.parameter.pollinterval", "%d", poll_interval);
+
+	if (poll_ob_ms != POLL_OB_DEFAULT)
+		dstate_setinfo("driver.parameter.pollinterval_ob", "%g", poll_ob_ms / 1000.0);
+	if (poll_lb_ms != POLL_LB_DEFAULT)
+		dstate_setinfo("driver.parameter.pollinterval_lb", "%g", poll_lb_ms / 1000.0);
+	if (poll_max_ms != POLL_MAX_DEFAULT)
+		dstate_setinfo("driver.parameter.pollinterval_max", "%g", poll_max_ms / 1000.0);
+	if (history_size > 0)
+		dstate_setinfo("driver.parameter.history", "%lu", (unsigned long)(history_size / 1024));
+
+	/* The synchronous option may have been changed from the default */
+	dstate_setinfo("driver.parameter.synchronous", "%s",
+		(do_synchronous==1)?"yes":"no");
+
+	/* remap the device.* info from ups.* for the transition period */
+	if (dstate_getinfo("ups.mfr") != NULL)
+		dstate_setinfo("device.mfr", "%s", dstate_getinfo("ups.mfr"));
+	if (dstate_getinfo("ups.model") != NULL)
+		dstate_setinfo("device.model", "%s", dstate_getinfo("ups.model"));
+	if (dstate_getinfo("ups.serial") != NULL)
+		dstate_setinfo("device.serial", "%s", dstate_getinfo("ups.serial"));
+}
+
+/* whether <flag> is one of the words in <status> */
+static int status_has(const char *status, const char *flag)
+{
+	size_t	len = strlen(flag);
+
+	while (*status) {
+		size_t	wlen = strcspn(status, " ");
+
+		if ((wlen == len) && !strncmp(status, flag, len))
+			return 1;
+
+		status += wlen;
+		status += strspn(status, " ");
+	}
+
+	return 0;
+}
+
+/* follow the power state in ups.status */
+static void poll_watch(void)
+{
+	const char	*status = dstate_getinfo("ups.status");
+	int	state = POLL_ONLINE;
+
+	if (status && status_has(status, "LB"))
+		state = POLL_LOWBATT;
+	else if (status && status_has(status, "OB"))
+		state = POLL_ONBATT;
+
+	if (state != poll_state) {
+		upsdebugx(1, "Power state %s, adapting the update interval",
+			(state == POLL_LOWBATT) ? "LB" : (state == POLL_ONBATT) ? "OB" : "OL");
+		poll_state = state;
+	}
+}
+
+/* the update interval for the current power state, in ms */
+long poll_update_interval(void)
+{
+	long	ms = poll_interval * 1000L;
+
+	if ((poll_state != POLL_ONLINE) && (poll_ob_ms > 0) && (poll_ob_ms < ms))
+		ms = poll_ob_ms;
+
+	if ((poll_state == POLL_LOWBATT) && (poll_lb_ms > 0) && (poll_lb_ms < ms))
+		ms = poll_lb_ms;
+
+	return ms;
+}
+
+int poll_due(const poll_age_t *age)
+{
+	/* on battery, everything is read as often as the driver walks it */
+	if ((poll_state != POLL_ONLINE) || (age->skip == 0))
+		return 1;
+
+	/* allow for the update timer not being exactly on time */
+	return (ev_now() - age->last) >= (age->skip - update_interval / 2);
+}
+
+void poll_seen(poll_age_t *age, int changed)
+{
+	long long	now = ev_now();
+
+	if (changed || (age->last == 0) || (poll_max_ms <= 0)) {
+		age->skip = 0;
+	} else if (age->skip == 0) {
+		/* start from the rate at which the driver reads it */
+		age->skip = (long)(now - age->last);
+	} else {
+		age->skip *= 2;
+	}
+
+	if (age->skip > poll_max_ms)
+		age->skip = poll_max_ms;
+
+	age->last = now;
+}
+
+int poll_urgent(const char *var)
+{
+	if (poll_state == POLL_ONLINE)
+		return 0;
+
+	return !strcmp(var, "battery.charge") || !strcmp(var, "battery.runtime");
+}
+
+static void main_update(void *arg);
+
+/* data on extrafd: update now, then start the interval over */
+static void main_extrafd(int fd, void *arg)
+{
+	ev_settimer(update_timer, update_interval, update_interval);
+	main_update(arg);
+}
+
+/* follow the changes to extrafd, poll_interval and the power state */
+static void main_watch(void)
+{
+	if ((update_extrafd != -1) && (update_extrafd != extrafd)) {
+		ev_delfd(update_extrafd);
+	}
+
+	/* every time: it may have been closed and reopened as the same number */
+	if (extrafd != -1) {
+		ev_addfd(extrafd, main_extrafd, NULL);
+	}
+
+	update_extrafd = extrafd;
+
+	if (poll_update_interval() != update_interval) {
+		update_interval = poll_update_interval();
+		ev_settimer(update_timer, update_interval, update_interval);
+	}
+}
+
+void poll_now(void)
+{
+	if (update_timer) {
+		ev_settimer(update_timer, update_interval, 0);
+	}
+}
+
+static void main_update(void *arg)
+{
+	upsdrv_updateinfo();
+	poll_watch();
+	dstate_sample();
+
+	/* Dump the data tree (in upsc-like format) to stdout and exit */
+	if (dump_data) {
+		/* Wait for 'dump_data' update loops to ensure data completion */
+		if (update_count == dump_data) {
+			dstate_dump();
+			exit_flag = 1;
+		}
+		else
+			update_count++;
+	}
+
+	main_watch();
+}
+
+/* call upsdrv_updateinfo() every poll_interval, the first time in <first> ms */
+static void main_start(long first)
+{
+	update_interval = poll_update_interval();
+	update_timer = ev_addtimer(update_interval, first, main_update, NULL);
+
+	main_watch();
 }
 
 static void set_exit_flag(int sig)
@@ -498,11 +876,430 @@ static void setup_signals(void)
 	sigaction(SIGPIPE, &sa, NULL);
 }
 
+/* --- multi-device hosting (-A) --- */
+
+/* called by drivers that can be hosted, from upsdrv_makevartable(), once
+ * for each global variable that describes a single device */
+void host_register_state(void *addr, size_t len)
+{
+	host_state_t	*tmp, *last;
+
+	if (host_cur)
+		fatalx(EXIT_FAILURE, "host_register_state: called after the devices were set up");
+
+	tmp = last = host_state_h;
+
+	while (tmp) {
+		last = tmp;
+		tmp = tmp->next;
+	}
+
+	tmp = xcalloc(1, sizeof(*tmp));
+	tmp->addr = addr;
+	tmp->len = len;
+
+	if (last)
+		last->next = tmp;
+	else
+		host_state_h = tmp;
+
+	host_state_len += len;
+}
+
+static void host_state_save(unsigned char *buf)
+{
+	host_state_t	*tmp;
+
+	for (tmp = host_state_h; tmp; tmp = tmp->next) {
+		memcpy(buf, tmp->addr, tmp->len);
+		buf += tmp->len;
+	}
+}
+
+static void host_state_load(const unsigned char *buf)
+{
+	host_state_t	*tmp;
+
+	for (tmp = host_state_h; tmp; tmp = tmp->next) {
+		memcpy(tmp->addr, buf, tmp->len);
+		buf += tmp->len;
+	}
+}
+
+/* make <dev> the device that main, dstate and the driver work on */
+static void host_switch(host_dev_t *dev)
+{
+	if (dev == host_cur)
+		return;
+
+	if (host_cur)
+		host_state_save(host_cur->state);
+
+	host_state_load(dev->state);
+	dstate_ctx_switch(dev->dstate);
+	ev_set_owner(dev);
+
+	host_cur = dev;
+}
+
+/* the event loop is about to call a handler of <owner> */
+static void host_activate(void *owner)
+{
+	host_switch(owner);
+}
+
+/* first pass over ups.conf: remember the settings of every section */
+static void host_conf_arg(const char *confupsname, const char *var, const char *val)
+{
+	host_dev_t	*dev, *lastdev;
+	host_arg_t	*arg, *lastarg;
+
+	dev = lastdev = host_devs;
+
+	while (dev) {
+		if (!strcmp(dev->upsname, confupsname))
+			break;
+
+		lastdev = dev;
+		dev = dev->next;
+	}
+
+	if (!dev) {
+		dev = xcalloc(1, sizeof(*dev));
+		dev->upsname = xstrdup(confupsname);
+
+		if (lastdev)
+			lastdev->next = dev;
+		else
+			host_devs = dev;
+	}
+
+	if (!strcmp(var, "driver") && val) {
+		free(dev->driver);
+		dev->driver = xstrdup(val);
+	}
+
+	if (!strcmp(var, "hosted") && !val)
+		dev->hosted = 1;
+
+	arg = lastarg = dev->args;
+
+	while (arg) {
+		lastarg = arg;
+		arg = arg->next;
+	}
+
+	arg = xcalloc(1, sizeof(*arg));
+	arg->var = xstrdup(var);
+	arg->val = val ? xstrdup(val) : NULL;
+
+	if (lastarg)
+		lastarg->next = arg;
+	else
+		dev->args = arg;
+}
+
+static void host_dev_free(host_dev_t *dev)
+{
+	host_arg_t	*arg, *next;
+
+	for (arg = dev->args; arg; arg = next) {
+		next = arg->next;
+
+		free(arg->var);
+		free(arg->val);
+		free(arg);
+	}
+
+	free(dev->upsname);
+	free(dev->driver);
+	free(dev->state);
+	free(dev->pidfn);
+	free(dev);
+}
+
+static vartab_t *vartab_dup(const vartab_t *src)
+{
+	vartab_t	*head = NULL, *last = NULL, *tmp;
+
+	for (; src; src = src->next) {
+		tmp = xcalloc(1, sizeof(*tmp));
+		tmp->vartype = src->vartype;
+		tmp->var = xstrdup(src->var);
+		tmp->val = src->val ? xstrdup(src->val) : NULL;
+		tmp->desc = xstrdup(src->desc);
+		tmp->found = src->found;
+
+		if (last)
+			last->next = tmp;
+		else
+			head = tmp;
+
+		last = tmp;
+	}
+
+	return head;
+}
+
+/* keep the hosted sections for this driver and give each one its own
+ * copy of the globals, then apply its ups.conf settings to that copy */
+static int host_setup(void)
+{
+	host_dev_t	*dev, *next, *last = NULL;
+	host_arg_t	*arg;
+	unsigned char	*tmpl;
+	int	count = 0;
+
+	for (dev = host_devs; dev; dev = next) {
+		next = dev->next;
+
+		if (dev->hosted && dev->driver && !strcmp(dev->driver, progname)) {
+			last = dev;
+			continue;
+		}
+
+		if (last)
+			last->next = next;
+		else
+			host_devs = next;
+
+		host_dev_free(dev);
+	}
+
+	if (!host_devs)
+		fatalx(EXIT_FAILURE, "Error: no 'hosted' section for driver %s found in ups.conf", progname);
+
+	/* only drivers that registered their own globals can be hosted */
+	if (!host_state_h)
+		fatalx(EXIT_FAILURE, "Error: driver %s can not host several devices (-A)", progname);
+
+	host_register_state(&upsfd, sizeof(upsfd));
+	host_register_state(&extrafd, sizeof(extrafd));
+	host_register_state(&device_path, sizeof(device_path));
+	host_register_state(&device_name, sizeof(device_name));
+	host_register_state(&upsname, sizeof(upsname));
+	host_register_state(&poll_interval, sizeof(poll_interval));
+	host_register_state(&do_synchronous, sizeof(do_synchronous));
+	host_register_state(&do_lock_port, sizeof(do_lock_port));
+	host_register_state(&vartab_h, sizeof(vartab_h));
+	host_register_state(&upsh, sizeof(upsh));
+	host_register_state(&update_timer, sizeof(update_timer));
+	host_register_state(&update_extrafd, sizeof(update_extrafd));
+	host_register_state(&update_interval, sizeof(update_interval));
+	host_register_state(&poll_state, sizeof(poll_state));
+	host_register_state(&poll_ob_ms, sizeof(poll_ob_ms));
+	host_register_state(&poll_lb_ms, sizeof(poll_lb_ms));
+	host_register_state(&poll_max_ms, sizeof(poll_max_ms));
+	host_register_state(&history_size, sizeof(history_size));
+
+	/* every device starts from the state before any section was applied */
+	host_vartab = vartab_h;
+	tmpl = xmalloc(host_state_len);
+	host_state_save(tmpl);
+
+	for (dev = host_devs; dev; dev = dev->next) {
+		dev->state = xmalloc(host_state_len);
+		memcpy(dev->state, tmpl, host_state_len);
+		dev->dstate = dstate_ctx_new();
+
+		host_switch(dev);
+
+		upsname = dev->upsname;
+		vartab_h = vartab_dup(host_vartab);
+
+		for (arg = dev->args; arg; arg = arg->next)
+			upsconf_arg(dev->upsname, arg->var, arg->val);
+
+		if (!device_path)
+			fatalx(EXIT_FAILURE, "Error: no port specified for [%s] in ups.conf", upsname);
+
+		count++;
+	}
+
+	free(tmpl);
+
+	return count;
+}
+
+static void host_cleanup(void)
+{
+	host_dev_t	*dev, *next;
+	host_state_t	*st, *stnext;
+
+	for (dev = host_devs; dev; dev = dev->next) {
+		host_switch(dev);
+
+		if (dev->inited)
+			upsdrv_cleanup();
+
+		if (dev->pidfn)
+			unlink(dev->pidfn);
+
+		dstate_ctx_free(dev->dstate);
+		dev->dstate = NULL;
+
+		vartab_free(vartab_h);
+		vartab_h = NULL;
+
+		free(device_path);
+		device_path = NULL;
+	}
+
+	host_cur = NULL;
+
+	for (dev = host_devs; dev; dev = next) {
+		next = dev->next;
+		host_dev_free(dev);
+	}
+
+	host_devs = NULL;
+
+	for (st = host_state_h; st; st = stnext) {
+		stnext = st->next;
+		free(st);
+	}
+
+	host_state_h = NULL;
+
+	vartab_free(host_vartab);
+	host_vartab = NULL;
+}
+
+void host_init_failed(const char *fmt, ...)
+{
+	va_list	ap;
+	char	msg[LARGEBUF];
+
+	va_start(ap, fmt);
+	vsnprintf(msg, sizeof(msg), fmt, ap);
+	va_end(ap);
+
+	if (!host_mode || !host_cur)
+		fatalx(EXIT_FAILURE, "%s", msg);
+
+	upslogx(LOG_ERR, "[%s] %s", upsname, msg);
+	host_failed = 1;
+}
+
+/* the part of starting the current device that is tried again if the
+ * driver can't reach it; returns 0 if it couldn't */
+static int host_start(host_dev_t *dev)
+{
+	host_failed = 0;
+	upsdrv_initups();
+
+	if (host_failed) {
+		upslogx(LOG_WARNING, "[%s] not started, trying again in %ld seconds",
+			upsname, dev->retry_delay / 1000);
+		return 0;
+	}
+
+	dev->inited = 1;
+
+	publish_driver_version();
+
+	upsdrv_initinfo();
+	upsdrv_updateinfo();
+
+	check_ignorelb();
+
+	return 1;
+}
+
+/* one-shot timer of a device that isn't started yet */
+static void host_retry(void *arg)
+{
+	host_dev_t	*dev = arg;
+
+	dev->retry_delay = (2 * dev->retry_delay < HOST_RETRY_MAX) ? 2 * dev->retry_delay : HOST_RETRY_MAX;
+
+	if (!host_start(dev)) {
+		ev_addtimer(0, dev->retry_delay, host_retry, dev);
+		return;
+	}
+
+	upslogx(LOG_INFO, "[%s] started", upsname);
+	main_start(0);
+}
+
+/* bring up every hosted device, then let the event loop interleave their
+ * updates: each one keeps its own poll interval, and the first updates
+ * are spread over it */
+static void host_main(void)
+{
+	host_dev_t	*dev;
+	int	i, count;
+
+	count = host_setup();
+
+	atexit(host_cleanup);
+
+	if (upsdrv_info.status == DRV_BROKEN)
+		fatalx(EXIT_FAILURE, "Fatal error: broken driver. It probably needs to be converted.\n");
+
+	if (nut_debug_level == 0)
+		setup_signals();
+
+	ev_set_activate(host_activate);
+
+	for (dev = host_devs; dev; dev = dev->next) {
+		char	buffer[SMALLBUF];
+
+		host_switch(dev);
+
+		upslogx(LOG_INFO, "Starting hosted device [%s] on %s", upsname, device_path);
+
+		if (nut_debug_level == 0) {
+			snprintf(buffer, sizeof(buffer), "%s/%s-%s.pid", altpidpath(), progname, upsname);
+			kill_duplicate(buffer);
+			dev->pidfn = xstrdup(buffer);
+			writepid(dev->pidfn);
+		}
+
+		dstate_setinfo("device.type", "ups");
+
+		/* if it fails, its socket still tells upsd that its data is stale */
+		dev->retry_delay = HOST_RETRY_MIN;
+		host_start(dev);
+
+		dstate_init(progname, upsname);
+
+		publish_driver_parameters();
+		dstate_setinfo("driver.flag.hosted", "enabled");
+		dstate_sethistory(history_size);
+	}
+
+	if (nut_debug_level == 0) {
+		background();
+
+		/* PID changes when backgrounding */
+		for (dev = host_devs; dev; dev = dev->next)
+			writepid(dev->pidfn);
+	}
+
+	for (i = 0, dev = host_devs; dev; dev = dev->next, i++) {
+		host_switch(dev);
+
+		if (dev->inited)
+			main_start(poll_interval * 1000L * (i + 1) / count);
+		else
+			ev_addtimer(0, dev->retry_delay, host_retry, dev);
+	}
+
+	while (!exit_flag) {
+		ev_dispatch(-1);
+		dstate_flush();
+	}
+
+	upslogx(LOG_INFO, "Signal %d: exiting", exit_flag);
+
+	exit(EXIT_SUCCESS);
+}
+
 int main(int argc, char **argv)
 {
 	struct	passwd	*new_uid = NULL;
-	int	i, do_forceshutdown = 0;
-	int	update_count = 0;
+	int	i, do_forceshutdown = 0, have_xargs = 0;
 
 	atexit(exit_cleanup);
 
@@ -522,9 +1319,12 @@ int main(int argc, char **argv)
 	/* build the driver's extra (-x) variable table */
 	upsdrv_makevartable();
 
-	while ((i = getopt(argc, argv, "+a:s:kDd:hx:Lqr:u:Vi:")) != -1) {
+	while ((i = getopt(argc, argv, "+a:s:AkDd:hx:Lqr:u:Vi:")) != -1) {
 		switch (i) {
 			case 'a':
+				if (host_mode)
+					fatalx(EXIT_FAILURE, "Error: -A can not be combined with -a or -s");
+
 				upsname = optarg;
 
 				read_upsconf();
@@ -534,9 +1334,19 @@ int main(int argc, char **argv)
 						optarg);
 				break;
 			case 's':
+				if (host_mode)
+					fatalx(EXIT_FAILURE, "Error: -A can not be combined with -a or -s");
+
 				upsname = optarg;
 				upsname_found = 1;
 				break;
+			case 'A':
+				if (upsname)
+					fatalx(EXIT_FAILURE, "Error: -A can not be combined with -a or -s");
+
+				host_mode = 1;
+				read_upsconf();
+				break;
 			case 'D':
 				nut_debug_level++;
 				break;
@@ -568,6 +1378,7 @@ int main(int argc, char **argv)
 				exit(EXIT_SUCCESS);
 			case 'x':
 				splitxarg(optarg);
+				have_xargs = 1;
 				break;
 			case 'h':
 				help_msg();
@@ -586,13 +1397,18 @@ int main(int argc, char **argv)
 			"Error: too many non-option arguments. Try -h for help.");
 	}
 
-	if (!upsname_found) {
+	if (host_mode) {
+		if (do_forceshutdown || dump_data || have_xargs)
+			fatalx(EXIT_FAILURE,
+				"Error: -A can not be combined with -k, -d or -x. Try -h for help.");
+	}
+	else if (!upsname_found) {
 		fatalx(EXIT_FAILURE,
 			"Error: specifying '-a id' or '-s id' is now mandatory. Try -h for help.");
 	}
 
 	/* we need to get the port from somewhere */
-	if (!device_path) {
+	if (!device_path && !host_mode) {
 		fatalx(EXIT_FAILURE,
 			"Error: you must specify a port name in ups.conf or in '-x port=...' argument.\n"
 			"Try -h for help.");
@@ -609,9 +1425,12 @@ int main(int argc, char **argv)
 
 	/* Only switch to statepath if we're not powering off or just dumping data, for discovery */
 	/* This avoid case where ie /var is umounted */
-	if ((!do_forceshutdown) && (dump_data < 0) && (chdir(dflt_statepath())))
+	if ((!do_forceshutdown) && (!dump_data) && (chdir(dflt_statepath())))
 		fatal_with_errno(EXIT_FAILURE, "Can't chdir to %s", dflt_statepath());
 
+	if (host_mode)
+		host_main();	/* does not return */
+
 	/* Setup signals to communicate with driver once backgrounded. */
 	if ((nut_debug_level == 0) && (!do_forceshutdown)) {
 		char	buffer[SMALLBUF];
@@ -620,30 +1439,10 @@ int main(int argc, char **argv)
 
 		snprintf(buffer, sizeof(buffer), "%s/%s-%s.pid", altpidpath(), progname, upsname);
 
-		/* Try to prevent that driver is started multiple times. If a PID file */
-		/* already exists, send a TERM signal to the process and try if it goes */
-		/* away. If not, retry a couple of times. */
-		for (i = 0; i < 3; i++) {
-			struct stat	st;
-
-			if (stat(buffer, &st) != 0) {
-				/* PID file not found */
-				break;
-			}
-
-			if (sendsignalfn(buffer, SIGTERM) != 0) {
-				/* Can't send signal to PID, assume invalid file */
-				break;
-			}
-
-			upslogx(LOG_WARNING, "Duplicate driver instance detected (PID file %s exists)! Terminating other driver!", buffer);
-
-			/* Allow driver some time to quit */
-			sleep(5);
-		}
+		kill_duplicate(buffer);
 
 		/* Only write pid if we're not just dumping data, for discovery */
-		if (dump_data < 0) {
+		if (!dump_data) {
 			pidfn = xstrdup(buffer);
 			writepid(pidfn);	/* before backgrounding */
 		}
@@ -669,86 +1468,34 @@ int main(int argc, char **argv)
 	if (do_forceshutdown)
 		forceshutdown();
 
-	/* publish the top-level data: version numbers, driver name */
-	dstate_setinfo("driver.version", "%s", UPS_VERSION);
-	dstate_setinfo("driver.version.internal", "%s", upsdrv_info.version);
-	dstate_setinfo("driver.name", "%s", progname);
+	publish_driver_version();
 
 	/* get the base data established before allowing connections */
 	upsdrv_initinfo();
 	upsdrv_updateinfo();
 
-	if (dstate_getinfo("driver.flag.ignorelb")) {
-		int	have_lb_method = 0;
-
-		if (dstate_getinfo("battery.charge") && dstate_getinfo("battery.charge.low")) {
-			upslogx(LOG_INFO, "using 'battery.charge' to set battery low state");
-			have_lb_method++;
-		}
-
-		if (dstate_getinfo("battery.runtime") && dstate_getinfo("battery.runtime.low")) {
-			upslogx(LOG_INFO, "using 'battery.runtime' to set battery low state");
-			have_lb_method++;
-		}
-
-		if (!have_lb_method) {
-			fatalx(EXIT_FAILURE,
-				"The 'ignorelb' flag is set, but there is no way to determine the\n"
-				"battery state of charge.\n\n"
-				"Only set this flag if both 'battery.charge' and 'battery.charge.low'\n"
-				"and/or 'battery.runtime' and 'battery.runtime.low' are available.\n");
-		}
-	}
+	check_ignorelb();
 
 	/* now we can start servicing requests */
 	/* Only write pid if we're not just dumping data, for discovery */
-	if (dump_data < 0) {
+	if (!dump_data) {
 		dstate_init(progname, upsname);
 	}
 
-	/* The poll_interval may have been changed from the default */
-	dstate_setinfo("driver.parameter.pollinterval", "%d", poll_interval);
-
-	/* The synchronous option may have been changed from the default */
-	dstate_setinfo("driver.parameter.synchronous", "%s",
-		(do_synchronous==1)?"yes":"no");
-
-	/* remap the device.* info from ups.* for the transition period */
-	if (dstate_getinfo("ups.mfr") != NULL)
-		dstate_setinfo("device.mfr", "%s", dstate_getinfo("ups.mfr"));
-	if (dstate_getinfo("ups.model") != NULL)
-		dstate_setinfo("device.model", "%s", dstate_getinfo("ups.model"));
-	if (dstate_getinfo("ups.serial") != NULL)
-		dstate_setinfo("device.serial", "%s", dstate_getinfo("ups.serial"));
+	publish_driver_parameters();
 
 	if ( (nut_debug_level == 0) && (!dump_data) ) {
 		background();
 		writepid(pidfn);	/* PID changes when backgrounding */
 	}
 
-	while (!exit_flag) {
-
-		struct timeval	timeout;
-
-		gettimeofday(&timeout, NULL);
-		timeout.tv_sec += poll_interval;
+	dstate_sethistory(history_size);
+	main_start(0);
 
-		upsdrv_updateinfo();
-
-		/* Dump the data tree (in upsc-like format) to stdout and exit */
-		if (dump_data) {
-			/* Wait for 'dump_data' update loops to ensure data completion */
-			if (update_count == dump_data) {
-				dstate_dump();
-				exit_flag = 1;
-			}
-			else
-				update_count++;
-		}
-
-		while (!dstate_poll_fds(timeout, extrafd) && !exit_flag) {
-			/* repeat until time is up or extrafd has data */
-		}
+	/* what the handlers changed reaches upsd in one write per round */
+	while (!exit_flag) {
+		ev_dispatch(-1);
+		dstate_flush();
 	}
 
 	/* if we get here, the exit flag was set by a signal handler */
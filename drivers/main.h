@@ -5,6 +5,7 @@
 #include "upsconf.h"
 #include "dstate.h"
 #include "extstate.h"
+#include "eventloop.h"
 
 /* public functions & variables from main.c */
 extern const char	*progname, *upsname, *device_name;
@@ -12,6 +13,9 @@ extern char		*device_path;
 extern int		upsfd, extrafd, broken_driver, experimental_driver, do_lock_port, exit_flag;
 extern unsigned int	poll_interval;
 
+/* set when this process serves several ups.conf sections (-A) */
+extern int		host_mode;
+
 /* functions & variables required in each driver */
 void upsdrv_initups(void);	/* open connection to UPS, fail if not found */
 void upsdrv_initinfo(void);	/* prep data, settings for UPS monitoring */
@@ -51,6 +55,53 @@ typedef struct vartab_s {
 /* callback from driver - create the table for future -x entries */
 void addvar(int vartype, const char *name, const char *desc);
 
+/* callback from driver - declare a global that holds per-device state, so
+ * that this driver can serve several devices from one process (-A); call
+ * it from upsdrv_makevartable() for every such variable */
+void host_register_state(void *addr, size_t len);
+
+/* callback from driver - upsdrv_initups() can't reach or identify the
+ * device: with -A, the host logs <fmt> and tries it again later, while it
+ * serves the other devices, so the driver must return right after this;
+ * otherwise this is fatalx() */
+void host_init_failed(const char *fmt, ...)
+	__attribute__ ((__format__ (__printf__, 1, 2)));
+
+/* adaptive polling: main shortens the update interval while ups.status
+ * shows OB or LB (pollinterval_ob, pollinterval_lb), and drivers with
+ * item tables read the values that don't change less and less often
+ * while on line power, up to pollinterval_max */
+#define POLL_ONLINE	0
+#define POLL_ONBATT	1
+#define POLL_LOWBATT	2
+
+/* POLL_* as of the last upsdrv_updateinfo() */
+extern int		poll_state;
+
+/* one per item, zeroed, in the driver's table */
+typedef struct poll_age_s {
+	long long	last;	/* when it was last read (ev_now()) */
+	long	skip;	/* how long to leave it alone after that (ms) */
+} poll_age_t;
+
+/* the update interval for the current power state, in ms */
+long poll_update_interval(void);
+
+/* should this item be read now? */
+int poll_due(const poll_age_t *age);
+
+/* it was read; <changed> if that changed anything in the dstate tree
+ * (compare dstate_changes() before and after) */
+void poll_seen(poll_age_t *age, int changed);
+
+/* have upsdrv_updateinfo() called right away (e.g. when the driver learned
+ * of a new status between updates), then at the usual interval */
+void poll_now(void);
+
+/* whether <var> should be read with the status items, as it is while
+ * on battery for the values that shutdown decisions depend on */
+int poll_urgent(const char *var);
+
 /* subdriver description structure */
 typedef struct upsdrv_info_s {
 	const char	*name;		/* driver full name, for banner printing, ... */ 
@@ -125,6 +125,7 @@ static int	ups_status = 0;
 static bool_t	data_has_changed = FALSE;	/* for SEMI_STATIC data polling */
 
 static time_t	lastpoll;	/* Timestamp the last polling */
+static int	lastpoll_state = POLL_ONLINE;	/* poll_state at the last full update */
 
 #if defined(QX_USB) && defined(QX_SERIAL)
 static int	is_usb = 0;	/* Whether the device is connected through USB (1) or serial (0) */
@@ -1679,8 +1680,8 @@ void	upsdrv_updateinfo(void)
 	/* Clear status buffer before beginning */
 	status_init();
 
-	/* Do a full update (polling) every pollfreq or upon data change (i.e. setvar/instcmd) */
-	if ((now > (lastpoll + pollfreq)) || (data_has_changed == TRUE)) {
+	/* Do a full update (polling) every pollfreq, upon data change (i.e. setvar/instcmd) or when going on or off battery */
+	if ((now > (lastpoll + pollfreq)) || (data_has_changed == TRUE) || (poll_state != lastpoll_state)) {
 
 		upsdebugx(1, "Full update...");
 
@@ -1702,6 +1703,7 @@ void	upsdrv_updateinfo(void)
 		}
 
 		lastpoll = now;
+		lastpoll_state = poll_state;
 		data_has_changed = FALSE;
 
 		ups_alarm_set();
@@ -2424,10 +2426,24 @@ static void	qx_set_var(item_t *item)
 }
 
 /* Walk UPS variables and set elements of the qx2nut array. */
+/* Whether an item is read less often while it doesn't change:
+ * not the status, nor what the battery guesstimation and the internal (QX_FLAG_NONUT) vars depend on */
+static int	qx_ages(const item_t *item)
+{
+	if (item->qxflags & (QX_FLAG_QUICK_POLL | QX_FLAG_NONUT))
+		return 0;
+
+	if (!strncmp(item->info_type, "ups.alarm", 9) || !strncmp(item->info_type, "ups.status", 10) || !strcmp(item->info_type, "ups.load"))
+		return 0;
+
+	return strncmp(item->info_type, "battery.", 8);
+}
+
 static bool_t	qx_ups_walk(walkmode_t mode)
 {
 	item_t	*item;
 	int	retcode;
+	unsigned long	changes;
 
 	/* Clear batt.{chrg,runt}.act for guesstimation */
 	if (mode == QX_WALKMODE_FULL_UPDATE) {
@@ -2483,8 +2499,11 @@ static bool_t	qx_ups_walk(walkmode_t mode)
 
 		case QX_WALKMODE_QUICK_UPDATE:
 
-			/* Quick update only deals with status and alarms! */
-			if (!(item->qxflags & QX_FLAG_QUICK_POLL))
+			/* Quick update only deals with status and alarms, and with battery charge and runtime while on battery */
+			if (item->qxflags & QX_FLAG_QUICK_POLL)
+				break;
+
+			if (!poll_urgent(item->info_type) || (item->qxflags & (QX_FLAG_ABSENT | QX_FLAG_CMD | QX_FLAG_SETVAR | QX_FLAG_STATIC)))
 				continue;
 
 			break;
@@ -2499,6 +2518,10 @@ static bool_t	qx_ups_walk(walkmode_t mode)
 			if ((item->qxflags & QX_FLAG_SEMI_STATIC) && (data_has_changed == FALSE))
 				continue;
 
+			/* Values that haven't changed for a while are read less often */
+			if (qx_ages(item) && (data_has_changed == FALSE) && !poll_due(&item->age))
+				continue;
+
 			break;
 
 		default:
@@ -2563,8 +2586,12 @@ static bool_t	qx_ups_walk(walkmode_t mode)
 		}
 
 		/* Process the value we got back (set status bits and set the value of other parameters) */
+		changes = dstate_changes();
 		retcode = ups_infoval_set(item);
 
+		if (retcode != -1 && mode == QX_WALKMODE_FULL_UPDATE && qx_ages(item))
+			poll_seen(&item->age, dstate_changes() != changes);
+
 		/* Clear data from the item */
 		memset(item->answer, 0, sizeof(item->answer));
 		memset(item->value, 0, sizeof(item->value));
@@ -31,6 +31,7 @@
 #include <string.h>
 #include <unistd.h>
 #include "config.h"
+#include "main.h"	/* for poll_age_t */
 
 /* For testing purposes */
 /*#define TESTING*/
@@ -105,6 +106,8 @@ typedef struct item_t {
 						 * Return -1 in case of errors, else 0.
 						 * If QX_FLAG_SETVAR/QX_FLAG_CMD -> process command before it is sent: value must be filled with the command to be sent to the UPS.
 						 * Otherwise -> process value we got from answer before it gets stored in a NUT variable: value must be filled with the processed value already compliant to NUT standards. */
+
+	poll_age_t	age;			/* Adaptive polling (filled at runtime) */
 } item_t;
 
 /* Driver's own flags */
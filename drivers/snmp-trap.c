@@ -0,0 +1,58 @@
+/* snmp-trap.c - Network UPS Tools snmp-ups: which traps a MIB cares about
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "common.h"
+#include "snmp-trap.h"
+
+/* <oid> is <prefix>, or under it */
+static int trap_prefix(const char *prefix, const char *oid, size_t len)
+{
+	size_t	plen = strlen(prefix);
+
+	return (plen <= len) && !strncmp(prefix, oid, plen)
+		&& ((plen == len) || (oid[plen] == '.'));
+}
+
+int su_trap_match(const char *prefix, const char *trapoid)
+{
+	const char	*last, *prev;
+	char	buf[LARGEBUF];
+
+	/* the leading dot is optional */
+	prefix += (*prefix == '.');
+	trapoid += (*trapoid == '.');
+
+	if (trap_prefix(prefix, trapoid, strlen(trapoid))) {
+		return 1;
+	}
+
+	/* enterprise.0.specific: try again without the 0 */
+	if (((last = strrchr(trapoid, '.')) == NULL) || (last - trapoid < 2)
+		|| (last[-1] != '0') || (last[-2] != '.')) {
+		return 0;
+	}
+
+	prev = last - 2;
+
+	if ((size_t)(prev - trapoid) + strlen(last) >= sizeof(buf)) {
+		return 0;
+	}
+
+	snprintf(buf, sizeof(buf), "%.*s%s", (int)(prev - trapoid), trapoid, last);
+
+	return trap_prefix(prefix, buf, strlen(buf));
+}
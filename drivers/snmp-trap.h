@@ -0,0 +1,26 @@
+/* snmp-trap.h - Network UPS Tools snmp-ups: which traps a MIB cares about
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef SNMP_TRAP_H_SEEN
+#define SNMP_TRAP_H_SEEN 1
+
+/* whether the trap <trapoid> (dotted, numeric) is one of those that
+ * <prefix> stands for; an SNMPv1 trap, turned into enterprise.0.specific
+ * as RFC 3584 says, also matches as enterprise.specific */
+int su_trap_match(const char *prefix, const char *trapoid);
+
+#endif	/* SNMP_TRAP_H_SEEN */
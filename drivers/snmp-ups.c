@@ -33,10 +33,14 @@
 
 #include <limits.h>
 #include <ctype.h> /* for isprint() */
+#include <time.h> /* for clock() */
+#include <sys/socket.h>
+#include <netdb.h> /* for getaddrinfo() */
 
 /* NUT SNMP common functions */
 #include "main.h"
 #include "snmp-ups.h"
+#include "snmp-trap.h"
 #include "parseconf.h"
 
 /* include all known mib2nut lookup tables */
@@ -114,6 +118,9 @@ struct snmp_session g_snmp_sess, *g_snmp_sess_p;
 const char *OID_pwr_status;
 int g_pwr_battery;
 int pollfreq; /* polling frequency */
+int maxvarbinds; /* most OIDs asked in one GET request */
+int maxrepetitions; /* rows asked per template column in one GETBULK */
+int maxinflight; /* requests sent without waiting for the answers */
 int quirk_symmetra_threephase = 0;
 /* Number of device(s): standard is "1", but daisychain means more than 1 */
 long devices_count = 1;
@@ -126,6 +133,7 @@ mib2nut_info_t *mib2nut_info;
 /* FIXME: to be trashed */
 snmp_info_t *snmp_info;
 alarms_info_t *alarms_info;
+traps_info_t *traps_info;
 const char *mibname;
 const char *mibvers;
 
@@ -148,6 +156,7 @@ upsdrv_info_t	upsdrv_info = {
 /* FIXME: integrate MIBs info? do the same as for usbhid-ups! */
 
 time_t lastpoll = 0;
+static int lastpoll_state = POLL_ONLINE; /* poll_state at the last full walk */
 
 /* template OIDs index start with 0 or 1 (estimated stable for a MIB),
  * automatically guessed at the first pass */
@@ -158,11 +167,170 @@ int outlet_template_index_base = -1;
 int outletgroup_template_index_base = -1;
 int device_template_offset = -1;
 
+/* number of snmp_ups_walk() update passes, for the stale retry logic */
+static unsigned long walk_iterations = 0;
+
+/* set while walking only the status items, between full walks */
+static int walk_quick = FALSE;
+
+/* errors in a row of nut_snmp_walk(), to limit their logging (see
+ * SU_ERR_LIMIT and SU_ERR_RATE) */
+static unsigned int numerr = 0;
+
+/* traps and informs, see su_trap_open(): one listener for the process,
+ * and the devices it takes them from; a hosted device (-A) knows its
+ * own by su_trap_peer */
+#define SNMPTRAPOID_OID	".1.3.6.1.6.3.1.1.4.1.0"
+#define SNMPTRAPS_OID	".1.3.6.1.6.3.1.1.5"	/* the generic SNMPv1 traps */
+
+typedef struct {
+	struct sockaddr_storage	addr;
+	void	*owner;		/* the device, for ev_set_owner() */
+	traps_info_t	*traps;
+	int	pending;	/* a trap came since the last update */
+	unsigned long	matched;	/* of the traps entries */
+} su_trap_peer_t;
+
+static void *su_trap_sessp[2] = { NULL, NULL };	/* IPv4, IPv6 */
+static int su_trap_port = 0;
+static su_trap_peer_t *su_trap_peers = NULL;
+static int su_trap_npeers = 0;
+static int su_trap_peer = -1;
+
+/* what the traps were about, for this update */
+static unsigned long su_trap_matched = 0;
+
 /* sysOID location */
 #define SYSOID_OID	".1.3.6.1.2.1.1.2.0"
 
+/* the values of the current walk, fetched ahead by su_prefetch() with
+ * multi-varbind GETs and GETBULKs, and handed out by nut_snmp_get().
+ * They are found by their binary OID, which points into the responses
+ * kept. The arrays are only emptied between the walks, not freed. */
+#define SU_CACHE_HASH	256
+
+typedef struct {
+	struct variable_list	*var;	/* in one of su_cache_pdus */
+	int	next;		/* in the hash bucket, or -1 */
+} su_cached_t;
+
+static int su_cache[SU_CACHE_HASH];	/* 0: empty, or index + 1 */
+static su_cached_t *su_cache_vars = NULL;
+static int su_cache_nvars = 0, su_cache_maxvars = 0;
+static struct snmp_pdu **su_cache_pdus = NULL;
+static int su_cache_npdus = 0, su_cache_maxpdus = 0;
+
+/* the template columns read with GETBULK, see su_prefetch_columns() */
+#define SU_COLUMN_ACTIVE	0
+#define SU_COLUMN_DONE		1	/* all its rows are in the cache */
+#define SU_COLUMN_FAILED	2
+
+typedef struct {
+	const oid	*name;	/* the OID of an instance, less its index */
+	size_t	name_len;
+	oid	last;		/* index of the last row read */
+	int	rows;
+	int	busy;		/* asked, not answered yet */
+	int	state;
+} su_column_t;
+
+static su_column_t *su_columns = NULL;
+static int su_ncolumns = 0, su_maxcolumns = 0;
+
+/* the OIDs su_prefetch() asks with GETs */
+typedef struct {
+	const oid	*name;
+	size_t	name_len;
+} su_oidref_t;
+
+static su_oidref_t *su_prefetch_oids = NULL;
+static int su_prefetch_maxoids = 0;
+
+/* the requests of su_prefetch() on the way, see su_prefetch_run() */
+#define SU_REQUEST_IDLE		0
+#define SU_REQUEST_SENT		1
+#define SU_REQUEST_ANSWERED	2
+
+typedef struct {
+	int	state;
+	int	type;		/* SNMP_MSG_GET or SNMP_MSG_GETBULK */
+	int	status;		/* STAT_SUCCESS, or why there is no response */
+	struct snmp_pdu	*response;
+	int	first, n;	/* GET: su_prefetch_oids asked; GETBULK: n columns */
+	su_column_t	**columns;
+	int	maxcolumns;
+} su_request_t;
+
+static su_request_t *su_window = NULL;
+static int su_maxwindow = 0;
+
+/* the su_prefetch_oids still to ask */
+typedef struct {
+	int	first, n;
+} su_range_t;
+
+static su_range_t *su_ranges = NULL;
+static int su_nranges = 0, su_maxranges = 0;
+
+/* textual OIDs, parsed once, see su_parse_oid(); they don't depend on the
+ * device, so this is shared by the hosted devices (-A) */
+#define SU_OID_HASH	1024
+
+typedef struct su_oid_s {
+	char	*OID;
+	oid	*name;		/* NULL if it doesn't parse */
+	size_t	name_len;
+	struct su_oid_s	*next;
+} su_oid_t;
+
+static su_oid_t *su_oids[SU_OID_HASH];
+
+/* the sysOIDs of mib2nut, parsed into a tree of their sub-identifiers
+ * by su_sysoid_build(), so that finding the MIBs of a device takes one
+ * step per sub-identifier of its sysOID; shared by the hosted devices */
+typedef struct su_sysoid_s {
+	oid	id;
+	int	*mibs;		/* indexes in mib2nut of the sysOIDs ending here */
+	int	nmibs;
+	struct su_sysoid_s	*children, *next;
+} su_sysoid_t;
+
+static su_sysoid_t *su_sysoids = NULL;
+
+/* snmp_info by NUT name, see su_index_build() */
+static snmp_info_t **su_index = NULL;
+static size_t su_index_size = 0;
+
+/* snmp_info compiled for the walks by su_compile(): what would
+ * otherwise be formatted and parsed again at each of them */
+typedef struct {
+	const char	*OID;		/* as read for this device, or NULL */
+	const oid	*name;		/* parsed, NULL if it doesn't parse */
+	size_t	name_len;
+	const oid	*column;	/* outlet templates: their table column, or NULL */
+	size_t	column_len;
+	int	base, count;	/* outlet templates: the instances below */
+	snmp_info_t	*instances;
+} su_compiled_t;
+
+static su_compiled_t **su_compiled = NULL;	/* [device][entry of snmp_info] */
+static int su_nentries = 0;
+
+/* requests sent during the current walk */
+static unsigned long su_requests = 0;
+
 /* Forward functions declarations */
 static void disable_transfer_oids(void);
+static void su_compile(void);
+static void su_compile_free(void);
+static void su_index_free(void);
+static void su_oid_free(void);
+static void su_sysoid_free(su_sysoid_t *node);
+static const oid *su_parse_oid(const char *OID, size_t *name_len);
+static bool_t su_answers(void);
+static void su_trap_open(void);
+static int su_trap_take(void);
+static int su_trap_wants(const snmp_info_t *su_info_p);
 bool_t get_and_process_data(int mode, snmp_info_t *su_info_p);
 int extract_template_number(int template_type, const char* varname);
 int get_template_type(const char* varname);
@@ -211,6 +379,9 @@ su_addcmd(su_info_p);
 	else
 		dstate_datastale();
 
+	/* what the update walks read is known now */
+	su_compile();
+
 	/* setup handlers for instcmd and setvar functions */
 	upsh.setvar = su_setvar;
 	upsh.instcmd = su_instcmd;
@@ -218,35 +389,52 @@ su_addcmd(su_info_p);
 
 void upsdrv_updateinfo(void)
 {
+	int	full, trapped;
+
 	upsdebugx(1,"SNMP UPS driver: entering %s()", __func__);
 
-	/* only update every pollfreq */
-	/* FIXME: only update status (SU_STATUS_*), à la usbhid-ups, in between */
-	if (time(NULL) > (lastpoll + pollfreq)) {
+	/* update everything every pollfreq, and when going on or off battery */
+	full = (time(NULL) > (lastpoll + pollfreq)) || (poll_state != lastpoll_state);
 
-		alarm_init();
-		status_init();
+	/* the device sent a trap: read the status, and what it is about */
+	trapped = su_trap_take();
 
-		/* update all dynamic info fields */
-		if (snmp_ups_walk(SU_WALKMODE_UPDATE))
-			dstate_dataok();
-		else
-			dstate_datastale();
+	/* in between, only the status (and battery charge), and only while
+	 * on battery (see poll_urgent()) or after a trap */
+	if (!full && !trapped && (poll_state == POLL_ONLINE)) {
+		/* Just tell everything is ok to upsd */
+		dstate_dataok();
+		return;
+	}
+
+	walk_quick = !full;
 
-		/* Commit status first, otherwise in daisychain mode, "device.0" may
-		 * clear the alarm count since it has an empty alarm buffer and if there
-		 * is only one device that has alarms! */
-		if (daisychain_enabled == FALSE)
-			alarm_commit();
-		status_commit();
-		if (daisychain_enabled == TRUE)
-			alarm_commit();
+	alarm_init();
+	status_init();
 
+	/* update all dynamic info fields */
+	if (snmp_ups_walk(SU_WALKMODE_UPDATE))
+		dstate_dataok();
+	else
+		dstate_datastale();
+
+	/* Commit status first, otherwise in daisychain mode, "device.0" may
+	 * clear the alarm count since it has an empty alarm buffer and if there
+	 * is only one device that has alarms! */
+	if (daisychain_enabled == FALSE)
+		alarm_commit();
+	status_commit();
+	if (daisychain_enabled == TRUE)
+		alarm_commit();
+
+	walk_quick = FALSE;
+	su_trap_matched = 0;
+
+	if (full) {
 		/* store timestamp */
 		lastpoll = time(NULL);
+		lastpoll_state = poll_state;
 	}
-	else /* Just tell everything is ok to upsd */
-		dstate_dataok();
 }
 
 void upsdrv_shutdown(void)
@@ -306,6 +494,14 @@ void upsdrv_makevartable(void)
 		"Specifies the number of Net-SNMP retries to be used in the requests (default=5)");
 	addvar(VAR_VALUE, SU_VAR_TIMEOUT,
 		"Specifies the Net-SNMP timeout in seconds between retries (default=1)");
+	addvar(VAR_VALUE, SU_VAR_MAXVARBINDS,
+		"Set the maximum number of OIDs per GET request (default=16, 1 to ask them one by one)");
+	addvar(VAR_VALUE, SU_VAR_MAXREPETITIONS,
+		"Set the number of outlets asked per GETBULK request, with SNMP v2c and v3 (default=16, 0 to not use GETBULK)");
+	addvar(VAR_VALUE, SU_VAR_TRAPPORT,
+		"Listen for SNMP traps and informs on this UDP port, and update when they come");
+	addvar(VAR_VALUE, SU_VAR_MAXINFLIGHT,
+		"Set the number of requests sent without waiting for the answers (default=4, 1 to wait for each)");
 	addvar(VAR_FLAG, "notransferoids",
 		"Disable transfer OIDs (use on APCC Symmetras)");
 	addvar(VAR_FLAG, "symmetrathreephase",
@@ -322,6 +518,41 @@ void upsdrv_makevartable(void)
 		"Set the authentication protocol (MD5 or SHA) used for authenticated SNMPv3 messages (default=MD5)");
 	addvar(VAR_VALUE, SU_VAR_PRIVPROT,
 		"Set the privacy protocol (DES or AES) used for encrypted SNMPv3 messages (default=DES)");
+
+	/* per-device state, for serving several devices from one process (-A) */
+	host_register_state(&g_snmp_sess, sizeof(g_snmp_sess));
+	host_register_state(&g_snmp_sess_p, sizeof(g_snmp_sess_p));
+	host_register_state(&OID_pwr_status, sizeof(OID_pwr_status));
+	host_register_state(&g_pwr_battery, sizeof(g_pwr_battery));
+	host_register_state(&pollfreq, sizeof(pollfreq));
+	host_register_state(&maxvarbinds, sizeof(maxvarbinds));
+	host_register_state(&maxrepetitions, sizeof(maxrepetitions));
+	host_register_state(&maxinflight, sizeof(maxinflight));
+	host_register_state(&quirk_symmetra_threephase, sizeof(quirk_symmetra_threephase));
+	host_register_state(&devices_count, sizeof(devices_count));
+	host_register_state(&current_device_number, sizeof(current_device_number));
+	host_register_state(&daisychain_enabled, sizeof(daisychain_enabled));
+	host_register_state(&daisychain_info, sizeof(daisychain_info));
+	host_register_state(&mib2nut_info, sizeof(mib2nut_info));
+	host_register_state(&snmp_info, sizeof(snmp_info));
+	host_register_state(&alarms_info, sizeof(alarms_info));
+	host_register_state(&traps_info, sizeof(traps_info));
+	host_register_state(&su_trap_peer, sizeof(su_trap_peer));
+	host_register_state(&mibname, sizeof(mibname));
+	host_register_state(&mibvers, sizeof(mibvers));
+	host_register_state(&lastpoll, sizeof(lastpoll));
+	host_register_state(&lastpoll_state, sizeof(lastpoll_state));
+	host_register_state(&numerr, sizeof(numerr));
+	host_register_state(&template_index_base, sizeof(template_index_base));
+	host_register_state(&device_template_index_base, sizeof(device_template_index_base));
+	host_register_state(&outlet_template_index_base, sizeof(outlet_template_index_base));
+	host_register_state(&outletgroup_template_index_base, sizeof(outletgroup_template_index_base));
+	host_register_state(&device_template_offset, sizeof(device_template_offset));
+	host_register_state(&walk_iterations, sizeof(walk_iterations));
+	host_register_state(&su_index, sizeof(su_index));
+	host_register_state(&su_index_size, sizeof(su_index_size));
+	host_register_state(&su_compiled, sizeof(su_compiled));
+	host_register_state(&su_nentries, sizeof(su_nentries));
 }
 
 void upsdrv_initups(void)
@@ -355,13 +586,33 @@ void upsdrv_initups(void)
 		exit(EXIT_SUCCESS);
 	}
 
-	/* init SNMP library, etc... */
-	nut_snmp_init(progname, device_path);
+	/* init SNMP library, etc..., unless an earlier try did (-A) */
+	if (g_snmp_sess_p == NULL) {
+		nut_snmp_init(progname, device_path);
+
+		if (g_snmp_sess_p == NULL)
+			return;
+	}
+
+	/* -A: a device that doesn't answer would hold up the others for every
+	 * OID the detection tries, so it is only detected once it answers */
+	if (host_mode && !su_answers()) {
+		host_init_failed("No answer from %s", device_path);
+		return;
+	}
+
+	/* init the number of OIDs per request, detection included */
+	if (getval(SU_VAR_MAXVARBINDS))
+		maxvarbinds = atoi(getval(SU_VAR_MAXVARBINDS));
+	else
+		maxvarbinds = DEFAULT_MAXVARBINDS;
 
-	/* FIXME: first test if the device is reachable to avoid timeouts! */
+	if (maxvarbinds < 1)
+		fatalx(EXIT_FAILURE, "Bad %s: %s", SU_VAR_MAXVARBINDS, getval(SU_VAR_MAXVARBINDS));
 
 	/* Load the SNMP to NUT translation data */
-	load_mib2nut(mibs);
+	if (load_mib2nut(mibs) != TRUE)
+		return;
 
 	/* init polling frequency */
 	if (getval(SU_VAR_POLLFREQ))
@@ -369,6 +620,27 @@ void upsdrv_initups(void)
 	else
 		pollfreq = DEFAULT_POLLFREQ;
 
+	/* GETBULK came with SNMP v2c */
+	if (getval(SU_VAR_MAXREPETITIONS))
+		maxrepetitions = atoi(getval(SU_VAR_MAXREPETITIONS));
+	else
+		maxrepetitions = DEFAULT_MAXREPETITIONS;
+
+	if (maxrepetitions < 0)
+		fatalx(EXIT_FAILURE, "Bad %s: %s", SU_VAR_MAXREPETITIONS, getval(SU_VAR_MAXREPETITIONS));
+
+	if (g_snmp_sess.version == SNMP_VERSION_1)
+		maxrepetitions = 0;
+
+	/* init the number of concurrent requests */
+	if (getval(SU_VAR_MAXINFLIGHT))
+		maxinflight = atoi(getval(SU_VAR_MAXINFLIGHT));
+	else
+		maxinflight = DEFAULT_MAXINFLIGHT;
+
+	if (maxinflight < 1)
+		fatalx(EXIT_FAILURE, "Bad %s: %s", SU_VAR_MAXINFLIGHT, getval(SU_VAR_MAXINFLIGHT));
+
 	/* Get UPS Model node to see if there's a MIB */
 // FIXME: extend and use match_model_OID(char *model)
 	su_info_p = su_find_info("ups.model");
@@ -410,13 +682,25 @@ void upsdrv_initups(void)
 	if (status == TRUE)
 		upslogx(0, "Detected %s on host %s (mib: %s %s)",
 			 model, device_path, mibname, mibvers);
-	else
-		fatalx(EXIT_FAILURE, "%s MIB wasn't found on %s", mibs, g_snmp_sess.peername);
-		/* FIXME: "No supported device detected" */
+	else {
+		host_init_failed("%s MIB wasn't found on %s", mibs, g_snmp_sess.peername);
+
+		/* -A: detected again at the next try */
+		if (host_mode)
+			free(snmp_info);
+		snmp_info = NULL;
+		mibname = NULL;
+		su_index_free();
+		return;
+	}
 
 	/* Init daisychain and check if support is required */
 	daisychain_init();
 
+	/* updates when the device says something changed */
+	if (getval(SU_VAR_TRAPPORT))
+		su_trap_open();
+
 	/* Allocate / init the daisychain info structure (for phases only for now)
 	 * daisychain_info[0] is the whole chain! (added +1) */
 	daisychain_info = (daisychain_info_t**)malloc(sizeof(daisychain_info_t) * (devices_count + 1));
@@ -449,10 +733,35 @@ void upsdrv_initups(void)
 
 void upsdrv_cleanup(void)
 {
+	int	i;
+
 	/* General cleanup */
 	if (daisychain_info)
 		free(daisychain_info);
 
+	su_compile_free();
+	su_index_free();
+	su_oid_free();
+	su_sysoid_free(su_sysoids);
+	su_sysoids = NULL;
+
+	/* the trap listener serves the whole process, see su_trap_open() */
+	for (i = 0; i < 2; i++) {
+		if (su_trap_sessp[i]) {
+			snmp_sess_close(su_trap_sessp[i]);
+			su_trap_sessp[i] = NULL;
+		}
+	}
+	su_trap_port = 0;
+	free(su_trap_peers);
+	su_trap_peers = NULL;
+	su_trap_npeers = 0;
+	su_trap_peer = -1;
+
+	/* private copy of the mapping table, see load_mib2nut() */
+	if (host_mode)
+		free(snmp_info);
+
 	/* Net-SNMP specific cleanup */
 	nut_snmp_cleanup();
 }
@@ -620,10 +929,42 @@ void nut_snmp_init(const char *type, const char *hostname)
 	g_snmp_sess_p = snmp_open(&g_snmp_sess);	/* establish the session */
 	if (g_snmp_sess_p == NULL) {
 		nut_snmp_perror(&g_snmp_sess, 0, NULL, "nut_snmp_init: snmp_open");
-		fatalx(EXIT_FAILURE, "Unable to establish communication");
+		host_init_failed("Unable to establish communication");
+
+		/* -A: set up again at the next try */
+		free(g_snmp_sess.peername);
+		free(g_snmp_sess.community);
+		free(g_snmp_sess.securityName);
 	}
 }
 
+/* whether the device answers at all: a GET of its sysOID, whatever the
+ * answer is */
+static bool_t su_answers(void)
+{
+	struct snmp_pdu *pdu, *response = NULL;
+	const oid *name;
+	size_t name_len;
+	int status;
+
+	if ((name = su_parse_oid(SYSOID_OID, &name_len)) == NULL)
+		return TRUE;
+
+	pdu = snmp_pdu_create(SNMP_MSG_GET);
+	if (pdu == NULL)
+		fatalx(EXIT_FAILURE, "Not enough memory");
+
+	snmp_add_null_var(pdu, name, name_len);
+
+	status = snmp_synch_response(g_snmp_sess_p, pdu, &response);
+	su_requests++;
+
+	if (response)
+		snmp_free_pdu(response);
+
+	return (status == STAT_SUCCESS) ? TRUE : FALSE;
+}
+
 void nut_snmp_cleanup(void)
 {
 	/* close snmp session. */
@@ -656,11 +997,10 @@ struct snmp_pdu **nut_snmp_walk(const char *OID, int max_iteration)
 {
 	int status;
 	struct snmp_pdu *pdu, *response = NULL;
-	oid name[MAX_OID_LEN];
-	size_t name_len = MAX_OID_LEN;
-	oid * current_name;
+	const oid *name;
+	size_t name_len;
+	const oid * current_name;
 	size_t current_name_len;
-	static unsigned int numerr = 0;
 	int nb_iteration = 0;
 	struct snmp_pdu ** ret_array = NULL;
 	int type = SNMP_MSG_GET;
@@ -669,7 +1009,7 @@ struct snmp_pdu **nut_snmp_walk(const char *OID, int max_iteration)
 	upsdebugx(4, "%s: max. iteration = %i", __func__, max_iteration);
 
 	/* create and send request. */
-	if (!snmp_parse_oid(OID, name, &name_len)) {
+	if ((name = su_parse_oid(OID, &name_len)) == NULL) {
 		upsdebugx(2, "[%s] %s: %s: %s",
 			upsname?upsname:device_name, __func__, OID, snmp_api_errstring(snmp_errno));
 		return NULL;
@@ -693,6 +1033,7 @@ struct snmp_pdu **nut_snmp_walk(const char *OID, int max_iteration)
 		snmp_add_null_var(pdu, current_name, current_name_len);
 
 		status = snmp_synch_response(g_snmp_sess_p, pdu, &response);
+		su_requests++;
 
 		if (!response) {
 			break;
@@ -752,16 +1093,197 @@ struct snmp_pdu **nut_snmp_walk(const char *OID, int max_iteration)
 	return ret_array;
 }
 
+static unsigned int su_hash(const char *str)
+{
+	unsigned int	h = 5381;
+
+	while (*str) {
+		h = h * 33 + (unsigned char)*str++;
+	}
+
+	return h;
+}
+
+/* the same, for the NUT names, which are compared ignoring case */
+static unsigned int su_hash_name(const char *str)
+{
+	unsigned int	h = 5381;
+
+	while (*str) {
+		h = h * 33 + (unsigned char)tolower((unsigned char)*str++);
+	}
+
+	return h;
+}
+
+/* <OID> parsed, from the OIDs seen so far if it is one of them */
+static const oid *su_parse_oid(const char *OID, size_t *name_len)
+{
+	unsigned int	h = su_hash(OID) % SU_OID_HASH;
+	su_oid_t	*o;
+	oid	name[MAX_OID_LEN];
+	size_t	len = MAX_OID_LEN;
+
+	for (o = su_oids[h]; o; o = o->next) {
+		if (!strcmp(o->OID, OID))
+			break;
+	}
+
+	if (o == NULL) {
+		o = xcalloc(1, sizeof(*o));
+		o->OID = xstrdup(OID);
+
+		if (snmp_parse_oid(OID, name, &len)) {
+			o->name = xmalloc(len * sizeof(oid));
+			memcpy(o->name, name, len * sizeof(oid));
+			o->name_len = len;
+		}
+
+		o->next = su_oids[h];
+		su_oids[h] = o;
+	}
+
+	*name_len = o->name_len;
+	return o->name;
+}
+
+static void su_oid_free(void)
+{
+	su_oid_t	*o, *onext;
+	int	i;
+
+	for (i = 0; i < SU_OID_HASH; i++) {
+		for (o = su_oids[i]; o; o = onext) {
+			onext = o->next;
+			free(o->OID);
+			free(o->name);
+			free(o);
+		}
+		su_oids[i] = NULL;
+	}
+}
+
+static unsigned int su_hash_oid(const oid *name, size_t name_len)
+{
+	unsigned int	h = 5381;
+
+	while (name_len-- > 0) {
+		h = h * 33 + (unsigned int)*name++;
+	}
+
+	return h;
+}
+
+static struct variable_list *su_cache_find(const oid *name, size_t name_len)
+{
+	struct variable_list	*var;
+	int	i;
+
+	for (i = su_cache[su_hash_oid(name, name_len) % SU_CACHE_HASH]; i; i = su_cache_vars[i - 1].next + 1) {
+		var = su_cache_vars[i - 1].var;
+
+		if ((var->name_length == name_len) && !memcmp(var->name, name, name_len * sizeof(oid)))
+			return var;
+	}
+
+	return NULL;
+}
+
+/* <var> must stay valid until su_cache_clear(), see su_cache_keep() */
+static void su_cache_add(struct variable_list *var)
+{
+	unsigned int	h = su_hash_oid(var->name, var->name_length) % SU_CACHE_HASH;
+
+	if (su_cache_nvars == su_cache_maxvars) {
+		su_cache_maxvars = su_cache_maxvars ? 2 * su_cache_maxvars : 64;
+		su_cache_vars = xrealloc(su_cache_vars, su_cache_maxvars * sizeof(*su_cache_vars));
+	}
+
+	su_cache_vars[su_cache_nvars].var = var;
+	su_cache_vars[su_cache_nvars].next = su_cache[h] - 1;
+	su_cache[h] = ++su_cache_nvars;
+}
+
+/* keep the response, that the cached variables point into */
+static void su_cache_keep(struct snmp_pdu *response)
+{
+	if (su_cache_npdus == su_cache_maxpdus) {
+		su_cache_maxpdus = su_cache_maxpdus ? 2 * su_cache_maxpdus : 16;
+		su_cache_pdus = xrealloc(su_cache_pdus, su_cache_maxpdus * sizeof(*su_cache_pdus));
+	}
+
+	su_cache_pdus[su_cache_npdus++] = response;
+}
+
+static void su_cache_clear(void)
+{
+	int	i;
+
+	memset(su_cache, 0, sizeof(su_cache));
+	su_cache_nvars = 0;
+
+	for (i = 0; i < su_cache_npdus; i++)
+		snmp_free_pdu(su_cache_pdus[i]);
+
+	su_cache_npdus = 0;
+	su_ncolumns = 0;
+}
+
+/* the column <name> is a row of, if all of it was read */
+static su_column_t *su_column_find(const oid *name, size_t name_len)
+{
+	su_column_t	*column;
+	int	i;
+
+	for (i = 0; i < su_ncolumns; i++) {
+		column = &su_columns[i];
+
+		if ((column->state == SU_COLUMN_DONE) && (column->name_len + 1 == name_len)
+			&& !memcmp(column->name, name, column->name_len * sizeof(oid)))
+			return column;
+	}
+
+	return NULL;
+}
+
 struct snmp_pdu *nut_snmp_get(const char *OID)
 {
 	struct snmp_pdu ** pdu_array;
 	struct snmp_pdu * ret_pdu;
+	struct variable_list *var, *next;
+	const oid *name;
+	size_t name_len;
 
 	if (OID == NULL)
 		return NULL;
 
 	upsdebugx(3, "%s(%s)", __func__, OID);
 
+	if ((su_cache_nvars > 0) || (su_ncolumns > 0)) {
+		name = su_parse_oid(OID, &name_len);
+
+		/* already read by su_prefetch() */
+		if (name && ((var = su_cache_find(name, name_len)) != NULL)) {
+			ret_pdu = snmp_pdu_create(SNMP_MSG_RESPONSE);
+			if (ret_pdu == NULL)
+				fatalx(EXIT_FAILURE, "Not enough memory");
+
+			/* snmp_clone_varbind() copies the rest of the list too */
+			next = var->next_variable;
+			var->next_variable = NULL;
+			ret_pdu->variables = snmp_clone_varbind(var);
+			var->next_variable = next;
+
+			return ret_pdu;
+		}
+
+		/* not in a table that was read whole: there is no such row */
+		if (name && (su_column_find(name, name_len) != NULL)) {
+			upsdebugx(3, "%s: %s is not in the table", __func__, OID);
+			return NULL;
+		}
+	}
+
 	pdu_array = nut_snmp_walk(OID,1);
 
 	if(pdu_array == NULL) {
@@ -1079,109 +1601,424 @@ void nut_snmp_perror(struct snmp_session *sess, int status,
 }
 
 /* -----------------------------------------------------------
- * utility functions.
+ * SNMP traps and informs.
  * ----------------------------------------------------------- */
 
-/* deal with APCC weirdness on Symmetras */
-static void disable_transfer_oids(void)
+/* the address <host> (as in "port", less the port) resolves to */
+static bool_t su_trap_resolve(const char *host, struct sockaddr_storage *addr)
 {
-	snmp_info_t *su_info_p;
-
-	upslogx(LOG_INFO, "Disabling transfer OIDs");
+	char buf[SU_LARGEBUF], *p;
+	struct addrinfo hints, *res;
 
-	for (su_info_p = &snmp_info[0]; su_info_p->info_type != NULL ; su_info_p++) {
-		if (!strcasecmp(su_info_p->info_type, "input.transfer.low")) {
-			su_info_p->flags &= ~SU_FLAG_OK;
-			continue;
-		}
+	/* [transport:]host[:port], with [] around IPv6 addresses */
+	if (!strncasecmp(host, "udp:", 4) || !strncasecmp(host, "udp6:", 5))
+		host = strchr(host, ':') + 1;
 
-		if (!strcasecmp(su_info_p->info_type, "input.transfer.high")) {
-			su_info_p->flags &= ~SU_FLAG_OK;
-			continue;
-		}
+	if (*host == '[') {
+		snprintf(buf, sizeof(buf), "%s", host + 1);
+		if ((p = strchr(buf, ']')) != NULL)
+			*p = '\0';
+	}
+	else {
+		snprintf(buf, sizeof(buf), "%s", host);
+		if (((p = strchr(buf, ':')) != NULL) && (strchr(p + 1, ':') == NULL))
+			*p = '\0';
 	}
-}
 
-/* Universal function to add or update info element.
- * If value is NULL, use the default one (su_info_p->dfl) if provided */
-void su_setinfo(snmp_info_t *su_info_p, const char *value)
-{
-	info_lkp_t	*info_lkp;
-	char info_type[128];
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
 
-	upsdebugx(1, "entering %s(%s, %s)", __func__, su_info_p->info_type, (value)?value:"");
+	if (getaddrinfo(buf, NULL, &hints, &res) != 0)
+		return FALSE;
 
-	memset(info_type, 0, 20);
-	/* pre-fill with the device name for checking */
-	snprintf(info_type, 128, "device.%i", current_device_number);
+	memset(addr, 0, sizeof(*addr));
+	memcpy(addr, res->ai_addr, res->ai_addrlen);
+	freeaddrinfo(res);
 
-	if ((daisychain_enabled == TRUE) && (devices_count > 1)) {
-		/* Only append "device.X" for master and slaves, if not already done! */
-		if ((current_device_number > 0) && (strstr(su_info_p->info_type, info_type) == NULL)) {
-			/* Special case: we remove "device" from the device collection not to
-			 * get "device.X.device.<something>", but "device.X.<something>" */
-			if (!strncmp(su_info_p->info_type, "device.", 7)) {
-				snprintf(info_type, 128, "device.%i.%s",
-					current_device_number, su_info_p->info_type + 7);
-			}
-			else {
-				snprintf(info_type, 128, "device.%i.%s",
-					current_device_number, su_info_p->info_type);
-			}
-		}
-		else
-			snprintf(info_type, 128, "%s", su_info_p->info_type);
-	}
-	else
-		snprintf(info_type, 128, "%s", su_info_p->info_type);
+	return TRUE;
+}
 
-	upsdebugx(1, "%s: using info_type '%s'", __func__, info_type);
+static bool_t su_trap_same_host(const struct sockaddr_storage *a, const struct sockaddr *b)
+{
+	if (a->ss_family != b->sa_family)
+		return FALSE;
 
-	if (SU_TYPE(su_info_p) == SU_TYPE_CMD)
-		return;
+	if (b->sa_family == AF_INET)
+		return !memcmp(&((const struct sockaddr_in *)a)->sin_addr,
+			&((const struct sockaddr_in *)b)->sin_addr, sizeof(struct in_addr));
 
-	/* ups.status and {ups, Lx, outlet, outlet.group}.alarm have special
-	 * handling, not here! */
-	if ((strcasecmp(su_info_p->info_type, "ups.status"))
-		&& (strcasecmp(strrchr(su_info_p->info_type, '.'), ".alarm")))
-	{
-		if (value != NULL)
-			dstate_setinfo(info_type, "%s", value);
-		else if (su_info_p->dfl != NULL)
-			dstate_setinfo(info_type, "%s", su_info_p->dfl);
-		else {
-			upsdebugx(3, "%s: no value nor default provided, aborting...", __func__);
-			return;
-		}
+	if (b->sa_family == AF_INET6)
+		return !memcmp(&((const struct sockaddr_in6 *)a)->sin6_addr,
+			&((const struct sockaddr_in6 *)b)->sin6_addr, sizeof(struct in6_addr));
 
-		dstate_setflags(info_type, su_info_p->info_flags);
-		dstate_setaux(info_type, su_info_p->info_len);
+	return FALSE;
+}
 
-		/* Set enumerated values, only if the data has ST_FLAG_RW and there
-		 * are lookup values */
-// FIXME: daisychain settings support: check if applicable
-		if ((su_info_p->info_flags & ST_FLAG_RW) && su_info_p->oid2info) {
+/* the trap OID (snmpTrapOID.0) of <pdu>, into <name> */
+static bool_t su_trap_oid(netsnmp_pdu *pdu, oid *name, size_t *name_len)
+{
+	struct variable_list *var;
+	const oid *trapoid;
+	size_t trapoid_len;
+
+	if (pdu->command == SNMP_MSG_TRAP) {
+		/* SNMPv1, as RFC 3584 translates it */
+		if (pdu->trap_type == 6) {
+			if (pdu->enterprise_length + 2 > MAX_OID_LEN)
+				return FALSE;
+			memcpy(name, pdu->enterprise, pdu->enterprise_length * sizeof(oid));
+			name[pdu->enterprise_length] = 0;
+			name[pdu->enterprise_length + 1] = pdu->specific_type;
+			*name_len = pdu->enterprise_length + 2;
+		}
+		else {
+			trapoid = su_parse_oid(SNMPTRAPS_OID, &trapoid_len);
+			if (trapoid == NULL)
+				return FALSE;
+			memcpy(name, trapoid, trapoid_len * sizeof(oid));
+			name[trapoid_len] = pdu->trap_type + 1;
+			*name_len = trapoid_len + 1;
+		}
+		return TRUE;
+	}
 
-			upsdebugx(3, "%s: adding enumerated values", __func__);
+	trapoid = su_parse_oid(SNMPTRAPOID_OID, &trapoid_len);
+	if (trapoid == NULL)
+		return FALSE;
 
-			/* Loop on all existing values */
-			for (info_lkp = su_info_p->oid2info; info_lkp != NULL
-				&& info_lkp->info_value != NULL; info_lkp++) {
-					dstate_addenum(info_type, "%s", info_lkp->info_value);
-			}
+	for (var = pdu->variables; var; var = var->next_variable) {
+		if ((var->type == ASN_OBJECT_ID)
+			&& !snmp_oid_compare(var->name, var->name_length, trapoid, trapoid_len)
+			&& (var->val_len / sizeof(oid) <= MAX_OID_LEN)) {
+			*name_len = var->val_len / sizeof(oid);
+			memcpy(name, var->val.objid, var->val_len);
+			return TRUE;
 		}
-
-		/* Commit the current value, to avoid staleness with huge
-		 * data collections on slow devices */
-		 dstate_dataok();
 	}
+
+	return FALSE;
 }
 
-void su_status_set(snmp_info_t *su_info_p, long value)
+/* when su_trap_callback() found something for a device, in its context */
+static void su_trap_poll(void *arg)
 {
-	const char *info_value = NULL;
+	upsdebugx(2, "%s: updating now", __func__);
+	poll_now();
+}
 
-	upsdebugx(2, "SNMP UPS driver: entering %s()", __func__);
+static int su_trap_callback(int op, netsnmp_session *session, int reqid,
+	netsnmp_pdu *pdu, void *magic)
+{
+	su_trap_peer_t *peer = NULL;
+	netsnmp_pdu *reply;
+	oid name[MAX_OID_LEN];
+	size_t name_len, j, len;
+	char buf[SU_LARGEBUF];
+	char trap[MAX_OID_LEN * 11];	/* 32 bits sub-identifiers */
+	void *owner;
+	int i;
+
+	if ((op != NETSNMP_CALLBACK_OP_RECEIVED_MESSAGE) || (pdu == NULL))
+		return 1;
+
+	if ((pdu->command != SNMP_MSG_TRAP) && (pdu->command != SNMP_MSG_TRAP2)
+		&& (pdu->command != SNMP_MSG_INFORM))
+		return 1;
+
+	/* an inform waits for its acknowledgement, from the listener that
+	 * took it (see su_trap_listen()) */
+	if (pdu->command == SNMP_MSG_INFORM) {
+		reply = snmp_clone_pdu(pdu);
+		if (reply != NULL) {
+			reply->command = SNMP_MSG_RESPONSE;
+			reply->errstat = 0;
+			reply->errindex = 0;
+			if (!snmp_sess_send(*(void **)magic, reply))
+				snmp_free_pdu(reply);
+		}
+	}
+
+	/* the UDP transports put the sender first there */
+	if (pdu->transport_data != NULL) {
+		for (i = 0; i < su_trap_npeers; i++) {
+			if (su_trap_same_host(&su_trap_peers[i].addr, (struct sockaddr *)pdu->transport_data)) {
+				peer = &su_trap_peers[i];
+				break;
+			}
+		}
+	}
+
+	if (peer == NULL) {
+		upsdebugx(2, "%s: ignoring a trap from an unknown host", __func__);
+		return 1;
+	}
+
+	if (!su_trap_oid(pdu, name, &name_len)) {
+		upsdebugx(2, "%s: trap without snmpTrapOID", __func__);
+		name_len = 0;
+	}
+	else {
+		snprint_objid(buf, sizeof(buf), name, name_len);
+		upsdebugx(2, "%s: trap %s", __func__, buf);
+	}
+
+	/* dotted and numeric, as in the traps_info_t */
+	trap[0] = '\0';
+	for (j = 0, len = 0; (j < name_len) && (len < sizeof(trap)); j++)
+		len += snprintf(trap + len, sizeof(trap) - len, ".%lu", (unsigned long)name[j]);
+
+	/* besides the status, the values this trap is about */
+	for (i = 0; peer->traps && (name_len > 0) && peer->traps[i].OID; i++) {
+		if ((size_t)i >= sizeof(peer->matched) * 8)
+			break;
+
+		if (su_trap_match(peer->traps[i].OID, trap))
+			peer->matched |= 1UL << i;
+	}
+
+	if (!peer->pending) {
+		peer->pending = 1;
+
+		/* poll_now() is about the device that is current */
+		owner = ev_get_owner();
+		ev_set_owner(peer->owner);
+		ev_addtimer(0, 0, su_trap_poll, NULL);
+		ev_set_owner(owner);
+	}
+
+	return 1;
+}
+
+static void su_trap_read(int fd, void *arg)
+{
+	fd_set fds;
+
+	FD_ZERO(&fds);
+	FD_SET(fd, &fds);
+	snmp_sess_read(*(void **)arg, &fds);
+}
+
+/* listen on <addr> into <sessp>; returns FALSE if it can't */
+static bool_t su_trap_listen(const char *addr, void **sessp)
+{
+	netsnmp_session session;
+	netsnmp_transport *transport;
+
+	transport = netsnmp_transport_open_server("snmptrap", addr);
+	if (transport == NULL)
+		return FALSE;
+
+	snmp_sess_init(&session);
+	session.peername = SNMP_DEFAULT_PEERNAME;
+	session.version = SNMP_DEFAULT_VERSION;
+	session.community_len = SNMP_DEFAULT_COMMUNITY_LEN;
+	session.retries = SNMP_DEFAULT_RETRIES;
+	session.timeout = SNMP_DEFAULT_TIMEOUT;
+	session.callback = su_trap_callback;
+	session.callback_magic = sessp;
+	session.isAuthoritative = SNMP_SESS_UNKNOWNAUTH;
+
+	*sessp = snmp_sess_add(&session, transport, NULL, NULL);
+	if (*sessp == NULL)
+		return FALSE;
+
+	ev_addfd(transport->sock, su_trap_read, sessp);
+
+	return TRUE;
+}
+
+/* take the traps from the current device, listening on the "trapport"
+ * (over IPv4 and IPv6, where there is IPv6) if this process doesn't
+ * already */
+static void su_trap_open(void)
+{
+	su_trap_peer_t *peer;
+	char addr[SU_INFOSIZE];
+	int port = atoi(getval(SU_VAR_TRAPPORT));
+
+	if ((port < 1) || (port > 65535))
+		fatalx(EXIT_FAILURE, "Bad %s: %s", SU_VAR_TRAPPORT, getval(SU_VAR_TRAPPORT));
+
+	if (su_trap_port == 0) {
+		snprintf(addr, sizeof(addr), "udp:%d", port);
+		if (!su_trap_listen(addr, &su_trap_sessp[0]))
+			fatalx(EXIT_FAILURE, "Can't listen for traps on UDP port %d", port);
+
+		snprintf(addr, sizeof(addr), "udp6:%d", port);
+		if (!su_trap_listen(addr, &su_trap_sessp[1]))
+			upsdebugx(1, "%s: can't listen for traps over IPv6", __func__);
+
+		su_trap_port = port;
+		upslogx(LOG_INFO, "Listening for SNMP traps on UDP port %d%s", port,
+			su_trap_sessp[1] ? "" : " (IPv4 only)");
+	}
+	else if (port != su_trap_port) {
+		upslogx(LOG_WARNING, "[%s] Already listening for SNMP traps on UDP port %d, not %d",
+			upsname?upsname:device_name, su_trap_port, port);
+	}
+
+	su_trap_peers = xrealloc(su_trap_peers, (su_trap_npeers + 1) * sizeof(*su_trap_peers));
+	peer = &su_trap_peers[su_trap_npeers];
+	memset(peer, 0, sizeof(*peer));
+
+	if (!su_trap_resolve(g_snmp_sess.peername, &peer->addr)) {
+		upslogx(LOG_WARNING, "[%s] Can't resolve %s, ignoring its traps",
+			upsname?upsname:device_name, g_snmp_sess.peername);
+		return;
+	}
+
+	if ((peer->addr.ss_family == AF_INET6) && (su_trap_sessp[1] == NULL)) {
+		upslogx(LOG_WARNING, "[%s] %s is IPv6, but traps are only taken over IPv4",
+			upsname?upsname:device_name, g_snmp_sess.peername);
+	}
+
+	peer->owner = ev_get_owner();
+	peer->traps = traps_info;
+	su_trap_peer = su_trap_npeers++;
+}
+
+/* whether a trap came from the current device since the last update,
+ * and what it was about, into su_trap_matched */
+static int su_trap_take(void)
+{
+	su_trap_peer_t *peer;
+
+	if (su_trap_peer < 0)
+		return 0;
+
+	peer = &su_trap_peers[su_trap_peer];
+	if (!peer->pending)
+		return 0;
+
+	su_trap_matched = peer->matched;
+	peer->pending = 0;
+	peer->matched = 0;
+
+	return 1;
+}
+
+/* whether a trap was about <su_info_p> */
+static int su_trap_wants(const snmp_info_t *su_info_p)
+{
+	int i;
+
+	for (i = 0; su_trap_matched && traps_info[i].OID; i++) {
+		if ((size_t)i >= sizeof(su_trap_matched) * 8)
+			break;
+
+		if ((su_trap_matched & (1UL << i)) && traps_info[i].info_type
+			&& !strncmp(su_info_p->info_type, traps_info[i].info_type, strlen(traps_info[i].info_type)))
+			return 1;
+	}
+
+	return 0;
+}
+
+/* -----------------------------------------------------------
+ * utility functions.
+ * ----------------------------------------------------------- */
+
+/* deal with APCC weirdness on Symmetras */
+static void disable_transfer_oids(void)
+{
+	snmp_info_t *su_info_p;
+
+	upslogx(LOG_INFO, "Disabling transfer OIDs");
+
+	for (su_info_p = &snmp_info[0]; su_info_p->info_type != NULL ; su_info_p++) {
+		if (!strcasecmp(su_info_p->info_type, "input.transfer.low")) {
+			su_info_p->flags &= ~SU_FLAG_OK;
+			continue;
+		}
+
+		if (!strcasecmp(su_info_p->info_type, "input.transfer.high")) {
+			su_info_p->flags &= ~SU_FLAG_OK;
+			continue;
+		}
+	}
+}
+
+/* Universal function to add or update info element.
+ * If value is NULL, use the default one (su_info_p->dfl) if provided */
+void su_setinfo(snmp_info_t *su_info_p, const char *value)
+{
+	info_lkp_t	*info_lkp;
+	char info_type[128];
+
+	upsdebugx(1, "entering %s(%s, %s)", __func__, su_info_p->info_type, (value)?value:"");
+
+	memset(info_type, 0, 20);
+	/* pre-fill with the device name for checking */
+	snprintf(info_type, 128, "device.%i", current_device_number);
+
+	if ((daisychain_enabled == TRUE) && (devices_count > 1)) {
+		/* Only append "device.X" for master and slaves, if not already done! */
+		if ((current_device_number > 0) && (strstr(su_info_p->info_type, info_type) == NULL)) {
+			/* Special case: we remove "device" from the device collection not to
+			 * get "device.X.device.<something>", but "device.X.<something>" */
+			if (!strncmp(su_info_p->info_type, "device.", 7)) {
+				snprintf(info_type, 128, "device.%i.%s",
+					current_device_number, su_info_p->info_type + 7);
+			}
+			else {
+				snprintf(info_type, 128, "device.%i.%s",
+					current_device_number, su_info_p->info_type);
+			}
+		}
+		else
+			snprintf(info_type, 128, "%s", su_info_p->info_type);
+	}
+	else
+		snprintf(info_type, 128, "%s", su_info_p->info_type);
+
+	upsdebugx(1, "%s: using info_type '%s'", __func__, info_type);
+
+	if (SU_TYPE(su_info_p) == SU_TYPE_CMD)
+		return;
+
+	/* ups.status and {ups, Lx, outlet, outlet.group}.alarm have special
+	 * handling, not here! */
+	if ((strcasecmp(su_info_p->info_type, "ups.status"))
+		&& (strcasecmp(strrchr(su_info_p->info_type, '.'), ".alarm")))
+	{
+		if (value != NULL)
+			dstate_setinfo(info_type, "%s", value);
+		else if (su_info_p->dfl != NULL)
+			dstate_setinfo(info_type, "%s", su_info_p->dfl);
+		else {
+			upsdebugx(3, "%s: no value nor default provided, aborting...", __func__);
+			return;
+		}
+
+		dstate_setflags(info_type, su_info_p->info_flags);
+		dstate_setaux(info_type, su_info_p->info_len);
+
+		/* Set enumerated values, only if the data has ST_FLAG_RW and there
+		 * are lookup values */
+// FIXME: daisychain settings support: check if applicable
+		if ((su_info_p->info_flags & ST_FLAG_RW) && su_info_p->oid2info) {
+
+			upsdebugx(3, "%s: adding enumerated values", __func__);
+
+			/* Loop on all existing values */
+			for (info_lkp = su_info_p->oid2info; info_lkp != NULL
+				&& info_lkp->info_value != NULL; info_lkp++) {
+					dstate_addenum(info_type, "%s", info_lkp->info_value);
+			}
+		}
+
+		/* Commit the current value, to avoid staleness with huge
+		 * data collections on slow devices */
+		 dstate_dataok();
+	}
+}
+
+void su_status_set(snmp_info_t *su_info_p, long value)
+{
+	const char *info_value = NULL;
+
+	upsdebugx(2, "SNMP UPS driver: entering %s()", __func__);
 
 	if ((info_value = su_find_infoval(su_info_p->oid2info, value)) != NULL)
 	{
@@ -1254,27 +2091,78 @@ void su_alarm_set(snmp_info_t *su_info_p, long value)
 }
 
 /* find info element definition in my info array. */
-snmp_info_t *su_find_info(const char *type)
+/* index snmp_info by NUT name, once load_mib2nut() has chosen it */
+static void su_index_build(void)
 {
 	snmp_info_t *su_info_p;
+	size_t count, i;
 
-	for (su_info_p = &snmp_info[0]; su_info_p->info_type != NULL ; su_info_p++)
-		if (!strcasecmp(su_info_p->info_type, type)) {
-			upsdebugx(3, "%s: \"%s\" found", __func__, type);
-			return su_info_p;
+	su_index_free();
+
+	for (count = 0; snmp_info[count].info_type != NULL; count++)
+		;
+
+	/* open addressing, at most half full */
+	for (su_index_size = 64; su_index_size < 2 * count; su_index_size *= 2)
+		;
+
+	su_index = xcalloc(su_index_size, sizeof(*su_index));
+
+	for (su_info_p = &snmp_info[0]; su_info_p->info_type != NULL ; su_info_p++) {
+		i = su_hash_name(su_info_p->info_type) & (su_index_size - 1);
+
+		while (su_index[i] != NULL) {
+			/* the first one wins, as in the table */
+			if (!strcasecmp(su_index[i]->info_type, su_info_p->info_type))
+				break;
+
+			i = (i + 1) & (su_index_size - 1);
 		}
 
+		if (su_index[i] == NULL)
+			su_index[i] = su_info_p;
+	}
+}
+
+static void su_index_free(void)
+{
+	free(su_index);
+	su_index = NULL;
+	su_index_size = 0;
+}
+
+snmp_info_t *su_find_info(const char *type)
+{
+	snmp_info_t *su_info_p;
+	size_t i;
+
+	if (su_index != NULL) {
+		for (i = su_hash_name(type) & (su_index_size - 1); su_index[i] != NULL;
+			i = (i + 1) & (su_index_size - 1)) {
+			if (!strcasecmp(su_index[i]->info_type, type)) {
+				upsdebugx(3, "%s: \"%s\" found", __func__, type);
+				return su_index[i];
+			}
+		}
+	}
+	else {
+		/* still looking for the right table */
+		for (su_info_p = &snmp_info[0]; su_info_p->info_type != NULL ; su_info_p++)
+			if (!strcasecmp(su_info_p->info_type, type)) {
+				upsdebugx(3, "%s: \"%s\" found", __func__, type);
+				return su_info_p;
+			}
+	}
+
 	upsdebugx(3, "%s: unknown info type (%s)", __func__, type);
 	return NULL;
 }
 
-/* Counter match the sysOID using {device,ups}.model OID
- * Return TRUE if this OID can be retrieved, FALSE otherwise */
-bool_t match_model_OID()
+/* the OID of {device,ups}.model in snmp_info, which tells whether the
+ * device speaks that MIB; returns FALSE if there is none */
+static bool_t su_model_OID(char *buf, size_t buflen)
 {
-	bool_t retCode = FALSE;
-	snmp_info_t *su_info_p, *cur_info_p;
-	char testOID_buf[LARGEBUF];
+	snmp_info_t *su_info_p;
 
 	/* Try to get device.model first */
 	su_info_p = su_find_info("device.model");
@@ -1282,40 +2170,105 @@ bool_t match_model_OID()
 	if (su_info_p == NULL)
 		su_info_p = su_find_info("ups.model");
 
-	if (su_info_p != NULL) {
-		/* Daisychain specific: we may have a template (including formatting
-		 * string) that needs to be adapted! */
-		if (strchr(su_info_p->OID, '%') != NULL)
-		{
-			upsdebugx(2, "Found template, need to be adapted");
-			cur_info_p = (snmp_info_t *)malloc(sizeof(snmp_info_t));
-			cur_info_p->info_type = (char *)xmalloc(SU_INFOSIZE);
-			cur_info_p->OID = (char *)xmalloc(SU_INFOSIZE);
-			snprintf((char*)cur_info_p->info_type, SU_INFOSIZE, "%s", su_info_p->info_type);
-			/* Use the daisychain master (0) / 1rst device index */
-			snprintf((char*)cur_info_p->OID, SU_INFOSIZE, su_info_p->OID, 0);
-		}
-		else {
-			upsdebugx(2, "Found entry, not a template %s", su_info_p->OID);
-			/* Otherwise, just point at what we found */
-			cur_info_p = su_info_p;
-		}
+	if ((su_info_p == NULL) || (su_info_p->OID == NULL))
+		return FALSE;
 
-		upsdebugx(2, "Testing %s using OID %s", cur_info_p->info_type, cur_info_p->OID);
-		retCode = nut_snmp_get_str(cur_info_p->OID, testOID_buf, LARGEBUF, NULL);
+	/* Daisychain specific: we may have a template (including formatting
+	 * string) that needs to be adapted! */
+	if (strchr(su_info_p->OID, '%') != NULL) {
+		upsdebugx(2, "Found template, need to be adapted");
+		/* Use the daisychain master (0) / 1rst device index */
+		snprintf(buf, buflen, su_info_p->OID, 0);
+	}
+	else {
+		upsdebugx(2, "Found entry, not a template %s", su_info_p->OID);
+		snprintf(buf, buflen, "%s", su_info_p->OID);
+	}
 
-		/* Free our malloc, if it was dynamic */
-		if (strchr(su_info_p->OID, '%') != NULL) {
-			if (cur_info_p->info_type != NULL)
-				free((char*)cur_info_p->info_type);
-			if (cur_info_p->OID != NULL)
-				free((char*)cur_info_p->OID);
-			if (cur_info_p != NULL)
-				free((char*)cur_info_p);
+	return TRUE;
+}
+
+/* Counter match the sysOID using {device,ups}.model OID
+ * Return TRUE if this OID can be retrieved, FALSE otherwise */
+bool_t match_model_OID()
+{
+	char testOID[SU_INFOSIZE];
+	char testOID_buf[LARGEBUF];
+
+	if (su_model_OID(testOID, sizeof(testOID)) != TRUE)
+		return FALSE;
+
+	upsdebugx(2, "Testing model using OID %s", testOID);
+	return nut_snmp_get_str(testOID, testOID_buf, LARGEBUF, NULL);
+}
+
+/* the child of <node> for the sub-identifier <id>, added if <add> */
+static su_sysoid_t *su_sysoid_child(su_sysoid_t *node, oid id, int add)
+{
+	su_sysoid_t *child;
+
+	for (child = node->children; child; child = child->next) {
+		if (child->id == id)
+			return child;
+	}
+
+	if (!add)
+		return NULL;
+
+	child = xcalloc(1, sizeof(*child));
+	child->id = id;
+	child->next = node->children;
+	node->children = child;
+
+	return child;
+}
+
+/* parse the sysOIDs of mib2nut into su_sysoids, once */
+static void su_sysoid_build(void)
+{
+	su_sysoid_t *node;
+	const oid *name;
+	size_t name_len, j;
+	int i;
+
+	if (su_sysoids != NULL)
+		return;
+
+	su_sysoids = xcalloc(1, sizeof(*su_sysoids));
+
+	for (i = 0; mib2nut[i] != NULL; i++) {
+		if (mib2nut[i]->sysOID == NULL)
+			continue;
+
+		if ((name = su_parse_oid(mib2nut[i]->sysOID, &name_len)) == NULL) {
+			upsdebugx(2, "%s: can't build OID %s: %s",
+				__func__, mib2nut[i]->sysOID, snmp_api_errstring(snmp_errno));
+			continue;
 		}
+
+		for (node = su_sysoids, j = 0; j < name_len; j++)
+			node = su_sysoid_child(node, name[j], 1);
+
+		/* in the order of mib2nut, which is that of the matches */
+		node->mibs = xrealloc(node->mibs, (node->nmibs + 1) * sizeof(*node->mibs));
+		node->mibs[node->nmibs++] = i;
 	}
+}
 
-	return retCode;
+static void su_sysoid_free(su_sysoid_t *node)
+{
+	su_sysoid_t *child, *next;
+
+	if (node == NULL)
+		return;
+
+	for (child = node->children; child; child = next) {
+		next = child->next;
+		su_sysoid_free(child);
+	}
+
+	free(node->mibs);
+	free(node);
 }
 
 /* Try to find the MIB using sysOID matching.
@@ -1325,8 +2278,8 @@ mib2nut_info_t *match_sysoid()
 	char sysOID_buf[LARGEBUF];
 	oid device_sysOID[MAX_OID_LEN];
 	size_t device_sysOID_len = MAX_OID_LEN;
-	oid mib2nut_sysOID[MAX_OID_LEN];
-	size_t mib2nut_sysOID_len = MAX_OID_LEN;
+	su_sysoid_t *node;
+	size_t j;
 	int i;
 
 	/* Retrieve sysOID value of this device */
@@ -1343,44 +2296,29 @@ mib2nut_info_t *match_sysoid()
 			return NULL;
 		}
 
-		/* Now, iterate on mib2nut definitions */
-		for (i = 0; mib2nut[i] != NULL; i++)
-		{
-			upsdebugx(1, "%s: checking MIB %s", __func__, mib2nut[i]->mib_name);
+		/* Now, follow it in the mib2nut definitions */
+		su_sysoid_build();
 
-			if (mib2nut[i]->sysOID == NULL)
-				continue;
+		for (node = su_sysoids, j = 0; node && (j < device_sysOID_len); j++)
+			node = su_sysoid_child(node, device_sysOID[j], 0);
 
-			/* Clear variables */
-			memset(mib2nut_sysOID, 0, sizeof(mib2nut_sysOID));
-			mib2nut_sysOID_len = MAX_OID_LEN;
+		for (i = 0; node && (i < node->nmibs); i++)
+		{
+			mib2nut_info_t *m2n = mib2nut[node->mibs[i]];
 
-			if (!read_objid(mib2nut[i]->sysOID, mib2nut_sysOID, &mib2nut_sysOID_len))
-			{
-				upsdebugx(2, "%s: can't build OID %s: %s",
-					__func__, sysOID_buf, snmp_api_errstring(snmp_errno));
+			upsdebugx(2, "%s: sysOID matches MIB '%s'!", __func__, m2n->mib_name);
+			/* Counter verify, using {ups,device}.model */
+			snmp_info = m2n->snmp_info;
 
-				/* Try to continue anyway! */
+			if (match_model_OID() != TRUE) {
+				upsdebugx(2, "%s: testOID provided and doesn't match MIB '%s'!", __func__, m2n->mib_name);
+				snmp_info = NULL;
 				continue;
 			}
-			/* Now compare these */
-			upsdebugx(1, "%s: comparing %s with %s", __func__, sysOID_buf, mib2nut[i]->sysOID);
-			if (!netsnmp_oid_equals(device_sysOID, device_sysOID_len, mib2nut_sysOID, mib2nut_sysOID_len))
-			{
-				upsdebugx(2, "%s: sysOID matches MIB '%s'!", __func__, mib2nut[i]->mib_name);
-				/* Counter verify, using {ups,device}.model */
-				snmp_info = mib2nut[i]->snmp_info;
-
-				if (match_model_OID() != TRUE) {
-					upsdebugx(2, "%s: testOID provided and doesn't match MIB '%s'!", __func__, mib2nut[i]->mib_name);
-					snmp_info = NULL;
-					continue;
-				}
-				else
-					upsdebugx(2, "%s: testOID provided and matches MIB '%s'!", __func__, mib2nut[i]->mib_name);
+			else
+				upsdebugx(2, "%s: testOID provided and matches MIB '%s'!", __func__, m2n->mib_name);
 
-				return mib2nut[i];
-			}
+			return m2n;
 		}
 		/* Yell all to call for user report */
 		upslogx(LOG_ERR, "No matching MIB found for sysOID '%s'!\n" \
@@ -1394,6 +2332,146 @@ mib2nut_info_t *match_sysoid()
 	return NULL;
 }
 
+/* ask the model OIDs of the MIBs <mib> may be, <maxvarbinds> per GET
+ * instead of one by one, up to the first the device has, and set
+ * missing[i] for the MIBs mib2nut[i] whose OID it doesn't have;
+ * returns -1 if it doesn't answer */
+static int su_probe_mibs(const char *mib, char *missing)
+{
+	char testOID[SU_INFOSIZE];
+	const oid **names;
+	size_t *names_len;
+	int *which, *answered;
+	int count, n = 0, first, found = 0, i, j, k, ret = 0;
+	struct snmp_pdu *pdu, *response;
+	struct variable_list *var;
+	int status;
+
+	/* SNMPv1 fails the whole request for one missing OID, which would
+	 * only tell one of them at a time, as the classic method does */
+	if (g_snmp_sess.version == SNMP_VERSION_1)
+		return 0;
+
+	for (count = 0; mib2nut[count] != NULL; count++)
+		;
+
+	names = xcalloc(count, sizeof(*names));
+	names_len = xcalloc(count, sizeof(*names_len));
+	which = xcalloc(count, sizeof(*which));
+	answered = xcalloc(count, sizeof(*answered));
+
+	/* the distinct OIDs to ask, in the order of mib2nut; those that don't
+	 * parse are left to match_model_OID() to fail on */
+	for (i = 0; i < count; i++) {
+		const oid *name;
+		size_t name_len;
+
+		which[i] = -1;
+
+		if (strcmp(mib, "auto") && strcmp(mib, mib2nut[i]->mib_name))
+			continue;
+
+		snmp_info = mib2nut[i]->snmp_info;
+
+		if (su_model_OID(testOID, sizeof(testOID)) != TRUE) {
+			missing[i] = 1;
+			continue;
+		}
+
+		if ((name = su_parse_oid(testOID, &name_len)) == NULL)
+			continue;
+
+		for (j = 0; (j < n) && (names[j] != name); j++)
+			;
+
+		if (j == n) {
+			names[n] = name;
+			names_len[n] = name_len;
+			/* until the device says otherwise */
+			answered[n++] = 1;
+		}
+
+		which[i] = j;
+	}
+
+	snmp_info = NULL;
+
+	/* a single one is asked by match_model_OID() anyway */
+	for (first = 0; (n > 1) && (first < n) && !found; ) {
+		k = (n - first < maxvarbinds) ? n - first : maxvarbinds;
+
+		pdu = snmp_pdu_create(SNMP_MSG_GET);
+		if (pdu == NULL)
+			fatalx(EXIT_FAILURE, "Not enough memory");
+
+		for (i = 0; i < k; i++)
+			snmp_add_null_var(pdu, names[first + i], names_len[first + i]);
+
+		response = NULL;
+		status = snmp_synch_response(g_snmp_sess_p, pdu, &response);
+		su_requests++;
+
+		if ((status != STAT_SUCCESS) || (response == NULL)) {
+			if (response)
+				snmp_free_pdu(response);
+			ret = -1;
+			break;
+		}
+
+		switch (response->errstat)
+		{
+		case SNMP_ERR_NOERROR:
+			for (var = response->variables, i = 0; var && (i < k); var = var->next_variable, i++) {
+				if ((var->type == SNMP_NOSUCHOBJECT) || (var->type == SNMP_NOSUCHINSTANCE)
+					|| (var->type == SNMP_ENDOFMIBVIEW))
+					answered[first + i] = 0;
+				else
+					found = 1;
+			}
+			first += k;
+			break;
+
+		case SNMP_ERR_TOOBIG:
+			/* a single one is left to match_model_OID() */
+			if (k == 1) {
+				found = 1;
+				break;
+			}
+
+			maxvarbinds = k / 2;
+			upsdebugx(2, "%s: response too big, asking %d OID(s) at a time",
+				__func__, maxvarbinds);
+			break;
+
+		default:
+			ret = -1;
+			break;
+		}
+
+		snmp_free_pdu(response);
+
+		if (ret < 0)
+			break;
+	}
+
+	if (ret == 0) {
+		for (i = 0; i < count; i++) {
+			if ((which[i] >= 0) && !answered[which[i]])
+				missing[i] = 1;
+		}
+	}
+
+	upsdebugx(2, "%s: %d of %d model OID(s) asked%s", __func__,
+		first, n, (ret == 0) ? "" : ", no answer");
+
+	free(names);
+	free(names_len);
+	free(which);
+	free(answered);
+
+	return ret;
+}
+
 /* Load the right snmp_info_t structure matching mib parameter */
 bool_t load_mib2nut(const char *mib)
 {
@@ -1418,11 +2496,26 @@ bool_t load_mib2nut(const char *mib)
 	/* Otherwise, revert to the classic method */
 	if (m2n == NULL)
 	{
+		char	*missing;
+
+		/* first, rule out at once the MIBs whose OID the device lacks */
+		for (i = 0; mib2nut[i] != NULL; i++)
+			;
+
+		missing = xcalloc(i + 1, sizeof(*missing));
+
+		if (su_probe_mibs(mib, missing) < 0)
+			memset(missing, 0, i + 1);
+
 		for (i = 0; mib2nut[i] != NULL; i++) {
 			/* Is there already a MIB name provided? */
 			if (strcmp(mib, "auto") && strcmp(mib, mib2nut[i]->mib_name)) {
 				continue;
 			}
+			if (missing[i]) {
+				upsdebugx(2, "%s: testOID not found for MIB '%s'", __func__, mib2nut[i]->mib_name);
+				continue;
+			}
 			upsdebugx(1, "load_mib2nut: trying classic method with '%s' mib", mib2nut[i]->mib_name);
 
 			/* Classic method: test an OID specific to this MIB */
@@ -1440,26 +2533,51 @@ bool_t load_mib2nut(const char *mib)
 			m2n = mib2nut[i];
 			break;
 		}
+
+		free(missing);
 	}
 
 	/* Store the result, if any */
 	if (m2n != NULL)
 	{
 		snmp_info = m2n->snmp_info;
+
+		/* the flags of the table entries are updated while walking, so
+		 * each hosted device (-A) works on its own copy of the table */
+		if (host_mode) {
+			snmp_info_t	*su_info_p;
+
+			for (su_info_p = snmp_info; su_info_p->info_type != NULL; su_info_p++)
+				;
+
+			snmp_info = xmalloc((su_info_p - m2n->snmp_info + 1) * sizeof(snmp_info_t));
+			memcpy(snmp_info, m2n->snmp_info, (su_info_p - m2n->snmp_info + 1) * sizeof(snmp_info_t));
+		}
+
 		OID_pwr_status = m2n->oid_pwr_status;
 		mibname = m2n->mib_name;
 		mibvers = m2n->mib_version;
 		alarms_info = m2n->alarms_info;
+		traps_info = m2n->traps_info;
+		su_index_build();
 		upsdebugx(1, "load_mib2nut: using %s mib", mibname);
 		return TRUE;
 	}
 
 	/* Did we find something or is it really an unknown mib */
 	if (strcmp(mib, "auto") != 0) {
-		fatalx(EXIT_FAILURE, "Unknown mibs value: %s", mib);
-	} else {
-		fatalx(EXIT_FAILURE, "No supported device detected");
+		for (i = 0; (mib2nut[i] != NULL) && strcmp(mib, mib2nut[i]->mib_name); i++)
+			;
+
+		if (mib2nut[i] == NULL)
+			fatalx(EXIT_FAILURE, "Unknown mibs value: %s", mib);
+
+		host_init_failed("%s MIB wasn't found on %s", mib, g_snmp_sess.peername);
+		return FALSE;
 	}
+
+	host_init_failed("No supported device detected");
+	return FALSE;
 }
 
 /* find the OID value matching that INFO_* value */
@@ -1688,6 +2806,55 @@ int base_snmp_template_index(const snmp_info_t *su_info_p)
 	return base_index;
 }
 
+/* Format the OID of instance <number> of an outlet or outlet group
+ * template, for the current device */
+static void su_template_oid(const snmp_info_t *su_info_p, char *buf, size_t buf_len,
+	int number)
+{
+	/* Special processing for daisychain:
+	 * these outlet | outlet groups also include formatting info,
+	 * so we have to check if the daisychain is enabled, and if
+	 * the formatting info for it are in 1rst or 2nd position */
+	if (daisychain_enabled == TRUE) {
+		if (su_info_p->flags & SU_TYPE_DAISY_1) {
+			snprintf(buf, buf_len, su_info_p->OID,
+				current_device_number + device_template_offset, number);
+		}
+		else {
+			snprintf(buf, buf_len, su_info_p->OID,
+				number + device_template_offset, current_device_number - device_template_offset);
+		}
+	}
+	else {
+		snprintf(buf, buf_len, su_info_p->OID, number);
+	}
+}
+
+/* The table column of an outlet or outlet group template, when the
+ * instance number is the last part of its OIDs */
+static bool_t su_template_column(const snmp_info_t *su_info_p, char *buf, size_t buf_len)
+{
+	char	other[SU_INFOSIZE];
+	char	*dot, *otherdot;
+
+	/* server side (ABSENT) data */
+	if (su_info_p->OID == NULL)
+		return FALSE;
+
+	su_template_oid(su_info_p, buf, buf_len, 100000);
+	su_template_oid(su_info_p, other, sizeof(other), 100001);
+
+	dot = strrchr(buf, '.');
+	otherdot = strrchr(other, '.');
+
+	if ((dot == NULL) || (otherdot == NULL) || (dot - buf != otherdot - other)
+		|| strncmp(buf, other, dot - buf) || !strcmp(dot, otherdot))
+		return FALSE;
+
+	*dot = '\0';
+	return TRUE;
+}
+
 /* Try to determine the number of items (outlets, outlet groups, ...),
  * using a template definition. Walk through the template until we can't
  * get anymore values. I.e., if we can iterate up to 8 item, return 8 */
@@ -1697,8 +2864,41 @@ static int guestimate_template_count(snmp_info_t *su_info_p)
 	char test_OID[SU_INFOSIZE];
 	int base_count;
 	const char *OID_template = su_info_p->OID;
+	su_column_t *column;
+	const oid *name;
+	size_t name_len;
+	long value;
+
+	upsdebugx(1, "%s(%s)", __func__, OID_template ? OID_template : "NULL");
+
+	/* server side (ABSENT) data: nothing to count */
+	if (OID_template == NULL)
+		return 0;
+
+	/* read whole with GETBULK: the items are walked from the base index
+	 * up to the last row, so that none past a hole in the table is left
+	 * out (those of the hole are then found missing) */
+	if (su_template_column(su_info_p, test_OID, sizeof(test_OID))) {
+		strncat(test_OID, ".0", sizeof(test_OID) - strlen(test_OID) - 1);
+
+		if (((name = su_parse_oid(test_OID, &name_len)) != NULL)
+			&& ((column = su_column_find(name, name_len)) != NULL)) {
+			/* as below, an invalid index 0 is not an item */
+			if ((su_cache_find(name, name_len) == NULL)
+				|| ((su_info_p->flags & SU_FLAG_ZEROINVALID)
+				&& nut_snmp_get_int(test_OID, &value) && (value == 0)))
+				base_index++;
 
-	upsdebugx(1, "%s(%s)", __func__, OID_template);
+			base_count = 0;
+			if (column->rows && (column->last >= (oid)base_index)
+				&& (column->last - base_index < INT_MAX))
+				base_count = (int)(column->last - base_index + 1);
+
+			upsdebugx(3, "%s: %i (from the table, %i row(s))", __func__,
+				base_count, column->rows);
+			return base_count;
+		}
+	}
 
 	/* Determine if OID index starts from 0 or 1? */
 	snprintf(test_OID, sizeof(test_OID), OID_template, base_index);
@@ -1725,6 +2925,257 @@ static int guestimate_template_count(snmp_info_t *su_info_p)
 	return base_count;
 }
 
+/* Name, default value and OID of instance <number> of a template, into
+ * <instance> as set up by instantiate_info()
+ * type: outlet, outlet.group, device */
+static void su_template_instance(const char *type, const snmp_info_t *su_info_p,
+	int number, snmp_info_t *instance)
+{
+	int cur_nut_index = 0;
+	char tmp_buf[SU_INFOSIZE];
+
+	/* Special processing for daisychain:
+	 * append 'device.x' to the NUT variable name, except for the
+	 * whole daisychain ("device.0") */
+	if (!strncmp(type, "device", 6))
+	{
+		/* Device(s) 1-N (master + slave(s)) need to append 'device.x' */
+		if (current_device_number > 0) {
+			char *ptr = NULL;
+			/* Another special processing for daisychain
+			 * device collection needs special appending */
+			if (!strncmp(su_info_p->info_type, "device.", 7))
+				ptr = (char*)&su_info_p->info_type[7];
+			else
+				ptr = (char*)su_info_p->info_type;
+
+			snprintf((char*)instance->info_type, SU_INFOSIZE,
+					"device.%i.%s", current_device_number, ptr);
+		}
+		else
+		{
+			/* Device 1 ("device.0", whole daisychain) needs no
+			 * special processing */
+			cur_nut_index = number;
+			snprintf((char*)instance->info_type, SU_INFOSIZE,
+					su_info_p->info_type, cur_nut_index);
+		}
+	}
+	else /* Outlet and outlet groups templates */
+	{
+		/* Get the index of the current template instance */
+		cur_nut_index = number;
+
+		/* Special processing for daisychain */
+		if (daisychain_enabled == TRUE) {
+			/* Device(s) 1-N (master + slave(s)) need to append 'device.x' */
+			if ((devices_count > 1) && (current_device_number > 0)) {
+				memset(&tmp_buf[0], 0, SU_INFOSIZE);
+				strcat(&tmp_buf[0], "device.%i.");
+				strcat(&tmp_buf[0], su_info_p->info_type);
+
+				upsdebugx(4, "FORMATTING STRING = %s", &tmp_buf[0]);
+					snprintf((char*)instance->info_type, SU_INFOSIZE,
+						&tmp_buf[0], current_device_number, cur_nut_index);
+			}
+			else {
+				// FIXME: daisychain-whole, what to do?
+				snprintf((char*)instance->info_type, SU_INFOSIZE,
+					su_info_p->info_type, cur_nut_index);
+			}
+		}
+		else {
+			snprintf((char*)instance->info_type, SU_INFOSIZE,
+				su_info_p->info_type, cur_nut_index);
+		}
+	}
+
+	/* check if default value is also a template */
+	if ((su_info_p->dfl != NULL) &&
+		(strstr(su_info_p->dfl, "%i") != NULL)) {
+		if (instance->dfl == su_info_p->dfl)
+			instance->dfl = (char *)xmalloc(SU_INFOSIZE);
+		snprintf((char *)instance->dfl, SU_INFOSIZE, su_info_p->dfl, cur_nut_index);
+	}
+
+	if (instance->OID != NULL) {
+		/* Special processing for daisychain */
+		if (!strncmp(type, "device", 6)) {
+			if (current_device_number > 0) {
+				snprintf((char *)instance->OID, SU_INFOSIZE, su_info_p->OID, current_device_number + device_template_offset);
+			}
+			//else
+			// FIXME: daisychain-whole, what to do?
+		}
+		else {
+			su_template_oid(su_info_p, (char *)instance->OID, SU_INFOSIZE, number);
+		}
+	}
+}
+
+/* Register the command, or get and process the data, of an instance of
+ * template <su_info_p> */
+static bool_t su_template_process(int mode, snmp_info_t *su_info_p, snmp_info_t *instance)
+{
+	bool_t status = TRUE;
+
+	if (instance->OID != NULL) {
+		/* add instant commands to the info database. */
+		if (SU_TYPE(su_info_p) == SU_TYPE_CMD) {
+			upsdebugx(1, "Adding template command %s", instance->info_type);
+			/* FIXME: only add if "su_ups_get(cur_info_p) == TRUE" */
+			if (mode == SU_WALKMODE_INIT)
+				dstate_addcmd(instance->info_type);
+		}
+		else /* get and process this data */
+			status = get_and_process_data(mode, instance);
+	} else {
+		/* server side (ABSENT) data */
+		su_setinfo(instance, NULL);
+	}
+	/* set back the flag */
+	su_info_p->flags = instance->flags;
+
+	return status;
+}
+
+/* -----------------------------------------------------------
+ * Compiled mapping table: the OIDs and instances of snmp_info for each
+ * device, made once the initial walk has found what is there.
+ * ----------------------------------------------------------- */
+
+/* what su_compile() made of <su_info_p> for the current device, or NULL */
+static su_compiled_t *su_compiled_entry(const snmp_info_t *su_info_p)
+{
+	if ((su_compiled == NULL) || (current_device_number < 1)
+		|| (current_device_number > devices_count)
+		|| (su_info_p < snmp_info) || (su_info_p >= snmp_info + su_nentries))
+		return NULL;
+
+	return &su_compiled[current_device_number][su_info_p - snmp_info];
+}
+
+static void su_instances_free(su_compiled_t *compiled, const snmp_info_t *su_info_p)
+{
+	snmp_info_t *instance;
+	int i;
+
+	for (i = 0; i < compiled->count; i++) {
+		instance = &compiled->instances[i];
+		free((char *)instance->info_type);
+		free((char *)instance->OID);
+		if (instance->dfl != su_info_p->dfl)
+			free((char *)instance->dfl);
+	}
+
+	free(compiled->instances);
+	compiled->instances = NULL;
+	compiled->count = 0;
+}
+
+/* the <count> instances of outlet template <su_info_p> from index <base>,
+ * expanded once for the current device; NULL before su_compile() */
+static snmp_info_t *su_compiled_instances(const char *type, snmp_info_t *su_info_p,
+	int base, int count)
+{
+	su_compiled_t *compiled = su_compiled_entry(su_info_p);
+	int i;
+
+	if ((compiled == NULL) || !strncmp(type, "device", 6)
+		|| (SU_TYPE(su_info_p) == SU_TYPE_CMD))
+		return NULL;
+
+	if ((compiled->instances != NULL) && (compiled->base == base) && (compiled->count == count))
+		return compiled->instances;
+
+	/* the number of outlets changed */
+	su_instances_free(compiled, su_info_p);
+
+	compiled->instances = xcalloc(count, sizeof(snmp_info_t));
+	compiled->base = base;
+	compiled->count = count;
+
+	for (i = 0; i < count; i++) {
+		instantiate_info(su_info_p, &compiled->instances[i]);
+		su_template_instance(type, su_info_p, base + i, &compiled->instances[i]);
+	}
+
+	return compiled->instances;
+}
+
+/* format and parse the OIDs of snmp_info for each device, so that the
+ * update walks don't have to */
+static void su_compile(void)
+{
+	snmp_info_t *su_info_p;
+	su_compiled_t *compiled;
+	char buf[SU_INFOSIZE];
+	int saved_device_number = current_device_number;
+
+	su_compile_free();
+
+	for (su_nentries = 0; snmp_info[su_nentries].info_type != NULL; su_nentries++)
+		;
+
+	su_compiled = xcalloc(devices_count + 1, sizeof(*su_compiled));
+
+	for (current_device_number = 1; current_device_number <= devices_count; current_device_number++) {
+		su_compiled[current_device_number] = xcalloc(su_nentries, sizeof(su_compiled_t));
+
+		for (su_info_p = &snmp_info[0]; su_info_p->info_type != NULL ; su_info_p++) {
+			compiled = &su_compiled[current_device_number][su_info_p - snmp_info];
+
+			if (su_info_p->OID == NULL)
+				continue;
+
+			/* the instances are made by process_template() */
+			if (su_info_p->flags & (SU_OUTLET | SU_OUTLET_GROUP)) {
+				if (su_template_column(su_info_p, buf, sizeof(buf)))
+					compiled->column = su_parse_oid(buf, &compiled->column_len);
+				continue;
+			}
+
+			/* Daisychain specific: the OID of this device, as su_ups_get()
+			 * formats it */
+			if (strchr(su_info_p->OID, '%') != NULL) {
+				snprintf(buf, sizeof(buf), su_info_p->OID, current_device_number + device_template_offset);
+				compiled->OID = xstrdup(buf);
+			}
+			else
+				compiled->OID = su_info_p->OID;
+
+			compiled->name = su_parse_oid(compiled->OID, &compiled->name_len);
+		}
+	}
+
+	current_device_number = saved_device_number;
+
+	upsdebugx(2, "%s: %d entries, %ld device(s)", __func__, su_nentries, devices_count);
+}
+
+static void su_compile_free(void)
+{
+	su_compiled_t *compiled;
+	int dev, i;
+
+	if (su_compiled == NULL)
+		return;
+
+	for (dev = 1; dev <= devices_count; dev++) {
+		for (i = 0; i < su_nentries; i++) {
+			compiled = &su_compiled[dev][i];
+			su_instances_free(compiled, &snmp_info[i]);
+			if (compiled->OID != snmp_info[i].OID)
+				free((char *)compiled->OID);
+		}
+		free(su_compiled[dev]);
+	}
+
+	free(su_compiled);
+	su_compiled = NULL;
+	su_nentries = 0;
+}
+
 /* Process template definition, instantiate and get data or register
  * command
  * type: outlet, outlet.group, device */
@@ -1735,12 +3186,10 @@ bool_t process_template(int mode, const char* type, snmp_info_t *su_info_p)
 	 * negative with server side data */
 	bool_t status = TRUE;
 	int cur_template_number = 1;
-	int cur_nut_index = 0;
 	int template_count = 0;
 	int base_snmp_index = 0;
-	snmp_info_t cur_info_p;
+	snmp_info_t cur_info_p, *instances;
 	char template_count_var[SU_BUFSIZE];
-	char tmp_buf[SU_INFOSIZE];
 
 	upsdebugx(1, "%s template definition found (%s)...", type, su_info_p->info_type);
 
@@ -1763,123 +3212,29 @@ bool_t process_template(int mode, const char* type, snmp_info_t *su_info_p)
 	}
 
 	/* Only instantiate templates if needed! */
-	if (template_count > 0) {
-		/* general init of data using the template */
-		instantiate_info(su_info_p, &cur_info_p);
-
-		base_snmp_index = base_snmp_template_index(su_info_p);
-
-		for (cur_template_number = base_snmp_index ;
-				cur_template_number < (template_count + base_snmp_index) ;
-				cur_template_number++)
-		{
-			/* Special processing for daisychain:
-			 * append 'device.x' to the NUT variable name, except for the
-			 * whole daisychain ("device.0") */
-			if (!strncmp(type, "device", 6))
-			{
-				/* Device(s) 1-N (master + slave(s)) need to append 'device.x' */
-				if (current_device_number > 0) {
-					char *ptr = NULL;
-					/* Another special processing for daisychain
-					 * device collection needs special appending */
-					if (!strncmp(su_info_p->info_type, "device.", 7))
-						ptr = (char*)&su_info_p->info_type[7];
-					else
-						ptr = (char*)su_info_p->info_type;
-
-					snprintf((char*)cur_info_p.info_type, SU_INFOSIZE,
-							"device.%i.%s", current_device_number, ptr);
-				}
-				else
-				{
-					/* Device 1 ("device.0", whole daisychain) needs no
-					 * special processing */
-					cur_nut_index = cur_template_number;
-					snprintf((char*)cur_info_p.info_type, SU_INFOSIZE,
-							su_info_p->info_type, cur_nut_index);
-				}
-			}
-			else /* Outlet and outlet groups templates */
-			{
-				/* Get the index of the current template instance */
-				cur_nut_index = cur_template_number;
-
-				/* Special processing for daisychain */
-				if (daisychain_enabled == TRUE) {
-					/* Device(s) 1-N (master + slave(s)) need to append 'device.x' */
-					if ((devices_count > 1) && (current_device_number > 0)) {
-						memset(&tmp_buf[0], 0, SU_INFOSIZE);
-						strcat(&tmp_buf[0], "device.%i.");
-						strcat(&tmp_buf[0], su_info_p->info_type);
-
-						upsdebugx(4, "FORMATTING STRING = %s", &tmp_buf[0]);
-							snprintf((char*)cur_info_p.info_type, SU_INFOSIZE,
-								&tmp_buf[0], current_device_number, cur_nut_index);
-					}
-					else {
-						// FIXME: daisychain-whole, what to do?
-						snprintf((char*)cur_info_p.info_type, SU_INFOSIZE,
-							su_info_p->info_type, cur_nut_index);
-					}
-				}
-				else {
-					snprintf((char*)cur_info_p.info_type, SU_INFOSIZE,
-						su_info_p->info_type, cur_nut_index);
-				}
-			}
+	if (template_count > 0) {
+		base_snmp_index = base_snmp_template_index(su_info_p);
 
-			/* check if default value is also a template */
-			if ((cur_info_p.dfl != NULL) &&
-				(strstr(su_info_p->dfl, "%i") != NULL)) {
-				cur_info_p.dfl = (char *)xmalloc(SU_INFOSIZE);
-				snprintf((char *)cur_info_p.dfl, SU_INFOSIZE, su_info_p->dfl, cur_nut_index);
+		/* after the initial walk, they are made once */
+		instances = su_compiled_instances(type, su_info_p, base_snmp_index, template_count);
+		if (instances != NULL) {
+			for (cur_template_number = 0 ; cur_template_number < template_count ;
+					cur_template_number++) {
+				instances[cur_template_number].flags = su_info_p->flags;
+				status = su_template_process(mode, su_info_p, &instances[cur_template_number]);
 			}
+			return status;
+		}
 
-			if (cur_info_p.OID != NULL) {
-				/* Special processing for daisychain */
-				if (!strncmp(type, "device", 6)) {
-					if (current_device_number > 0) {
-						snprintf((char *)cur_info_p.OID, SU_INFOSIZE, su_info_p->OID, current_device_number + device_template_offset);
-					}
-					//else
-					// FIXME: daisychain-whole, what to do?
-				}
-				else {
-					/* Special processing for daisychain:
-					 * these outlet | outlet groups also include formatting info,
-					 * so we have to check if the daisychain is enabled, and if
-					 * the formatting info for it are in 1rst or 2nd position */
-					if (daisychain_enabled == TRUE) {
-						if (su_info_p->flags & SU_TYPE_DAISY_1) {
-							snprintf((char *)cur_info_p.OID, SU_INFOSIZE,
-								su_info_p->OID, current_device_number + device_template_offset, cur_template_number);
-						}
-						else {
-							snprintf((char *)cur_info_p.OID, SU_INFOSIZE,
-								su_info_p->OID, cur_template_number + device_template_offset, current_device_number - device_template_offset);
-						}
-					}
-					else {
-						snprintf((char *)cur_info_p.OID, SU_INFOSIZE, su_info_p->OID, cur_template_number);
-					}
-				}
+		/* general init of data using the template */
+		instantiate_info(su_info_p, &cur_info_p);
 
-				/* add instant commands to the info database. */
-				if (SU_TYPE(su_info_p) == SU_TYPE_CMD) {
-					upsdebugx(1, "Adding template command %s", cur_info_p.info_type);
-					/* FIXME: only add if "su_ups_get(cur_info_p) == TRUE" */
-					if (mode == SU_WALKMODE_INIT)
-						dstate_addcmd(cur_info_p.info_type);
-				}
-				else /* get and process this data */
-					status = get_and_process_data(mode, &cur_info_p);
-			} else {
-				/* server side (ABSENT) data */
-				su_setinfo(&cur_info_p, NULL);
-			}
-			/* set back the flag */
-			su_info_p->flags = cur_info_p.flags;
+		for (cur_template_number = base_snmp_index ;
+				cur_template_number < (template_count + base_snmp_index) ;
+				cur_template_number++)
+		{
+			su_template_instance(type, su_info_p, cur_template_number, &cur_info_p);
+			status = su_template_process(mode, su_info_p, &cur_info_p);
 		}
 		free((char*)cur_info_p.info_type);
 		if (cur_info_p.OID != NULL)
@@ -2224,12 +3579,528 @@ int process_phase_data(const char* type, long *nb_phases, snmp_info_t *su_info_p
 
 
 /* walk ups variables and set elements of the info array. */
+/* the items a quick walk reads */
+static int su_quick(const snmp_info_t *su_info_p)
+{
+	return !strcmp(su_info_p->info_type, "ups.status")
+		|| !strncmp(su_info_p->info_type, "ups.alarm", 9)
+		|| poll_urgent(su_info_p->info_type)
+		|| su_trap_wants(su_info_p);
+}
+
+/* the items read less often while they don't change; not the status,
+ * and not on daisychains, where one entry serves several devices */
+static int su_ages(const snmp_info_t *su_info_p)
+{
+	return (devices_count == 1)
+		&& strcmp(su_info_p->info_type, "ups.status")
+		&& strncmp(su_info_p->info_type, "ups.alarm", 9);
+}
+
+/* the entries of the current device that snmp_ups_walk() reads */
+static int su_prefetch_wants(int mode, const snmp_info_t *su_info_p)
+{
+	if ((su_info_p->OID == NULL) || (SU_TYPE(su_info_p) == SU_TYPE_CMD))
+		return 0;
+
+	if (su_info_p->flags & SU_FLAG_ABSENT)
+		return 0;
+
+	if ((mode == SU_WALKMODE_INIT) && !strncmp(su_info_p->info_type, "device.count", 12))
+		return 0;
+
+	if ((mode == SU_WALKMODE_UPDATE)
+		&& (!(su_info_p->flags & SU_FLAG_OK) || (su_info_p->flags & SU_FLAG_STATIC)))
+		return 0;
+
+	if (walk_quick && !su_quick(su_info_p))
+		return 0;
+
+	/* process_template() reads them whatever their age */
+	if (su_info_p->flags & (SU_OUTLET | SU_OUTLET_GROUP))
+		return 1;
+
+	if ((mode == SU_WALKMODE_UPDATE) && su_ages(su_info_p) && !poll_due(&su_info_p->age)
+		&& !su_trap_wants(su_info_p))
+		return 0;
+
+	return 1;
+}
+
+static void su_column_add(const oid *name, size_t name_len)
+{
+	su_column_t *column;
+	int i;
+
+	for (i = 0; i < su_ncolumns; i++) {
+		if ((su_columns[i].name_len == name_len)
+			&& !memcmp(su_columns[i].name, name, name_len * sizeof(oid)))
+			return;
+	}
+
+	if (su_ncolumns == su_maxcolumns) {
+		su_maxcolumns = su_maxcolumns ? 2 * su_maxcolumns : 16;
+		su_columns = xrealloc(su_columns, su_maxcolumns * sizeof(*su_columns));
+	}
+
+	column = &su_columns[su_ncolumns++];
+	memset(column, 0, sizeof(*column));
+	column->name = name;
+	column->name_len = name_len;
+	column->state = SU_COLUMN_ACTIVE;
+}
+
+/* one more row of <column>, or the end of it */
+static void su_column_row(su_column_t *column, struct variable_list *var)
+{
+	if ((var->type == SNMP_ENDOFMIBVIEW) || (var->name_length <= column->name_len)
+		|| memcmp(var->name, column->name, column->name_len * sizeof(oid))) {
+		column->state = SU_COLUMN_DONE;
+		return;
+	}
+
+	/* more than one index, or going back: not the table we thought */
+	if ((var->name_length != column->name_len + 1)
+		|| (column->rows && (var->name[column->name_len] <= column->last))) {
+		column->state = SU_COLUMN_FAILED;
+		return;
+	}
+
+	column->last = var->name[column->name_len];
+	column->rows++;
+
+	su_cache_add(var);
+}
+
+/* the answer to a request of su_prefetch_run() */
+static int su_request_callback(int op, netsnmp_session *session, int reqid,
+	netsnmp_pdu *pdu, void *magic)
+{
+	su_request_t *req = (su_request_t *)magic;
+
+	if ((op == NETSNMP_CALLBACK_OP_RECEIVED_MESSAGE) && (pdu != NULL)) {
+		/* net-snmp frees <pdu> when we return */
+		req->response = snmp_clone_pdu(pdu);
+		req->status = STAT_SUCCESS;
+	}
+	else
+		req->status = STAT_TIMEOUT;
+
+	req->state = SU_REQUEST_ANSWERED;
+	return 1;
+}
+
+static void su_request_send(su_request_t *req, struct snmp_pdu *pdu)
+{
+	req->response = NULL;
+	req->state = SU_REQUEST_SENT;
+	su_requests++;
+
+	if (!snmp_sess_async_send(snmp_sess_pointer(g_snmp_sess_p), pdu, su_request_callback, req)) {
+		snmp_free_pdu(pdu);
+		req->status = STAT_ERROR;
+		req->state = SU_REQUEST_ANSWERED;
+	}
+}
+
+/* wait for answers, or for net-snmp to retry or give up on a request */
+static void su_request_wait(void)
+{
+	void *sessp = snmp_sess_pointer(g_snmp_sess_p);
+	int numfds = 0, block = 1, ret;
+	fd_set fds;
+	struct timeval timeout;
+
+	FD_ZERO(&fds);
+	snmp_sess_select_info(sessp, &numfds, &fds, &timeout, &block);
+
+	ret = select(numfds, &fds, NULL, NULL, block ? NULL : &timeout);
+
+	if (ret > 0)
+		snmp_sess_read(sessp, &fds);
+	else if (ret == 0)
+		snmp_sess_timeout(sessp);
+	else if (errno != EINTR)
+		fatal_with_errno(EXIT_FAILURE, "select");
+}
+
+/* ask the first <n> OIDs from <first> of su_prefetch_oids with a GET */
+static void su_request_get(su_request_t *req, int first, int n)
+{
+	struct snmp_pdu *pdu;
+	int i;
+
+	pdu = snmp_pdu_create(SNMP_MSG_GET);
+	if (pdu == NULL)
+		fatalx(EXIT_FAILURE, "Not enough memory");
+
+	for (i = first; i < first + n; i++)
+		snmp_add_null_var(pdu, su_prefetch_oids[i].name, su_prefetch_oids[i].name_len);
+
+	req->type = SNMP_MSG_GET;
+	req->first = first;
+	req->n = n;
+	su_request_send(req, pdu);
+}
+
+/* ask the next <maxrepetitions> rows of up to <maxvarbinds> of the
+ * template columns that aren't asked already; 0 if there is none */
+static int su_request_bulk(su_request_t *req)
+{
+	struct snmp_pdu *pdu;
+	su_column_t *column;
+	oid name[MAX_OID_LEN];
+	int i;
+
+	if (req->maxcolumns < maxvarbinds) {
+		req->maxcolumns = maxvarbinds;
+		req->columns = xrealloc(req->columns, req->maxcolumns * sizeof(*req->columns));
+	}
+
+	for (i = 0, req->n = 0; (i < su_ncolumns) && (req->n < maxvarbinds); i++) {
+		column = &su_columns[i];
+		if ((column->state == SU_COLUMN_ACTIVE) && !column->busy)
+			req->columns[req->n++] = column;
+	}
+
+	if (req->n == 0)
+		return 0;
+
+	pdu = snmp_pdu_create(SNMP_MSG_GETBULK);
+	if (pdu == NULL)
+		fatalx(EXIT_FAILURE, "Not enough memory");
+
+	pdu->non_repeaters = 0;
+	pdu->max_repetitions = maxrepetitions;
+
+	/* each from its last row on */
+	for (i = 0; i < req->n; i++) {
+		column = req->columns[i];
+		column->busy = 1;
+
+		memcpy(name, column->name, column->name_len * sizeof(oid));
+		name[column->name_len] = column->last;
+		snmp_add_null_var(pdu, name, column->name_len + (column->rows ? 1 : 0));
+	}
+
+	req->type = SNMP_MSG_GETBULK;
+	su_request_send(req, pdu);
+	return 1;
+}
+
+/* what to ask again after a GET for some of su_prefetch_oids */
+static void su_range_push(int first, int n)
+{
+	if (su_nranges == su_maxranges) {
+		su_maxranges = su_maxranges ? 2 * su_maxranges : 16;
+		su_ranges = xrealloc(su_ranges, su_maxranges * sizeof(*su_ranges));
+	}
+
+	su_ranges[su_nranges].first = first;
+	su_ranges[su_nranges++].n = n;
+}
+
+/* the answer to a GET; returns -1 if the agent doesn't answer */
+static int su_answer_get(su_request_t *req)
+{
+	struct snmp_pdu *response = req->response;
+	struct variable_list *var;
+	su_oidref_t tmp;
+	int i;
+
+	if ((req->status != STAT_SUCCESS) || (response == NULL)) {
+		if (response)
+			snmp_free_pdu(response);
+		return -1;
+	}
+
+	switch (response->errstat)
+	{
+	case SNMP_ERR_NOERROR:
+		for (var = response->variables; var; var = var->next_variable) {
+			/* SNMPv2 exceptions, left to su_ups_get() to report */
+			if ((var->type == SNMP_NOSUCHOBJECT) || (var->type == SNMP_NOSUCHINSTANCE)
+				|| (var->type == SNMP_ENDOFMIBVIEW))
+				continue;
+
+			su_cache_add(var);
+		}
+		su_cache_keep(response);
+		return 0;
+
+	case SNMP_ERR_TOOBIG:
+		snmp_free_pdu(response);
+		/* a single one is left to a GET of its own */
+		if (req->n == 1)
+			return 0;
+
+		/* remember it for the next walks */
+		if (maxvarbinds > req->n / 2) {
+			maxvarbinds = req->n / 2;
+			upsdebugx(2, "%s: response too big, asking %d OID(s) at a time",
+				__func__, maxvarbinds);
+		}
+
+		su_range_push(req->first, req->n / 2);
+		su_range_push(req->first + req->n / 2, req->n - req->n / 2);
+		return 0;
+
+	default:
+		/* SNMPv1 fails the whole request for one missing OID: leave that
+		 * one to a GET of its own, and ask the others again */
+		i = (int)response->errindex - 1;
+		snmp_free_pdu(response);
+
+		if ((i < 0) || (i >= req->n))
+			return -1;
+
+		tmp = su_prefetch_oids[req->first];
+		su_prefetch_oids[req->first] = su_prefetch_oids[req->first + i];
+		su_prefetch_oids[req->first + i] = tmp;
+
+		if (req->n > 1)
+			su_range_push(req->first + 1, req->n - 1);
+		return 0;
+	}
+}
+
+/* the answer to a GETBULK */
+static void su_answer_bulk(su_request_t *req)
+{
+	struct snmp_pdu *response = req->response;
+	struct variable_list *var;
+	su_column_t *column;
+	int i, rows;
+
+	for (i = 0; i < req->n; i++)
+		req->columns[i]->busy = 0;
+
+	if ((req->status != STAT_SUCCESS) || (response == NULL)
+		|| (response->errstat != SNMP_ERR_NOERROR)) {
+
+		/* fewer rows, for this and the later walks */
+		if ((req->status == STAT_SUCCESS) && response
+			&& (response->errstat == SNMP_ERR_TOOBIG) && (maxrepetitions > 1)) {
+			maxrepetitions /= 2;
+			upsdebugx(2, "%s: response too big, asking %d row(s) at a time",
+				__func__, maxrepetitions);
+			snmp_free_pdu(response);
+			return;
+		}
+
+		upsdebugx(2, "%s: GETBULK failed, reading the rows one by one", __func__);
+		for (i = 0; i < req->n; i++)
+			req->columns[i]->state = SU_COLUMN_FAILED;
+
+		if (response)
+			snmp_free_pdu(response);
+		return;
+	}
+
+	/* row after row, a variable of each column asked */
+	rows = 0;
+	for (var = response->variables, i = 0; var; var = var->next_variable, i++) {
+		column = req->columns[i % req->n];
+		if (column->state != SU_COLUMN_ACTIVE)
+			continue;
+
+		su_column_row(column, var);
+		rows++;
+	}
+
+	su_cache_keep(response);
+
+	/* the agent may cut a response short, but not to nothing */
+	if (rows == 0) {
+		for (i = 0; i < req->n; i++) {
+			if (req->columns[i]->state == SU_COLUMN_ACTIVE)
+				req->columns[i]->state = SU_COLUMN_FAILED;
+		}
+	}
+}
+
+/* read the <count> su_prefetch_oids, <maxvarbinds> per GET, and the
+ * template columns with GETBULK, keeping up to <maxinflight> requests on
+ * the way; returns the number of requests */
+static int su_prefetch_run(int count)
+{
+	su_request_t *req;
+	int i, first, n, inflight, sent, requests = 0, giveup = 0;
+
+	if (su_maxwindow < maxinflight) {
+		su_window = xrealloc(su_window, maxinflight * sizeof(*su_window));
+		memset(&su_window[su_maxwindow], 0, (maxinflight - su_maxwindow) * sizeof(*su_window));
+		su_maxwindow = maxinflight;
+	}
+
+	/* taken from the end: the first OIDs are asked first */
+	su_nranges = 0;
+	for (i = (count + maxvarbinds - 1) / maxvarbinds; i > 0; i--) {
+		first = (i - 1) * maxvarbinds;
+		n = count - first;
+		su_range_push(first, (n < maxvarbinds) ? n : maxvarbinds);
+	}
+
+	while (1) {
+		/* fill the window */
+		inflight = sent = 0;
+		for (i = 0; i < maxinflight; i++) {
+			req = &su_window[i];
+
+			if ((req->state == SU_REQUEST_IDLE) && !giveup) {
+				if (su_nranges > 0) {
+					su_nranges--;
+					su_request_get(req, su_ranges[su_nranges].first, su_ranges[su_nranges].n);
+					requests++;
+				}
+				else if (su_request_bulk(req))
+					requests++;
+			}
+
+			if (req->state != SU_REQUEST_IDLE)
+				inflight++;
+			if (req->state == SU_REQUEST_SENT)
+				sent++;
+		}
+
+		if (inflight == 0)
+			break;
+
+		if (sent > 0)
+			su_request_wait();
+
+		/* and apply what came back */
+		for (i = 0; i < maxinflight; i++) {
+			req = &su_window[i];
+			if (req->state != SU_REQUEST_ANSWERED)
+				continue;
+
+			req->state = SU_REQUEST_IDLE;
+
+			if (req->type == SNMP_MSG_GETBULK)
+				su_answer_bulk(req);
+			else if ((su_answer_get(req) < 0) && !giveup) {
+				upsdebugx(2, "%s: no answer, reading the OIDs one by one", __func__);
+				giveup = 1;
+			}
+		}
+	}
+
+	/* the rest of the columns are read one by one */
+	for (i = 0; i < su_ncolumns; i++) {
+		if (su_columns[i].state == SU_COLUMN_ACTIVE)
+			su_columns[i].state = SU_COLUMN_FAILED;
+	}
+
+	return requests;
+}
+
+/* gather the values the walk of the current device needs into
+ * su_prefetch_oids, from <count> on, and its template columns; returns
+ * the new count */
+static int su_prefetch_device(int mode, int count)
+{
+	snmp_info_t *su_info_p;
+	su_compiled_t *compiled;
+	const oid *name;
+	size_t name_len;
+	char buf[SU_INFOSIZE];
+
+	for (su_info_p = &snmp_info[0]; su_info_p->info_type != NULL ; su_info_p++) {
+		if (!su_prefetch_wants(mode, su_info_p))
+			continue;
+
+		/* formatted and parsed by su_compile() after the first walk */
+		compiled = su_compiled_entry(su_info_p);
+
+		if (su_info_p->flags & (SU_OUTLET | SU_OUTLET_GROUP)) {
+			if (maxrepetitions < 1)
+				continue;
+
+			name = NULL;
+			if (compiled != NULL)
+				name = compiled->column;
+			else if (su_template_column(su_info_p, buf, sizeof(buf)))
+				name = su_parse_oid(buf, &name_len);
+
+			if (name != NULL)
+				su_column_add(name, compiled ? compiled->column_len : name_len);
+			continue;
+		}
+
+		if (maxvarbinds < 2)
+			continue;
+
+		/* Daisychain specific: the same OID for all the devices, asked
+		 * for the first one */
+		if ((current_device_number > 1) && (strchr(su_info_p->OID, '%') == NULL))
+			continue;
+
+		if (compiled != NULL) {
+			name = compiled->name;
+			name_len = compiled->name_len;
+		}
+		else {
+			/* Daisychain specific: the OID of this device, as su_ups_get()
+			 * formats it */
+			if (strchr(su_info_p->OID, '%') != NULL)
+				snprintf(buf, sizeof(buf), su_info_p->OID, current_device_number + device_template_offset);
+			else
+				snprintf(buf, sizeof(buf), "%s", su_info_p->OID);
+
+			name = su_parse_oid(buf, &name_len);
+		}
+
+		/* not a valid OID, su_ups_get() will say so */
+		if (name == NULL)
+			continue;
+
+		if (count == su_prefetch_maxoids) {
+			su_prefetch_maxoids = su_prefetch_maxoids ? 2 * su_prefetch_maxoids : 64;
+			su_prefetch_oids = xrealloc(su_prefetch_oids, su_prefetch_maxoids * sizeof(*su_prefetch_oids));
+		}
+
+		su_prefetch_oids[count].name = name;
+		su_prefetch_oids[count++].name_len = name_len;
+	}
+
+	return count;
+}
+
+/* read the values the walk of all the devices needs, into the cache
+ * nut_snmp_get() looks into first */
+static void su_prefetch(int mode)
+{
+	int saved_device_number = current_device_number;
+	int count = 0, rows = 0, requests, i;
+
+	for (current_device_number = 1; current_device_number <= devices_count; current_device_number++)
+		count = su_prefetch_device(mode, count);
+
+	current_device_number = saved_device_number;
+
+	if ((count == 0) && (su_ncolumns == 0))
+		return;
+
+	requests = su_prefetch_run(count);
+
+	for (i = 0; i < su_ncolumns; i++)
+		rows += su_columns[i].rows;
+
+	upsdebugx(2, "%s: %d OID(s), %d column(s) of %d row(s) in %d request(s)",
+		__func__, count, su_ncolumns, rows, requests);
+}
+
 bool_t snmp_ups_walk(int mode)
 {
 	long *input_phases, *output_phases, *bypass_phases;
-	static unsigned long iterations = 0;
 	snmp_info_t *su_info_p;
 	bool_t status = FALSE;
+	unsigned long changes;
+	long long started = ev_now();
+	clock_t cpu = clock();
+
+	su_requests = 0;
 
 	/* Loop through all device(s) */
 	/* Note: considering "unitary" and "daisy-chained" devices, we have
@@ -2250,6 +4121,9 @@ bool_t snmp_ups_walk(int mode)
 	 * for the whole (#0) virtual device, so it *seems* similar to unitary.
 	 */
 
+	/* read what all the devices need in a few requests */
+	su_prefetch(mode);
+
 	for (current_device_number = 0 ; current_device_number <= devices_count ; current_device_number++)
 	{
 		/* reinit the alarm buffer, before */
@@ -2273,6 +4147,7 @@ bool_t snmp_ups_walk(int mode)
 			/* Check if we are asked to stop (reactivity++) */
 			if (exit_flag != 0) {
 				upsdebugx(1, "%s: aborting because exit_flag was set", __func__);
+				su_cache_clear();
 				return TRUE;
 			}
 
@@ -2307,6 +4182,10 @@ bool_t snmp_ups_walk(int mode)
 			if ((mode == SU_WALKMODE_UPDATE) && (su_info_p->flags & SU_FLAG_STATIC))
 				continue;
 
+			/* between full walks, only the status */
+			if (walk_quick && !su_quick(su_info_p))
+				continue;
+
 			/* Set default value if we cannot fetch it */
 			/* and set static flag on this element.
 			 * Not applicable to outlets (need SU_FLAG_STATIC tagging) */
@@ -2333,7 +4212,7 @@ bool_t snmp_ups_walk(int mode)
 
 			/* check stale elements only on each PN_STALE_RETRY iteration. */
 	/*		if ((su_info_p->flags & SU_FLAG_STALE) &&
-					(iterations % SU_STALE_RETRY) != 0)
+					(walk_iterations % SU_STALE_RETRY) != 0)
 				continue;
 	*/
 			/* Filter 1-phase Vs 3-phase according to {input,output,bypass}.phase.
@@ -2378,13 +4257,22 @@ bool_t snmp_ups_walk(int mode)
 				else
 					status = process_template(mode, "outlet.group", su_info_p);
 			}
+			else if ((mode == SU_WALKMODE_UPDATE) && su_ages(su_info_p)
+				&& !poll_due(&su_info_p->age) && !su_trap_wants(su_info_p)) {
+				/* hasn't changed for a while, read it less often */
+				continue;
+			}
 			else {
 /*				if (daisychain_enabled == TRUE) {
 					status = process_template(mode, "device", su_info_p);
 				}
 				else {
 */					/* get and process this data, including daisychain adaptation */
+					changes = dstate_changes();
 					status = get_and_process_data(mode, su_info_p);
+
+					if ((mode == SU_WALKMODE_UPDATE) && su_ages(su_info_p))
+						poll_seen(&su_info_p->age, dstate_changes() != changes);
 //				}
 			}
 		}	/* for (su_info_p... */
@@ -2397,7 +4285,14 @@ bool_t snmp_ups_walk(int mode)
 			device_alarm_init();
 		}
 	}
-	iterations++;
+	su_cache_clear();
+	walk_iterations++;
+
+	/* what a walk costs, apart from waiting for the device */
+	upsdebugx(2, "%s: %lu request(s), %lld ms, %.1f ms of CPU", __func__,
+		su_requests, ev_now() - started,
+		(double)(clock() - cpu) * 1000 / CLOCKS_PER_SEC);
+
 	return status;
 }
 
@@ -2414,36 +4309,47 @@ bool_t su_ups_get(snmp_info_t *su_info_p)
 	int index = 0;
 	char *format_char = NULL;
 	snmp_info_t *tmp_info_p = NULL;
+	snmp_info_t compiled_info;
+	su_compiled_t *compiled;
 
 	upsdebugx(2, "%s: %s %s", __func__, su_info_p->info_type, su_info_p->OID);
 
 	/* Check if this is a daisychain template */
 	if ((format_char = strchr(su_info_p->OID, '%')) != NULL) {
-		tmp_info_p = instantiate_info(su_info_p, tmp_info_p);
-		if (tmp_info_p != NULL) {
-			/* adapt the OID */
-			if (su_info_p->OID != NULL) {
-				snprintf((char *)tmp_info_p->OID, SU_INFOSIZE, su_info_p->OID,
-					current_device_number + device_template_offset);
-			}
-			else {
-				free_info(tmp_info_p);
-				return FALSE;
-			}
+		/* su_compile() already has the OID of this device */
+		compiled = su_compiled_entry(su_info_p);
+		if ((compiled != NULL) && (compiled->OID != NULL)) {
+			compiled_info = *su_info_p;
+			compiled_info.OID = compiled->OID;
+			su_info_p = &compiled_info;
+		}
+		else {
+			tmp_info_p = instantiate_info(su_info_p, tmp_info_p);
+			if (tmp_info_p != NULL) {
+				/* adapt the OID */
+				if (su_info_p->OID != NULL) {
+					snprintf((char *)tmp_info_p->OID, SU_INFOSIZE, su_info_p->OID,
+						current_device_number + device_template_offset);
+				}
+				else {
+					free_info(tmp_info_p);
+					return FALSE;
+				}
 
-			/* adapt info_type */
-			if (su_info_p->info_type != NULL) {
-				snprintf((char *)tmp_info_p->info_type, SU_INFOSIZE, "%s", su_info_p->info_type);
+				/* adapt info_type */
+				if (su_info_p->info_type != NULL) {
+					snprintf((char *)tmp_info_p->info_type, SU_INFOSIZE, "%s", su_info_p->info_type);
+				}
+				else {
+					free_info(tmp_info_p);
+					return FALSE;
+				}
+				su_info_p = tmp_info_p;
 			}
 			else {
-				free_info(tmp_info_p);
+				upsdebugx(2, "%s: can't instantiate template", __func__);
 				return FALSE;
 			}
-			su_info_p = tmp_info_p;
-		}
-		else {
-			upsdebugx(2, "%s: can't instantiate template", __func__);
-			return FALSE;
 		}
 	}
 
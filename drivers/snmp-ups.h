@@ -30,10 +30,8 @@
 - add syscontact/location (to all mib.h or centralized?)
 - complete shutdown
 - add enum values to OIDs.
-- optimize network flow by:
-  1) caching OID values (as in usbhid-ups) with timestamping and lifetime
-  2) constructing one big packet (calling snmp_add_null_var
-     for each OID request we made), instead of sending many small packets
+- optimize network flow by caching OID values (as in usbhid-ups) with
+  timestamping and lifetime
 - add support for registration and traps (manager mode)
   => Issue: 1 trap listener for N snmp-ups drivers!
 - complete mib2nut data (add all OID translation to NUT)
@@ -49,6 +47,8 @@
 #ifndef SNMP_UPS_H
 #define SNMP_UPS_H
 
+#include "main.h"	/* for poll_age_t */
+
 /* FIXME: still needed?
  * workaround for buggy Net-SNMP config */
 #ifdef PACKAGE_BUGREPORT
@@ -85,6 +85,9 @@
 #define DEFAULT_POLLFREQ          30   /* in seconds */
 #define DEFAULT_NETSNMP_RETRIES   5
 #define DEFAULT_NETSNMP_TIMEOUT   1    /* in seconds */
+#define DEFAULT_MAXVARBINDS       16   /* OIDs per GET request */
+#define DEFAULT_MAXREPETITIONS    16   /* rows per column in a GETBULK */
+#define DEFAULT_MAXINFLIGHT       4    /* requests on the way at once */
 
 /* use explicit booleans */
 #ifndef FALSE
@@ -124,6 +127,7 @@ typedef struct {
 	const char   *dfl;        /* default value */
 	unsigned long flags;      /* snmp-ups internal flags */
 	info_lkp_t   *oid2info;   /* lookup table between OID and NUT values */
+	poll_age_t    age;        /* adaptive polling - internal to snmp driver */
 } snmp_info_t;
 
 #define SU_FLAG_OK		(1 << 0)	/* show element to upsd - internal to snmp driver */
@@ -198,6 +202,10 @@ typedef struct {
 #define SU_VAR_TIMEOUT		"snmp_timeout"
 #define SU_VAR_MIBS			"mibs"
 #define SU_VAR_POLLFREQ		"pollfreq"
+#define SU_VAR_MAXVARBINDS	"maxvarbinds"
+#define SU_VAR_MAXREPETITIONS	"maxrepetitions"
+#define SU_VAR_MAXINFLIGHT	"maxinflight"
+#define SU_VAR_TRAPPORT		"trapport"
 /* SNMP v3 related parameters */
 #define SU_VAR_SECLEVEL		"secLevel"
 #define SU_VAR_SECNAME		"secName"
@@ -231,6 +239,13 @@ typedef struct {
 	const char *alarm_value;  /* when not NULL, set ups.alarm to this */
 } alarms_info_t;
 
+/* what to read again, with the status and alarms, when the device sends a
+ * trap or an inform (see the "trapport" option) */
+typedef struct {
+	const char *OID;          /* the trap (snmpTrapOID.0), or a prefix of it */
+	const char *info_type;    /* the NUT variables starting with this, or NULL */
+} traps_info_t;
+
 typedef struct {
 	const char	*mib_name;
 	const char	*mib_version;
@@ -240,6 +255,7 @@ typedef struct {
 	const char	*sysOID;			/* OID to match against sysOID, aka MIB
 									 * main entry point */
 	alarms_info_t	*alarms_info;
+	traps_info_t	*traps_info;
 } mib2nut_info_t;
 
 /* Common SNMP functions */
@@ -281,6 +297,9 @@ extern struct snmp_session g_snmp_sess, *g_snmp_sess_p;
 extern const char *OID_pwr_status;
 extern int g_pwr_battery;
 extern int pollfreq; /* polling frequency */
+extern int maxvarbinds; /* most OIDs asked in one GET request */
+extern int maxrepetitions; /* rows asked per template column in one GETBULK */
+extern int maxinflight; /* requests sent without waiting for the answers */
 extern int input_phases, output_phases, bypass_phases;
 
 /* Common daisychain structure and functions */
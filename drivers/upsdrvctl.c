@@ -21,6 +21,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 
@@ -28,6 +29,7 @@
 #include "proto.h"
 #include "common.h"
 #include "upsconf.h"
+#include "eventloop.h"
 
 typedef struct {
 	char	*upsname;
@@ -35,6 +37,10 @@ typedef struct {
 	char	*port;
 	int	sdorder;
 	int	maxstartdelay;
+	int	maxretry;
+	int	retrydelay;
+	int	hosted;		/* served by a single 'driver -A' process */
+	int	host_done;	/* that process was already handled */
 	void	*next;
 }	ups_t;
 
@@ -54,6 +60,9 @@ static int	maxretry = 1;
 	/* timer - delay between each restart attempt of the driver(s) */
 static int	retrydelay = 5;
 
+	/* counter - how many drivers may be starting at the same time */
+static int	maxparallel = 1;
+
 	/* Directory where driver executables live */
 static char	*driverpath = NULL;
 
@@ -80,6 +89,9 @@ void do_upsconf_args(char *upsname, char *var, char *val)
 		if (!strcmp(var, "retrydelay"))
 			retrydelay = atoi(val);
 
+		if (!strcmp(var, "maxparallel"))
+			maxparallel = atoi(val);
+
 		if (!strcmp(var, "nowait"))
 			waitfordrivers = 0;
 
@@ -103,6 +115,15 @@ void do_upsconf_args(char *upsname, char *var, char *val)
 			if (!strcmp(var, "maxstartdelay"))
 				tmp->maxstartdelay = atoi(val);
 
+			if (!strcmp(var, "maxretry"))
+				tmp->maxretry = atoi(val);
+
+			if (!strcmp(var, "retrydelay"))
+				tmp->retrydelay = atoi(val);
+
+			if (!strcmp(var, "hosted") && !val)
+				tmp->hosted = 1;
+
 			if (!strcmp(var, "sdorder")) {
 				tmp->sdorder = atoi(val);
 
@@ -123,6 +144,13 @@ void do_upsconf_args(char *upsname, char *var, char *val)
 	tmp->next = NULL;
 	tmp->sdorder = 0;
 	tmp->maxstartdelay = -1;	/* use global value by default */
+	tmp->maxretry = -1;
+	tmp->retrydelay = -1;
+	tmp->hosted = 0;
+	tmp->host_done = 0;
+
+	if (!strcmp(var, "hosted") && !val)
+		tmp->hosted = 1;
 
 	if (!strcmp(var, "driver"))
 		tmp->driver = xstrdup(val);
@@ -136,6 +164,26 @@ void do_upsconf_args(char *upsname, char *var, char *val)
 		upstable = tmp;
 }
 
+/* all hosted sections of a driver share one process: returns 1 if that
+ * process was already started or stopped, or marks it as handled now */
+static int host_done(const ups_t *ups)
+{
+	ups_t	*tmp;
+
+	for (tmp = upstable; tmp; tmp = tmp->next) {
+		if (tmp->hosted && tmp->host_done && tmp->driver && ups->driver
+			&& !strcmp(tmp->driver, ups->driver))
+			return 1;
+	}
+
+	for (tmp = upstable; tmp; tmp = tmp->next) {
+		if (tmp == ups)
+			tmp->host_done = 1;
+	}
+
+	return 0;
+}
+
 /* handle sending the signal */
 static void stop_driver(const ups_t *ups)
 {
@@ -143,6 +191,11 @@ static void stop_driver(const ups_t *ups)
 	int	ret;
 	struct stat	fs;
 
+	if (ups->hosted && host_done(ups)) {
+		upsdebugx(1, "Stopping UPS: %s (already stopped with its host)", ups->upsname);
+		return;
+	}
+
 	upsdebugx(1, "Stopping UPS: %s", ups->upsname);
 
 	snprintf(pidfn, sizeof(pidfn), "%s/%s-%s.pid", altpidpath(),
@@ -269,63 +322,382 @@ static void forkexec(char *const argv[], const ups_t *ups)
 	fatal_with_errno(EXIT_FAILURE, "execv");
 }
 
-static void start_driver(const ups_t *ups)
-{
+/* Starting: every driver to start becomes a job, and up to maxparallel
+ * jobs run at once.  A job is done when its driver went to the background
+ * (the first process exited with 0) and its socket appeared, or failed
+ * when it ran out of attempts.  Each job has its own startup timer and
+ * retry delay, so a slow or failing driver only holds up its own slot. */
+
+typedef enum {
+	JOB_PENDING = 0,	/* waiting for a slot */
+	JOB_RUNNING,		/* forked, waiting for the first process to exit */
+	JOB_RETRY,		/* failed, waiting for the retry delay */
+	JOB_SOCKET,		/* in the background, waiting for the socket */
+	JOB_DONE,
+	JOB_FAILED
+} job_state_t;
+
+typedef struct start_job_s {
+	const ups_t	*ups;
 	char	*argv[8];
 	char	dfn[SMALLBUF];
+	char	sockfn[SMALLBUF];
+	job_state_t	state;
+	int	tries;
+	pid_t	pid;
+	int	timer;		/* startup timer, retry delay or socket check */
+	long long	started, attempt;	/* the first and the last attempt */
+	struct start_job_s	*next;
+} start_job_t;
+
+static start_job_t	*start_jobs = NULL;
+static int	start_running = 0, start_pipe[2] = { -1, -1 };
+
+static void start_next(void);
+
+static void start_sigchld(int sig)
+{
+	int	save_errno = errno;
+
+	/* wake up the loop, the children are reaped there */
+	if (write(start_pipe[1], "", 1) < 0) {
+		/* the pipe is full: there is a wakeup pending anyway */
+	}
+
+	errno = save_errno;
+}
+
+static int ups_maxstartdelay(const ups_t *ups)
+{
+	return (ups->maxstartdelay != -1) ? ups->maxstartdelay : maxstartdelay;
+}
+
+static void start_giveup(start_job_t *job)
+{
+	upslogx(LOG_ERR, "UPS %s: giving up", job->ups->upsname);
+
+	job->state = JOB_FAILED;
+	exec_error++;
+}
+
+static void start_retry(void *arg)
+{
+	start_job_t	*job = arg;
+
+	job->timer = 0;
+	job->state = JOB_PENDING;
+
+	start_next();
+}
+
+/* an attempt failed: try again after the retry delay, if there are tries left */
+static void start_failed(start_job_t *job)
+{
+	int	delay = (job->ups->retrydelay != -1) ? job->ups->retrydelay : retrydelay;
+
+	if (job->tries < 1) {
+		start_giveup(job);
+		return;
+	}
+
+	upsdebugx(2, "UPS %s: %i remaining attempts, next in %d seconds",
+		job->ups->upsname, job->tries, delay);
+
+	job->state = JOB_RETRY;
+	job->timer = ev_addtimer(0, delay * 1000L, start_retry, job);
+}
+
+static void start_ready(start_job_t *job)
+{
+	upslogx(LOG_INFO, "UPS %s: ready after %.1f seconds", job->ups->upsname,
+		(ev_now() - job->started) / 1000.0);
+
+	job->state = JOB_DONE;
+}
+
+/* the driver is in the background: it is ready once its socket exists */
+static void start_check_socket(void *arg)
+{
+	start_job_t	*job = arg;
+	struct stat	fs;
+
+	if (stat(job->sockfn, &fs) == 0) {
+		ev_deltimer(job->timer);
+		job->timer = 0;
+		start_ready(job);
+		return;
+	}
+
+	if (ev_now() - job->attempt < ups_maxstartdelay(job->ups) * 1000LL) {
+		return;
+	}
+
+	ev_deltimer(job->timer);
+	job->timer = 0;
+
+	upslogx(LOG_WARNING, "UPS %s: driver started, but %s did not appear",
+		job->ups->upsname, job->sockfn);
+	job->state = JOB_DONE;
+}
+
+/* the driver didn't go to the background in time: leave it be, as the
+ * sequential start did, and count it as a failed attempt */
+static void start_timeout(void *arg)
+{
+	start_job_t	*job = arg;
+
+	job->timer = 0;
+	job->pid = -1;
+	start_running--;
+
+	upslogx(LOG_WARNING, "UPS %s: startup timer elapsed, continuing...",
+		job->ups->upsname);
+
+	start_failed(job);
+	start_next();
+}
+
+static void start_exited(start_job_t *job, int wstat)
+{
+	ev_deltimer(job->timer);
+	job->timer = 0;
+	job->pid = -1;
+	start_running--;
+
+	if (WIFSIGNALED(wstat)) {
+		upslogx(LOG_WARNING, "UPS %s: driver died after signal %d",
+			job->ups->upsname, WTERMSIG(wstat));
+		start_failed(job);
+		return;
+	}
+
+	if (!WIFEXITED(wstat)) {
+		upslogx(LOG_WARNING, "UPS %s: driver exited abnormally", job->ups->upsname);
+		start_failed(job);
+		return;
+	}
+
+	if (WEXITSTATUS(wstat) != 0) {
+		upslogx(LOG_WARNING, "UPS %s: driver failed to start (exit status=%d)",
+			job->ups->upsname, WEXITSTATUS(wstat));
+		start_failed(job);
+		return;
+	}
+
+	job->state = JOB_SOCKET;
+	job->timer = ev_addtimer(100, 0, start_check_socket, job);
+}
+
+static void start_reap(int fd, void *arg)
+{
+	char	buf[SMALLBUF];
+	int	wstat;
+	pid_t	pid;
+	start_job_t	*job;
+
+	while (read(fd, buf, sizeof(buf)) > 0)
+		;
+
+	while ((pid = waitpid(-1, &wstat, WNOHANG)) > 0) {
+		for (job = start_jobs; job; job = job->next) {
+			if ((job->state == JOB_RUNNING) && (job->pid == pid))
+				break;
+		}
+
+		/* one that ran out of time earlier */
+		if (!job) {
+			upsdebugx(2, "Reaped pid %d", (int)pid);
+			continue;
+		}
+
+		start_exited(job, wstat);
+	}
+
+	start_next();
+}
+
+static void start_launch(start_job_t *job)
+{
+	pid_t	pid;
+
+	job->tries--;
+	debugcmdline(2, "exec: ", job->argv);
+
+	if (testmode) {
+		job->state = JOB_DONE;
+		return;
+	}
+
+	pid = fork();
+
+	if (pid < 0)
+		fatal_with_errno(EXIT_FAILURE, "fork");
+
+	if (pid == 0) {
+		execv(job->argv[0], job->argv);
+
+		/* shouldn't get here */
+		fatal_with_errno(EXIT_FAILURE, "execv");
+	}
+
+	/* Handle "parallel" drivers startup */
+	if (waitfordrivers == 0) {
+		upsdebugx(2, "'nowait' set, continuing...");
+		job->state = JOB_DONE;
+		return;
+	}
+
+	job->attempt = ev_now();
+
+	if (job->started == 0)
+		job->started = job->attempt;
+
+	job->pid = pid;
+	job->state = JOB_RUNNING;
+	job->timer = ev_addtimer(0, ups_maxstartdelay(job->ups) * 1000L,
+		start_timeout, job);
+	start_running++;
+}
+
+/* fill the free slots, in ups.conf order */
+static void start_next(void)
+{
+	start_job_t	*job;
+
+	for (job = start_jobs; job; job = job->next) {
+		if ((maxparallel > 0) && (start_running >= maxparallel))
+			return;
+
+		if (job->state == JOB_PENDING)
+			start_launch(job);
+	}
+}
+
+static int start_busy(void)
+{
+	start_job_t	*job;
+
+	for (job = start_jobs; job; job = job->next) {
+		if ((job->state != JOB_DONE) && (job->state != JOB_FAILED))
+			return 1;
+	}
+
+	return 0;
+}
+
+static void start_run(void)
+{
+	struct sigaction	sa;
+	start_job_t	*job, *next;
+	long long	begin = ev_now();
+	int	i, ready = 0, count = 0;
+
+	if (!start_jobs)
+		return;
+
+	if (pipe(start_pipe) < 0)
+		fatal_with_errno(EXIT_FAILURE, "pipe");
+
+	for (i = 0; i < 2; i++) {
+		fcntl(start_pipe[i], F_SETFL, fcntl(start_pipe[i], F_GETFL) | O_NONBLOCK);
+		fcntl(start_pipe[i], F_SETFD, FD_CLOEXEC);
+	}
+
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_NOCLDSTOP;
+	sa.sa_handler = start_sigchld;
+	sigaction(SIGCHLD, &sa, NULL);
+
+	ev_addfd(start_pipe[0], start_reap, NULL);
+
+	start_next();
+
+	while (start_busy())
+		ev_dispatch(-1);
+
+	sa.sa_handler = SIG_DFL;
+	sigaction(SIGCHLD, &sa, NULL);
+
+	ev_free();
+	close(start_pipe[0]);
+	close(start_pipe[1]);
+
+	for (job = start_jobs; job; job = next) {
+		next = job->next;
+
+		if (job->state == JOB_DONE)
+			ready++;
+
+		count++;
+		free(job);
+	}
+
+	start_jobs = NULL;
+
+	if (!testmode && waitfordrivers)
+		upslogx(LOG_INFO, "%d of %d drivers started in %.1f seconds",
+			ready, count, (ev_now() - begin) / 1000.0);
+}
+
+static void start_driver(const ups_t *ups)
+{
+	start_job_t	*job, **last;
 	int	ret, arg = 0;
-	int	initial_exec_error = exec_error, drv_maxretry = maxretry;
 	struct stat	fs;
 
+	if (ups->hosted && host_done(ups)) {
+		upsdebugx(1, "Starting UPS: %s (already started with its host)", ups->upsname);
+		return;
+	}
+
 	upsdebugx(1, "Starting UPS: %s", ups->upsname);
 
-	snprintf(dfn, sizeof(dfn), "%s/%s", driverpath, ups->driver);
-	ret = stat(dfn, &fs);
+	job = xcalloc(1, sizeof(*job));
+	job->ups = ups;
+	job->pid = -1;
+	job->tries = (ups->maxretry != -1) ? ups->maxretry : maxretry;
+
+	snprintf(job->dfn, sizeof(job->dfn), "%s/%s", driverpath, ups->driver);
+	ret = stat(job->dfn, &fs);
 
 	if (ret < 0)
-		fatal_with_errno(EXIT_FAILURE, "Can't start %s", dfn);
+		fatal_with_errno(EXIT_FAILURE, "Can't start %s", job->dfn);
 
-	argv[arg++] = dfn;
-	argv[arg++] = (char *)"-a";		/* FIXME: cast away const */
-	argv[arg++] = ups->upsname;
+	/* the driver makes it after it chroot()ed */
+	snprintf(job->sockfn, sizeof(job->sockfn), "%s%s/%s-%s", pt_root ? pt_root : "",
+		dflt_statepath(), ups->driver, ups->upsname);
+
+	job->argv[arg++] = job->dfn;
+
+	/* one process serves all the hosted sections of this driver */
+	if (ups->hosted) {
+		job->argv[arg++] = (char *)"-A";	/* FIXME: cast away const */
+	} else {
+		job->argv[arg++] = (char *)"-a";	/* FIXME: cast away const */
+		job->argv[arg++] = ups->upsname;
+	}
 
 	/* stick on the chroot / user args if given to us */
 	if (pt_root) {
-		argv[arg++] = (char *)"-r";	/* FIXME: cast away const */
-		argv[arg++] = pt_root;
+		job->argv[arg++] = (char *)"-r";	/* FIXME: cast away const */
+		job->argv[arg++] = pt_root;
 	}
 
 	if (pt_user) {
-		argv[arg++] = (char *)"-u";	/* FIXME: cast away const */
-		argv[arg++] = pt_user;
+		job->argv[arg++] = (char *)"-u";	/* FIXME: cast away const */
+		job->argv[arg++] = pt_user;
 	}
 
 	/* tie it off */
-	argv[arg++] = NULL;
-
+	job->argv[arg++] = NULL;
 
-	while (drv_maxretry > 0) {
-		int cur_exec_error = exec_error;
+	if (job->tries < 1)
+		job->tries = 1;
 
-		upsdebugx(2, "%i remaining attempts", drv_maxretry);
-		debugcmdline(2, "exec: ", argv);
-		drv_maxretry--;
+	for (last = &start_jobs; *last; last = &(*last)->next)
+		;
 
-		if (!testmode) {
-			forkexec(argv, ups);
-		}
-
-		/* driver command succeeded */
-		if (cur_exec_error == exec_error) {
-			drv_maxretry = 0;
-			exec_error = initial_exec_error;
-		}
-		else {
-		/* otherwise, retry if still needed */
-			if (drv_maxretry > 0)
-				sleep (retrydelay);
-		}
-	}
+	*last = job;
 }
 
 static void help(const char *progname)
@@ -538,6 +910,9 @@ int main(int argc, char **argv)
 	else
 		send_one_driver(command, argv[1]);
 
+	/* start_driver() only queued them */
+	start_run();
+
 	if (exec_error)
 		exit(EXIT_FAILURE);
 
@@ -28,6 +28,9 @@
 /* USB standard timeout [ms] */
 #define USB_TIMEOUT 5000
 
+/* the longest wait for an interrupt report when no timeout is given [ms] */
+#define USB_INTERRUPT_WAIT 100
+
 /*!
  * USBDevice_t: Describe a USB device. This structure contains exactly
  * the 5 pieces of information by which a USB device identifies
@@ -30,7 +30,10 @@
 #define DRIVER_NAME	"Generic HID driver"
 #define DRIVER_VERSION		"0.43"
 
+#include <ctype.h>
+
 #include "main.h"
+#include "eventloop.h"
 #include "libhid.h"
 #include "usbhid-ups.h"
 #include "hidparser.h"
@@ -112,9 +115,21 @@ bool_t use_interrupt_pipe = TRUE;
 #else
 bool_t use_interrupt_pipe = FALSE;
 #endif
+static int interrupt_timer = 0; /* reads the interrupt pipe, see hu_interrupt() */
 static time_t lastpoll; /* Timestamp the last polling */
+static int lastpoll_state = POLL_ONLINE; /* poll_state at the last full update */
 hid_dev_handle_t udev;
 
+/* subdriver->hid2nut, indexed once HU_WALKMODE_INIT resolved the HID paths */
+typedef struct {
+	hid_info_t	**byname;	/* open addressing on the NUT name (no case) */
+	hid_info_t	**bydata;	/* open addressing on the HID data */
+	size_t	size;			/* of both, a power of 2 */
+	hid_info_t	**walk[3];	/* what each walk mode reads, NULL terminated */
+} hu_index_t;
+
+static hu_index_t hu_index;
+
 /* support functions */
 static hid_info_t *find_nut_info(const char *varname);
 static hid_info_t *find_hid_info(const HIDData_t *hiddata);
@@ -124,6 +139,7 @@ static void process_boolean_info(const char *nutvalue);
 static void ups_alarm_set(void);
 static void ups_status_set(void);
 static bool_t hid_ups_walk(walkmode_t mode);
+static void hu_index_free(void);
 static int reconnect_ups(void);
 static int ups_infoval_set(hid_info_t *item, double value);
 static int callback(hid_dev_handle_t udev, HIDDevice_t *hd, unsigned char *rdbuf, int rdlen);
@@ -720,72 +736,44 @@ void upsdrv_makevartable(void)
 
 #define	MAX_EVENT_NUM	32
 
-void upsdrv_updateinfo(void)
+/* read the interrupt pipe, on which the UPS notifies changes */
+static void hu_interrupt(void *arg)
 {
 	hid_info_t	*item;
 	HIDData_t	*event[MAX_EVENT_NUM], *found_data;
-	int		i, evtCount;
+	int		i, evtCount, old_status = ups_status;
 	double		value;
-	time_t		now;
 
-	upsdebugx(1, "upsdrv_updateinfo...");
-
-	time(&now);
-
-	/* check for device availability to set datastale! */
+	/* disconnected: upsdrv_updateinfo() reconnects */
 	if (hd == NULL) {
-		/* don't flood reconnection attempts */
-		if (now < (int)(lastpoll + poll_interval)) {
-			return;
-		}
-
-		upsdebugx(1, "Got to reconnect!\n");
-
-		if (!reconnect_ups()) {
-			lastpoll = now;
-			dstate_datastale();
-			return;
-		}
-
-		hd = &curDevice;
-
-		if (hid_ups_walk(HU_WALKMODE_INIT) == FALSE) {
-			hd = NULL;
-			return;
-		}
+		return;
 	}
-#ifdef DEBUG
-	interval();
-#endif
-	/* Get HID notifications on Interrupt pipe first */
-	if (use_interrupt_pipe == TRUE) {
-		evtCount = HIDGetEvents(udev, event, MAX_EVENT_NUM);
-		switch (evtCount)
-		{
-		case -EBUSY:		/* Device or resource busy */
-			upslog_with_errno(LOG_CRIT, "Got disconnected by another driver");
-		case -EPERM:		/* Operation not permitted */
-		case -ENODEV:		/* No such device */
-		case -EACCES:		/* Permission denied */
-		case -EIO:		/* I/O error */
-		case -ENXIO:		/* No such device or address */
-		case -ENOENT:		/* No such file or directory */
-			/* Uh oh, got to reconnect! */
-			hd = NULL;
-			return;
-		default:
-			upsdebugx(1, "Got %i HID objects...", (evtCount >= 0) ? evtCount : 0);
-			break;
+
+	evtCount = HIDGetEvents(udev, event, MAX_EVENT_NUM, -1);
+	switch (evtCount)
+	{
+	case -EBUSY:		/* Device or resource busy */
+		upslog_with_errno(LOG_CRIT, "Got disconnected by another driver");
+	case -EPERM:		/* Operation not permitted */
+	case -ENODEV:		/* No such device */
+	case -EACCES:		/* Permission denied */
+	case -EIO:		/* I/O error */
+	case -ENXIO:		/* No such device or address */
+	case -ENOENT:		/* No such file or directory */
+		/* Uh oh, got to reconnect! */
+		hd = NULL;
+		return;
+	default:
+		if (evtCount > 0) {
+			upsdebugx(1, "Got %i HID objects...", evtCount);
 		}
-	} else {
-		evtCount = 0;
-		upsdebugx(1, "Not using interrupt pipe...");
+		break;
 	}
 
 	/* Process pending events (HID notifications on Interrupt pipe) */
 	for (i = 0; i < evtCount; i++) {
 
-		if (HIDGetDataValue(udev, event[i], &value, poll_interval) != 1)
+		if (HIDGetDataValue(udev, event[i], &value, MAX_TS) != 1)
 			continue;
 
 		if (nut_debug_level >= 2) {
@@ -812,14 +800,62 @@ void upsdrv_updateinfo(void)
 
 		ups_infoval_set(item, value);
 	}
+
+	/* pass a new status on right away, and update the rest now too */
+	if (ups_status != old_status) {
+		status_init();
+		ups_status_set();
+		status_commit();
+
+		poll_now();
+	}
+}
+
+void upsdrv_updateinfo(void)
+{
+	time_t		now;
+
+	upsdebugx(1, "upsdrv_updateinfo...");
+
+	time(&now);
+
+	/* check for device availability to set datastale! */
+	if (hd == NULL) {
+		/* don't flood reconnection attempts */
+		if (now < (int)(lastpoll + poll_interval)) {
+			return;
+		}
+
+		upsdebugx(1, "Got to reconnect!\n");
+
+		if (!reconnect_ups()) {
+			lastpoll = now;
+			dstate_datastale();
+			return;
+		}
+
+		hd = &curDevice;
+
+		if (hid_ups_walk(HU_WALKMODE_INIT) == FALSE) {
+			hd = NULL;
+			return;
+		}
+	}
 #ifdef DEBUG
-	upsdebugx(1, "took %.3f seconds handling interrupt reports...\n", interval());
+	interval();
 #endif
+	/* HID notifications on the Interrupt pipe are read by hu_interrupt() */
+	if (use_interrupt_pipe == FALSE) {
+		upsdebugx(1, "Not using interrupt pipe...");
+	}
+
 	/* clear status buffer before begining */
 	status_init();
 
-	/* Do a full update (polling) every pollfreq or upon data change (ie setvar/instcmd) */
-	if ((now > (lastpoll + pollfreq)) || (data_has_changed == TRUE)) {
+	/* Do a full update (polling) every pollfreq, upon data change (ie setvar/instcmd)
+	 * or when going on or off battery */
+	if ((now > (lastpoll + pollfreq)) || (data_has_changed == TRUE)
+		|| (poll_state != lastpoll_state)) {
 		upsdebugx(1, "Full update...");
 
 		alarm_init();
@@ -828,6 +864,7 @@ void upsdrv_updateinfo(void)
 			return;
 
 		lastpoll = now;
+		lastpoll_state = poll_state;
 		data_has_changed = FALSE;
 
 		ups_alarm_set();
@@ -872,6 +909,11 @@ void upsdrv_initinfo(void)
 
 	time(&lastpoll);
 
+	/* notifications are handled as they come, not once per update */
+	if (use_interrupt_pipe == TRUE) {
+		interrupt_timer = ev_addtimer(HU_INTERRUPT_MS, HU_INTERRUPT_MS, hu_interrupt, NULL);
+	}
+
 	/* install handlers */
 	upsh.setvar = setvar;
 	upsh.instcmd = instcmd;
@@ -1004,6 +1046,13 @@ void upsdrv_cleanup(void)
 {
 	upsdebugx(1, "upsdrv_cleanup...");
 
+	if (interrupt_timer) {
+		ev_deltimer(interrupt_timer);
+		interrupt_timer = 0;
+	}
+
+	hu_index_free();
+
 	comm_driver->close(udev);
 	Free_ReportDesc(pDesc);
 	free_report_buffer(reportbuf);
@@ -1166,11 +1215,150 @@ static double interval(void)
 #endif
 
 /* walk ups variables and set elements of the info array. */
-static bool_t hid_ups_walk(walkmode_t mode)
+/* whether an item is read less often while it doesn't change: status
+ * bits and alarms always get read */
+static int hu_ages(const hid_info_t *item)
+{
+	return !(item->hidflags & HU_FLAG_QUICK_POLL)
+		&& strcmp(item->info_type, "BOOL")
+		&& strncmp(item->info_type, "ups.alarm", 9);
+}
+
+static size_t hu_hash_name(const char *name)
+{
+	size_t	h = 5381;
+
+	while (*name) {
+		h = h * 33 + tolower((unsigned char)*name++);
+	}
+
+	return h;
+}
+
+static size_t hu_hash_data(const HIDData_t *hiddata)
+{
+	return (size_t)hiddata / sizeof(*hiddata);
+}
+
+/* order by report, then as in hid2nut */
+static int hu_cmp_report(const void *a, const void *b)
+{
+	const hid_info_t	*ia = *(hid_info_t * const *)a;
+	const hid_info_t	*ib = *(hid_info_t * const *)b;
+
+	if (ia->hiddata->ReportID != ib->hiddata->ReportID)
+		return ia->hiddata->ReportID - ib->hiddata->ReportID;
+
+	return (ia > ib) - (ia < ib);
+}
+
+/* the items that <mode> may read: the flags that never change are
+ * checked here, those that do in hid_ups_walk() */
+static int hu_index_wants(const hid_info_t *item, walkmode_t mode)
+{
+	if (mode == HU_WALKMODE_INIT)
+		return 1;
+
+	if (item->hiddata == NULL)
+		return 0;
+
+	if ((mode == HU_WALKMODE_QUICK_UPDATE) && (item->hidflags & HU_FLAG_QUICK_POLL))
+		return 1;
+
+	return !(item->hidflags & (HU_FLAG_ABSENT | HU_TYPE_CMD | HU_FLAG_STATIC));
+}
+
+static hid_info_t **hu_index_list(walkmode_t mode)
+{
+	hid_info_t	*item, **list;
+	size_t	count = 0;
+
+	for (item = subdriver->hid2nut; item->info_type != NULL; item++) {
+		count++;
+	}
+
+	list = xcalloc(count + 1, sizeof(*list));
+	count = 0;
+
+	for (item = subdriver->hid2nut; item->info_type != NULL; item++) {
+		if (hu_index_wants(item, mode))
+			list[count++] = item;
+	}
+
+	/* the walk in init has to keep the order, for duplicates */
+	if (mode != HU_WALKMODE_INIT)
+		qsort(list, count, sizeof(*list), hu_cmp_report);
+
+	return list;
+}
+
+static void hu_index_build(void)
 {
 	hid_info_t	*item;
+	size_t	count = 0, i;
+
+	for (item = subdriver->hid2nut; item->info_type != NULL; item++) {
+		count++;
+	}
+
+	for (hu_index.size = 64; hu_index.size < 2 * count; hu_index.size *= 2);
+
+	hu_index.byname = xcalloc(hu_index.size, sizeof(*hu_index.byname));
+	hu_index.bydata = xcalloc(hu_index.size, sizeof(*hu_index.bydata));
+
+	/* the first match wins, as it did in the linear searches */
+	for (item = subdriver->hid2nut; item->info_type != NULL; item++) {
+
+		if (item->hiddata == NULL)
+			continue;
+
+		i = hu_hash_name(item->info_type) & (hu_index.size - 1);
+		while (hu_index.byname[i] && strcasecmp(hu_index.byname[i]->info_type, item->info_type)) {
+			i = (i + 1) & (hu_index.size - 1);
+		}
+
+		if (!hu_index.byname[i])
+			hu_index.byname[i] = item;
+
+		/* Skip server side vars */
+		if (item->hidflags & HU_FLAG_ABSENT)
+			continue;
+
+		i = hu_hash_data(item->hiddata) & (hu_index.size - 1);
+		while (hu_index.bydata[i] && (hu_index.bydata[i]->hiddata != item->hiddata)) {
+			i = (i + 1) & (hu_index.size - 1);
+		}
+
+		if (!hu_index.bydata[i])
+			hu_index.bydata[i] = item;
+	}
+
+	hu_index.walk[HU_WALKMODE_QUICK_UPDATE] = hu_index_list(HU_WALKMODE_QUICK_UPDATE);
+	hu_index.walk[HU_WALKMODE_FULL_UPDATE] = hu_index_list(HU_WALKMODE_FULL_UPDATE);
+
+	upsdebugx(2, "hu_index_build: %d items in hid2nut", (int)count);
+}
+
+static void hu_index_free(void)
+{
+	size_t	i;
+
+	free(hu_index.byname);
+	free(hu_index.bydata);
+
+	for (i = 0; i < sizeof(hu_index.walk) / sizeof(hu_index.walk[0]); i++) {
+		free(hu_index.walk[i]);
+	}
+
+	memset(&hu_index, 0, sizeof(hu_index));
+}
+
+static bool_t hid_ups_walk(walkmode_t mode)
+{
+	hid_info_t	*item, **walk;
 	double		value;
-	int		retcode;
+	int		retcode = 0, report = -1, age;
+	unsigned long	changes, transfers;
 
 #ifndef SHUT_MODE
 	/* extract the VendorId for further testing */
@@ -1180,8 +1368,25 @@ static bool_t hid_ups_walk(walkmode_t mode)
 
 	/* 3 modes: HU_WALKMODE_INIT, HU_WALKMODE_QUICK_UPDATE and HU_WALKMODE_FULL_UPDATE */
 
+	/* (re)connecting: all of hid2nut, and index it again afterwards */
+	if (mode == HU_WALKMODE_INIT) {
+		hu_index_free();
+		hu_index.walk[HU_WALKMODE_INIT] = hu_index_list(HU_WALKMODE_INIT);
+	}
+
+	walk = hu_index.walk[mode];
+	if (walk == NULL) {
+		upsdebugx(1, "hid_ups_walk: not initialized");
+		return FALSE;
+	}
+
+	/* a report read (or received on the interrupt pipe) in this update
+	 * is good for all the items in it, one of the last update is not */
+	age = poll_update_interval() / 2;
+	transfers = reportbuf->transfers;
+
 	/* Device data walk ----------------------------- */
-	for (item = subdriver->hid2nut; item->info_type != NULL; item++) {
+	for (; (item = *walk) != NULL; walk++) {
 
 #ifdef SHUT_MODE
 		/* Check if we are asked to stop (reactivity++) in SHUT mode.
@@ -1237,21 +1442,26 @@ static bool_t hid_ups_walk(walkmode_t mode)
 			continue;
 
 		case HU_WALKMODE_QUICK_UPDATE:
-			/* Quick update only deals with status and alarms! */
-			if (!(item->hidflags & HU_FLAG_QUICK_POLL))
+			/* Quick update only deals with status and alarms,
+			 * and with battery charge and runtime while on battery
+			 * (see hu_index_wants() for the rest) */
+			if (item->hidflags & HU_FLAG_QUICK_POLL)
+				break;
+
+			if (!poll_urgent(item->info_type))
 				continue;
 
 			break;
 
 		case HU_WALKMODE_FULL_UPDATE:
-			/* These don't need polling after initinfo() */
-			if (item->hidflags & (HU_FLAG_ABSENT | HU_TYPE_CMD | HU_FLAG_STATIC))
-				continue;
-
 			/* These need to be polled after user changes (setvar / instcmd) */
 			if ( (item->hidflags & HU_FLAG_SEMI_STATIC) && (data_has_changed == FALSE) )
 				continue;
 
+			/* Values that haven't changed for a while are read less often */
+			if (hu_ages(item) && (data_has_changed == FALSE) && !poll_due(&item->age))
+				continue;
+
 			break;
 
 		default:
@@ -1267,7 +1477,16 @@ static bool_t hid_ups_walk(walkmode_t mode)
 		}
 #endif
 
-		retcode = HIDGetDataValue(udev, item->hiddata, &value, poll_interval);
+		/* the items come by report (see hu_index_list()), so each
+		 * report is read once, and the items decoded from the buffer */
+		if (item->hiddata->ReportID != report) {
+			report = item->hiddata->ReportID;
+			retcode = HIDGetReport(udev, item->hiddata, age);
+		}
+
+		if (retcode == 1) {
+			retcode = HIDGetDataValue(udev, item->hiddata, &value, age);
+		}
 
 		switch (retcode)
 		{
@@ -1313,9 +1532,15 @@ static bool_t hid_ups_walk(walkmode_t mode)
 
 		/* Process the value we got back (set status bits and
 		 * set the value of other parameters) */
+		changes = dstate_changes();
+
 		if (ups_infoval_set(item, value) != 1)
 			continue;
 
+		if ((mode == HU_WALKMODE_FULL_UPDATE) && hu_ages(item)) {
+			poll_seen(&item->age, dstate_changes() != changes);
+		}
+
 		if (mode == HU_WALKMODE_INIT) {
 			info_lkp_t	*info_lkp;
 
@@ -1342,6 +1567,12 @@ static bool_t hid_ups_walk(walkmode_t mode)
 		}
 	}
 
+	upsdebugx(2, "hid_ups_walk: %lu report(s) read", reportbuf->transfers - transfers);
+
+	if (mode == HU_WALKMODE_INIT) {
+		hu_index_build();
+	}
+
 	return TRUE;
 }
 
@@ -1467,7 +1698,20 @@ static void ups_status_set(void)
 static hid_info_t *find_nut_info(const char *varname)
 {
 	hid_info_t *hidups_item;
+	size_t	i;
+
+	if (hu_index.byname) {
+		i = hu_hash_name(varname) & (hu_index.size - 1);
+		for (; (hidups_item = hu_index.byname[i]) != NULL; i = (i + 1) & (hu_index.size - 1)) {
+			if (!strcasecmp(hidups_item->info_type, varname))
+				return hidups_item;
+		}
+
+		upsdebugx(2, "find_nut_info: unknown info type: %s", varname);
+		return NULL;
+	}
 
+	/* not indexed yet */
 	for (hidups_item = subdriver->hid2nut; hidups_item->info_type != NULL ; hidups_item++) {
 
 		if (strcasecmp(hidups_item->info_type, varname))
@@ -1487,12 +1731,24 @@ static hid_info_t *find_nut_info(const char *varname)
 static hid_info_t *find_hid_info(const HIDData_t *hiddata)
 {
 	hid_info_t *hidups_item;
+	size_t	i;
 
 	if(!hiddata) {
 		upsdebugx(2, "%s: hiddata == NULL", __func__);
 		return NULL;
 	}
 
+	if (hu_index.bydata) {
+		i = hu_hash_data(hiddata) & (hu_index.size - 1);
+		for (; (hidups_item = hu_index.bydata[i]) != NULL; i = (i + 1) & (hu_index.size - 1)) {
+			if (hidups_item->hiddata == hiddata)
+				return hidups_item;
+		}
+
+		return NULL;
+	}
+
+	/* not indexed yet */
 	for (hidups_item = subdriver->hid2nut; hidups_item->info_type != NULL ; hidups_item++) {
 
 		/* Skip server side vars */
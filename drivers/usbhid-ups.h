@@ -31,6 +31,7 @@
 #include <string.h>
 #include <unistd.h>
 #include "config.h"
+#include "main.h"	/* for poll_age_t */
 #include "libhid.h"
 
 extern hid_dev_handle_t	udev;
@@ -51,6 +52,7 @@ extern bool_t	 	use_interrupt_pipe;	/* Set to FALSE if interrupt reports should
 #define DEFAULT_POLLFREQ	30	/* Polling interval, in seconds */
 					/* The driver will wait for Interrupt */
 					/* and do "light poll" in the meantime */
+#define HU_INTERRUPT_MS		250	/* Interrupt pipe read interval, in ms */
 
 #ifndef MAX_STRING_SIZE
 #define MAX_STRING_SIZE	128
@@ -167,6 +169,7 @@ typedef struct {
 	info_lkp_t *hid2info;		/* lookup table between HID and NUT values */
 								/* if HU_FLAG_ENUM is set, hid2info is also used
 								 * as enumerated values (dstate_addenum()) */
+	poll_age_t	age;		/* adaptive polling (filled at runtime) */
 
 /*	char *info_HID_format;	*//* FFE: HID format for complex values */
 /*	interpreter interpret;	*//* FFE: interpreter fct, NULL if not needed  */
@@ -89,6 +89,7 @@ static void ups_update(const char *fn, const char *name, const char *desc)
 		/* release all data */
 		sstate_infofree(temp);
 		sstate_cmdfree(temp);
+		sstate_historyfree(temp);
 		pconf_finish(&temp->sock_ctx);
 
 		close(temp->sock_fd);
@@ -419,6 +420,7 @@ static void delete_ups(upstype_t *target)
 			/* release memory */
 			sstate_infofree(ptr);
 			sstate_cmdfree(ptr);
+			sstate_historyfree(ptr);
 			pconf_finish(&ptr->sock_ctx);
 
 			free(ptr->fn);
@@ -26,6 +26,7 @@
 #include "netmisc.h"
 #include "netuser.h"
 #include "netinstcmd.h"
+#include "netwatch.h"
 
 #define FLAG_USER	0x0001		/* username and password must be set */
 
@@ -60,6 +61,9 @@ struct {
 	{ "SET",	net_set,	FLAG_USER	},
 	{ "INSTCMD",	net_instcmd,	FLAG_USER	},
 
+	{ "WATCH",	net_watch,	0		},
+	{ "UNWATCH",	net_unwatch,	0		},
+
 	{ NULL,		(void(*)())(NULL), 0		}
 };
 
@@ -223,6 +223,38 @@ static void list_range(nut_ctype_t *client, const char *upsname, const char *var
 	sendback(client, "END LIST RANGE %s %s\n", upsname, var);
 }
 
+/* the reply comes later, when the driver sends the samples */
+static void list_history(nut_ctype_t *client, const char *upsname,
+	const char *var, const char *since)
+{
+	upstype_t	*ups;
+	char	*ptr;
+
+	ups = get_ups_ptr(upsname);
+
+	if (!ups) {
+		send_err(client, NUT_ERR_UNKNOWN_UPS);
+		return;
+	}
+
+	if (!ups_available(ups, client))
+		return;
+
+	/* the driver reads the var name as a single word */
+	if ((*var == '\0') || (strpbrk(var, " \t\r\n\"\\") != NULL)) {
+		send_err(client, NUT_ERR_INVALID_ARGUMENT);
+		return;
+	}
+
+	if (!(strtod(since, &ptr) >= 0) || (ptr == since) || (*ptr != '\0')) {
+		send_err(client, NUT_ERR_INVALID_ARGUMENT);
+		return;
+	}
+
+	if (!sstate_history(ups, client, var, since))
+		send_err(client, NUT_ERR_DRIVER_NOT_CONNECTED);
+}
+
 static void list_ups(nut_ctype_t *client)
 {
 	upstype_t	*utmp;
@@ -344,5 +376,16 @@ void net_list(nut_ctype_t *client, int numarg, const char **arg)
 		return;
 	}
 
+	if (numarg < 4) {
+		send_err(client, NUT_ERR_INVALID_ARGUMENT);
+		return;
+	}
+
+	/* LIST HISTORY UPS VARNAME SINCE */
+	if (!strcasecmp(arg[0], "HISTORY")) {
+		list_history(client, arg[1], arg[2], arg[3]);
+		return;
+	}
+
 	send_err(client, NUT_ERR_INVALID_ARGUMENT);
 }
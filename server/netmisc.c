@@ -28,6 +28,7 @@
 #include "neterr.h"
 
 #include "netmisc.h"
+#include "netwatch.h"
 
 void net_ver(nut_ctype_t *client, int numarg, const char **arg)
 {
@@ -58,7 +59,7 @@ void net_help(nut_ctype_t *client, int numarg, const char **arg)
 	}
 
 	sendback(client, "Commands: HELP VER GET LIST SET INSTCMD LOGIN LOGOUT"
-		" USERNAME PASSWORD STARTTLS\n");
+		" USERNAME PASSWORD STARTTLS WATCH UNWATCH\n");
 }
 
 void net_fsd(nut_ctype_t *client, int numarg, const char **arg)
@@ -88,5 +89,7 @@ void net_fsd(nut_ctype_t *client, int numarg, const char **arg)
 
 	ups->fsd = 1;
 	sendback(client, "OK FSD-SET\n");
+
+	watch_notify(ups, "ups.status");
 }
 
@@ -0,0 +1,187 @@
+/* netwatch.c - WATCH handlers for upsd
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "common.h"
+
+#include "upsd.h"
+#include "sstate.h"
+#include "state.h"
+#include "neterr.h"
+
+#include "netwatch.h"
+
+extern	nut_ctype_t *firstclient;	/* for watch_notify */
+
+static void watch_entry_free(watch_t *watch)
+{
+	int	i;
+
+	for (i = 0; i < watch->numprefix; i++) {
+		free(watch->prefix[i]);
+	}
+
+	free(watch->prefix);
+	free(watch->ups);
+	free(watch);
+}
+
+/* remove the subscription of a client to <upsname>, if any */
+static int watch_del(nut_ctype_t *client, const char *upsname)
+{
+	watch_t	**wptr, *watch;
+
+	for (wptr = &client->watchlist; *wptr; wptr = &(*wptr)->next) {
+
+		watch = *wptr;
+
+		if (strcasecmp(watch->ups, upsname)) {
+			continue;
+		}
+
+		*wptr = watch->next;
+		watch_entry_free(watch);
+
+		return 1;
+	}
+
+	return 0;	/* not found */
+}
+
+static int watch_match(const watch_t *watch, const char *var)
+{
+	int	i;
+
+	if (watch->numprefix == 0) {
+		return 1;
+	}
+
+	for (i = 0; i < watch->numprefix; i++) {
+		if (!strncasecmp(var, watch->prefix[i], strlen(watch->prefix[i]))) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+void watch_notify(const upstype_t *ups, const char *var)
+{
+	nut_ctype_t	*client;
+	watch_t	*watch;
+	const char	*val = NULL;
+	int	found = 0;
+
+	for (client = firstclient; client; client = client->next) {
+
+		for (watch = client->watchlist; watch; watch = watch->next) {
+			if (!strcasecmp(watch->ups, ups->name) && watch_match(watch, var)) {
+				break;
+			}
+		}
+
+		if (!watch) {
+			continue;
+		}
+
+		/* only look the value up once there is someone to tell */
+		if (!found) {
+			val = sstate_getinfo(ups, var);
+			found = 1;
+		}
+
+		if (!val) {
+			sendback(client, "NOTIFY DELVAR %s %s\n", ups->name, var);
+			continue;
+		}
+
+		/* status is always a special case, see netlist.c */
+		if ((ups->fsd == 1) && (!strcasecmp(var, "ups.status"))) {
+			sendback(client, "NOTIFY VAR %s %s \"FSD %s\"\n", ups->name, var, val);
+		} else {
+			sendback(client, "NOTIFY VAR %s %s \"%s\"\n", ups->name, var, val);
+		}
+	}
+}
+
+void watch_free(nut_ctype_t *client)
+{
+	watch_t	*watch, *wnext;
+
+	for (watch = client->watchlist; watch; watch = wnext) {
+		wnext = watch->next;
+		watch_entry_free(watch);
+	}
+
+	client->watchlist = NULL;
+}
+
+void net_watch(nut_ctype_t *client, int numarg, const char **arg)
+{
+	const upstype_t	*ups;
+	watch_t	*watch;
+	int	i;
+
+	if (numarg < 1) {
+		send_err(client, NUT_ERR_INVALID_ARGUMENT);
+		return;
+	}
+
+	ups = get_ups_ptr(arg[0]);
+
+	if (!ups) {
+		send_err(client, NUT_ERR_UNKNOWN_UPS);
+		return;
+	}
+
+	/* a new WATCH on the same UPS replaces the previous one */
+	watch_del(client, ups->name);
+
+	watch = xcalloc(1, sizeof(*watch));
+	watch->ups = xstrdup(ups->name);
+	watch->numprefix = numarg - 1;
+
+	if (watch->numprefix > 0) {
+		watch->prefix = xcalloc(watch->numprefix, sizeof(*watch->prefix));
+	}
+
+	for (i = 0; i < watch->numprefix; i++) {
+		watch->prefix[i] = xstrdup(arg[i + 1]);
+	}
+
+	watch->next = client->watchlist;
+	client->watchlist = watch;
+
+	upsdebugx(3, "%s: %s watches UPS [%s] (%d prefixes)", __func__,
+		client->addr, ups->name, watch->numprefix);
+
+	sendback(client, "OK\n");
+}
+
+void net_unwatch(nut_ctype_t *client, int numarg, const char **arg)
+{
+	if (numarg != 1) {
+		send_err(client, NUT_ERR_INVALID_ARGUMENT);
+		return;
+	}
+
+	if (!watch_del(client, arg[0])) {
+		send_err(client, NUT_ERR_UNKNOWN_UPS);
+		return;
+	}
+
+	sendback(client, "OK\n");
+}
@@ -0,0 +1,53 @@
+/* netwatch.h - WATCH handlers for upsd
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef NETWATCH_H_SEEN
+#define NETWATCH_H_SEEN 1
+
+#include "upstype.h"
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+#endif
+
+/* per client subscription to the changes of the variables of one UPS */
+typedef struct watch_s {
+	char	*ups;
+	char	**prefix;	/* no prefix: all variables */
+	int	numprefix;
+
+	struct watch_s	*next;
+} watch_t;
+
+void net_watch(nut_ctype_t *client, int numarg, const char **arg);
+void net_unwatch(nut_ctype_t *client, int numarg, const char **arg);
+
+/* notify the watching clients that <var> changed (or was deleted) on <ups> */
+void watch_notify(const upstype_t *ups, const char *var);
+
+/* free all the subscriptions of a client */
+void watch_free(nut_ctype_t *client);
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+#endif
+
+#endif	/* NETWATCH_H_SEEN */
@@ -49,6 +49,15 @@ typedef struct nut_ctype_s {
 	 * (disabled by default) */
 	int	tracking;
 
+	/* variable change subscriptions (see netwatch.c) */
+	struct watch_s	*watchlist;
+
+	/* while a LIST HISTORY waits for the driver, what the client sent
+	 * next is held here unparsed, so that the replies keep their order */
+	int	histwait;
+	char	*held;
+	size_t	heldlen;
+
 #ifdef	WITH_OPENSSL
 	SSL	*ssl;
 #elif defined(WITH_NSS)
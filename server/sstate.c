@@ -27,6 +27,8 @@
 #include "sstate.h"
 #include "upsd.h"
 #include "upstype.h"
+#include "netwatch.h"
+#include "neterr.h"
 
 #include <fcntl.h>
 #include <stdio.h>
@@ -36,6 +38,90 @@
 #include <sys/socket.h>
 #include <sys/un.h> 
 
+/* a LIST HISTORY the driver hasn't finished yet: it answers them in order */
+typedef struct histreq_s {
+	nut_ctype_t	*client;	/* NULL once the client is gone */
+	char	*var;
+	int	begun;			/* BEGIN LIST sent */
+	time_t	heard;			/* asked, or last answered, at */
+	struct histreq_s	*next;
+} histreq_t;
+
+/* the request that a HISTORY* reply from the driver is for */
+static histreq_t *history_head(upstype_t *ups, const char *var)
+{
+	histreq_t	*req = ups->histq;
+
+	if ((!req) || (strcmp(req->var, var) != 0)) {
+		upsdebugx(1, "UPS [%s]: unexpected history of %s", ups->name, var);
+		return NULL;
+	}
+
+	return req;
+}
+
+static void history_begin(upstype_t *ups, histreq_t *req)
+{
+	if (!req->begun) {
+		sendback(req->client, "BEGIN LIST HISTORY %s %s\n", ups->name, req->var);
+		req->begun = 1;
+	}
+}
+
+static void history_pop(upstype_t *ups)
+{
+	histreq_t	*req = ups->histq;
+
+	ups->histq = req->next;
+
+	/* the client can go on */
+	if (req->client) {
+		req->client->histwait = 0;
+	}
+
+	free(req->var);
+	free(req);
+}
+
+static int parse_history(upstype_t *ups, int numargs, char **arg)
+{
+	histreq_t	*req;
+
+	if (strncasecmp(arg[0], "HISTORY", 7) != 0)
+		return 0;
+
+	req = history_head(ups, arg[1]);
+
+	if (!req)
+		return 1;
+
+	time(&req->heard);
+
+	/* HISTORY <varname> <time> <value> */
+	if ((numargs == 4) && (!strcasecmp(arg[0], "HISTORY"))) {
+		history_begin(ups, req);
+		sendback(req->client, "HISTORY %s %s %s %s\n", ups->name, arg[1], arg[2], arg[3]);
+		return 1;
+	}
+
+	/* HISTORYDONE <varname> */
+	if (!strcasecmp(arg[0], "HISTORYDONE")) {
+		history_begin(ups, req);
+		sendback(req->client, "END LIST HISTORY %s %s\n", ups->name, arg[1]);
+		history_pop(ups);
+		return 1;
+	}
+
+	/* HISTORYOFF <varname> */
+	if (!strcasecmp(arg[0], "HISTORYOFF")) {
+		send_err(req->client, NUT_ERR_FEATURE_NOT_CONFIGURED);
+		history_pop(ups);
+		return 1;
+	}
+
+	return 0;
+}
+
 static int parse_args(upstype_t *ups, int numargs, char **arg)
 {
 	if (numargs < 1)
@@ -65,6 +151,9 @@ static int parse_args(upstype_t *ups, int numargs, char **arg)
 	if (numargs < 2)
 		return 0;
 
+	if (parse_history(ups, numargs, arg))
+		return 1;
+
 	/* FIXME: all these should return their state_...() value! */
 	/* ADDCMD <cmdname> */
 	if (!strcasecmp(arg[0], "ADDCMD")) {
@@ -80,7 +169,9 @@ static int parse_args(upstype_t *ups, int numargs, char **arg)
 
 	/* DELINFO <var> */
 	if (!strcasecmp(arg[0], "DELINFO")) {
-		state_delinfo(&ups->inforoot, arg[1]);
+		if (state_delinfo(&ups->inforoot, arg[1])) {
+			watch_notify(ups, arg[1]);
+		}
 		return 1;
 	}
 
@@ -95,7 +186,9 @@ static int parse_args(upstype_t *ups, int numargs, char **arg)
 
 	/* SETINFO <varname> <value> */
 	if (!strcasecmp(arg[0], "SETINFO")) {
-		state_setinfo(&ups->inforoot, arg[1], arg[2]);
+		if (state_setinfo(&ups->inforoot, arg[1], arg[2])) {
+			watch_notify(ups, arg[1]);
+		}
 		return 1;
 	}
 
@@ -249,6 +342,86 @@ int sstate_connect(upstype_t *ups)
 	return fd;
 }
 
+/* ask the driver for the samples of <var> after <since>; the reply is sent
+ * to <client> when the driver gives it */
+int sstate_history(upstype_t *ups, nut_ctype_t *client, const char *var, const char *since)
+{
+	char	buf[SMALLBUF];
+	histreq_t	*req, **last;
+
+	snprintf(buf, sizeof(buf), "HISTORY %s %s\n", var, since);
+
+	if (!sstate_sendline(ups, buf)) {
+		return 0;
+	}
+
+	req = xcalloc(1, sizeof(*req));
+	req->client = client;
+	req->var = xstrdup(var);
+	time(&req->heard);
+
+	for (last = &ups->histq; *last; last = &(*last)->next)
+		;
+
+	*last = req;
+
+	/* its next commands wait for the reply */
+	client->histwait = 1;
+
+	return 1;
+}
+
+/* <client> is going away: its pending history requests are answered to
+ * nobody */
+void sstate_history_drop(nut_ctype_t *client)
+{
+	upstype_t	*ups;
+	histreq_t	*req;
+
+	for (ups = firstups; ups; ups = ups->next) {
+		for (req = ups->histq; req; req = req->next) {
+			if (req->client == client) {
+				req->client = NULL;
+			}
+		}
+	}
+}
+
+/* end the first history request, which the driver won't finish */
+static void history_end(upstype_t *ups, const char *errtype)
+{
+	if (ups->histq->begun) {
+		sendback(ups->histq->client, "END LIST HISTORY %s %s\n", ups->name, ups->histq->var);
+	} else {
+		send_err(ups->histq->client, errtype);
+	}
+
+	history_pop(ups);
+}
+
+/* the driver is gone: end the history requests it didn't finish */
+void sstate_historyfree(upstype_t *ups)
+{
+	while (ups->histq) {
+		history_end(ups, NUT_ERR_DRIVER_NOT_CONNECTED);
+	}
+}
+
+/* the driver hasn't answered the first history request for <maxage>
+ * seconds: end it, lest it hold up the next ones forever */
+void sstate_history_expire(upstype_t *ups, int maxage)
+{
+	time_t	now;
+
+	time(&now);
+
+	while (ups->histq && (difftime(now, ups->histq->heard) > maxage)) {
+		upslogx(LOG_WARNING, "UPS [%s]: no history of %s from the driver",
+			ups->name, ups->histq->var);
+		history_end(ups, NUT_ERR_DATA_STALE);
+	}
+}
+
 void sstate_disconnect(upstype_t *ups)
 {
 	if ((!ups) || (ups->sock_fd < 0)) {
@@ -257,6 +430,7 @@ void sstate_disconnect(upstype_t *ups)
 
 	sstate_infofree(ups);
 	sstate_cmdfree(ups);
+	sstate_historyfree(ups);
 
 	pconf_finish(&ups->sock_ctx);
 
@@ -25,6 +25,7 @@
 
 #include "state.h"
 #include "upstype.h"
+#include "nut_ctype.h"
 
 #define SS_CONNFAIL_INT 300	/* complain about a dead driver every 5 mins */
 #define SS_MAX_READ 256		/* don't let drivers tie us up in read()     */
@@ -50,8 +51,12 @@ void sstate_makeinstcmdlist_t(const upstype_t *ups, char *buf, size_t bufsize);
 int sstate_dead(upstype_t *ups, int maxage);
 void sstate_infofree(upstype_t *ups);
 void sstate_cmdfree(upstype_t *ups);
+void sstate_historyfree(upstype_t *ups);
 int sstate_sendline(upstype_t *ups, const char *buf);
 const st_tree_t *sstate_getnode(const upstype_t *ups, const char *varname);
+int sstate_history(upstype_t *ups, nut_ctype_t *client, const char *var, const char *since);
+void sstate_history_drop(nut_ctype_t *client);
+void sstate_history_expire(upstype_t *ups, int maxage);
 
 #ifdef __cplusplus
 /* *INDENT-OFF* */
@@ -312,6 +312,10 @@ static void client_disconnect(nut_ctype_t *client)
 		declogins(client->loginups);
 	}
 
+	watch_free(client);
+	sstate_history_drop(client);
+	free(client->held);
+
 	ssl_finish(client);
 
 	pconf_finish(&client->ctx);
@@ -533,11 +537,60 @@ static void client_connect(stype_t *server)
 	upsdebugx(2, "Connect from %s", client->addr);
 }
 
+/* handle the commands in <buf>, holding the ones after a LIST HISTORY
+ * that waits for the driver */
+static void client_parse(nut_ctype_t *client, const char *buf, size_t len)
+{
+	size_t	i;
+
+	/* fragment handling code */
+	for (i = 0; i < len; i++) {
+
+		/* add to the receive queue one by one */
+		switch (pconf_char(&client->ctx, buf[i]))
+		{
+		case 1:
+			time(&client->last_heard);	/* command received */
+			parse_net(client);
+
+			if (client->histwait && (i + 1 < len)) {
+				client->heldlen = len - i - 1;
+				client->held = xmalloc(client->heldlen);
+				memcpy(client->held, buf + i + 1, client->heldlen);
+				return;
+			}
+
+			continue;
+
+		case 0:
+			continue;	/* haven't gotten a line yet */
+
+		default:
+			/* parse error */
+			upslogx(LOG_NOTICE, "Parse error on sock: %s", client->ctx.errmsg);
+			return;
+		}
+	}
+}
+
+/* the LIST HISTORY is answered: go on with what was held */
+static void client_resume(nut_ctype_t *client)
+{
+	char	*held = client->held;
+	size_t	heldlen = client->heldlen;
+
+	client->held = NULL;
+	client->heldlen = 0;
+
+	client_parse(client, held, heldlen);
+	free(held);
+}
+
 /* read tcp messages and handle them */
 static void client_readline(nut_ctype_t *client)
 {
 	char	buf[SMALLBUF];
-	int	i, ret;
+	int	ret;
 
 #ifdef WITH_SSL
 	if (client->ssl) {
@@ -560,28 +613,7 @@ static void client_readline(nut_ctype_t *client)
 		return;
 	}
 
-	/* fragment handling code */
-	for (i = 0; i < ret; i++) {
-
-		/* add to the receive queue one by one */
-		switch (pconf_char(&client->ctx, buf[i]))
-		{
-		case 1:
-			time(&client->last_heard);	/* command received */
-			parse_net(client);
-			continue;
-
-		case 0:
-			continue;	/* haven't gotten a line yet */
-
-		default:
-			/* parse error */
-			upslogx(LOG_NOTICE, "Parse error on sock: %s", client->ctx.errmsg);
-			return;
-		}
-	}
-
-	return;
+	client_parse(client, buf, ret);
 }
 
 void server_load(void)
@@ -653,6 +685,7 @@ void driver_free(void)
 
 		sstate_infofree(ups);
 		sstate_cmdfree(ups);
+		sstate_historyfree(ups);
 
 		pconf_finish(&ups->sock_ctx);
 
@@ -956,6 +989,8 @@ static void mainloop(void)
 			ups_data_ok(ups);
 		}
 
+		sstate_history_expire(ups, maxage);
+
 		fds[nfds].fd = ups->sock_fd;
 		fds[nfds].events = POLLIN;
 
@@ -970,11 +1005,19 @@ static void mainloop(void)
 
 		cnext = client->next;
 
+		if (!client->histwait && client->held) {
+			client_resume(client);
+		}
+
 		if (difftime(now, client->last_heard) > 60) {
-			/* shed clients after 1 minute of inactivity */
+			/* shed clients after 1 minute of inactivity,
+			 * except the ones waiting for WATCH notifications
+			 * (unless a write to them failed) */
 			/* FIXME: create an upsd.conf parameter (CLIENT_INACTIVITY_DELAY) */
-			client_disconnect(client);
-			continue;
+			if (!client->watchlist || !client->last_heard) {
+				client_disconnect(client);
+				continue;
+			}
 		}
 
 		if (nfds >= maxconn) {
@@ -983,7 +1026,8 @@ static void mainloop(void)
 		}
 
 		fds[nfds].fd = client->sock_fd;
-		fds[nfds].events = POLLIN;
+		/* nothing more is read while a LIST HISTORY waits */
+		fds[nfds].events = client->histwait ? 0 : POLLIN;
 
 		handler[nfds].type = CLIENT;
 		handler[nfds].data = client;
@@ -51,6 +51,8 @@ typedef struct upstype_s {
 	int	fsd;		/* forced shutdown in effect? */
 
 	int	retain;
+
+	struct histreq_s	*histq;	/* LIST HISTORY requests, see sstate.c */
 	
 	struct upstype_s	*next;
 
@@ -0,0 +1,331 @@
+/* hidparserbench - HID report decoding checks and benchmarks
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/*
+ * Usage: hidparserbench [<scale>]
+ *
+ * Parse a report descriptor laid out like those of HID Power Devices
+ * (flags, byte aligned and unaligned fields, signed and unsigned, up to
+ * 32 bits), then:
+ * - check that GetValue() and SetValue() give the same results as the
+ *   bit by bit extraction they replaced, on random reports;
+ * - measure both on a set of reports as a UPS on line power sends them.
+ * Exits with a failure if the check finds a difference.
+ * <scale> multiplies the number of iterations (default: 1).
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hidparser.h"
+
+static const unsigned char report_desc[] = {
+	0x05, 0x84,		/* Usage Page (Power Device) */
+	0x09, 0x04,		/* Usage (UPS) */
+	0xa1, 0x01,		/* Collection (Application) */
+
+	0x85, 0x01,		/*   Report ID (1) */
+	0x05, 0x85,		/*   Usage Page (Battery System) */
+	0x09, 0x66,		/*   Usage (RemainingCapacity) */
+	0x15, 0x00,		/*   Logical Minimum (0) */
+	0x25, 0x64,		/*   Logical Maximum (100) */
+	0x75, 0x08,		/*   Report Size (8) */
+	0x95, 0x01,		/*   Report Count (1) */
+	0xb1, 0x02,		/*   Feature (Data, Variable, Absolute) */
+
+	0x85, 0x02,		/*   Report ID (2) */
+	0x09, 0xd0,		/*   Usage (ACPresent) */
+	0x09, 0x44,		/*   Usage (Charging) */
+	0x09, 0x45,		/*   Usage (Discharging) */
+	0x09, 0x42,		/*   Usage (BelowRemainingCapacityLimit) */
+	0x09, 0x4b,		/*   Usage (NeedReplacement) */
+	0x09, 0x46,		/*   Usage (FullyCharged) */
+	0x25, 0x01,		/*   Logical Maximum (1) */
+	0x75, 0x01,		/*   Report Size (1) */
+	0x95, 0x06,		/*   Report Count (6) */
+	0x81, 0x02,		/*   Input (Data, Variable, Absolute) */
+	0x09, 0x2c,		/*   Usage (CapacityMode) */
+	0x25, 0x03,		/*   Logical Maximum (3) */
+	0x75, 0x02,		/*   Report Size (2) */
+	0x95, 0x01,		/*   Report Count (1) */
+	0x81, 0x02,		/*   Input (Data, Variable, Absolute) */
+
+	0x85, 0x03,		/*   Report ID (3) */
+	0x05, 0x84,		/*   Usage Page (Power Device) */
+	0x09, 0x30,		/*   Usage (Voltage) */
+	0x09, 0x32,		/*   Usage (Frequency) */
+	0x09, 0x35,		/*   Usage (PercentLoad) */
+	0x27, 0xff, 0xff, 0x00, 0x00,	/*   Logical Maximum (65535) */
+	0x75, 0x10,		/*   Report Size (16) */
+	0x95, 0x03,		/*   Report Count (3) */
+	0xb1, 0x02,		/*   Feature (Data, Variable, Absolute) */
+
+	0x85, 0x04,		/*   Report ID (4) */
+	0x09, 0x36,		/*   Usage (Temperature) */
+	0x09, 0x31,		/*   Usage (Current) */
+	0x16, 0x00, 0xf8,	/*   Logical Minimum (-2048) */
+	0x26, 0xff, 0x07,	/*   Logical Maximum (2047) */
+	0x75, 0x0c,		/*   Report Size (12) */
+	0x95, 0x02,		/*   Report Count (2) */
+	0xb1, 0x02,		/*   Feature (Data, Variable, Absolute) */
+
+	0x85, 0x05,		/*   Report ID (5) */
+	0x05, 0x85,		/*   Usage Page (Battery System) */
+	0x09, 0x68,		/*   Usage (RunTimeToEmpty) */
+	0x15, 0x00,		/*   Logical Minimum (0) */
+	0x27, 0xff, 0xff, 0xff, 0x7f,	/*   Logical Maximum (2147483647) */
+	0x75, 0x20,		/*   Report Size (32) */
+	0x95, 0x01,		/*   Report Count (1) */
+	0xb1, 0x02,		/*   Feature (Data, Variable, Absolute) */
+	0x09, 0x8c,		/*   Usage (WarningCapacityLimit) */
+	0x25, 0x64,		/*   Logical Maximum (100), in 7 bits */
+	0x75, 0x07,		/*   Report Size (7) */
+	0x95, 0x01,		/*   Report Count (1) */
+	0xb1, 0x02,		/*   Feature (Data, Variable, Absolute) */
+	0x09, 0x8d,		/*   Usage (RemainingTimeLimit) */
+	0x25, 0x0a,		/*   Logical Maximum (10), sent in 9 bits */
+	0x75, 0x09,		/*   Report Size (9) */
+	0x95, 0x01,		/*   Report Count (1) */
+	0xb1, 0x02,		/*   Feature (Data, Variable, Absolute) */
+
+	0xc0			/* End Collection */
+};
+
+/* what a UPS on line power sends, report ID first: 100% charged; on
+ * line, fully charged; 230 V, 50 Hz, 35% load; 31 C, -3 A; 1 h 20 min
+ * left, warning at 20%, time limit 10 */
+static const unsigned char sample_reports[][10] = {
+	{ 0x01, 0x64 },
+	{ 0x02, 0x61 },
+	{ 0x03, 0xe6, 0x00, 0x32, 0x00, 0x23, 0x00 },
+	{ 0x04, 0x1f, 0xd0, 0xff },
+	{ 0x05, 0xc0, 0x12, 0x00, 0x00, 0x14, 0x05 },
+};
+
+#define NB_SAMPLES	(sizeof(sample_reports) / sizeof(sample_reports[0]))
+
+/* bit by bit, as GetValue() did before its fields were precomputed */
+static void ref_GetValue(const unsigned char *Buf, const HIDData_t *pData, long *pValue)
+{
+	int	Weight, Bit;
+	long	value = 0, rawvalue;
+	long	range, mask, signbit, b, m;
+
+	Bit = pData->Offset + 8;
+
+	for (Weight = 0; Weight < pData->Size && Weight < 32; Weight++, Bit++) {
+		if (Buf[Bit >> 3] & (1 << (Bit & 7))) {
+			value += (1L << Weight);
+		}
+	}
+
+	rawvalue = value;
+
+	range = pData->LogMax - pData->LogMin + 1;
+	if (range <= 0) {
+		*pValue = value;
+		return;
+	}
+
+	for (b = 0; (unsigned long)(range - 1) >> b; b++);
+
+	mask = (1L << b) - 1;
+	signbit = b ? (1L << (b - 1)) : 0;
+	value = value & mask;
+
+	if (pData->LogMin < 0 && (value & signbit) != 0) {
+		value |= ~mask;
+	}
+
+	if (value >= pData->LogMin && value <= pData->LogMax) {
+		*pValue = value;
+		return;
+	}
+
+	m = (value - pData->LogMin) & mask;
+	value = pData->LogMin + m;
+	if (value <= pData->LogMax) {
+		*pValue = value;
+		return;
+	}
+
+	value = rawvalue;
+	b = (pData->Size < 32) ? pData->Size : 32;
+	mask = (1L << b) - 1;
+	signbit = 1L << (b - 1);
+	if (pData->LogMin < 0 && (value & signbit) != 0) {
+		value |= ~mask;
+	}
+	if (value < pData->LogMin) {
+		value = pData->LogMin;
+	} else if (value > pData->LogMax) {
+		value = pData->LogMax;
+	}
+
+	*pValue = value;
+}
+
+static void ref_SetValue(const HIDData_t *pData, unsigned char *Buf, long Value)
+{
+	int	Weight, Bit;
+
+	Bit = pData->Offset + 8;
+
+	for (Weight = 0; Weight < pData->Size && Weight < 32; Weight++, Bit++) {
+		if (Value & (1L << Weight)) {
+			Buf[Bit >> 3] |= (1 << (Bit & 7));
+		} else {
+			Buf[Bit >> 3] &= ~(1 << (Bit & 7));
+		}
+	}
+}
+
+static double now(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static const unsigned char *sample_for(const HIDData_t *pData)
+{
+	size_t	i;
+
+	for (i = 0; i < NB_SAMPLES; i++) {
+		if (sample_reports[i][0] == pData->ReportID) {
+			return sample_reports[i];
+		}
+	}
+
+	return NULL;
+}
+
+static int check(const HIDDesc_t *pDesc, int rounds)
+{
+	unsigned char	buf[64], refbuf[64];
+	long	value, refvalue;
+	int	i, n, errors = 0;
+	size_t	j;
+
+	srand(1);
+
+	for (n = 0; n < rounds; n++) {
+		for (j = 0; j < sizeof(buf); j++) {
+			buf[j] = rand() & 0xff;
+		}
+
+		for (i = 0; i < pDesc->nitems; i++) {
+			HIDData_t	*pData = &pDesc->item[i];
+
+			GetValue(buf, pData, &value);
+			ref_GetValue(buf, pData, &refvalue);
+
+			if (value != refvalue) {
+				printf("GetValue: report %d offset %d size %d: %ld, expected %ld\n",
+					pData->ReportID, pData->Offset, pData->Size, value, refvalue);
+				errors++;
+			}
+
+			value = rand() - RAND_MAX / 2;
+			memcpy(refbuf, buf, sizeof(buf));
+
+			SetValue(pData, buf, value);
+			ref_SetValue(pData, refbuf, value);
+
+			if (memcmp(buf, refbuf, sizeof(buf))) {
+				printf("SetValue: report %d offset %d size %d: differs for %ld\n",
+					pData->ReportID, pData->Offset, pData->Size, value);
+				errors++;
+			}
+		}
+	}
+
+	return errors;
+}
+
+static void run(const char *name, const HIDDesc_t *pDesc, long iterations,
+	void (*get)(const unsigned char *, HIDData_t *, long *))
+{
+	double	start, elapsed;
+	long	n, sum = 0, value;
+	int	i;
+
+	start = now();
+
+	for (n = 0; n < iterations; n++) {
+		for (i = 0; i < pDesc->nitems; i++) {
+			get(sample_for(&pDesc->item[i]), &pDesc->item[i], &value);
+			sum += value;
+		}
+	}
+
+	elapsed = now() - start;
+
+	printf("%-28s %10ld ops %12.1f ns/op  (sum %ld)\n", name,
+		iterations * pDesc->nitems, elapsed * 1e9 / (iterations * pDesc->nitems), sum);
+}
+
+/* ref_GetValue() with the signature of GetValue() */
+static void ref_get(const unsigned char *Buf, HIDData_t *pData, long *pValue)
+{
+	ref_GetValue(Buf, pData, pValue);
+}
+
+int main(int argc, char **argv)
+{
+	HIDDesc_t	*pDesc;
+	double	scale = (argc > 1) ? atof(argv[1]) : 1.0;
+	long	value;
+	int	i, errors;
+
+	if (scale <= 0) {
+		fprintf(stderr, "usage: %s [<scale>]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	pDesc = Parse_ReportDesc(report_desc, sizeof(report_desc));
+	if (!pDesc) {
+		printf("Parse_ReportDesc failed\n");
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < pDesc->nitems; i++) {
+		HIDData_t	*pData = &pDesc->item[i];
+
+		GetValue(sample_for(pData), pData, &value);
+		printf("report %d offset %3d size %2d: %ld\n",
+			pData->ReportID, pData->Offset, pData->Size, value);
+	}
+
+	errors = check(pDesc, 10000);
+	printf("%d item(s), %d difference(s) with the bit by bit extraction\n",
+		pDesc->nitems, errors);
+
+	if (!errors) {
+		run("GetValue/bit-by-bit", pDesc, 200000 * scale, ref_get);
+		run("GetValue/precomputed", pDesc, 200000 * scale, GetValue);
+	}
+
+	Free_ReportDesc(pDesc);
+
+	return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
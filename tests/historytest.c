@@ -0,0 +1,317 @@
+/* historytest - driver-side history round trip checks
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/*
+ * Usage: historytest
+ *
+ * Record series into a history small enough that its oldest chunks are
+ * reused many times over, then check that history_query() gives back
+ * exactly the newest samples as they were recorded:
+ * - a regular poll of a value that seldom changes, which must take about
+ *   two bits per sample;
+ * - an irregular one, with timestamp jitter from a few ms to hours and
+ *   values that change in every bit, negative, tiny, huge or not finite,
+ *   both interleaved in the same pool;
+ * - each delta of delta at the ends of its class, with values that differ
+ *   in a few bits anywhere, down to the last one;
+ * queried from every sample (which must be left out), with and without a
+ * limit.
+ * Exits with a failure if a check finds a difference.
+ */
+
+#include "config.h"
+
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "history.h"
+
+#define NSAMPLES	20000
+
+typedef struct {
+	long long	t;
+	double	val;
+} sample_t;
+
+typedef struct {
+	const char	*var;
+	sample_t	*in;		/* as recorded */
+	int	nin;
+	sample_t	*out;		/* as given back */
+	int	nout, stop;		/* stop: make the callback return 0 there */
+} series_t;
+
+static int	errors = 0;
+
+static int collect(const char *var, long long t, double val, void *arg)
+{
+	series_t	*s = arg;
+
+	if (strcmp(var, s->var)) {
+		printf("%s: callback for %s\n", s->var, var);
+		errors++;
+	}
+
+	s->out[s->nout].t = t;
+	s->out[s->nout].val = val;
+	s->nout++;
+
+	return s->nout != s->stop;
+}
+
+/* the same bits, so that NaN matches itself and -0 doesn't match 0 */
+static int same_value(double a, double b)
+{
+	return !memcmp(&a, &b, sizeof(a));
+}
+
+static void record(history_t *hist, series_t *s, long long t, double val)
+{
+	history_add(hist, s->var, t, val);
+
+	s->in[s->nin].t = t;
+	s->in[s->nin].val = val;
+	s->nin++;
+}
+
+/* query <s> after <since>, <max> at most, and compare with what it was
+ * given from <first> on; returns how many came back */
+static int check_query(const history_t *hist, series_t *s, long long since,
+	int max, int first, const char *what)
+{
+	int	count, expect, i;
+
+	s->nout = 0;
+	count = history_query(hist, s->var, since, max, collect, s);
+
+	expect = s->nin - first;
+
+	if (expect > max) {
+		expect = max;
+	}
+
+	if ((count != s->nout) || (count != expect)) {
+		printf("%s: %s after %lld: %d sample(s), %d given, %d expected\n",
+			s->var, what, since, count, s->nout, expect);
+		errors++;
+		return count;
+	}
+
+	for (i = 0; i < count; i++) {
+		const sample_t	*in = &s->in[first + i], *out = &s->out[i];
+
+		if ((in->t != out->t) || !same_value(in->val, out->val)) {
+			printf("%s: %s after %lld: #%d is %lld %.17g, recorded %lld %.17g\n",
+				s->var, what, since, first + i,
+				out->t, out->val, in->t, in->val);
+			errors++;
+			return count;
+		}
+	}
+
+	return count;
+}
+
+/* what is left of <s> must be its newest samples, in order; check that
+ * as well as queries from each of them; returns how many were kept */
+static int check_series(const history_t *hist, series_t *s)
+{
+	int	kept, first, step, i;
+
+	s->nout = 0;
+	kept = history_query(hist, s->var, LLONG_MIN, INT_MAX, collect, s);
+
+	printf("%s: %d of %d sample(s) kept\n", s->var, kept, s->nin);
+
+	if ((kept < 1) || (kept >= s->nin)) {
+		printf("%s: the pool was not reused as it should\n", s->var);
+		errors++;
+		return kept;
+	}
+
+	first = s->nin - kept;
+	check_query(hist, s, LLONG_MIN, INT_MAX, first, "all");
+
+	/* right before and at each sample: the one at <since> is left out;
+	 * the whole rest is compared for some of them only */
+	step = kept / 200 + 1;
+
+	for (i = first; i < s->nin; i++) {
+		check_query(hist, s, s->in[i].t - 1, 3, i, "before, 3 max");
+		check_query(hist, s, s->in[i].t, 3, i + 1, "at, 3 max");
+
+		if ((i - first) % step == 0) {
+			check_query(hist, s, s->in[i].t - 1, INT_MAX, i, "before");
+			check_query(hist, s, s->in[i].t, INT_MAX, i + 1, "at");
+		}
+	}
+
+	check_query(hist, s, s->in[s->nin - 1].t, INT_MAX, s->nin, "last");
+
+	/* the callback can stop it, the sample it stops at isn't counted */
+	s->stop = kept / 2;
+	s->nout = 0;
+
+	if (history_query(hist, s->var, LLONG_MIN, INT_MAX, collect, s) != s->stop - 1) {
+		printf("%s: stopped at %d, %d counted\n", s->var, s->stop, s->nout);
+		errors++;
+	}
+
+	s->stop = 0;
+
+	return kept;
+}
+
+static series_t *series_new(const char *var)
+{
+	series_t	*s = calloc(1, sizeof(*s));
+
+	if (!s || !(s->in = calloc(NSAMPLES, sizeof(sample_t)))
+		|| !(s->out = calloc(NSAMPLES, sizeof(sample_t)))) {
+		printf("out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	s->var = var;
+	return s;
+}
+
+/* the ends of each class of delta of delta */
+static const long long	edge_dods[] = {
+	1, -1, 63, -63, 64, -64, 65, 255, -255, 256, -256, 257,
+	2047, -2047, 2048, -2048, 2049, 1LL << 40, -(1LL << 40)
+};
+
+static void series_free(series_t *s)
+{
+	free(s->in);
+	free(s->out);
+	free(s);
+}
+
+static const double	odd_values[] = {
+	0.0, -0.0, 1.0, -1.0, 1e-310, -1e308, 1e308, 0.1, 230.4, -273.15,
+	INFINITY, -INFINITY, NAN, 5e-324, 4294967296.0, 1.0 / 3.0
+};
+
+int main(void)
+{
+	history_t	*hist;
+	series_t	*reg, *irr, *edge, *single;
+	long long	t, jitter, delta;
+	double	charge = 100.0;
+	int	i, fit;
+
+	srand(1);
+
+	/* both series share the pool, so that each takes the chunks of the
+	 * other as well as its own */
+	hist = history_new(16 * 1024);
+	reg = series_new("battery.charge");
+	irr = series_new("input.voltage");
+
+	for (i = 0, t = 1600000000000LL; i < NSAMPLES; i++) {
+		t += 5000;
+
+		if (i % 500 == 499) {
+			charge -= 0.5;
+		}
+
+		record(hist, reg, t, charge);
+
+		if (i % 4) {
+			continue;
+		}
+
+		/* from a few ms, within each class of delta of delta, to
+		 * hours and back */
+		switch (rand() % 6) {
+		case 0:	jitter = rand() % 64; break;
+		case 1:	jitter = rand() % 512; break;
+		case 2:	jitter = rand() % 4096; break;
+		case 3:	jitter = 3600000LL + rand() % 100000; break;
+		default:	jitter = 0; break;
+		}
+
+		if (rand() % 3) {
+			record(hist, irr, t + jitter, 230.0 + (rand() % 200) / 10.0);
+		} else {
+			record(hist, irr, t + jitter, odd_values[rand() % (sizeof(odd_values) / sizeof(odd_values[0]))]);
+		}
+
+		t += jitter;
+	}
+
+	check_series(hist, reg);
+	check_series(hist, irr);
+	history_free(hist);
+	series_free(reg);
+	series_free(irr);
+
+	/* each delta of delta at the end of its class, each there and back
+	 * again, with values a few bits apart in every place, down to the
+	 * last one */
+	hist = history_new(4 * 1024);
+	edge = series_new("ups.temperature");
+
+	for (i = 0, t = 0, delta = 1LL << 41; i < NSAMPLES; i++) {
+		long long	dod = edge_dods[(i / 2) % (sizeof(edge_dods) / sizeof(edge_dods[0]))];
+
+		delta += (i % 2) ? -dod : dod;
+		t += delta;
+
+		record(hist, edge, t, nextafter(25.0, 1e9 * (i % 2)) * (1 + (i % 64) * 0x1p-52 * (1ULL << (i % 48))));
+	}
+
+	check_series(hist, edge);
+	history_free(hist);
+	series_free(edge);
+
+	/* one chunk, reused for itself: a regular poll of the same value
+	 * takes two bits per sample, the first one aside, so it holds about
+	 * 900 of them before the first one goes */
+	hist = history_new(1);
+	single = series_new("ups.load");
+
+	for (i = 0, t = 0, fit = 0; i < NSAMPLES; i++, t += 1000) {
+		record(hist, single, t, 42.0);
+
+		single->nout = 0;
+		history_query(hist, single->var, LLONG_MIN, 1, collect, single);
+
+		if (!fit && (single->out[0].t != 0)) {
+			fit = i;
+		}
+	}
+
+	printf("%s: %d sample(s) fit in a chunk\n", single->var, fit);
+
+	if (fit < 800) {
+		errors++;
+	}
+
+	check_series(hist, single);
+	history_free(hist);
+	series_free(single);
+
+	printf("%d error(s)\n", errors);
+
+	return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
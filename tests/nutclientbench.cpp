@@ -0,0 +1,210 @@
+/* nutclientbench - nutclient protocol layer benchmarks
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/*
+ * Usage: nutclientbench [<scale>]
+ *
+ * Measure the throughput of the tokenizer, of the escaping and of the
+ * response parsing (through the socket layer) of nut::TcpClient.
+ * The server is an in-process fake upsd on the other end of a socketpair,
+ * whose replies are queued before each query, so the figures do not
+ * include any network or scheduling latency.
+ * <scale> multiplies the number of iterations (default: 1).
+ */
+
+#include "../clients/nutclient.h"
+
+#include <chrono>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+namespace {
+
+/* Give access to the protocol internals of nut::TcpClient */
+class BenchClient : public nut::TcpClient
+{
+public:
+	using nut::TcpClient::attach;
+	using nut::TcpClient::explode;
+	using nut::TcpClient::escape;
+};
+
+/* In-process fake upsd on the other end of a socketpair */
+class FakeUpsd
+{
+public:
+	FakeUpsd(BenchClient& client)
+	{
+		int fds[2];
+		if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+		{
+			perror("socketpair");
+			exit(EXIT_FAILURE);
+		}
+		client.attach(fds[0]);
+		_fd = fds[1];
+		fcntl(_fd, F_SETFL, fcntl(_fd, F_GETFL) | O_NONBLOCK);
+	}
+
+	~FakeUpsd()
+	{
+		close(_fd);
+	}
+
+	/* Queue a reply, to be read by the client after its query */
+	void reply(const std::string& data)
+	{
+		size_t done = 0;
+		while(done < data.size())
+		{
+			ssize_t res = write(_fd, data.data() + done, data.size() - done);
+			if(res < 0)
+			{
+				perror("write");
+				exit(EXIT_FAILURE);
+			}
+			done += res;
+		}
+	}
+
+	/* Discard the queries sent by the client */
+	void drain()
+	{
+		char buf[4096];
+		while(read(_fd, buf, sizeof(buf)) > 0)
+			;
+	}
+
+private:
+	int _fd;
+};
+
+/* Run <op> <iterations> times, <op> returning the number of bytes it handled */
+void run(const char* name, size_t iterations, std::function<size_t()> op)
+{
+	size_t bytes = op();	/* warm-up */
+
+	bytes = 0;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for(size_t n=0; n<iterations; ++n)
+	{
+		bytes += op();
+	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	printf("%-28s %10lu ops %12.1f ns/op %10.1f MB/s\n", name,
+		(unsigned long)iterations,
+		elapsed.count() * 1e9 / iterations,
+		bytes / elapsed.count() / 1e6);
+}
+
+std::string listReply(const std::string& dev, size_t count)
+{
+	std::ostringstream str;
+	str << "BEGIN LIST VAR " << dev << "\n";
+	for(size_t n=0; n<count; ++n)
+	{
+		str << "VAR " << dev << " outlet." << n << ".desc \"Outlet \\\"" << n << "\\\" (rack A)\"\n";
+	}
+	str << "END LIST VAR " << dev << "\n";
+	return str.str();
+}
+
+} /* namespace */
+
+int main(int argc, char** argv)
+{
+	double scale = (argc > 1) ? atof(argv[1]) : 1.0;
+	if(scale <= 0)
+	{
+		fprintf(stderr, "usage: %s [<scale>]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	const std::string simple = "VAR ups1 battery.charge \"100\"";
+	const std::string escaped = "VAR ups1 ups.alarm \"Replace \\\"battery\\\" \\\\ check wiring\"";
+	const std::string value = "Rack \"A\" \\ row 3";
+
+	run("explode/simple", 1000000 * scale, [&]() {
+		return BenchClient::explode(simple).size() ? simple.size() : 0;
+	});
+	run("explode/escaped", 1000000 * scale, [&]() {
+		return BenchClient::explode(escaped).size() ? escaped.size() : 0;
+	});
+	run("escape", 1000000 * scale, [&]() {
+		return BenchClient::escape(value).size() ? value.size() : 0;
+	});
+
+	BenchClient client;
+	FakeUpsd upsd(client);
+
+	const std::string list20 = listReply("ups1", 20);
+	run("list/VAR-20", 20000 * scale, [&]() {
+		upsd.reply(list20);
+		client.getDeviceVariableValues("ups1");
+		upsd.drain();
+		return list20.size();
+	});
+
+	const std::string list200 = listReply("ups1", 200);
+	run("list/VAR-200", 2000 * scale, [&]() {
+		upsd.reply(list200);
+		client.getDeviceVariableValues("ups1");
+		upsd.drain();
+		return list200.size();
+	});
+
+	const std::string get = "VAR ups1 outlet.1.delay.shutdown \"120\"\n";
+	run("get/sequential-48", 2000 * scale, [&]() {
+		for(int n=0; n<48; ++n)
+		{
+			upsd.reply(get);
+			client.getDeviceVariableValue("ups1", "outlet.1.delay.shutdown");
+		}
+		upsd.drain();
+		return get.size() * 48;
+	});
+
+	std::string get48;
+	for(int n=0; n<48; ++n)
+	{
+		get48 += get;
+	}
+	run("get/batch-48", 2000 * scale, [&]() {
+		nut::Batch batch(client);
+		for(int n=0; n<48; ++n)
+		{
+			batch.getDeviceVariableValue("ups1", "outlet.1.delay.shutdown");
+		}
+		upsd.reply(get48);
+		batch.execute();
+		upsd.drain();
+		return get48.size();
+	});
+
+	return EXIT_SUCCESS;
+}
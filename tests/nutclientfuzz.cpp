@@ -0,0 +1,228 @@
+/* nutclientfuzz - nutclient response parser fuzzing target
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/*
+ * libFuzzer-style target feeding arbitrary server responses to
+ * nut::TcpClient. The first byte of the input selects the operation,
+ * the rest is what the server answers. Only nut::NutException may
+ * come out of the client.
+ *
+ * With libFuzzer:
+ *   make nutclientfuzz CXXFLAGS="-g -fsanitize=fuzzer,address -DWITH_LIBFUZZER"
+ *   ./nutclientfuzz <corpus-dir>
+ *
+ * Otherwise, the program runs the inputs given as files on its command
+ * line, or (without arguments, as done by "make check") deterministic
+ * mutations of a built-in set of responses.
+ */
+
+#include "../clients/nutclient.h"
+
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+namespace {
+
+/* Give access to the protocol internals of nut::TcpClient */
+class FuzzClient : public nut::TcpClient
+{
+public:
+	using nut::TcpClient::attach;
+	using nut::TcpClient::explode;
+	using nut::TcpClient::parseTracking;
+};
+
+void fuzzBatch(FuzzClient& client)
+{
+	nut::Batch batch(client);
+	size_t get = batch.getDeviceVariableValue("ups1", "battery.charge");
+	size_t list = batch.getDeviceVariableValues("ups1");
+	size_t set = batch.setDeviceVariable("ups1", "ups.id", "My \"UPS\"");
+	size_t cmd = batch.executeDeviceCommand("ups1", "load.off");
+
+	try
+	{
+		batch.execute();
+	}
+	catch(nut::NutException&) {}
+
+	try { batch.getResult(get); } catch(nut::NutException&) {}
+	try { batch.getListResult(list); } catch(nut::NutException&) {}
+	try { batch.getTrackingID(set); } catch(nut::NutException&) {}
+	try { batch.getTrackingID(cmd); } catch(nut::NutException&) {}
+}
+
+} /* namespace */
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+	/* Stay below the socket buffer size, the whole response is queued
+	 * before the query is sent */
+	if(size < 1 || size > 65536)
+	{
+		return 0;
+	}
+
+	int fds[2];
+	if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+	{
+		return 0;
+	}
+
+	FuzzClient client;
+	client.attach(fds[0]);
+
+	const std::string response((const char*)data + 1, size - 1);
+	for(size_t done = 0; done < response.size(); )
+	{
+		ssize_t res = write(fds[1], response.data() + done, response.size() - done);
+		if(res <= 0)
+			break;
+		done += res;
+	}
+	/* End of data: the client must not wait for more */
+	shutdown(fds[1], SHUT_WR);
+
+	try
+	{
+		switch(data[0] % 6)
+		{
+		case 0:
+			client.getDeviceVariableValue("ups1", "battery.charge");
+			break;
+		case 1:
+			client.getDeviceVariableValues("ups1");
+			break;
+		case 2:
+			fuzzBatch(client);
+			break;
+		case 3:
+			client.watch("ups1", std::vector<std::string>(),
+				[](const std::string&, const std::string&, const std::vector<std::string>&) {});
+			while(true)
+			{
+				client.processWatches();
+			}
+			break;
+		case 4:
+			client.getTrackingResult("1234");
+			client.setDeviceVariable("ups1", "ups.id", "x");
+			break;
+		case 5:
+			FuzzClient::explode(response);
+			FuzzClient::parseTracking(response);
+			break;
+		}
+	}
+	catch(nut::NutException&) {}
+
+	close(fds[1]);
+	return 0;
+}
+
+#ifndef WITH_LIBFUZZER
+
+static const char* seeds[] = {
+	"\x00VAR ups1 battery.charge \"100\"\n",
+	"\x00ERR UNKNOWN-UPS\n",
+	"\x01" "BEGIN LIST VAR ups1\nVAR ups1 battery.charge \"100\"\nVAR ups1 ups.status \"OL\"\nEND LIST VAR ups1\n",
+	"\x01" "BEGIN LIST VAR ups1\nNOTIFY VAR ups1 x \"1\"\nVAR ups1 ups.alarm \"a \\\"b\\\" \\\\c\"\nEND LIST VAR ups1\n",
+	"\x02VAR ups1 battery.charge \"100\"\nERR UNKNOWN-UPS\nOK\nOK TRACKING 1\n",
+	"\x02VAR ups1 battery.charge \"100\"\nBEGIN LIST VAR ups1\ngarbage\nEND LIST VAR ups1\nOK\nERR ACCESS-DENIED\n",
+	"\x03OK\nBEGIN LIST VAR ups1\nVAR ups1 ups.status \"OL\"\nEND LIST VAR ups1\nNOTIFY VAR ups1 ups.status \"OB\"\nNOTIFY DELVAR ups1 ups.status\n",
+	"\x04PENDING\nOK TRACKING 1234\n",
+	"\x05OK TRACKING \"12\\\"34\"",
+};
+
+static void fuzzFile(const char* fn)
+{
+	FILE* f = fopen(fn, "rb");
+	if(!f)
+	{
+		perror(fn);
+		exit(EXIT_FAILURE);
+	}
+	std::string data;
+	char buf[4096];
+	size_t sz;
+	while((sz = fread(buf, 1, sizeof(buf), f)) > 0)
+	{
+		data.append(buf, sz);
+	}
+	fclose(f);
+	LLVMFuzzerTestOneInput((const uint8_t*)data.data(), data.size());
+}
+
+int main(int argc, char** argv)
+{
+	if(argc > 1)
+	{
+		for(int n=1; n<argc; ++n)
+		{
+			fuzzFile(argv[n]);
+		}
+		return EXIT_SUCCESS;
+	}
+
+	/* Deterministic mutations of the seeds */
+	static const char special[] = "\"\\ \n";
+	const size_t nseeds = sizeof(seeds) / sizeof(seeds[0]);
+	const size_t iterations = 20000;
+	uint32_t rnd = 2463534242U;
+	for(size_t n=0; n<iterations; ++n)
+	{
+		const char* seed = seeds[n % nseeds];
+		/* The first byte (operation) may be \0 */
+		std::string input(seed, 1);
+		input += std::string(seed + 1);
+
+		size_t mutations = n / nseeds % 8;
+		for(size_t m=0; m<mutations && input.size()>1; ++m)
+		{
+			rnd ^= rnd << 13; rnd ^= rnd >> 17; rnd ^= rnd << 5;
+			size_t pos = 1 + rnd % (input.size() - 1);
+			switch((rnd >> 24) % 4)
+			{
+			case 0:
+				input[pos] = (char)(rnd >> 8);
+				break;
+			case 1:
+				input.insert(pos, 1, special[(rnd >> 8) % (sizeof(special) - 1)]);
+				break;
+			case 2:
+				input.erase(pos, 1 + (rnd >> 8) % 8);
+				break;
+			case 3:
+				input.insert(pos, input.substr(1, pos - 1));
+				break;
+			}
+		}
+		LLVMFuzzerTestOneInput((const uint8_t*)input.data(), input.size());
+	}
+
+	printf("%lu inputs processed\n", (unsigned long)iterations);
+	return EXIT_SUCCESS;
+}
+
+#endif /* WITH_LIBFUZZER */
@@ -23,6 +23,11 @@ class NutClientTest : public CppUnit::TestFixture
 	CPPUNIT_TEST_SUITE( NutClientTest );
 		CPPUNIT_TEST( test_stringset_to_strarr );
 		CPPUNIT_TEST( test_stringvector_to_strarr );
+		CPPUNIT_TEST( test_batch );
+		CPPUNIT_TEST( test_watch_pushed );
+		CPPUNIT_TEST( test_watch_polled );
+		CPPUNIT_TEST( test_bad_replies );
+		CPPUNIT_TEST( test_reconnect );
 	CPPUNIT_TEST_SUITE_END();
 
 public:
@@ -31,6 +36,11 @@ public:
 
 	void test_stringset_to_strarr();
 	void test_stringvector_to_strarr();
+	void test_batch();
+	void test_watch_pushed();
+	void test_watch_polled();
+	void test_bad_replies();
+	void test_reconnect();
 };
 
 // Registers the fixture into the 'registry'
@@ -42,6 +52,139 @@ strarr stringset_to_strarr(const std::set<std::string>& strset);
 strarr stringvector_to_strarr(const std::vector<std::string>& strset);
 } // extern "C"
 
+#include <map>
+#include <utility>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/**
+ * Minimal fake upsd, answering canned replies to queries.
+ * It listens on a loopback port and serves connections one after the other
+ * in a child process. When several replies are registered for a query, they
+ * are used in turn, the last one being repeated. An empty reply closes the
+ * connection.
+ */
+class FakeServer
+{
+public:
+	FakeServer(int connections = 1):_pid(-1), _port(0), _connections(connections) {}
+
+	~FakeServer()
+	{
+		wait();
+	}
+
+	void reply(const std::string& query, const std::string& response)
+	{
+		_replies.insert(std::make_pair(query, response));
+	}
+
+	void start()
+	{
+		struct sockaddr_in sin;
+		socklen_t len = sizeof(sin);
+
+		memset(&sin, 0, sizeof(sin));
+		sin.sin_family = AF_INET;
+		sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+		int sock = socket(AF_INET, SOCK_STREAM, 0);
+		bind(sock, (struct sockaddr*)&sin, sizeof(sin));
+		listen(sock, 1);
+		getsockname(sock, (struct sockaddr*)&sin, &len);
+		_port = ntohs(sin.sin_port);
+
+		if(pipe(_log) < 0)
+			return;
+
+		_pid = fork();
+		if(_pid == 0)
+		{
+			close(_log[0]);
+			for(int n=0; n<_connections; ++n)
+			{
+				int fd = accept(sock, NULL, NULL);
+				serve(fd);
+				close(fd);
+			}
+			close(sock);
+			close(_log[1]);
+			_exit(0);
+		}
+		close(_log[1]);
+		close(sock);
+	}
+
+	int port()const {return _port;}
+
+	/**
+	 * Wait for the end of the server and retrieve the queries it received,
+	 * one per line.
+	 */
+	std::string transcript()
+	{
+		wait();
+		std::string res;
+		char buf[256];
+		ssize_t sz;
+		while((sz = ::read(_log[0], buf, sizeof(buf))) > 0)
+			res.append(buf, sz);
+		return res;
+	}
+
+private:
+	void wait()
+	{
+		int status;
+		if(_pid > 0)
+		{
+			waitpid(_pid, &status, 0);
+			_pid = -1;
+		}
+	}
+
+	void serve(int fd)
+	{
+		std::string line;
+		char c;
+		while(::read(fd, &c, 1) == 1)
+		{
+			if(c != '\n')
+			{
+				line += c;
+				continue;
+			}
+			std::string logged = line + "\n";
+			if(::write(_log[1], logged.c_str(), logged.size()) < 0)
+				return;
+			std::string response = "ERR UNKNOWN-COMMAND\n";
+			std::multimap<std::string, std::string>::iterator it = _replies.find(line);
+			if(it != _replies.end())
+			{
+				response = it->second;
+				if(_replies.count(line) > 1)
+					_replies.erase(it);
+			}
+			if(response.empty())
+				return;
+			if(::write(fd, response.c_str(), response.size()) < 0)
+				return;
+			line.clear();
+		}
+	}
+
+	std::multimap<std::string, std::string> _replies;
+	pid_t _pid;
+	int _port;
+	int _connections;
+	int _log[2];
+};
+
 void NutClientTest::setUp()
 {
 }
@@ -98,3 +241,210 @@ void NutClientTest::test_stringvector_to_strarr()
 	
 	strarr_free(arr);
 }
+
+void NutClientTest::test_batch()
+{
+	FakeServer server;
+	server.reply("GET VAR ups1 battery.charge", "VAR ups1 battery.charge \"100\"\n");
+	server.reply("GET VAR nope battery.charge", "ERR UNKNOWN-UPS\n");
+	server.reply("LIST VAR ups1", "BEGIN LIST VAR ups1\n"
+		"VAR ups1 battery.charge \"100\"\n"
+		"VAR ups1 ups.status \"OL\"\n"
+		"END LIST VAR ups1\n");
+	server.reply("LIST VAR nope", "ERR UNKNOWN-UPS\n");
+	server.reply("LIST VAR bad", "BEGIN LIST VAR bad\n"
+		"garbage\n"
+		"END LIST VAR bad\n");
+	server.reply("SET VAR ups1 outlet.1.delay.shutdown \"30\"", "OK\n");
+	server.reply("INSTCMD ups1 load.off ", "OK TRACKING 1234\n");
+	server.start();
+
+	nut::TcpClient client("localhost", server.port());
+	nut::Batch batch(client);
+
+	size_t get_ok = batch.getDeviceVariableValue("ups1", "battery.charge");
+	size_t list_err = batch.getDeviceVariableValues("nope");
+	size_t get_err = batch.getDeviceVariableValue("nope", "battery.charge");
+	size_t list_bad = batch.getDeviceVariableValues("bad");
+	size_t list_ok = batch.getDeviceVariableValues("ups1");
+	size_t set_ok = batch.setDeviceVariable("ups1", "outlet.1.delay.shutdown", "30");
+	size_t cmd_ok = batch.executeDeviceCommand("ups1", "load.off");
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("Batch::size() is not 7", (size_t)7, batch.size());
+
+	batch.execute();
+
+	CPPUNIT_ASSERT_MESSAGE("GET operation failed", batch.isOk(get_ok));
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("GET operation result", std::string("100"), batch.getResult(get_ok)[0]);
+
+	CPPUNIT_ASSERT_MESSAGE("LIST of unknown device succeeded", !batch.isOk(list_err));
+	CPPUNIT_ASSERT_THROW(batch.getListResult(list_err), nut::NutException);
+	CPPUNIT_ASSERT_MESSAGE("GET of unknown device succeeded", !batch.isOk(get_err));
+	CPPUNIT_ASSERT_THROW(batch.getResult(get_err), nut::NutException);
+	CPPUNIT_ASSERT_MESSAGE("LIST with invalid content succeeded", !batch.isOk(list_bad));
+
+	CPPUNIT_ASSERT_MESSAGE("LIST operation failed after errors", batch.isOk(list_ok));
+	std::vector<std::vector<std::string> > vars = batch.getListResult(list_ok);
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("LIST operation has not 2 items", (size_t)2, vars.size());
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("LIST operation item 1", std::string("ups.status"), vars[1][0]);
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("LIST operation item 1 value", std::string("OL"), vars[1][1]);
+
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("SET operation tracking", std::string(""), batch.getTrackingID(set_ok));
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("INSTCMD operation tracking", std::string("1234"), batch.getTrackingID(cmd_ok));
+
+	client.disconnect();
+
+	// Operations which could not be sent fail, and are not sent again
+	nut::Batch unsent(client);
+	size_t set_unsent = unsent.setDeviceVariable("ups1", "outlet.1.delay.shutdown", "30");
+	CPPUNIT_ASSERT_THROW(unsent.execute(), nut::IOException);
+	CPPUNIT_ASSERT_MESSAGE("SET operation not sent succeeded", !unsent.isOk(set_unsent));
+	CPPUNIT_ASSERT_THROW(unsent.getTrackingID(set_unsent), nut::IOException);
+	unsent.execute();
+	CPPUNIT_ASSERT_THROW(unsent.getTrackingID(set_unsent), nut::IOException);
+}
+
+typedef std::vector<std::pair<std::string, std::vector<std::string> > > WatchChanges;
+
+void NutClientTest::test_watch_pushed()
+{
+	FakeServer server;
+	// Notifications sent before the initial list are already part of it
+	server.reply("WATCH ups1 battery.", "OK\n"
+		"NOTIFY VAR ups1 battery.charge \"95\"\n");
+	server.reply("LIST VAR ups1", "BEGIN LIST VAR ups1\n"
+		"VAR ups1 battery.charge \"95\"\n"
+		"VAR ups1 ups.status \"OL\"\n"
+		"END LIST VAR ups1\n");
+	server.reply("GET VAR ups1 ups.status", "NOTIFY VAR ups1 battery.charge \"95\"\n"
+		"NOTIFY VAR ups1 battery.charge \"80\"\n"
+		"NOTIFY DELVAR ups1 battery.runtime\n"
+		"NOTIFY DELVAR ups1 battery.charge\n"
+		"VAR ups1 ups.status \"OB\"\n");
+	server.start();
+
+	nut::TcpClient client("localhost", server.port());
+	WatchChanges changes;
+	std::vector<std::string> prefixes;
+	prefixes.push_back("battery.");
+	client.watch("ups1", prefixes, [&changes](const std::string&, const std::string& name,
+		const std::vector<std::string>& values)
+	{
+		changes.push_back(std::make_pair(name, values));
+	});
+
+	CPPUNIT_ASSERT_MESSAGE("WATCH not pushed", client.isWatchPushed("ups1"));
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("Initial values not notified once", (size_t)1, changes.size());
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("Initial value", std::string("95"), changes[0].second[0]);
+	CPPUNIT_ASSERT_MESSAGE("No keepalive deadline", client.getWatchTimeout() > 0);
+	client.setKeepAliveInterval(0);
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("Pushed watch has a timeout", -1L, client.getWatchTimeout());
+	changes.clear();
+
+	// Notifications received while waiting for a response are queued
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("Response mixed with notifications", std::string("OB"),
+		client.getDeviceVariableValue("ups1", "ups.status")[0]);
+	CPPUNIT_ASSERT_MESSAGE("Notifications dispatched too early", changes.empty());
+
+	client.processWatches();
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("Only changes must be notified", (size_t)2, changes.size());
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("Changed variable", std::string("battery.charge"), changes[0].first);
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("Changed value", std::string("80"), changes[0].second[0]);
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("Deleted variable", std::string("battery.charge"), changes[1].first);
+	CPPUNIT_ASSERT_MESSAGE("Deleted variable has values", changes[1].second.empty());
+
+	client.disconnect();
+}
+
+void NutClientTest::test_watch_polled()
+{
+	FakeServer server;
+	// No WATCH support on server: the default reply is ERR UNKNOWN-COMMAND
+	server.reply("LIST VAR ups1", "BEGIN LIST VAR ups1\n"
+		"VAR ups1 battery.charge \"100\"\n"
+		"VAR ups1 ups.status \"OL\"\n"
+		"END LIST VAR ups1\n");
+	server.reply("LIST VAR ups1", "BEGIN LIST VAR ups1\n"
+		"VAR ups1 battery.charge \"100\"\n"
+		"VAR ups1 ups.status \"OB\"\n"
+		"VAR ups1 ups.alarm \"Replace battery\"\n"
+		"END LIST VAR ups1\n");
+	server.start();
+
+	nut::TcpClient client("localhost", server.port());
+	client.setWatchPollInterval(0);
+	WatchChanges changes;
+	std::vector<std::string> prefixes;
+	prefixes.push_back("ups.");
+	client.watch("ups1", prefixes, [&changes](const std::string&, const std::string& name,
+		const std::vector<std::string>& values)
+	{
+		changes.push_back(std::make_pair(name, values));
+	});
+
+	CPPUNIT_ASSERT_MESSAGE("WATCH pushed by an old server", !client.isWatchPushed("ups1"));
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("Initial values not notified once", (size_t)1, changes.size());
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("Polled watch has no deadline", 0L, client.getWatchTimeout());
+	changes.clear();
+
+	client.processWatches();
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("Only changes must be notified", (size_t)2, changes.size());
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("New variable", std::string("ups.alarm"), changes[0].first);
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("Changed value", std::string("OB"), changes[1].second[0]);
+
+	changes.clear();
+	client.processWatches();
+	CPPUNIT_ASSERT_MESSAGE("Unchanged variables notified", changes.empty());
+
+	client.unwatch("ups1");
+	client.disconnect();
+}
+
+void NutClientTest::test_bad_replies()
+{
+	FakeServer server;
+	server.reply("GET VAR ups1 battery.charge", "ERR\n");
+	server.reply("GET VAR ups1 ups.id", "VAR ups1 ups.id \"a\\xb\"\n");
+	server.start();
+
+	nut::TcpClient client("localhost", server.port());
+
+	// A bare ERR used to escape as std::out_of_range
+	CPPUNIT_ASSERT_THROW(client.getDeviceVariableValue("ups1", "battery.charge"), nut::NutException);
+	// Unknown escapes are kept as they are
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("Unknown escape sequence", std::string("a\\xb"),
+		client.getDeviceVariableValue("ups1", "ups.id")[0]);
+
+	client.disconnect();
+}
+
+void NutClientTest::test_reconnect()
+{
+	FakeServer server(2);
+	server.reply("USERNAME admin", "OK\n");
+	server.reply("PASSWORD secret", "OK\n");
+	server.reply("LOGIN ups1", "OK\n");
+	server.reply("GET VAR ups1 ups.status", "VAR ups1 ups.status \"OL\"\n");
+	// Connection dropped by the server
+	server.reply("GET VAR ups1 battery.charge", "");
+	server.start();
+
+	nut::TcpClient client("localhost", server.port());
+	client.authenticate("admin", "secret");
+	client.deviceLogin("ups1");
+
+	CPPUNIT_ASSERT_THROW(client.getDeviceVariableValue("ups1", "battery.charge"), nut::IOException);
+	// Transparent reconnection, restoring the session
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("Value after reconnection", std::string("OL"),
+		client.getDeviceVariableValue("ups1", "ups.status")[0]);
+
+	client.setAutoReconnect(false);
+	CPPUNIT_ASSERT_THROW(client.getDeviceVariableValue("ups1", "battery.charge"), nut::IOException);
+	CPPUNIT_ASSERT_THROW(client.getDeviceVariableValue("ups1", "ups.status"), nut::IOException);
+
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("Queries received by the server", std::string(
+		"USERNAME admin\nPASSWORD secret\nLOGIN ups1\n"
+		"GET VAR ups1 battery.charge\n"
+		"USERNAME admin\nPASSWORD secret\nLOGIN ups1\n"
+		"GET VAR ups1 ups.status\n"
+		"GET VAR ups1 battery.charge\n"), server.transcript());
+}
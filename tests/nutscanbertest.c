@@ -0,0 +1,250 @@
+/* nutscanbertest - nut-scanner SNMP probe encoding checks
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/*
+ * Usage: nutscanbertest
+ *
+ * Check the GetRequest that the probe of a range sends against one
+ * encoded by hand, with short and long form lengths; then feed the
+ * parsing of the replies with GetResponses as agents may send them, and
+ * with what it must turn down: truncated packets, lengths beyond the
+ * packet or the size of a size_t, other PDUs than a GetResponse.
+ * Exits with a failure if a check finds a difference.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nutscan-ber.h"
+
+static int	errors = 0;
+
+/* GetRequest of SysOID, community "public", request-id 0x12345678 */
+static const unsigned char get_public[] = {
+	0x30, 0x29,					/* message */
+	0x02, 0x01, 0x00,				/* version 1 */
+	0x04, 0x06, 'p', 'u', 'b', 'l', 'i', 'c',	/* community */
+	0xa0, 0x1c,					/* GetRequest */
+	0x02, 0x04, 0x12, 0x34, 0x56, 0x78,		/* request-id */
+	0x02, 0x01, 0x00,				/* error-status */
+	0x02, 0x01, 0x00,				/* error-index */
+	0x30, 0x0e,					/* varbind list */
+	0x30, 0x0c,					/* varbind */
+	0x06, 0x08, 0x2b, 0x06, 0x01, 0x02, 0x01, 0x01, 0x02, 0x00,	/* 1.3.6.1.2.1.1.2.0 */
+	0x05, 0x00					/* NULL */
+};
+
+/* its GetResponse, from a UPS whose SysOID is 1.3.6.1.4.1.705.1, with
+ * lengths in the long form where the short one would do */
+static const unsigned char response_long[] = {
+	0x30, 0x82, 0x00, 0x33,
+	0x02, 0x01, 0x00,
+	0x04, 0x81, 0x06, 'p', 'u', 'b', 'l', 'i', 'c',
+	0xa2, 0x81, 0x24,
+	0x02, 0x04, 0x12, 0x34, 0x56, 0x78,
+	0x02, 0x01, 0x00,
+	0x02, 0x01, 0x00,
+	0x30, 0x16,
+	0x30, 0x14,
+	0x06, 0x08, 0x2b, 0x06, 0x01, 0x02, 0x01, 0x01, 0x02, 0x00,
+	0x06, 0x08, 0x2b, 0x06, 0x01, 0x04, 0x01, 0x85, 0x41, 0x01
+};
+
+static void check(int ok, const char *what)
+{
+	if (!ok) {
+		printf("%s: failed\n", what);
+		errors++;
+	}
+}
+
+static void dump(const char *what, const unsigned char *buf, size_t len)
+{
+	size_t	i;
+
+	printf("%s:", what);
+
+	for (i = 0; i < len; i++) {
+		printf(" %02x", buf[i]);
+	}
+
+	printf("\n");
+}
+
+/* the probe builds at the end of the buffer */
+static const unsigned char *build(unsigned char *buf, size_t size, const char *community,
+	unsigned long reqid, size_t *len)
+{
+	*len = nutscan_ber_build_probe(buf, size, community, reqid);
+
+	return buf + size - *len;
+}
+
+static void check_build(void)
+{
+	unsigned char	buf[1024];
+	const unsigned char	*req;
+	char	community[301];
+	size_t	len, size;
+
+	req = build(buf, sizeof(buf), "public", 0x12345678, &len);
+
+	if ((len != sizeof(get_public)) || memcmp(req, get_public, len)) {
+		dump("built", req, len);
+		dump("expected", get_public, sizeof(get_public));
+		errors++;
+	}
+
+	/* exactly the room it takes, and any less */
+	req = build(buf, sizeof(get_public), "public", 0x12345678, &len);
+	check((len == sizeof(get_public)) && !memcmp(req, get_public, len), "build in just enough room");
+
+	for (size = 0; size < sizeof(get_public); size++) {
+		if (nutscan_ber_build_probe(buf, size, "public", 0x12345678) != 0) {
+			printf("build in %lu bytes: should not fit\n", (unsigned long)size);
+			errors++;
+		}
+	}
+
+	/* the request-id, as few bytes as it takes, positive */
+	req = build(buf, sizeof(buf), "public", 0, &len);
+	check((len == sizeof(get_public) - 3) && !memcmp(req + 15, "\x02\x01\x00", 3), "request-id 0");
+
+	req = build(buf, sizeof(buf), "public", 0x7f, &len);
+	check(!memcmp(req + 15, "\x02\x01\x7f", 3), "request-id 0x7f");
+
+	req = build(buf, sizeof(buf), "public", 0x80, &len);
+	check(!memcmp(req + 15, "\x02\x02\x00\x80", 4), "request-id 0x80");
+
+	req = build(buf, sizeof(buf), "public", 0x7fffffff, &len);
+	check(!memcmp(req + 15, "\x02\x04\x7f\xff\xff\xff", 6), "request-id 0x7fffffff");
+
+	/* long form, with one byte of length from 128 on */
+	memset(community, 'c', 200);
+	community[200] = '\0';
+	req = build(buf, sizeof(buf), community, 1, &len);
+	check((len == 236) && !memcmp(req, "\x30\x81\xe9\x02\x01\x00\x04\x81\xc8", 9)
+		&& !memcmp(req + 209, "\xa0\x19\x02\x01\x01", 5), "community of 200 bytes");
+
+	/* then two from 256 on: 300 bytes of community, 334 of message */
+	memset(community, 'c', 300);
+	community[300] = '\0';
+	req = build(buf, sizeof(buf), community, 1, &len);
+	check((len == 338) && !memcmp(req, "\x30\x82\x01\x4e\x02\x01\x00\x04\x82\x01\x2c", 11)
+		&& !memcmp(req + 311, "\xa0\x19\x02\x01\x01", 5), "community of 300 bytes");
+}
+
+static void check_parse(void)
+{
+	unsigned char	buf[1024], pkt[64];
+	const unsigned char	*req;
+	unsigned long	reqids[] = { 0, 1, 0x7f, 0x80, 0xff, 0x100, 0x12345678, 0x7fffffff };
+	size_t	len, i, pos, n;
+
+	check(nutscan_ber_parse_probe(response_long, sizeof(response_long)) == 0x12345678,
+		"GetResponse with long form lengths");
+
+	/* what the probe sent, as the agent would answer it */
+	for (i = 0; i < sizeof(reqids) / sizeof(reqids[0]); i++) {
+		req = build(buf, sizeof(buf), "public", reqids[i], &len);
+		memcpy(pkt, req, len);
+		pkt[13] = 0xa2;
+
+		if (nutscan_ber_parse_probe(pkt, len) != (long)reqids[i]) {
+			printf("GetResponse to %lx: %lx\n", reqids[i], nutscan_ber_parse_probe(pkt, len));
+			errors++;
+		}
+
+		/* not its own request, nor a Set, nor a trap */
+		pkt[13] = 0xa0;
+		check(nutscan_ber_parse_probe(pkt, len) == -1, "GetRequest");
+		pkt[13] = 0xa3;
+		check(nutscan_ber_parse_probe(pkt, len) == -1, "SetRequest");
+		pkt[13] = 0xa4;
+		check(nutscan_ber_parse_probe(pkt, len) == -1, "Trap");
+	}
+
+	/* cut anywhere, even in the varbinds it doesn't read: the message
+	 * length tells */
+	for (len = 0; len < sizeof(response_long); len++) {
+		if (nutscan_ber_parse_probe(response_long, len) != -1) {
+			printf("GetResponse cut at %lu: taken\n", (unsigned long)len);
+			errors++;
+		}
+	}
+
+	/* lengths beyond the packet, or that no size_t holds */
+	memcpy(pkt, response_long, sizeof(response_long));
+	pkt[3] = 0x34;
+	check(nutscan_ber_parse_probe(pkt, sizeof(response_long)) == -1, "message longer than the packet");
+
+	memcpy(pkt, response_long, sizeof(response_long));
+	pkt[9] = 0x40;
+	check(nutscan_ber_parse_probe(pkt, sizeof(response_long)) == -1, "community longer than the packet");
+
+	memcpy(pkt, response_long, sizeof(response_long));
+	pkt[18] = 0x7f;
+	check(nutscan_ber_parse_probe(pkt, sizeof(response_long)) == -1, "PDU longer than the packet");
+
+	check(nutscan_ber_parse_probe((const unsigned char *)"\x30\x84\xff\xff\xff\xff\x02\x01\x00", 9) == -1,
+		"4 GB message");
+	check(nutscan_ber_parse_probe((const unsigned char *)"\x30\x88\xff\xff\xff\xff\xff\xff\xff\xff\x02", 11) == -1,
+		"16 EB message");
+	/* followed by what would be a GetResponse of request-id 5 */
+	check(nutscan_ber_parse_probe((const unsigned char *)"\x30\x89\x01\x00\x00\x00\x00\x00\x00\x00\x0c"
+		"\x02\x01\x00\x04\x00\xa2\x05\x02\x01\x05\x02\x00", 23) == -1,
+		"9 bytes of length");
+	check(nutscan_ber_parse_probe((const unsigned char *)"\x30\x80"
+		"\x02\x01\x00\x04\x00\xa2\x80\x02\x01\x05\x02\x00\x00\x00", 16) == -1,
+		"indefinite length");
+
+	/* request-ids of 5 bytes at most */
+	check(nutscan_ber_parse_probe((const unsigned char *)"\x30\x10\x02\x01\x00\x04\x00\xa2\x09\x02\x05\x00\xff\xff\xff\xff\x02\x00", 18) == 0x7fffffff,
+		"5 byte request-id");
+	check(nutscan_ber_parse_probe((const unsigned char *)"\x30\x11\x02\x01\x00\x04\x00\xa2\x0a\x02\x06\x00\x00\xff\xff\xff\xff\x02\x00", 19) == -1,
+		"6 byte request-id");
+	check(nutscan_ber_parse_probe((const unsigned char *)"\x30\x0a\x02\x01\x00\x04\x00\xa2\x03\x02\x00\x00", 12) == -1,
+		"empty request-id");
+
+	/* and the header alone */
+	pos = 0;
+	check(nutscan_ber_get_header(response_long, sizeof(response_long), &pos, 0x30, &n)
+		&& (pos == 4) && (n == 0x33), "long form header");
+	pos = 4;
+	check(nutscan_ber_get_header(response_long, sizeof(response_long), &pos, 0x02, &n)
+		&& (pos == 6) && (n == 1), "short form header");
+	pos = 4;
+	check(!nutscan_ber_get_header(response_long, sizeof(response_long), &pos, 0x04, &n), "wrong tag");
+	pos = sizeof(response_long) - 1;
+	check(!nutscan_ber_get_header(response_long, sizeof(response_long), &pos, 0x00, &n), "header at the end");
+	pos = 0;
+	check(nutscan_ber_get_header((const unsigned char *)"\x05\x00", 2, &pos, 0x05, &n)
+		&& (n == 0) && (pos == 2), "empty content at the end");
+}
+
+int main(void)
+{
+	check_build();
+	check_parse();
+
+	printf("%d error(s)\n", errors);
+
+	return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,180 @@
+/* nutscanstatetest - nut-scanner state file checks
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/*
+ * Usage: nutscanstatetest
+ *
+ * Write a state file as earlier scans would have left it, open it and
+ * check which hosts are skipped: those whose latest line says they did
+ * not answer that scan, less than the maximum age ago.  Then check that
+ * it was rewritten with these only, and that what the next scan records
+ * is taken into account when it is opened again.
+ * Exits with a failure if a check finds a difference.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "nut-scan.h"
+
+#define STATE_FILE	"nutscanstatetest.state"
+#define MAX_AGE	3600
+
+static int	errors = 0;
+
+static void check_skip(nutscan_device_type_t type, const char *host, int expect,
+	const char *why)
+{
+	int	skip = nutscan_state_skip(type, host);
+
+	if (skip != expect) {
+		printf("%s %s: %s, but %s\n", nutscan_device_type_string(type), host,
+			why, skip ? "skipped" : "probed");
+		errors++;
+	}
+}
+
+/* the file must hold <expect> lines, each of them one of <hosts> */
+static void check_file(int expect, const char **hosts)
+{
+	FILE	*fp;
+	char	buf[256], type[64], host[64];
+	int	count = 0, i;
+
+	if ((fp = fopen(STATE_FILE, "r")) == NULL) {
+		printf("%s: cannot read it back\n", STATE_FILE);
+		errors++;
+		return;
+	}
+
+	while (fgets(buf, sizeof(buf), fp) != NULL) {
+		count++;
+
+		if (sscanf(buf, "%63s %63s", type, host) != 2) {
+			printf("%s: bad line %s", STATE_FILE, buf);
+			errors++;
+			continue;
+		}
+
+		for (i = 0; hosts[i] && strcmp(hosts[i], host); i++)
+			;
+
+		if (!hosts[i]) {
+			printf("%s: %s %s should be gone\n", STATE_FILE, type, host);
+			errors++;
+		}
+	}
+
+	fclose(fp);
+
+	if (count != expect) {
+		printf("%s: %d line(s), %d expected\n", STATE_FILE, count, expect);
+		errors++;
+	}
+}
+
+int main(void)
+{
+	FILE	*fp;
+	long	now = (long)time(NULL);
+	const char	*silent[] = { "10.0.0.1", "10.0.0.3", "10.0.0.5", NULL };
+	const char	*recorded[] = { "10.0.0.1", "10.0.0.3", "10.0.0.5", "10.0.0.7", NULL };
+	const char	*silent_again[] = { "10.0.0.3", "10.0.0.5", "10.0.0.7", NULL };
+
+	if ((fp = fopen(STATE_FILE, "w")) == NULL) {
+		printf("%s: cannot write it\n", STATE_FILE);
+		return EXIT_FAILURE;
+	}
+
+	fprintf(fp, "SNMP 10.0.0.1 %ld 0\n", now - 10);
+	fprintf(fp, "SNMP 10.0.0.2 %ld 0\n", now - 10);
+	fprintf(fp, "SNMP 10.0.0.3 %ld 1\n", now - 5);
+	fprintf(fp, "bogus line\n");
+	fprintf(fp, "SNMP 10.0.0.2 %ld 1\n", now - 5);
+	fprintf(fp, "SNMP 10.0.0.3 %ld 0\n", now - 10);
+	fprintf(fp, "SNMP 10.0.0.4 %ld 0\n", now - 2 * MAX_AGE);
+	fprintf(fp, "NUT 10.0.0.1 %ld 1\n", now - 10);
+	fprintf(fp, "XML 10.0.0.5 %ld 0\n", now - 10);
+	fprintf(fp, "NONE 10.0.0.6 %ld 0\n", now - 10);
+	fprintf(fp, "FOO 10.0.0.6 %ld 0\n", now - 10);
+	fclose(fp);
+
+	if (!nutscan_state_open(STATE_FILE, MAX_AGE)) {
+		printf("%s: cannot open it\n", STATE_FILE);
+		return EXIT_FAILURE;
+	}
+
+	/* rewritten with the hosts it skips */
+	check_file(3, silent);
+
+	check_skip(TYPE_SNMP, "10.0.0.1", 1, "did not answer");
+	check_skip(TYPE_SNMP, "10.0.0.2", 0, "answered last");
+	check_skip(TYPE_SNMP, "10.0.0.3", 1, "did not answer last, on a later line");
+	check_skip(TYPE_SNMP, "10.0.0.4", 0, "did not answer, too long ago");
+	check_skip(TYPE_NUT, "10.0.0.1", 0, "answered that scan");
+	check_skip(TYPE_XML, "10.0.0.5", 1, "did not answer");
+	check_skip(TYPE_SNMP, "10.0.0.5", 0, "did not answer another scan only");
+	check_skip(TYPE_SNMP, "10.0.0.6", 0, "is on ignored lines only");
+	check_skip(TYPE_SNMP, "10.0.0.9", 0, "was never probed");
+
+	/* what the next scan finds */
+	nutscan_state_record(TYPE_SNMP, "10.0.0.1", 1);
+	nutscan_state_record(TYPE_NUT, "10.0.0.7", 0);
+
+	/* the entries are those of the file when opened */
+	check_skip(TYPE_SNMP, "10.0.0.1", 1, "did not answer before this scan");
+	check_skip(TYPE_NUT, "10.0.0.7", 0, "was not probed before this scan");
+
+	nutscan_state_close();
+	check_file(5, recorded);
+
+	if (!nutscan_state_open(STATE_FILE, MAX_AGE)) {
+		printf("%s: cannot open it again\n", STATE_FILE);
+		return EXIT_FAILURE;
+	}
+
+	check_file(3, silent_again);
+	check_skip(TYPE_SNMP, "10.0.0.1", 0, "answered the last scan");
+	check_skip(TYPE_SNMP, "10.0.0.3", 1, "did not answer");
+	check_skip(TYPE_NUT, "10.0.0.7", 1, "did not answer the last scan");
+	nutscan_state_close();
+
+	/* nothing is skipped once closed */
+	check_skip(TYPE_SNMP, "10.0.0.3", 0, "the state is closed");
+
+	/* and a file gone is no state */
+	remove(STATE_FILE);
+
+	if (!nutscan_state_open(STATE_FILE, MAX_AGE)) {
+		printf("%s: cannot create it\n", STATE_FILE);
+		errors++;
+	}
+
+	check_skip(TYPE_SNMP, "10.0.0.3", 0, "no state");
+	nutscan_state_close();
+	check_file(0, silent);
+	remove(STATE_FILE);
+
+	printf("%d error(s)\n", errors);
+
+	return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,96 @@
+/* snmptraptest - snmp-ups trap matching checks
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/*
+ * Usage: snmptraptest
+ *
+ * Match trap OIDs, as su_trap_oid() gives them for SNMPv2c informs and
+ * traps and for SNMPv1 traps (enterprise.0.specific), against entries
+ * in the forms the MIBs use: the RFC 1628 traps, which an SNMPv1 agent
+ * sends as enterprise upsTraps with the trap number as specific, and the
+ * enterprise.0 prefixes of the vendor MIBs.  Then check what must not
+ * match: OIDs that only share the leading characters of a sub-identifier,
+ * and a 0 that isn't the second to last one.
+ * Exits with a failure if a check finds a difference.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "snmp-trap.h"
+
+static int	errors = 0;
+
+static void check(const char *prefix, const char *trapoid, int expect)
+{
+	if (su_trap_match(prefix, trapoid) != expect) {
+		printf("%s %s %s, but does%s\n", trapoid, expect ? "matches" : "doesn't match",
+			prefix, expect ? "n't" : "");
+		errors++;
+	}
+}
+
+int main(void)
+{
+	/* upsTrapOnBattery and upsTrapTestCompleted (ietf-mib.c) */
+	check(".1.3.6.1.2.1.33.2.1", ".1.3.6.1.2.1.33.2.1", 1);
+	check(".1.3.6.1.2.1.33.2.2", ".1.3.6.1.2.1.33.2.2", 1);
+	check(".1.3.6.1.2.1.33.2.1", "1.3.6.1.2.1.33.2.1", 1);
+	check("1.3.6.1.2.1.33.2.1", ".1.3.6.1.2.1.33.2.1", 1);
+
+	/* the same, from an SNMPv1 agent */
+	check(".1.3.6.1.2.1.33.2.1", ".1.3.6.1.2.1.33.2.0.1", 1);
+	check(".1.3.6.1.2.1.33.2.2", ".1.3.6.1.2.1.33.2.0.2", 1);
+	check(".1.3.6.1.2.1.33.2.4", ".1.3.6.1.2.1.33.2.0.4", 1);
+	check(".1.3.6.1.2.1.33.2.1", ".1.3.6.1.2.1.33.2.0.2", 0);
+	check(".1.3.6.1.2.1.33.2.2", ".1.3.6.1.2.1.33.2.0.1", 0);
+
+	/* vendor traps, enterprise.0.specific in both versions */
+	check(".1.3.6.1.4.1.318.0.5", ".1.3.6.1.4.1.318.0.5", 1);
+	check(".1.3.6.1.4.1.318.0.5", ".1.3.6.1.4.1.318.0.50", 0);
+	check(".1.3.6.1.4.1.534.6.6.7.0", ".1.3.6.1.4.1.534.6.6.7.0.5", 1);
+	check(".1.3.6.1.4.1.534.6.6.7.0", ".1.3.6.1.4.1.534.6.6.7.0", 1);
+	check(".1.3.6.1.4.1.534.6.6.7.0", ".1.3.6.1.4.1.534.6.6.7.1", 0);
+	check(".1.3.6.1.4.1.534.6.6.7.0", ".1.3.6.1.4.1.534.6.6.7", 0);
+
+	/* a whole subtree */
+	check(".1.3.6.1.2.1.33.2", ".1.3.6.1.2.1.33.2.0.3", 1);
+	check(".1.3.6.1.2.1.33.2", ".1.3.6.1.2.1.33.2.3", 1);
+
+	/* sub-identifiers that only start the same */
+	check(".1.3.6.1.2.1.33.2.1", ".1.3.6.1.2.1.33.2.10", 0);
+	check(".1.3.6.1.2.1.33.2.1", ".1.3.6.1.2.1.33.2.0.10", 0);
+	check(".1.3.6.1.2.1.33.2.1", ".1.3.6.1.2.1.33.2.10.1", 0);
+	check(".1.3.6.1.2.1.33.2.1", ".1.3.6.1.2.1.33.2.00.1", 0);
+	check(".1.3.6.1.2.1.33.2.1", ".1.3.6.1.2.1.33.20.0.1", 0);
+	check(".1.3.6.1.2.1.33.2.1", ".1.3.6.1.2.1.33.2", 0);
+
+	/* the 0 is taken out only second to last */
+	check(".1.3.6.1.2.1.33.2.1", ".1.3.6.1.2.1.33.2.0.1.0", 0);
+	check(".1.3.6.1.2.1.33.2.1", ".1.3.6.1.2.1.33.0.2.1", 0);
+	check(".1.3.6.1.2.1.33.2.1", ".1.3.6.1.2.1.33.2.1.0.1", 1);
+
+	/* nothing much */
+	check(".1.3.6.1.2.1.33.2.1", "", 0);
+	check(".1.3.6.1.2.1.33.2.1", ".0.1", 0);
+
+	printf("%d error(s)\n", errors);
+
+	return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
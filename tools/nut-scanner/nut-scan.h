@@ -114,6 +114,14 @@ nutscan_device_t * nutscan_scan_eaton_serial(const char* ports_list);
 /* Display functions */
 void nutscan_display_ups_conf(nutscan_device_t * device);
 void nutscan_display_parsable(nutscan_device_t * device);
+void nutscan_display_json(nutscan_device_t * device);
+
+/* Scan state: the hosts that did not answer the scan of an IP address
+ * range less than max_age seconds ago are not probed again */
+int nutscan_state_open(const char * filename, long max_age);
+void nutscan_state_close(void);
+int nutscan_state_skip(nutscan_device_type_t type, const char * host);
+void nutscan_state_record(nutscan_device_type_t type, const char * host, int answered);
 
 #ifdef __cplusplus
 /* *INDENT-OFF* */
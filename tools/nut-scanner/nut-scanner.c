@@ -40,11 +40,12 @@
 
 #define ERR_BAD_OPTION	(-1)
 
-const char optstring[] = "?ht:s:e:E:c:l:u:W:X:w:x:p:b:B:d:L:CUSMOAm:NPqIVaD";
+const char optstring[] = "?ht:T:s:e:E:c:l:u:W:X:w:x:p:b:B:d:L:CUSMOAm:NPJFk:K:qIVaD";
 
 #ifdef HAVE_GETOPT_LONG
 const struct option longopts[] =
 	{{ "timeout",required_argument,NULL,'t' },
+	{ "max_parallel",required_argument,NULL,'T' },
 	{ "start_ip",required_argument,NULL,'s' },
 	{ "end_ip",required_argument,NULL,'e' },
 	{ "eaton_serial",required_argument,NULL,'E' },
@@ -70,6 +71,10 @@ const struct option longopts[] =
 	{ "ipmi_scan",no_argument,NULL,'I' },
 	{ "disp_nut_conf",no_argument,NULL,'N' },
 	{ "disp_parsable",no_argument,NULL,'P' },
+	{ "disp_json",no_argument,NULL,'J' },
+	{ "stream",no_argument,NULL,'F' },
+	{ "state_file",required_argument,NULL,'k' },
+	{ "state_age",required_argument,NULL,'K' },
 	{ "quiet",no_argument,NULL,'q' },
 	{ "help",no_argument,NULL,'h' },
 	{ "version",no_argument,NULL,'V' },
@@ -88,6 +93,19 @@ static char * end_ip = NULL;
 static char * port = NULL;
 static char * serial_ports = NULL;
 
+static void (*display_func)(nutscan_device_t * device) = nutscan_display_ups_conf;
+
+/* Display each device as soon as it is found */
+static void display_stream(nutscan_device_t * device)
+{
+	display_func(device);
+	fflush(stdout);
+}
+
+static void display_none(nutscan_device_t * device)
+{
+}
+
 #ifdef HAVE_PTHREAD
 static pthread_t thread[TYPE_END];
 
@@ -171,6 +189,9 @@ void show_usage()
 	printf("  -s, --start_ip <IP address>: First IP address to scan.\n");
 	printf("  -e, --end_ip <IP address>: Last IP address to scan.\n");
 	printf("  -m, --mask_cidr <IP address/mask>: Give a range of IP using CIDR notation.\n");
+	printf("  -T, --max_parallel <number>: Number of hosts probed at once by each scan of a range (default %d).\n", DEFAULT_MAX_PARALLEL);
+	printf("  -k, --state_file <file>: Remember in this file the hosts probed, and skip the ones that did not answer lately.\n");
+	printf("  -K, --state_age <seconds>: How long a host that did not answer is skipped (default %d).\n", DEFAULT_STATE_AGE);
 
 	if( nutscan_avail_snmp ) {
 		printf("\nSNMP v1 specific options:\n");
@@ -202,6 +223,8 @@ void show_usage()
 	printf("\ndisplay specific options:\n");
 	printf("  -N, --disp_nut_conf: Display result in the ups.conf format\n");
 	printf("  -P, --disp_parsable: Display result in a parsable format\n");
+	printf("  -J, --disp_json: Display result as one JSON object per device and line\n");
+	printf("  -F, --stream: Display each device as soon as it is found\n");
 	printf("\nMiscellaneous options:\n");
 	printf("  -V, --version: Display NUT version\n");
 	printf("  -a, --available: Display available bus that can be scanned\n");
@@ -225,7 +248,9 @@ int main(int argc, char *argv[])
 	int allow_ipmi = 0;
 	int allow_eaton_serial = 0; /* MUST be requested explicitly! */
 	int quiet = 0; /* The debugging level for certain upsdebugx() progress messages; 0 = print always, quiet==1 is to require at least one -D */
-	void (*display_func)(nutscan_device_t * device);
+	int stream = 0;
+	char * state_file = NULL;
+	long state_age = DEFAULT_STATE_AGE;
 	int ret_code = EXIT_SUCCESS;
 
 	memset(&snmp_sec, 0, sizeof(snmp_sec));
@@ -253,8 +278,6 @@ int main(int argc, char *argv[])
 
 	nutscan_init();
 
-	display_func = nutscan_display_ups_conf;
-
 	/* Parse command line options -- Second loop: everything else */
 	/* Restore error messages... */
 	opterr = 1;
@@ -272,6 +295,15 @@ int main(int argc, char *argv[])
 					timeout = DEFAULT_NETWORK_TIMEOUT * 1000 * 1000;
 				}
 				break;
+			case 'T':
+				if( atol(optarg) <= 0 ) {
+					fprintf(stderr,"Illegal number of parallel probes, using default %d\n", DEFAULT_MAX_PARALLEL);
+					nutscan_max_parallel = DEFAULT_MAX_PARALLEL;
+				}
+				else {
+					nutscan_max_parallel = atol(optarg);
+				}
+				break;
 			case 's':
 				start_ip = strdup(optarg);
 				if (end_ip == NULL)
@@ -419,6 +451,22 @@ int main(int argc, char *argv[])
 			case 'P':
 				display_func = nutscan_display_parsable;
 				break;
+			case 'J':
+				display_func = nutscan_display_json;
+				break;
+			case 'F':
+				stream = 1;
+				break;
+			case 'k':
+				state_file = strdup(optarg);
+				break;
+			case 'K':
+				state_age = atol(optarg);
+				if( state_age <= 0 ) {
+					fprintf(stderr,"Illegal state age, using default %ds\n", DEFAULT_STATE_AGE);
+					state_age = DEFAULT_STATE_AGE;
+				}
+				break;
 			case 'q':
 				quiet = 1;
 				break;
@@ -478,6 +526,16 @@ display_help:
 		/* BEWARE: allow_all does not include allow_eaton_serial! */
 	}
 
+	if( state_file ) {
+		if( !nutscan_state_open(state_file, state_age) ) {
+			upsdebugx(quiet,"Scan state not kept");
+		}
+	}
+
+	if( stream ) {
+		nutscan_set_device_cb(display_stream);
+	}
+
 /* TODO/discuss : Should the #else...#endif code below for lack of pthreads
  * during build also serve as a fallback for pthread failure at runtime?
  */
@@ -637,6 +695,13 @@ display_help:
 	}
 #endif /* HAVE_PTHREAD */
 
+	nutscan_state_close();
+
+	/* Already displayed one by one */
+	if( stream ) {
+		display_func = display_none;
+	}
+
 	upsdebugx(1,"SCANS DONE: display results");
 
 	upsdebugx(1,"SCANS DONE: display results: USB");
@@ -0,0 +1,181 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*! \file nutscan-ber.c
+    \brief the SNMP v1 GetRequest of SysOID, and its GetResponse, in BER
+
+    All that the stateless probe of the hosts of a range needs, so that it
+    does not need a Net-SNMP session per host.
+*/
+
+#include "common.h"
+#include "nutscan-ber.h"
+#include <string.h>
+
+/* SysOID, BER encoded */
+static const unsigned char probe_sysoid[] = { 0x2b, 0x06, 0x01, 0x02, 0x01, 0x01, 0x02, 0x00 };
+
+/* BER encoding, backwards: put a tag and length in front of buf[*pos],
+ * returns 0 if it does not fit */
+static int ber_put_header(unsigned char * buf, size_t * pos, unsigned char tag, size_t len)
+{
+	size_t n = 0, i, l;
+
+	/* long form, with n bytes of length */
+	if (len > 0x7f) {
+		for (l = len; l > 0; l >>= 8) {
+			n++;
+		}
+	}
+
+	if (*pos < n + 2) {
+		return 0;
+	}
+
+	for (i = 0, l = len; i < n; i++, l >>= 8) {
+		buf[--*pos] = l & 0xff;
+	}
+	buf[--*pos] = n ? (0x80 | n) : len;
+	buf[--*pos] = tag;
+
+	return 1;
+}
+
+static int ber_put_bytes(unsigned char * buf, size_t * pos, unsigned char tag, const void * data, size_t len)
+{
+	if (*pos < len) {
+		return 0;
+	}
+
+	*pos -= len;
+	memcpy(buf + *pos, data, len);
+
+	return ber_put_header(buf, pos, tag, len);
+}
+
+/* a positive INTEGER, with as few bytes as possible */
+static int ber_put_int(unsigned char * buf, size_t * pos, unsigned long value)
+{
+	size_t end = *pos;
+
+	do {
+		if (*pos == 0) {
+			return 0;
+		}
+		buf[--*pos] = value & 0xff;
+		value >>= 8;
+	} while (value > 0);
+
+	if (buf[*pos] & 0x80) {
+		if (*pos == 0) {
+			return 0;
+		}
+		buf[--*pos] = 0;
+	}
+
+	return ber_put_header(buf, pos, 0x02, end - *pos);
+}
+
+size_t nutscan_ber_build_probe(unsigned char * buf, size_t size, const char * community, unsigned long reqid)
+{
+	size_t pos = size;
+
+	/* varbind list, of one varbind */
+	if (!ber_put_bytes(buf, &pos, 0x05, NULL, 0)
+		|| !ber_put_bytes(buf, &pos, 0x06, probe_sysoid, sizeof(probe_sysoid))
+		|| !ber_put_header(buf, &pos, 0x30, size - pos)
+		|| !ber_put_header(buf, &pos, 0x30, size - pos)) {
+		return 0;
+	}
+
+	/* PDU: request-id, error-status, error-index */
+	if (!ber_put_int(buf, &pos, 0) || !ber_put_int(buf, &pos, 0)) {
+		return 0;
+	}
+	if (!ber_put_int(buf, &pos, reqid)
+		|| !ber_put_header(buf, &pos, 0xa0, size - pos)) {
+		return 0;
+	}
+
+	/* message: version (0 for v1), community */
+	if (!ber_put_bytes(buf, &pos, 0x04, community, strlen(community))
+		|| !ber_put_int(buf, &pos, 0)
+		|| !ber_put_header(buf, &pos, 0x30, size - pos)) {
+		return 0;
+	}
+
+	return size - pos;
+}
+
+int nutscan_ber_get_header(const unsigned char * buf, size_t len, size_t * pos, unsigned char tag, size_t * content_len)
+{
+	size_t n;
+
+	if (*pos + 2 > len || buf[*pos] != tag) {
+		return 0;
+	}
+	(*pos)++;
+
+	if (buf[*pos] & 0x80) {
+		n = buf[(*pos)++] & 0x7f;
+		if (n == 0 || n > sizeof(size_t) || *pos + n > len) {
+			return 0;
+		}
+		for (*content_len = 0; n > 0; n--) {
+			*content_len = (*content_len << 8) | buf[(*pos)++];
+		}
+	}
+	else {
+		*content_len = buf[(*pos)++];
+	}
+
+	return *content_len <= len - *pos;
+}
+
+static int ber_get_int(const unsigned char * buf, size_t len, size_t * pos, unsigned long * value)
+{
+	size_t n;
+
+	if (!nutscan_ber_get_header(buf, len, pos, 0x02, &n) || n == 0 || n > 5) {
+		return 0;
+	}
+
+	for (*value = 0; n > 0; n--) {
+		*value = (*value << 8) | buf[(*pos)++];
+	}
+
+	return 1;
+}
+
+long nutscan_ber_parse_probe(const unsigned char * buf, size_t len)
+{
+	size_t pos = 0, n;
+	unsigned long value;
+
+	if (!nutscan_ber_get_header(buf, len, &pos, 0x30, &n)
+		|| !ber_get_int(buf, len, &pos, &value)
+		|| !nutscan_ber_get_header(buf, len, &pos, 0x04, &n)) {
+		return -1;
+	}
+	pos += n;
+
+	if (!nutscan_ber_get_header(buf, len, &pos, 0xa2, &n)
+		|| !ber_get_int(buf, len, &pos, &value)) {
+		return -1;
+	}
+
+	return value & 0x7fffffff;
+}
@@ -0,0 +1,49 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*! \file nutscan-ber.h
+    \brief the SNMP v1 GetRequest of SysOID, and its GetResponse, in BER
+*/
+
+#ifndef SCAN_BER
+#define SCAN_BER
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+#endif
+
+/* Build the GetRequest of SysOID, at the end of buf; returns its length,
+ * or 0 if it does not fit in size */
+size_t nutscan_ber_build_probe(unsigned char * buf, size_t size, const char * community, unsigned long reqid);
+
+/* The request-id of a GetResponse, or -1 if buf does not hold one */
+long nutscan_ber_parse_probe(const unsigned char * buf, size_t len);
+
+/* Read a tag and length at buf[*pos], which must be of type tag, and move
+ * *pos to the content; returns 0 if it does not fit in len */
+int nutscan_ber_get_header(const unsigned char * buf, size_t len, size_t * pos, unsigned char tag, size_t * content_len);
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+#endif
+
+#endif
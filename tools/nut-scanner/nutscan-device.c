@@ -21,10 +21,20 @@
     \author Frederic Bohe <fredericbohe@eaton.com>
 */
 
+#include "common.h"
 #include "nutscan-device.h"
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+/* see nutscan_set_device_cb() */
+static void (*device_cb)(nutscan_device_t * device) = NULL;
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t device_cb_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
 
 const char * nutscan_device_type_strings[TYPE_END - 1] = {
 	"USB",
@@ -199,3 +209,23 @@ nutscan_device_t * nutscan_rewind_device(nutscan_device_t * device)
 
 	return device;
 }
+
+void nutscan_set_device_cb(void (*cb)(nutscan_device_t * device))
+{
+	device_cb = cb;
+}
+
+void nutscan_report_device(nutscan_device_t * device)
+{
+	if( device_cb == NULL || device == NULL ) {
+		return;
+	}
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&device_cb_mutex);
+#endif
+	(*device_cb)(device);
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&device_cb_mutex);
+#endif
+}
@@ -84,6 +84,23 @@ nutscan_device_t * nutscan_add_device_to_device(nutscan_device_t * first, nutsca
  */
 nutscan_device_t * nutscan_rewind_device(nutscan_device_t * device);
 
+/**
+ *  \brief  Set the function called with each device as soon as a scan finds it
+ *
+ *  It is called from the threads of the scans, one call at a time, with a
+ *  device that is not linked to any other yet.
+ *
+ *  \param  cb  Callback, or NULL for none
+ */
+void nutscan_set_device_cb(void (*cb)(nutscan_device_t * device));
+
+/**
+ *  \brief  Pass a device a scan just found to the callback, if any
+ *
+ *  \param  device  Complete device, not linked to any other yet
+ */
+void nutscan_report_device(nutscan_device_t * device);
+
 #ifdef __cplusplus
 /* *INDENT-OFF* */
 }
@@ -116,3 +116,71 @@ void nutscan_display_parsable(nutscan_device_t * device)
 	while( current_dev != NULL );
 }
 
+
+/* Print a JSON string, escaped */
+static void nutscan_display_json_string(const char * str)
+{
+	const unsigned char * c;
+
+	putchar('"');
+	for (c = (const unsigned char *)str; *c != '\0'; c++) {
+		if (*c == '"' || *c == '\\') {
+			printf("\\%c", *c);
+		}
+		else if (*c < 0x20) {
+			printf("\\u%04x", *c);
+		}
+		else {
+			putchar(*c);
+		}
+	}
+	putchar('"');
+}
+
+void nutscan_display_json(nutscan_device_t * device)
+{
+	nutscan_device_t * current_dev = device;
+	nutscan_options_t * opt;
+
+	if(device==NULL) {
+		return;
+	}
+
+	/* Find start of the list */
+	while(current_dev->prev != NULL) {
+		current_dev = current_dev->prev;
+	}
+
+	/* Display each devices, one per line */
+	do {
+		printf("{\"type\":");
+		nutscan_display_json_string(nutscan_device_type_string[current_dev->type]);
+		printf(",\"driver\":");
+		nutscan_display_json_string(current_dev->driver ? current_dev->driver : "");
+		printf(",\"port\":");
+		nutscan_display_json_string(current_dev->port ? current_dev->port : "");
+
+		opt = current_dev->opt;
+
+		while (NULL != opt) {
+			if( opt->option != NULL ) {
+				putchar(',');
+				nutscan_display_json_string(opt->option);
+				putchar(':');
+				/* flags have no value */
+				if( opt->value != NULL ) {
+					nutscan_display_json_string(opt->value);
+				}
+				else {
+					printf("true");
+				}
+			}
+			opt = opt->next;
+		}
+
+		printf("}\n");
+
+		current_dev = current_dev->next;
+	}
+	while( current_dev != NULL );
+}
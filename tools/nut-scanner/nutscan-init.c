@@ -22,6 +22,7 @@
 */
 
 #include "common.h"
+#include "nutscan-init.h"
 #include <ltdl.h>
 #include <unistd.h>
 #include <stdio.h>
@@ -34,6 +35,8 @@ int nutscan_avail_snmp = 0;
 int nutscan_avail_usb = 0;
 int nutscan_avail_xml_http = 0;
 
+size_t nutscan_max_parallel = DEFAULT_MAX_PARALLEL;
+
 int nutscan_load_usb_library(const char *libname_path);
 int nutscan_load_snmp_library(const char *libname_path);
 int nutscan_load_neon_library(const char *libname_path);
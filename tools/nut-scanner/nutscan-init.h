@@ -24,6 +24,8 @@
 #ifndef SCAN_INIT
 #define SCAN_INIT
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 /* *INDENT-OFF* */
 extern "C" {
@@ -37,6 +39,13 @@ extern int nutscan_avail_snmp;
 extern int nutscan_avail_usb;
 extern int nutscan_avail_xml_http;
 
+/* How many hosts a scan of an IP address range probes at once */
+#define DEFAULT_MAX_PARALLEL	128
+extern size_t nutscan_max_parallel;
+
+/* Seconds a host that did not answer is skipped, with a scan state file */
+#define DEFAULT_STATE_AGE	86400
+
 void nutscan_init(void);
 void nutscan_free(void);
 
@@ -0,0 +1,168 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*! \file nutscan-pool.c
+    \brief bounded pool of threads, for the scans of IP address ranges
+*/
+
+#include "common.h"
+#include "nutscan-init.h"
+#include "nutscan-pool.h"
+#include <stdlib.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+struct nutscan_pool {
+	void *	(*func)(void *);
+#ifdef HAVE_PTHREAD
+	pthread_mutex_t	lock;
+	pthread_cond_t	work;	/* an argument is waiting, or done */
+	pthread_cond_t	room;	/* the queue is no longer full */
+	void **		queue;	/* the waiting arguments, a ring of size max */
+	size_t		head;
+	size_t		count;
+	pthread_t *	threads;
+	size_t		nthreads;
+	size_t		max;
+	int		done;
+#endif
+};
+
+#ifdef HAVE_PTHREAD
+static void * nutscan_pool_worker(void * p)
+{
+	nutscan_pool_t * pool = (nutscan_pool_t *)p;
+	void * arg;
+
+	pthread_mutex_lock(&pool->lock);
+
+	for (;;) {
+		while (pool->count == 0 && !pool->done) {
+			pthread_cond_wait(&pool->work, &pool->lock);
+		}
+
+		if (pool->count == 0) {
+			break;
+		}
+
+		arg = pool->queue[pool->head];
+		pool->head = (pool->head + 1) % pool->max;
+		pool->count--;
+		pthread_cond_signal(&pool->room);
+
+		pthread_mutex_unlock(&pool->lock);
+		(*pool->func)(arg);
+		pthread_mutex_lock(&pool->lock);
+	}
+
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+#endif
+
+nutscan_pool_t * nutscan_pool_new(void * (*func)(void *))
+{
+	nutscan_pool_t * pool;
+
+	pool = calloc(1, sizeof(*pool));
+	if (pool == NULL) {
+		return NULL;
+	}
+
+	pool->func = func;
+
+#ifdef HAVE_PTHREAD
+	pool->max = nutscan_max_parallel > 0 ? nutscan_max_parallel : 1;
+	pool->queue = calloc(pool->max, sizeof(*pool->queue));
+	pool->threads = calloc(pool->max, sizeof(*pool->threads));
+	if (pool->queue == NULL || pool->threads == NULL) {
+		free(pool->queue);
+		free(pool->threads);
+		free(pool);
+		return NULL;
+	}
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work, NULL);
+	pthread_cond_init(&pool->room, NULL);
+#endif
+
+	return pool;
+}
+
+void nutscan_pool_run(nutscan_pool_t * pool, void * arg)
+{
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&pool->lock);
+
+	while (pool->count == pool->max) {
+		pthread_cond_wait(&pool->room, &pool->lock);
+	}
+
+	pool->queue[(pool->head + pool->count) % pool->max] = arg;
+	pool->count++;
+
+	/* one more thread, until there are max of them */
+	if (pool->nthreads < pool->max) {
+		if (pthread_create(&pool->threads[pool->nthreads], NULL,
+			nutscan_pool_worker, pool) == 0) {
+			pool->nthreads++;
+		}
+		else {
+			upsdebugx(1, "%s: pthread_create failed, with %lu thread(s) running",
+				__func__, (unsigned long)pool->nthreads);
+		}
+	}
+
+	/* no thread at all: do it here rather than leave it out */
+	if (pool->nthreads == 0) {
+		pool->count--;
+		pthread_mutex_unlock(&pool->lock);
+		(*pool->func)(arg);
+		return;
+	}
+
+	pthread_cond_signal(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+#else
+	(*pool->func)(arg);
+#endif
+}
+
+void nutscan_pool_wait(nutscan_pool_t * pool)
+{
+#ifdef HAVE_PTHREAD
+	size_t i;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->done = 1;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 0; i < pool->nthreads; i++) {
+		pthread_join(pool->threads[i], NULL);
+	}
+
+	pthread_cond_destroy(&pool->room);
+	pthread_cond_destroy(&pool->work);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->threads);
+	free(pool->queue);
+#endif
+	free(pool);
+}
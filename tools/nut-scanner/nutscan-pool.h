@@ -0,0 +1,50 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*! \file nutscan-pool.h
+    \brief bounded pool of threads, for the scans of IP address ranges
+*/
+
+#ifndef SCAN_POOL
+#define SCAN_POOL
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+#endif
+
+typedef struct nutscan_pool nutscan_pool_t;
+
+/* A pool calling func() on each argument given to nutscan_pool_run(), from
+ * at most nutscan_max_parallel threads at once (or in the caller, without
+ * pthread support) */
+nutscan_pool_t * nutscan_pool_new(void * (*func)(void *));
+
+/* Give arg to the pool, waiting while all its threads are busy and as many
+ * arguments are already waiting */
+void nutscan_pool_run(nutscan_pool_t * pool, void * arg);
+
+/* Wait until every argument was handled, and free the pool */
+void nutscan_pool_wait(nutscan_pool_t * pool);
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+#endif
+
+#endif
@@ -0,0 +1,246 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*! \file nutscan-state.c
+    \brief hosts probed by earlier scans of IP address ranges
+
+    The state file holds one line per probed host:
+	<scan type> <host> <time> <1 if it answered, 0 otherwise>
+    Later lines override earlier ones for the same host.  On opening, it
+    is rewritten with the hosts that did not answer recently, the only
+    ones that are then skipped; then the new probes are appended.
+*/
+
+#include "common.h"
+#include "nut-scan.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+typedef struct {
+	int	type;
+	char *	host;
+	time_t	when;
+	int	answered;
+	size_t	line;	/* the last one wins */
+} state_entry_t;
+
+static state_entry_t * entries = NULL;
+static size_t entries_count = 0;
+static long entries_max_age = 0;
+static FILE * state_fp = NULL;
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t state_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static int state_type(const char * name)
+{
+	int type;
+
+	for (type = TYPE_NONE + 1; type < TYPE_END; type++) {
+		if (!strcmp(nutscan_device_type_string(type), name)) {
+			return type;
+		}
+	}
+
+	return TYPE_NONE;
+}
+
+/* by type and host only, for bsearch() */
+static int state_cmp_host(const void * a, const void * b)
+{
+	const state_entry_t * ea = (const state_entry_t *)a;
+	const state_entry_t * eb = (const state_entry_t *)b;
+
+	if (ea->type != eb->type) {
+		return ea->type - eb->type;
+	}
+
+	return strcmp(ea->host, eb->host);
+}
+
+/* by type and host, the latest line first */
+static int state_cmp(const void * a, const void * b)
+{
+	const state_entry_t * ea = (const state_entry_t *)a;
+	const state_entry_t * eb = (const state_entry_t *)b;
+	int ret;
+
+	if ((ret = state_cmp_host(a, b)) != 0) {
+		return ret;
+	}
+
+	return (ea->line < eb->line) - (ea->line > eb->line);
+}
+
+/* Sort the entries, and keep the latest one of each host only if it did
+ * not answer, less than max_age seconds ago */
+static void state_compact(time_t now)
+{
+	state_entry_t * kept;
+	size_t i, j = 0;
+
+	if (entries_count == 0) {
+		return;
+	}
+
+	qsort(entries, entries_count, sizeof(*entries), state_cmp);
+
+	kept = calloc(entries_count, sizeof(*kept));
+	if (kept == NULL) {
+		nutscan_state_close();
+		return;
+	}
+
+	for (i = 0; i < entries_count; i++) {
+		if ((i == 0 || state_cmp_host(&entries[i - 1], &entries[i]) != 0)
+			&& !entries[i].answered && now - entries[i].when < entries_max_age) {
+			kept[j] = entries[i];
+			kept[j++].host = strdup(entries[i].host);
+		}
+	}
+
+	for (i = 0; i < entries_count; i++) {
+		free(entries[i].host);
+	}
+	free(entries);
+
+	entries = kept;
+	entries_count = j;
+}
+
+int nutscan_state_open(const char * filename, long max_age)
+{
+	FILE * fp;
+	char buf[LARGEBUF];
+	char type[SMALLBUF], host[LARGEBUF];
+	long when;
+	int answered;
+	size_t line = 0;
+	state_entry_t * new_entries;
+	time_t now = time(NULL);
+	size_t i;
+
+	nutscan_state_close();
+	entries_max_age = max_age;
+
+	if ((fp = fopen(filename, "r")) != NULL) {
+		while (fgets(buf, sizeof(buf), fp) != NULL) {
+			line++;
+			if (sscanf(buf, "%63s %1023s %ld %d", type, host, &when, &answered) != 4
+				|| state_type(type) == TYPE_NONE) {
+				upsdebugx(1, "%s: %s: ignoring line %lu", __func__,
+					filename, (unsigned long)line);
+				continue;
+			}
+
+			new_entries = realloc(entries, (entries_count + 1) * sizeof(*entries));
+			if (new_entries == NULL) {
+				break;
+			}
+			entries = new_entries;
+			entries[entries_count].type = state_type(type);
+			if ((entries[entries_count].host = strdup(host)) == NULL) {
+				break;
+			}
+			entries[entries_count].when = when;
+			entries[entries_count].answered = answered;
+			entries[entries_count].line = line;
+			entries_count++;
+		}
+		fclose(fp);
+	}
+
+	state_compact(now);
+
+	/* what is still of use, then the new probes as they complete */
+	if ((state_fp = fopen(filename, "w")) == NULL) {
+		fprintf(stderr, "Cannot write the scan state to %s\n", filename);
+		return 0;
+	}
+	setvbuf(state_fp, NULL, _IOLBF, 0);
+
+	for (i = 0; i < entries_count; i++) {
+		fprintf(state_fp, "%s %s %ld %d\n",
+			nutscan_device_type_string(entries[i].type),
+			entries[i].host, (long)entries[i].when, entries[i].answered);
+	}
+
+	upsdebugx(1, "%s: %lu host(s) will not be probed again", __func__,
+		(unsigned long)entries_count);
+
+	return 1;
+}
+
+void nutscan_state_close(void)
+{
+	size_t i;
+
+	if (state_fp != NULL) {
+		fclose(state_fp);
+		state_fp = NULL;
+	}
+
+	for (i = 0; i < entries_count; i++) {
+		free(entries[i].host);
+	}
+	free(entries);
+	entries = NULL;
+	entries_count = 0;
+}
+
+int nutscan_state_skip(nutscan_device_type_t type, const char * host)
+{
+	state_entry_t key;
+
+	/* the entries are not changed while scanning */
+	if (entries_count == 0) {
+		return 0;
+	}
+
+	key.type = type;
+	key.host = (char *)host;
+
+	if (bsearch(&key, entries, entries_count, sizeof(*entries), state_cmp_host) == NULL) {
+		return 0;
+	}
+
+	upsdebugx(2, "%s: %s did not answer the %s scan lately, skipped",
+		__func__, host, nutscan_device_type_string(type));
+
+	return 1;
+}
+
+void nutscan_state_record(nutscan_device_type_t type, const char * host, int answered)
+{
+	if (state_fp == NULL) {
+		return;
+	}
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&state_mutex);
+#endif
+	fprintf(state_fp, "%s %s %ld %d\n", nutscan_device_type_string(type),
+		host, (long)time(NULL), answered ? 1 : 0);
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&state_mutex);
+#endif
+}
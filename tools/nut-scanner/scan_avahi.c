@@ -292,6 +292,7 @@ static void update_device(const char * host_name,const char *ip, uint16_t port,c
 				}
 			}
 			if( dev->port ) {
+				nutscan_report_device(dev);
 				dev_ret = nutscan_add_device_to_device(dev_ret,dev);
 			}
 			else {
@@ -337,6 +338,7 @@ static void update_device(const char * host_name,const char *ip, uint16_t port,c
 				dev->port=strdup(host_name);
 			}
 			if( dev->port ) {
+				nutscan_report_device(dev);
 				dev_ret = nutscan_add_device_to_device(dev_ret,dev);
 			}
 			else {
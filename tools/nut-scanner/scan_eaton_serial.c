@@ -39,10 +39,7 @@
 #include "bcmxcp_io.h"
 #include "bcmxcp.h"
 #include "nutscan-serial.h"
-
-#ifdef HAVE_PTHREAD
-#include <pthread.h>
-#endif
+#include "eventloop.h"
 
 /* SHUT header */
 #define SHUT_SYNC 0x16
@@ -61,10 +58,6 @@ static nutscan_device_t * dev_ret = NULL;
 /* Remap some functions to avoid undesired behavior (drivers/main.c) */
 char *getval(const char *var) { return NULL; }
 
-#ifdef HAVE_PTHREAD
-static pthread_mutex_t dev_mutex;
-#endif
-
 /* Drivers name */
 #define SHUT_DRIVER_NAME  "mge-shut"
 #define XCP_DRIVER_NAME   "bcmxcp"
@@ -109,76 +102,222 @@ unsigned char calc_checksum(const unsigned char *buf)
 }
 
 /*******************************************************************************
- * SHUT functions (MGE legacy, but Eaton path forward)
+ * Probe engine
  ******************************************************************************/
 
-/* Light version of of drivers/libshut.c->shut_synchronise()
- * return 1 if OK, 0 otherwise */
-int shut_synchronise(int upsfd)
+/* All the ports are probed at once, from the event loop of the drivers
+ * (drivers/eventloop.c).  Each port goes through serial_protocols[] in turn,
+ * until one of them gets an answer.  A protocol is a small state machine:
+ * its step() function is called to start it (with step 0) and whenever the
+ * deadline of the current step passes, and its data() function whenever
+ * the port received something, in probe->buf */
+
+typedef struct serial_probe_s serial_probe_t;
+
+typedef struct {
+	const char	*driver;
+	void	(*step)(serial_probe_t *probe);
+	void	(*data)(serial_probe_t *probe);
+} serial_protocol_t;
+
+struct serial_probe_s {
+	char	*port;
+	int	fd;
+	const serial_protocol_t	*protocol;	/* in serial_protocols[] */
+	int	step;
+	int	tries;
+	int	timer;
+	unsigned char	buf[128];
+	size_t	len;
+};
+
+/* ports still being probed */
+static int serial_probes_active = 0;
+
+static void serial_probe_timeout(void *arg)
 {
-	int try;
-	u_char reply = '\0';
+	serial_probe_t	*probe = (serial_probe_t *)arg;
 
-	/* Sync with the UPS according to notification */
-	for (try = 0; try < MAX_TRY; try++) {
-		if ((ser_send_char(upsfd, SHUT_SYNC)) == -1) {
-			continue;
-		}
+	probe->timer = 0;
+	probe->protocol->step(probe);
+}
 
-		ser_get_char(upsfd, &reply, 1, 0);
-		if (reply == SHUT_SYNC) {
-			return 1;
-		}
+/* call the step() of the protocol in <ms> milliseconds, unless it gets an
+ * answer before */
+static void serial_probe_wait(serial_probe_t *probe, long ms)
+{
+	if (probe->timer) {
+		ev_deltimer(probe->timer);
+	}
+
+	probe->timer = ev_addtimer(0, ms, serial_probe_timeout, probe);
+}
+
+static void serial_probe_close(serial_probe_t *probe)
+{
+	if (probe->timer) {
+		ev_deltimer(probe->timer);
+		probe->timer = 0;
+	}
+
+	if (probe->fd != -1) {
+		ev_delfd(probe->fd);
+		ser_close(probe->fd, NULL);
+		probe->fd = -1;
+	}
+}
+
+/* the port is done with, found or not */
+static void serial_probe_done(serial_probe_t *probe)
+{
+	serial_probe_close(probe);
+	probe->protocol = NULL;
+	serial_probes_active--;
+}
+
+/* go on with the next protocol, after a pause */
+static void serial_probe_next(serial_probe_t *probe)
+{
+	serial_probe_close(probe);
+
+	if ((++probe->protocol)->driver == NULL) {
+		upsdebugx(2, "%s: nothing found on %s", __func__, probe->port);
+		serial_probe_done(probe);
+		return;
+	}
+
+	probe->step = 0;
+	serial_probe_wait(probe, 100);
+}
+
+static void serial_probe_found(serial_probe_t *probe)
+{
+	nutscan_device_t	*dev;
+
+	dev = nutscan_new_device();
+	dev->type = TYPE_EATON_SERIAL;
+	dev->driver = strdup(probe->protocol->driver);
+	dev->port = strdup(probe->port);
+	nutscan_report_device(dev);
+	dev_ret = nutscan_add_device_to_device(dev_ret, dev);
+
+	serial_probe_done(probe);
+}
+
+static void serial_probe_read(int fd, void *arg)
+{
+	serial_probe_t	*probe = (serial_probe_t *)arg;
+	unsigned char	discard[128];
+	ssize_t	ret;
+
+	if (probe->len < sizeof(probe->buf)) {
+		ret = read(fd, probe->buf + probe->len, sizeof(probe->buf) - probe->len);
+	} else {
+		ret = read(fd, discard, sizeof(discard));
 	}
-	return 0;
+
+	if (ret < 0 && (errno == EAGAIN || errno == EINTR)) {
+		return;
+	}
+
+	/* the port went away */
+	if (ret <= 0) {
+		upsdebug_with_errno(2, "%s: %s", __func__, probe->port);
+		serial_probe_done(probe);
+		return;
+	}
+
+	if (probe->len < sizeof(probe->buf)) {
+		probe->len += ret;
+	}
+
+	probe->protocol->data(probe);
 }
 
-/* SHUT scan:
- *   send SYNC token (0x16) and receive the SYNC token back
+/* open the port for the protocol; if that fails, the others would too */
+static int serial_probe_open(serial_probe_t *probe, speed_t speed)
+{
+	if ((probe->fd = ser_open_nf(probe->port)) == -1) {
+		upsdebug_with_errno(2, "%s: %s", __func__, probe->port);
+		serial_probe_done(probe);
+		return 0;
+	}
+
+	ev_addfd(probe->fd, serial_probe_read, probe);
+	probe->len = 0;
+
+	if (ser_set_speed_nf(probe->fd, probe->port, speed) == -1) {
+		serial_probe_next(probe);
+		return 0;
+	}
+
+	return 1;
+}
+
+/*******************************************************************************
+ * SHUT functions (MGE legacy, but Eaton path forward)
+ ******************************************************************************/
+
+/* SHUT scan, a light version of drivers/libshut.c->shut_synchronise():
+ *   send SYNC token (0x16) and receive the SYNC token back, MAX_TRY times
  *   FIXME: maybe try to get device descriptor?!
  */
-nutscan_device_t * nutscan_scan_eaton_serial_shut(const char* port_name)
+static void shut_step(serial_probe_t *probe)
 {
-	nutscan_device_t * dev = NULL;
-	int devfd = -1;
+	switch (probe->step)
+	{
+	case 0:
+		if (!serial_probe_open(probe, B2400)) {
+			return;
+		}
 
-	if ( (devfd = ser_open_nf(port_name)) != -1 ) {
 		/* set RTS to off and DTR to on to allow correct behavior
 		 * with UPS using PnP feature */
-		if (ser_set_dtr(devfd, 1) != -1) {
-
-			ser_set_rts(devfd, 0);
-			ser_set_speed_nf(devfd, port_name, B2400);
-
-			if (shut_synchronise(devfd)) {
-
-				/* Communication established successfully! */
-				dev = nutscan_new_device();
-				dev->type = TYPE_EATON_SERIAL;
-				dev->driver = strdup(SHUT_DRIVER_NAME);
-				dev->port = strdup(port_name);
-#ifdef HAVE_PTHREAD
-				pthread_mutex_lock(&dev_mutex);
-#endif
-				dev_ret = nutscan_add_device_to_device(dev_ret, dev);
-#ifdef HAVE_PTHREAD
-				pthread_mutex_unlock(&dev_mutex);
-#endif
-			}
+		if (ser_set_dtr(probe->fd, 1) == -1) {
+			serial_probe_next(probe);
+			return;
 		}
-		/* Close the device */
-		ser_close(devfd, NULL);
+		ser_set_rts(probe->fd, 0);
+
+		probe->tries = 0;
+		probe->step = 1;
+		/* fall through */
+
+	case 1:
+		if (probe->tries++ == MAX_TRY) {
+			serial_probe_next(probe);
+			return;
+		}
+
+		probe->len = 0;
+		ser_send_char(probe->fd, SHUT_SYNC);
+		serial_probe_wait(probe, 1000);
+		break;
 	}
+}
 
-	return dev;
+static void shut_data(serial_probe_t *probe)
+{
+	if (probe->step != 1) {
+		probe->len = 0;
+		return;
+	}
+
+	if (probe->buf[0] == SHUT_SYNC) {
+		/* Communication established successfully! */
+		serial_probe_found(probe);
+		return;
+	}
+
+	/* sync again */
+	shut_step(probe);
 }
 
 /*******************************************************************************
  * XCP functions (Eaton Powerware legacy)
  ******************************************************************************/
 
-/* XCP scan:
- *   baudrate nego (...)
+/* XCP scan, for each baud rate (probe->tries):
  *   Send ESC to take it out of menu
  *   Wait 90ms
  *   Send auth command (AUTHOR[4] = {0xCF, 0x69, 0xE8, 0xD5};)
@@ -186,81 +325,80 @@ nutscan_device_t * nutscan_scan_eaton_serial_shut(const char* port_name)
  *   Send PW_SET_REQ_ONLY_MODE command (0xA0) and wait for response
  *   [Get ID Block (PW_ID_BLOCK_REQ) (0x31)]
  */
-nutscan_device_t * nutscan_scan_eaton_serial_xcp(const char* port_name)
+static void xcp_step(serial_probe_t *probe)
 {
-	nutscan_device_t * dev = NULL;
-	int i, ret, devfd = -1;
-	unsigned char	answer[256];
-	unsigned char	sbuf[128];
-
-	memset(sbuf, 0, 128);
-
-	if ( (devfd = ser_open_nf(port_name)) != -1 ) {
-#ifdef HAVE_PTHREAD
-		pthread_mutex_lock(&dev_mutex);
-#endif
-		upsfd = devfd;
-#ifdef HAVE_PTHREAD
-		pthread_mutex_unlock(&dev_mutex);
-#endif
-
-		for (i=0; (pw_baud_rates[i].rate != 0) && (dev == NULL); i++)
-		{
-			memset(answer, 0, 256);
-
-			if (ser_set_speed_nf(devfd, port_name, pw_baud_rates[i].rate) == -1)
-				break;
-
-			ret = ser_send_char(devfd, 0x1d);	/* send ESC to take it out of menu */
-			if (ret <= 0)
-				break;
-
-			usleep(90000);
-			send_write_command(AUT, 4);
-			usleep(500000);
-			
-			/* Discovery with Baud Hunting (XCP protocol spec. §4.1.2)
-			 * sending PW_SET_REQ_ONLY_MODE should be enough, since
-			 * the unit should send back Identification block */
-			sbuf[0] = PW_COMMAND_START_BYTE;
-			sbuf[1] = (unsigned char)1;
-			sbuf[2] = PW_SET_REQ_ONLY_MODE;
-			sbuf[3] = calc_checksum(sbuf);
-			ret = ser_send_buf_pace(devfd, 1000, sbuf, 4);
-
-			/* Read PW_COMMAND_START_BYTE byte */
-			ret = ser_get_char(devfd, answer, 1, 0);
-
-#if 0
-			/* FIXME: seems not needed, but requires testing with more devices! */
-			if (ret <= 0) {
-				usleep(250000); /* 500000? */
-				memset(answer, 0, 256);
-				ret = command_sequence(&id_command, 1, answer);
-			}
-#endif
-
-			if ( (ret > 0) && (answer[0] == PW_COMMAND_START_BYTE) ) {
-				dev = nutscan_new_device();
-				dev->type = TYPE_EATON_SERIAL;
-				dev->driver = strdup(XCP_DRIVER_NAME);
-				dev->port = strdup(port_name);
-#ifdef HAVE_PTHREAD
-				pthread_mutex_lock(&dev_mutex);
-#endif
-				dev_ret = nutscan_add_device_to_device(dev_ret, dev);
-#ifdef HAVE_PTHREAD
-				pthread_mutex_unlock(&dev_mutex);
-#endif
-				break;
-			}
-			usleep(100000);
+	unsigned char	sbuf[4];
+
+	switch (probe->step)
+	{
+	case 0:
+		if (!serial_probe_open(probe, B19200)) {
+			return;
 		}
-		/* Close the device */
-		ser_close(devfd, NULL);
+
+		probe->tries = 0;
+		probe->step = 1;
+		/* fall through */
+
+	case 1:
+		if ((pw_baud_rates[probe->tries].rate == 0)
+			|| (ser_set_speed_nf(probe->fd, probe->port, pw_baud_rates[probe->tries].rate) == -1)
+			|| (ser_send_char(probe->fd, 0x1d) <= 0)) {	/* send ESC to take it out of menu */
+			serial_probe_next(probe);
+			return;
+		}
+
+		probe->step = 2;
+		serial_probe_wait(probe, 90);
+		break;
+
+	case 2:
+		/* for bcmxcp_ser.c */
+		upsfd = probe->fd;
+		send_write_command(AUT, 4);
+
+		probe->step = 3;
+		serial_probe_wait(probe, 500);
+		break;
+
+	case 3:
+		/* Discovery with Baud Hunting (XCP protocol spec. §4.1.2)
+		 * sending PW_SET_REQ_ONLY_MODE should be enough, since
+		 * the unit should send back Identification block */
+		sbuf[0] = PW_COMMAND_START_BYTE;
+		sbuf[1] = (unsigned char)1;
+		sbuf[2] = PW_SET_REQ_ONLY_MODE;
+		sbuf[3] = calc_checksum(sbuf);
+
+		probe->len = 0;
+		ser_send_buf_pace(probe->fd, 1000, sbuf, 4);
+
+		probe->step = 4;
+		serial_probe_wait(probe, 1000);
+		break;
+
+	case 4:
+		/* no answer, try the next baud rate */
+		probe->tries++;
+		probe->step = 1;
+		serial_probe_wait(probe, 100);
+		break;
 	}
+}
 
-	return dev;
+static void xcp_data(serial_probe_t *probe)
+{
+	if (probe->step != 4) {
+		probe->len = 0;
+		return;
+	}
+
+	if (probe->buf[0] == PW_COMMAND_START_BYTE) {
+		serial_probe_found(probe);
+		return;
+	}
+
+	probe->len = 0;
 }
 
 /*******************************************************************************
@@ -275,119 +413,85 @@ nutscan_device_t * nutscan_scan_eaton_serial_xcp(const char* port_name)
  *   - simply try to get Q1 (status) string
  *   - check its size and first char. which should be '('
  */
-nutscan_device_t * nutscan_scan_eaton_serial_q1(const char* port_name)
+static void q1_step(serial_probe_t *probe)
 {
-	nutscan_device_t * dev = NULL;
-	struct termios tio;
-	int ret = 0, retry;
-	int devfd = -1;
-	char buf[128];
-
-	if ( (devfd = ser_open_nf(port_name)) != -1 ) {
-		if (ser_set_speed_nf(devfd, port_name, B2400) != -1) {
-
-			if (!tcgetattr(devfd, &tio)) {
-
-				/* Use canonical mode input processing (to read reply line) */
-				tio.c_lflag |= ICANON;	/* Canonical input (erase and kill processing) */
-
-				tio.c_cc[VEOF]   = _POSIX_VDISABLE;
-				tio.c_cc[VEOL]   = '\r';
-				tio.c_cc[VERASE] = _POSIX_VDISABLE;
-				tio.c_cc[VINTR]  = _POSIX_VDISABLE;
-				tio.c_cc[VKILL]  = _POSIX_VDISABLE;
-				tio.c_cc[VQUIT]  = _POSIX_VDISABLE;
-				tio.c_cc[VSUSP]  = _POSIX_VDISABLE;
-				tio.c_cc[VSTART] = _POSIX_VDISABLE;
-				tio.c_cc[VSTOP]  = _POSIX_VDISABLE;
-
-				if (!tcsetattr(devfd, TCSANOW, &tio)) {
-
-					/* Set the default (normal) cablepower */
-					ser_set_dtr(devfd, 1);
-					ser_set_rts(devfd, 0);
-
-					/* Allow some time to settle for the cablepower */
-					usleep(100000);
-
-					/* Only try pure 'Q1', not older ones like 'D' or 'QS'
-					 * > [Q1\r]
-					 * < [(226.0 195.0 226.0 014 49.0 27.5 30.0 00001000\r]
-					 */
-					for (retry = 1; retry <= MAXTRIES; retry++) {
-
-						/* simplified code */
-						ser_flush_io(devfd);
-						if ( (ret = ser_send(devfd, "Q1\r")) > 0) {
-
-							/* Get Q1 reply */
-							if ( (ret = ser_get_buf(devfd, buf, sizeof(buf), SER_WAIT_SEC, 0)) > 0) {
-
-								/* Check answer */
-								/* should at least (and most) be 46 chars */
-								if (ret >= 46) {
-									if (buf[0] == '(') {
-
-										dev = nutscan_new_device();
-										dev->type = TYPE_EATON_SERIAL;
-										dev->driver = strdup(Q1_DRIVER_NAME);
-										dev->port = strdup(port_name);
-#ifdef HAVE_PTHREAD
-										pthread_mutex_lock(&dev_mutex);
-#endif
-										dev_ret = nutscan_add_device_to_device(dev_ret, dev);
-#ifdef HAVE_PTHREAD
-										pthread_mutex_unlock(&dev_mutex);
-#endif
-										break;
-									}
-								}
-							}
-						}
-					}
-				}
-			}
+	switch (probe->step)
+	{
+	case 0:
+		if (!serial_probe_open(probe, B2400)) {
+			return;
 		}
-		/* Close the device */
-		ser_close(devfd, NULL);
+
+		/* Set the default (normal) cablepower */
+		ser_set_dtr(probe->fd, 1);
+		ser_set_rts(probe->fd, 0);
+
+		/* Allow some time to settle for the cablepower */
+		probe->tries = 0;
+		probe->step = 1;
+		serial_probe_wait(probe, 100);
+		break;
+
+	case 1:
+		if (probe->tries++ == MAXTRIES) {
+			serial_probe_next(probe);
+			return;
+		}
+
+		/* Only try pure 'Q1', not older ones like 'D' or 'QS'
+		 * > [Q1\r]
+		 * < [(226.0 195.0 226.0 014 49.0 27.5 30.0 00001000\r]
+		 */
+		ser_flush_io(probe->fd);
+		probe->len = 0;
+		ser_send(probe->fd, "Q1\r");
+		serial_probe_wait(probe, SER_WAIT_SEC * 1000);
+		break;
 	}
-	return dev;
 }
 
-static void * nutscan_scan_eaton_serial_device(void * port_arg)
+static void q1_data(serial_probe_t *probe)
 {
-	nutscan_device_t * dev = NULL;
-	char* port_name = (char*) port_arg;
-
-	/* Try SHUT first */
-	if ( (dev = nutscan_scan_eaton_serial_shut(port_name)) == NULL) {
-		usleep(100000);
-		/* Else, try XCP */
-		if ( (dev = nutscan_scan_eaton_serial_xcp(port_name)) == NULL) {
-			/* Else, try Q1 */
-			usleep(100000);
-			dev = nutscan_scan_eaton_serial_q1(port_name);
-		}
-		/* Else try UTalk? */
+	unsigned char	*end;
+
+	if (probe->step != 1) {
+		probe->len = 0;
+		return;
 	}
-	return dev;
+
+	/* wait for the whole reply */
+	end = memchr(probe->buf, '\r', probe->len);
+	if ((end == NULL) && (probe->len < sizeof(probe->buf))) {
+		return;
+	}
+
+	/* Check answer */
+	/* should at least (and most) be 46 chars */
+	if ((probe->len >= 46) && (probe->buf[0] == '(')) {
+		serial_probe_found(probe);
+		return;
+	}
+
+	/* ask again */
+	q1_step(probe);
 }
 
+/* in the order they are tried; UTalk? */
+static const serial_protocol_t serial_protocols[] = {
+	{ SHUT_DRIVER_NAME, shut_step, shut_data },
+	{ XCP_DRIVER_NAME, xcp_step, xcp_data },
+	{ Q1_DRIVER_NAME, q1_step, q1_data },
+	{ NULL, NULL, NULL }
+};
+
 nutscan_device_t * nutscan_scan_eaton_serial(const char* ports_range)
 {
 	struct sigaction oldact;
 	int change_action_handler = 0;
-	char *current_port_name = NULL;
 	char **serial_ports_list;
+	serial_probe_t *probes;
 	int  current_port_nb;
 	int i;
-#ifdef HAVE_PTHREAD
-	pthread_t thread;
-	pthread_t * thread_array = NULL;
-	int thread_count = 0;
-
-	pthread_mutex_init(&dev_mutex,NULL);
-#endif
 
 	/* 1) Get ports_list */
 	serial_ports_list = nutscan_get_serial_ports_list(ports_range);
@@ -403,37 +507,26 @@ nutscan_device_t * nutscan_scan_eaton_serial(const char* ports_range)
 		}
 	}
 
-	/* port(s) iterator */
-	current_port_nb = 0;
-	while(serial_ports_list[current_port_nb] != NULL) {
-		current_port_name = serial_ports_list[current_port_nb];
-#ifdef HAVE_PTHREAD
-		if (pthread_create(&thread, NULL, nutscan_scan_eaton_serial_device, (void*)current_port_name) == 0){
-			thread_count++;
-			pthread_t *new_thread_array = realloc(thread_array,
-						thread_count*sizeof(pthread_t));
-			if (new_thread_array == NULL) {
-				upsdebugx(1, "%s: Failed to realloc thread", __func__);
-				break;
-			}
-			else {
-				thread_array = new_thread_array;
-			}
-			thread_array[thread_count-1] = thread;
+	for (current_port_nb = 0; serial_ports_list[current_port_nb] != NULL; current_port_nb++);
+
+	probes = calloc(current_port_nb, sizeof(*probes));
+	if (probes != NULL) {
+		/* 2) start them all, then wait for all of them */
+		for (i = 0; i < current_port_nb; i++) {
+			probes[i].port = serial_ports_list[i];
+			probes[i].fd = -1;
+			probes[i].protocol = serial_protocols;
+			serial_probe_wait(&probes[i], 0);
+		}
+		serial_probes_active = current_port_nb;
+
+		while (serial_probes_active > 0) {
+			ev_dispatch(-1);
 		}
-#else
-		nutscan_scan_eaton_serial_device(current_port_name);
-#endif
-		current_port_nb++;
-	}
 
-#ifdef HAVE_PTHREAD
-	for ( i = 0; i < thread_count ; i++) {
-		pthread_join(thread_array[i],NULL);
+		ev_free();
+		free(probes);
 	}
-	pthread_mutex_destroy(&dev_mutex);
-	free(thread_array);
-#endif
 
 	if(change_action_handler) {
 		signal(SIGPIPE,SIG_DFL);
@@ -27,10 +27,14 @@
 
 #ifdef WITH_IPMI
 #include "upsclient.h"
+#include "nutscan-pool.h"
 #include <freeipmi/freeipmi.h>
 #include <stdio.h>
 #include <string.h>
 #include <ltdl.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
 #define NUT_IPMI_DRV_NAME	"nut-ipmipsu"
 
@@ -43,6 +47,18 @@
 static lt_dlhandle dl_handle = NULL;
 static const char *dl_error = NULL;
 
+/* what the scan of a range found */
+static nutscan_device_t * dev_ret = NULL;
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t dev_mutex;
+#endif
+
+/* one host of a range, with its own copy of the settings */
+struct scan_ipmi_arg {
+	char * IPaddr;
+	nutscan_ipmi_t sec;
+};
+
 #ifdef HAVE_FREEIPMI_11X_12X
   /* Functions symbols remapping */
   #define IPMI_FRU_CLOSE_DEVICE_ID                     "ipmi_fru_close_device_id"
@@ -547,7 +563,8 @@ nutscan_device_t * nutscan_scan_ipmi_device(const char * IPaddr, nutscan_ipmi_t
 			nut_dev->port = strdup(port_id);
 			/* FIXME: also dump device.serial?
 			 * using drivers/libfreeipmi_get_board_info() */
-			
+			nutscan_report_device(nut_dev);
+
 			current_nut_dev = nutscan_add_device_to_device(
 							current_nut_dev,
 							nut_dev);
@@ -565,6 +582,28 @@ nutscan_device_t * nutscan_scan_ipmi_device(const char * IPaddr, nutscan_ipmi_t
 	return current_nut_dev;
 }
 
+static void * nutscan_scan_ipmi_host(void * arg)
+{
+	struct scan_ipmi_arg * ipmi_arg = (struct scan_ipmi_arg *)arg;
+	nutscan_device_t * nut_dev;
+
+	nut_dev = nutscan_scan_ipmi_device(ipmi_arg->IPaddr, &ipmi_arg->sec);
+	nutscan_state_record(TYPE_IPMI, ipmi_arg->IPaddr, nut_dev != NULL);
+	if (nut_dev != NULL) {
+#ifdef HAVE_PTHREAD
+		pthread_mutex_lock(&dev_mutex);
+#endif
+		dev_ret = nutscan_add_device_to_device(dev_ret, nut_dev);
+#ifdef HAVE_PTHREAD
+		pthread_mutex_unlock(&dev_mutex);
+#endif
+	}
+
+	free(ipmi_arg->IPaddr);
+	free(ipmi_arg);
+	return NULL;
+}
+
 /* General IPMI scan entry point: scan 1 to n devices, local or remote,
  * for IPMI support
  * Return NULL on error, or a valid nutscan_device_t otherwise */
@@ -572,9 +611,9 @@ nutscan_device_t * nutscan_scan_ipmi(const char * start_ip, const char * stop_ip
 {
 	nutscan_ip_iter_t ip;
 	char * ip_str = NULL;
-	nutscan_ipmi_t * tmp_sec;
-	nutscan_device_t * nut_dev = NULL;
+	struct scan_ipmi_arg * ipmi_arg;
 	nutscan_device_t * current_nut_dev = NULL;
+	nutscan_pool_t * pool;
 
 	if( !nutscan_avail_ipmi ) {
 		return NULL;
@@ -588,19 +627,40 @@ nutscan_device_t * nutscan_scan_ipmi(const char * start_ip, const char * stop_ip
 		current_nut_dev = nutscan_scan_ipmi_device(NULL, NULL);
 	}
 	else {
+		if( (pool = nutscan_pool_new(nutscan_scan_ipmi_host)) == NULL ) {
+			return NULL;
+		}
+#ifdef HAVE_PTHREAD
+		pthread_mutex_init(&dev_mutex,NULL);
+#endif
+
 		ip_str = nutscan_ip_iter_init(&ip, start_ip, stop_ip);
 
 		while(ip_str != NULL) {
-			tmp_sec = malloc(sizeof(nutscan_ipmi_t));
-			memcpy(tmp_sec, sec, sizeof(nutscan_ipmi_t));
+			if (nutscan_state_skip(TYPE_IPMI, ip_str)) {
+				free(ip_str);
+				ip_str = nutscan_ip_iter_inc(&ip);
+				continue;
+			}
 
-			if ((current_nut_dev = nutscan_scan_ipmi_device(ip_str, tmp_sec)) != NULL) {
-				/* Store the positive result */
-				current_nut_dev = nutscan_add_device_to_device(current_nut_dev, nut_dev);
+			if ((ipmi_arg = malloc(sizeof(*ipmi_arg))) == NULL) {
+				free(ip_str);
+				break;
 			}
+			ipmi_arg->IPaddr = ip_str;
+			memcpy(&ipmi_arg->sec, sec, sizeof(nutscan_ipmi_t));
+			nutscan_pool_run(pool, ipmi_arg);
+
 			/* Prepare the next iteration */
 			ip_str = nutscan_ip_iter_inc(&ip);
 		};
+
+		nutscan_pool_wait(pool);
+#ifdef HAVE_PTHREAD
+		pthread_mutex_destroy(&dev_mutex);
+#endif
+		current_nut_dev = dev_ret;
+		dev_ret = NULL;
 	}
 
 	return nutscan_rewind_device(current_nut_dev);
@@ -24,6 +24,7 @@
 #include "common.h"
 #include "upsclient.h"
 #include "nut-scan.h"
+#include "nutscan-pool.h"
 #ifdef HAVE_PTHREAD
 #include <pthread.h>
 #endif
@@ -149,12 +150,15 @@ static void * list_nut_devices(void * arg)
 	}
 
 	if ((*nut_upscli_tryconnect)(ups, hostname, port,UPSCLI_CONN_TRYSSL,&tv) < 0) {
+		nutscan_state_record(TYPE_NUT, target_hostname, 0);
 		free(target_hostname);
 		free(nut_arg);
 		free(ups);
 		return NULL;
 	}
 
+	nutscan_state_record(TYPE_NUT, target_hostname, 1);
+
 	if((*nut_upscli_list_start)(ups, numq, query) < 0) {
 		(*nut_upscli_disconnect)(ups);
 		free(target_hostname);
@@ -187,6 +191,7 @@ static void * list_nut_devices(void * arg)
 			if( dev->port ) {
 				snprintf(dev->port,buf_size,"%s@%s",answer[1],
 						hostname);
+				nutscan_report_device(dev);
 #ifdef HAVE_PTHREAD
 				pthread_mutex_lock(&dev_mutex);
 #endif
@@ -214,20 +219,21 @@ nutscan_device_t * nutscan_scan_nut(const char* startIP, const char* stopIP, con
 	char buf[SMALLBUF];
 	struct sigaction oldact;
 	int change_action_handler = 0;
-	int i;
 	struct scan_nut_arg *nut_arg;
-#ifdef HAVE_PTHREAD
-	pthread_t thread;
-	pthread_t * thread_array = NULL;
-	int thread_count = 0;
-
-	pthread_mutex_init(&dev_mutex,NULL);
-#endif
+	nutscan_pool_t * pool;
+	nutscan_device_t * result;
 
         if( !nutscan_avail_nut ) {
                 return NULL;
         }
 
+	if( (pool = nutscan_pool_new(list_nut_devices)) == NULL ) {
+		return NULL;
+	}
+#ifdef HAVE_PTHREAD
+	pthread_mutex_init(&dev_mutex,NULL);
+#endif
+
 	/* Ignore SIGPIPE if the caller hasn't set a handler for it yet */
 	if( sigaction(SIGPIPE, NULL, &oldact) == 0 ) {
 		if( oldact.sa_handler == SIG_DFL ) {
@@ -254,6 +260,13 @@ nutscan_device_t * nutscan_scan_nut(const char* startIP, const char* stopIP, con
 			ip_dest = strdup(ip_str);
 		}
 
+		if( nutscan_state_skip(TYPE_NUT, ip_dest) ) {
+			free(ip_dest);
+			free(ip_str);
+			ip_str = nutscan_ip_iter_inc(&ip);
+			continue;
+		}
+
 		if((nut_arg = malloc(sizeof(struct scan_nut_arg))) == NULL ) {
 			free(ip_dest);
 			break;
@@ -261,38 +274,22 @@ nutscan_device_t * nutscan_scan_nut(const char* startIP, const char* stopIP, con
 
 		nut_arg->timeout = usec_timeout;
 		nut_arg->hostname = ip_dest;
-#ifdef HAVE_PTHREAD
-		if (pthread_create(&thread,NULL,list_nut_devices,(void*)nut_arg)==0){
-			thread_count++;
-			pthread_t *new_thread_array = realloc(thread_array,
-						thread_count*sizeof(pthread_t));
-			if (new_thread_array == NULL) {
-				upsdebugx(1, "%s: Failed to realloc thread", __func__);
-				break;
-			}
-			else {
-				thread_array = new_thread_array;
-			}
-			thread_array[thread_count-1] = thread;
-		}
-#else
-		list_nut_devices(nut_arg);
-#endif
+		nutscan_pool_run(pool, nut_arg);
+
 		free(ip_str);
 		ip_str = nutscan_ip_iter_inc(&ip);
 	}
 
+	nutscan_pool_wait(pool);
 #ifdef HAVE_PTHREAD
-	for ( i=0; i < thread_count ; i++) {
-		pthread_join(thread_array[i],NULL);
-	}
 	pthread_mutex_destroy(&dev_mutex);
-	free(thread_array);
 #endif
 
 	if(change_action_handler) {
 		signal(SIGPIPE,SIG_DFL);
 	}
 
-	return nutscan_rewind_device(dev_ret);
+	result = nutscan_rewind_device(dev_ret);
+	dev_ret = NULL;
+	return result;
 }
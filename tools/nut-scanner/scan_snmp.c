@@ -28,6 +28,8 @@
 #ifdef WITH_SNMP
 
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
 #include <stdio.h>
 #include <string.h>
 #include <ltdl.h>
@@ -60,6 +62,9 @@
 #include <pthread.h>
 #endif
 #include "nutscan-snmp.h"
+#include "nutscan-pool.h"
+#include "nutscan-ber.h"
+#include "eventloop.h"
 
 /* Address API change */
 #ifndef usmAESPrivProtocol
@@ -70,6 +75,10 @@
 
 #define SysOID ".1.3.6.1.2.1.1.2.0"
 
+/* The probe sends nutscan_max_parallel requests, then reads the replies
+ * for this long before sending the next ones */
+#define PROBE_BURST_USEC	10000
+
 static nutscan_device_t * dev_ret = NULL;
 #ifdef HAVE_PTHREAD
 static pthread_mutex_t dev_mutex;
@@ -319,6 +328,8 @@ static void scan_snmp_add_device(nutscan_snmp_t * sec, struct snmp_pdu *response
 		}
 	}
 
+	nutscan_report_device(dev);
+
 #ifdef HAVE_PTHREAD
 	pthread_mutex_lock(&dev_mutex);
 #endif
@@ -618,6 +629,8 @@ static void * try_SysOID(void * arg)
 	(*nut_snmp_sess_synch_response)(handle,
 			pdu, &response);
 
+	nutscan_state_record(TYPE_SNMP, sec->peername, response != NULL);
+
 	if (response) {
 		sec->handle = handle;
 
@@ -688,24 +701,175 @@ try_SysOID_free:
 	return NULL;
 }
 
+/* Stateless probe of the hosts of a range: a GET of SysOID is sent to each
+ * of them from a single UDP socket (per address family), with a request-id
+ * telling which host it was for.  Only the hosts that answer then go through
+ * a Net-SNMP session in try_SysOID(), instead of a session and a full
+ * timeout for each and every address of the range.  SNMP v1 only, since v3
+ * needs a session anyway */
+
+typedef struct {
+	char *	ip;
+	struct sockaddr_storage	addr;
+	socklen_t	addrlen;
+	int	answered;
+} snmp_probe_t;
+
+static int probe_same_addr(const struct sockaddr_storage * a, const struct sockaddr_storage * b)
+{
+	if (a->ss_family != b->ss_family) {
+		return 0;
+	}
+
+	if (a->ss_family == AF_INET) {
+		return !memcmp(&((const struct sockaddr_in *)a)->sin_addr,
+			&((const struct sockaddr_in *)b)->sin_addr, sizeof(struct in_addr));
+	}
+
+	return !memcmp(&((const struct sockaddr_in6 *)a)->sin6_addr,
+		&((const struct sockaddr_in6 *)b)->sin6_addr, sizeof(struct in6_addr));
+}
+
+/* Read the replies that come in usec microseconds, marking the hosts that
+ * sent them */
+static void probe_read(int fd[2], snmp_probe_t * hosts, size_t count, unsigned long base, long usec)
+{
+	struct timeval tv;
+	long long now, deadline;
+	unsigned char buf[LARGEBUF];
+	struct sockaddr_storage from;
+	socklen_t fromlen;
+	fd_set fds;
+	ssize_t len;
+	long reqid;
+	unsigned long i;
+	int f, maxfd = -1;
+
+	/* monotonic, so that a clock step doesn't cut it short or drag it on */
+	deadline = ev_now() + (usec + 999) / 1000;
+
+	for (;;) {
+		now = ev_now();
+		if (now >= deadline) {
+			return;
+		}
+		tv.tv_sec = (deadline - now) / 1000;
+		tv.tv_usec = ((deadline - now) % 1000) * 1000;
+
+		FD_ZERO(&fds);
+		for (f = 0; f < 2; f++) {
+			if (fd[f] >= 0) {
+				FD_SET(fd[f], &fds);
+				if (fd[f] > maxfd) {
+					maxfd = fd[f];
+				}
+			}
+		}
+
+		if (select(maxfd + 1, &fds, NULL, NULL, &tv) <= 0) {
+			continue;
+		}
+
+		for (f = 0; f < 2; f++) {
+			if (fd[f] < 0 || !FD_ISSET(fd[f], &fds)) {
+				continue;
+			}
+
+			fromlen = sizeof(from);
+			len = recvfrom(fd[f], buf, sizeof(buf), 0, (struct sockaddr *)&from, &fromlen);
+			if (len <= 0 || (reqid = nutscan_ber_parse_probe(buf, len)) < 0) {
+				continue;
+			}
+
+			i = ((unsigned long)reqid - base) & 0x7fffffff;
+			if (i >= count || !probe_same_addr(&from, &hosts[i].addr)) {
+				upsdebugx(3, "%s: stray reply, ignored", __func__);
+				continue;
+			}
+
+			if (!hosts[i].answered) {
+				upsdebugx(2, "%s: %s answered", __func__, hosts[i].ip);
+				hosts[i].answered = 1;
+			}
+		}
+	}
+}
+
+/* Probe the hosts, then wait usec_timeout for the last replies.  Returns 0
+ * if it could not be done, so that all of them are tried */
+static int probe_range(snmp_probe_t * hosts, size_t count, const char * community, long usec_timeout)
+{
+	int fd[2] = { -1, -1 };
+	int f;
+	unsigned char buf[LARGEBUF];
+	size_t i, len, burst = 0;
+	unsigned long base;
+
+	/* request-ids of this scan, that some other one is unlikely to use */
+	base = ((unsigned long)time(NULL) ^ ((unsigned long)getpid() << 16)) & 0x3fffffff;
+
+	for (i = 0; i < count; i++) {
+		f = (hosts[i].addr.ss_family == AF_INET6);
+
+		if (fd[f] < 0) {
+			fd[f] = socket(hosts[i].addr.ss_family, SOCK_DGRAM, 0);
+			if (fd[f] < 0) {
+				upsdebugx(1, "%s: socket: %s", __func__, strerror(errno));
+				break;
+			}
+		}
+
+		len = nutscan_ber_build_probe(buf, sizeof(buf), community, (base + i) & 0x7fffffff);
+		if (len == 0) {
+			break;
+		}
+
+		if (sendto(fd[f], buf + sizeof(buf) - len, len, 0,
+			(struct sockaddr *)&hosts[i].addr, hosts[i].addrlen) < 0) {
+			upsdebugx(2, "%s: %s: %s", __func__, hosts[i].ip, strerror(errno));
+		}
+
+		if (++burst >= nutscan_max_parallel) {
+			probe_read(fd, hosts, count, base, PROBE_BURST_USEC);
+			burst = 0;
+		}
+	}
+
+	if (i == count) {
+		probe_read(fd, hosts, count, base, usec_timeout);
+	}
+
+	for (f = 0; f < 2; f++) {
+		if (fd[f] >= 0) {
+			close(fd[f]);
+		}
+	}
+
+	return i == count;
+}
+
 nutscan_device_t * nutscan_scan_snmp(const char * start_ip, const char * stop_ip,long usec_timeout, nutscan_snmp_t * sec)
 {
-	int i;
 	nutscan_snmp_t * tmp_sec;
 	nutscan_ip_iter_t ip;
 	char * ip_str = NULL;
-#ifdef HAVE_PTHREAD
-	pthread_t thread;
-	pthread_t * thread_array = NULL;
-	int thread_count = 0;
-
-	pthread_mutex_init(&dev_mutex,NULL);
-#endif
+	nutscan_pool_t * pool;
+	snmp_probe_t * hosts = NULL, * new_hosts;
+	size_t hosts_count = 0, hosts_size = 0, i;
+	struct addrinfo hints, * res;
+	int probe = 1;
 
 	if( !nutscan_avail_snmp ) {
 		return NULL;
 	}
 
+	if( (pool = nutscan_pool_new(try_SysOID)) == NULL ) {
+		return NULL;
+	}
+#ifdef HAVE_PTHREAD
+	pthread_mutex_init(&dev_mutex,NULL);
+#endif
+
 	g_usec_timeout = usec_timeout;
 
 	/* Force numeric OIDs resolution (ie, do not resolve to textual names)
@@ -720,36 +884,68 @@ nutscan_device_t * nutscan_scan_snmp(const char * start_ip, const char * stop_ip
 	ip_str = nutscan_ip_iter_init(&ip, start_ip, stop_ip);
 
 	while(ip_str != NULL) {
-		tmp_sec = malloc(sizeof(nutscan_snmp_t));
-		memcpy(tmp_sec, sec, sizeof(nutscan_snmp_t));
-		tmp_sec->peername = ip_str;
+		if( nutscan_state_skip(TYPE_SNMP, ip_str) ) {
+			free(ip_str);
+			ip_str = nutscan_ip_iter_inc(&ip);
+			continue;
+		}
 
-#ifdef HAVE_PTHREAD
-		if (pthread_create(&thread,NULL,try_SysOID,(void*)tmp_sec)==0){
-			thread_count++;
-			pthread_t *new_thread_array = realloc(thread_array,
-						thread_count*sizeof(pthread_t));
-			if (new_thread_array == NULL) {
-				upsdebugx(1, "%s: Failed to realloc thread", __func__);
+		if( hosts_count == hosts_size ) {
+			hosts_size = hosts_size ? hosts_size * 2 : 256;
+			new_hosts = realloc(hosts, hosts_size * sizeof(*hosts));
+			if( new_hosts == NULL ) {
+				free(ip_str);
 				break;
 			}
-			else {
-				thread_array = new_thread_array;
-			}
-			thread_array[thread_count-1] = thread;
+			hosts = new_hosts;
 		}
-#else
-		try_SysOID((void *)tmp_sec);
-#endif
+
+		memset(&hosts[hosts_count], 0, sizeof(*hosts));
+		hosts[hosts_count].ip = ip_str;
+
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_flags = AI_NUMERICHOST;
+		hints.ai_socktype = SOCK_DGRAM;
+		if( getaddrinfo(ip_str, "161", &hints, &res) == 0 ) {
+			memcpy(&hosts[hosts_count].addr, res->ai_addr, res->ai_addrlen);
+			hosts[hosts_count].addrlen = res->ai_addrlen;
+			freeaddrinfo(res);
+		}
+		else {
+			/* not probed, but still tried */
+			probe = 0;
+		}
+		hosts_count++;
+
 		ip_str = nutscan_ip_iter_inc(&ip);
 	};
 
-#ifdef HAVE_PTHREAD
-	for ( i=0; i < thread_count ; i++) {
-		pthread_join(thread_array[i],NULL);
+	/* SNMP v1 hosts of a range that do not even answer are not tried */
+	if( probe && hosts_count > 1 && (sec->community != NULL || sec->secLevel == NULL) ) {
+		probe = probe_range(hosts, hosts_count,
+			sec->community ? sec->community : "public", usec_timeout);
 	}
+	else {
+		probe = 0;
+	}
+
+	for( i = 0; i < hosts_count; i++ ) {
+		if( probe && !hosts[i].answered ) {
+			nutscan_state_record(TYPE_SNMP, hosts[i].ip, 0);
+			free(hosts[i].ip);
+			continue;
+		}
+
+		tmp_sec = malloc(sizeof(nutscan_snmp_t));
+		memcpy(tmp_sec, sec, sizeof(nutscan_snmp_t));
+		tmp_sec->peername = hosts[i].ip;
+		nutscan_pool_run(pool, tmp_sec);
+	}
+	free(hosts);
+
+	nutscan_pool_wait(pool);
+#ifdef HAVE_PTHREAD
 	pthread_mutex_destroy(&dev_mutex);
-	free(thread_array);
 #endif
 	nutscan_device_t * result = nutscan_rewind_device(dev_ret);
 	dev_ret = NULL;
@@ -254,6 +254,7 @@ nutscan_device_t * nutscan_scan_usb()
 				}
 				nutscan_add_option_to_device(nut_dev,"bus",
 							bus->dirname);
+				nutscan_report_device(nut_dev);
 
 				current_nut_dev = nutscan_add_device_to_device(
 								current_nut_dev,
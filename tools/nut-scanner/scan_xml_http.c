@@ -38,6 +38,7 @@
 #include <errno.h>
 #include <ne_xml.h>
 #include <ltdl.h>
+#include "nutscan-pool.h"
 
 #ifdef HAVE_PTHREAD
 #include <pthread.h>
@@ -305,6 +306,7 @@ static void * nutscan_scan_xml_http_generic(void * arg)
 					sprintf(buf,"http://%s",string);
 					nut_dev->port = strdup(buf);
 					upsdebugx(3,"nutscan_scan_xml_http_generic(): Adding configuration for driver='%s' port='%s'", nut_dev->driver, nut_dev->port);
+					nutscan_report_device(nut_dev);
 					dev_ret = nutscan_add_device_to_device(
 						dev_ret,nut_dev);
 #ifdef HAVE_PTHREAD
@@ -324,6 +326,7 @@ static void * nutscan_scan_xml_http_generic(void * arg)
 				}
 
 				if (ip != NULL) {
+					nutscan_state_record(TYPE_XML, ip, 1);
 					upsdebugx(2,"nutscan_scan_xml_http_generic(): we collected one reply to unicast for %s (repsponse from %s), done", ip, string);
 					goto end;
 				}
@@ -335,6 +338,9 @@ static void * nutscan_scan_xml_http_generic(void * arg)
 		}
 	}
 	upsdebugx(2,"nutscan_scan_xml_http_generic(): no replies collected for %s, done", ip ? ip : "<broadcast>");
+	if (ip != NULL) {
+		nutscan_state_record(TYPE_XML, ip, 0);
+	}
 	goto end;
 
 end_abort:
@@ -345,11 +351,21 @@ end:
 	return NULL;
 }
 
+/* one host of a range: its copy of the settings is ours to free */
+static void * nutscan_scan_xml_http_host(void * arg)
+{
+	nutscan_xml_t * sec = (nutscan_xml_t *)arg;
+
+	nutscan_scan_xml_http_generic(sec);
+	free(sec->peername);
+	free(sec);
+	return NULL;
+}
+
 nutscan_device_t * nutscan_scan_xml_http_range(const char * start_ip, const char * end_ip, long usec_timeout, nutscan_xml_t * sec)
 {
 	nutscan_xml_t * tmp_sec = NULL;
 	nutscan_device_t * result = NULL;
-	int i;
 
 	if( !nutscan_avail_xml_http ) {
 		return NULL;
@@ -368,11 +384,12 @@ nutscan_device_t * nutscan_scan_xml_http_range(const char * start_ip, const char
 			/* Iterate the range of IPs to scan */
 			nutscan_ip_iter_t ip;
 			char * ip_str = NULL;
-#ifdef HAVE_PTHREAD
-			pthread_t thread;
-			pthread_t * thread_array = NULL;
-			int thread_count = 0;
+			nutscan_pool_t * pool;
 
+			if( (pool = nutscan_pool_new(nutscan_scan_xml_http_host)) == NULL ) {
+				return NULL;
+			}
+#ifdef HAVE_PTHREAD
 			pthread_mutex_init(&dev_mutex,NULL);
 #endif
 
@@ -381,45 +398,30 @@ nutscan_device_t * nutscan_scan_xml_http_range(const char * start_ip, const char
 			ip_str = nutscan_ip_iter_init(&ip, start_ip, end_ip);
 
 			while(ip_str != NULL) {
+				if (nutscan_state_skip(TYPE_XML, ip_str)) {
+					free(ip_str);
+					ip_str = nutscan_ip_iter_inc(&ip);
+					continue;
+				}
+
 				tmp_sec = malloc(sizeof(nutscan_xml_t));
 				if (tmp_sec == NULL) {
 					fprintf(stderr,"Memory allocation \
 						error\n");
-					return NULL;
+					free(ip_str);
+					break;
 				}
 				memcpy(tmp_sec, sec, sizeof(nutscan_xml_t));
 				tmp_sec->peername = ip_str;
 				if (tmp_sec->usec_timeout < 0) tmp_sec->usec_timeout = usec_timeout;
 
-#ifdef HAVE_PTHREAD
-				if (pthread_create(&thread,NULL,nutscan_scan_xml_http_generic, (void *)tmp_sec)==0){
-					thread_count++;
-					pthread_t *new_thread_array = realloc(thread_array,
-								thread_count*sizeof(pthread_t));
-					if (new_thread_array == NULL) {
-						upsdebugx(1, "%s: Failed to realloc thread", __func__);
-						break;
-					}
-					else {
-						thread_array = new_thread_array;
-					}
-					thread_array[thread_count-1] = thread;
-				}
-#else
-				nutscan_scan_xml_http_generic((void *)tmp_sec);
-#endif
-/*				free(ip_str); */ /* One of these free()s seems to cause a double-free */
+				/* tmp_sec and ip_str are freed by nutscan_scan_xml_http_host() */
+				nutscan_pool_run(pool, tmp_sec);
 				ip_str = nutscan_ip_iter_inc(&ip);
-/*				free(tmp_sec); */
 			};
 
+			nutscan_pool_wait(pool);
 #ifdef HAVE_PTHREAD
-			if (thread_array != NULL) {
-				for ( i=0; i < thread_count ; i++) {
-						pthread_join(thread_array[i],NULL);
-				}
-				free(thread_array);
-			}
 			pthread_mutex_destroy(&dev_mutex);
 #endif
 			result = nutscan_rewind_device(dev_ret);